@@ -0,0 +1,143 @@
+# Runs benchmarks of the voxel module without a window, and prints their results as JSON.
+# See the Benchmarks section of doc/source/module_development.md for how to use it.
+extends SceneTree
+
+const BenchUtil = preload("res://util/bench_util.gd")
+
+const SUITES = {
+	"pipeline": "res://suites/pipeline.gd",
+	"eviction": "res://suites/eviction.gd",
+	"voxel_buffer": "res://suites/voxel_buffer.gd",
+	"meshing": "res://suites/meshing.gd",
+	"streams": "res://suites/streams.gd",
+}
+
+var _args := {}
+var _suite_name := ""
+var _suite = null
+
+
+func _initialize():
+	_args = BenchUtil.parse_args(OS.get_cmdline_args())
+
+	# Frames must not wait for anything else than the work being measured
+	OS.vsync_enabled = false
+	Engine.target_fps = 0
+
+	if _args.has("compare"):
+		quit(_compare(_args["compare"].split(",", false)))
+		return
+
+	_suite_name = _args.get("suite", "pipeline")
+	if not SUITES.has(_suite_name):
+		printerr("Unknown suite '", _suite_name, "'. Available suites: ", SUITES.keys())
+		quit(1)
+		return
+
+	var thread_counts := []
+	if _args.has("threads"):
+		thread_counts = BenchUtil.parse_int_list(_args["threads"])
+	if thread_counts.size() > 1:
+		# Each thread count runs in its own process,
+		# so latency histograms and peak memory are not mixed up between runs
+		var runs := []
+		for thread_count in thread_counts:
+			var run = _run_child_process(thread_count)
+			if run == null:
+				quit(1)
+				return
+			runs.append(run)
+		quit(_finish(runs))
+		return
+
+	_suite = load(SUITES[_suite_name]).new()
+	var err: int = _suite.start(self, _args)
+	if err != OK:
+		printerr("Could not start suite '", _suite_name, "': error ", err)
+		quit(1)
+
+
+func _idle(_delta: float) -> bool:
+	if _suite == null:
+		return false
+	if _suite.update():
+		var run := { "suite": _suite_name, "config": _suite.get_config(), "metrics": _suite.get_metrics() }
+		# Suites which check for bugs tell what went wrong, so scripts running them can fail
+		var failures := []
+		if _suite.has_method("get_failures"):
+			failures = _suite.get_failures()
+		_suite = null
+		var exit_code := _finish([run])
+		for failure in failures:
+			printerr("FAILED: ", failure)
+		if failures.size() > 0:
+			exit_code = 1
+		quit(exit_code)
+	return false
+
+
+func _finish(runs: Array) -> int:
+	var results := { "runs": runs }
+	print(JSON.print(results, "\t"))
+	if _args.has("output"):
+		if BenchUtil.write_json(_args["output"], results) != OK:
+			return 1
+	return 0
+
+
+func _run_child_process(thread_count: int):
+	var output_path := ProjectSettings.globalize_path("user://benchmark_child_results.json")
+	var args := PoolStringArray([
+		"--no-window", "--path", ProjectSettings.globalize_path("res://"), "-s", "res://main.gd"])
+	for key in _args:
+		if key != "threads" and key != "output":
+			args.append("--%s=%s" % [key, _args[key]])
+	args.append("--threads=%d" % thread_count)
+	args.append("--output=" + output_path)
+
+	print("Running suite '", _suite_name, "' with ", thread_count, " threads...")
+	var output := []
+	var exit_code := OS.execute(OS.get_executable_path(), args, true, output)
+	if exit_code != 0:
+		printerr("Run with ", thread_count, " threads failed with exit code ", exit_code)
+		for line in output:
+			printerr(line)
+		return null
+
+	var results = BenchUtil.read_json(output_path)
+	if results == null:
+		return null
+	return results["runs"][0]
+
+
+# Prints metrics of two result files side by side. Runs are matched by their order in each file.
+func _compare(paths: PoolStringArray) -> int:
+	if paths.size() != 2:
+		printerr("Expected two result files to compare, like --compare=before.json,after.json")
+		return 1
+	var before = BenchUtil.read_json(paths[0])
+	var after = BenchUtil.read_json(paths[1])
+	if before == null or after == null:
+		return 1
+
+	var run_count := int(min(before["runs"].size(), after["runs"].size()))
+	for run_index in run_count:
+		var before_run: Dictionary = before["runs"][run_index]
+		var after_run: Dictionary = after["runs"][run_index]
+		print("")
+		print("Suite '", before_run["suite"], "', before: ", before_run["config"], ", after: ", after_run["config"])
+
+		var names: Array = before_run["metrics"].keys()
+		names.sort()
+		for name in names:
+			if not after_run["metrics"].has(name):
+				continue
+			var a: float = before_run["metrics"][name]
+			var b: float = after_run["metrics"][name]
+			var change := ""
+			if a != 0.0:
+				var percent := 100.0 * (b - a) / abs(a)
+				change = "%s%.1f%%" % ["+" if percent >= 0.0 else "", percent]
+			print("%-40s %14.2f %14.2f %10s" % [name, a, b, change])
+
+	return 0
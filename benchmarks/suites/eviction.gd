@@ -0,0 +1,159 @@
+# Moves a viewer needing meshes through an area kept loaded by a data-only viewer, while the voxel memory budget is
+# exceeded, so blocks get evicted while their neighbors are still loading. Once the viewer stops and loading is
+# done, fails if any block needing a mesh is left with a neighbor that is neither loaded nor loading,
+# because such a block would never be meshed.
+#
+# Options:
+# --duration=<seconds>           How long the viewer moves. Default is 10.
+# --speed=<voxels/second>        Speed of the viewer. Default is 60.
+# --view_distance=<voxels>       View distance of the moving viewer. Default is 128.
+# --data_view_distance=<voxels>  View distance of the data-only viewer, which stays at the origin. Default is 512.
+# --budget=<bytes>               Voxel memory budget. Default is 1, so every block that can be evicted is.
+# --settle_timeout=<seconds>     How long to wait for loading to finish after the viewer stops. Default is 30.
+# --threads=<count>              Size of the voxel thread pool. Uses the default if not specified.
+extends Reference
+
+const IDLE_CHECK_PERIOD_FRAMES = 10
+
+var _config := {}
+var _duration_sec := 10.0
+var _speed := 60.0
+var _settle_timeout_sec := 30.0
+
+var _terrain: VoxelTerrain
+var _viewer: VoxelViewer
+var _data_viewer: VoxelViewer
+
+var _start_time_usec := 0
+var _frame_count := 0
+var _previous_budget := 0
+var _metrics := {}
+var _failures := []
+
+
+func start(tree: SceneTree, args: Dictionary) -> int:
+	_duration_sec = float(args.get("duration", "10"))
+	_speed = float(args.get("speed", "60"))
+	_settle_timeout_sec = float(args.get("settle_timeout", "30"))
+	var view_distance := int(args.get("view_distance", "128"))
+	var data_view_distance := int(args.get("data_view_distance", "512"))
+	var budget := int(args.get("budget", "1"))
+
+	if not VoxelServer.has_method("set_voxel_memory_budget_bytes"):
+		printerr("This version of the module can't evict blocks")
+		return ERR_UNAVAILABLE
+	var can_set_thread_count := VoxelServer.has_method("set_thread_count")
+	if args.has("threads"):
+		if not can_set_thread_count:
+			printerr("This version of the module can't change its thread count")
+			return ERR_UNAVAILABLE
+		VoxelServer.call("set_thread_count", int(args["threads"]))
+
+	_previous_budget = VoxelServer.call("get_voxel_memory_budget_bytes")
+	VoxelServer.call("set_voxel_memory_budget_bytes", budget)
+
+	_config = {
+		"duration": _duration_sec,
+		"speed": _speed,
+		"view_distance": view_distance,
+		"data_view_distance": data_view_distance,
+		"budget": budget,
+		"threads": VoxelServer.call("get_thread_count") if can_set_thread_count else "default"
+	}
+
+	var noise := OpenSimplexNoise.new()
+	noise.seed = 1337
+	noise.period = 128.0
+	noise.octaves = 4
+	var generator := VoxelGeneratorNoise2D.new()
+	generator.noise = noise
+	generator.channel = VoxelBuffer.CHANNEL_SDF
+	generator.height_start = -40.0
+	generator.height_range = 80.0
+
+	_terrain = VoxelTerrain.new()
+	_terrain.generator = generator
+	_terrain.mesher = VoxelMesherTransvoxel.new()
+	_terrain.max_view_distance = data_view_distance
+	tree.root.add_child(_terrain)
+
+	_data_viewer = VoxelViewer.new()
+	_data_viewer.view_distance = data_view_distance
+	_data_viewer.requires_visuals = false
+	_data_viewer.requires_collisions = false
+	tree.root.add_child(_data_viewer)
+
+	_viewer = VoxelViewer.new()
+	_viewer.view_distance = view_distance
+	tree.root.add_child(_viewer)
+
+	return OK
+
+
+# Returns true when the check is done
+func update() -> bool:
+	var now := OS.get_ticks_usec()
+	if _start_time_usec == 0:
+		_start_time_usec = now
+	_frame_count += 1
+
+	var time_sec := (now - _start_time_usec) / 1000000.0
+
+	if time_sec < _duration_sec:
+		_viewer.translation = Vector3(time_sec * _speed, 0.0, 0.0)
+		return false
+
+	if _frame_count % IDLE_CHECK_PERIOD_FRAMES == 0 and _is_idle():
+		_check()
+		_finish()
+		return true
+
+	if time_sec >= _duration_sec + _settle_timeout_sec:
+		_failures.append("Loading did not finish %.1f seconds after the viewer stopped" % _settle_timeout_sec)
+		_check()
+		_finish()
+		return true
+
+	return false
+
+
+func get_config() -> Dictionary:
+	return _config
+
+
+func get_metrics() -> Dictionary:
+	return _metrics
+
+
+# Messages describing what went wrong. The benchmark runner exits with an error if there are any.
+func get_failures() -> Array:
+	return _failures
+
+
+func _is_idle() -> bool:
+	var stats := VoxelServer.get_stats()
+	for stage in ["streaming", "generation", "meshing"]:
+		if stats.has(stage) and stats[stage]["tasks"] > 0:
+			return false
+	var terrain_stats := _terrain.get_statistics()
+	return terrain_stats["remaining_main_thread_blocks"] == 0
+
+
+func _check() -> void:
+	var terrain_stats := _terrain.get_statistics()
+	_metrics["evicted_blocks"] = terrain_stats["evicted_blocks"]
+	_metrics["reloaded_blocks"] = terrain_stats["reloaded_blocks"]
+	_metrics["blocks_missing_neighbors"] = terrain_stats["blocks_missing_neighbors"]
+
+	if terrain_stats["evicted_blocks"] == 0:
+		_failures.append("No block was evicted, so eviction was not tested")
+	if terrain_stats["blocks_missing_neighbors"] > 0:
+		_failures.append("%d blocks needing a mesh have neighbors which are neither loaded nor loading" \
+				% terrain_stats["blocks_missing_neighbors"])
+
+
+func _finish() -> void:
+	VoxelServer.call("set_voxel_memory_budget_bytes", _previous_budget)
+	_terrain.queue_free()
+	_viewer.queue_free()
+	_data_viewer.queue_free()
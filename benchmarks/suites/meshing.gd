@@ -0,0 +1,69 @@
+# Measures how long the Transvoxel mesher takes to build a block of terrain, and how long VoxelTool takes to edit a
+# buffer with spheres. Each operation is timed over several calls, and its median and 95th percentile are reported.
+#
+# Options:
+# --block_size=<voxels>     Size of blocks without padding. Default is 16.
+# --iterations=<count>      How many times each operation runs. Default is 100.
+# --sphere_radius=<voxels>  Radius of spheres edited with VoxelTool. Default is 8.
+extends Reference
+
+const BenchUtil = preload("res://util/bench_util.gd")
+
+var _block_size := 16
+var _iterations := 100
+var _sphere_radius := 8.0
+var _metrics := {}
+
+
+func start(_tree: SceneTree, args: Dictionary) -> int:
+	_block_size = int(args.get("block_size", "16"))
+	_iterations = int(args.get("iterations", "100"))
+	_sphere_radius = float(args.get("sphere_radius", "8"))
+	return OK
+
+
+# Runs everything in one go, since frames don't matter here
+func update() -> bool:
+	var mesher := VoxelMesherTransvoxel.new()
+	var padded_size := _block_size + mesher.get_minimum_padding() + mesher.get_maximum_padding()
+
+	var noise := OpenSimplexNoise.new()
+	noise.seed = 1337
+	noise.period = 32.0
+	var generator := VoxelGeneratorNoise2D.new()
+	generator.noise = noise
+	generator.channel = VoxelBuffer.CHANNEL_SDF
+	generator.height_start = -float(_block_size) / 2.0
+	generator.height_range = float(_block_size)
+
+	# The surface crosses the block, so there is a mesh to build
+	var voxels := VoxelBuffer.new()
+	voxels.create(padded_size, padded_size, padded_size)
+	generator.generate_block(voxels, Vector3(-1, -padded_size / 2, -1), 0)
+
+	_add_times("transvoxel_build_mesh",
+			BenchUtil.time_calls(mesher, "build_mesh", [voxels, []], _iterations))
+
+	var edited := VoxelBuffer.new()
+	edited.create(padded_size, padded_size, padded_size)
+	var vt: VoxelTool = edited.get_voxel_tool()
+	vt.channel = VoxelBuffer.CHANNEL_SDF
+	vt.mode = VoxelTool.MODE_ADD
+	var center := Vector3(padded_size, padded_size, padded_size) / 2.0
+	_add_times("voxel_tool_do_sphere",
+			BenchUtil.time_calls(vt, "do_sphere", [center, _sphere_radius], _iterations))
+
+	return true
+
+
+func get_config() -> Dictionary:
+	return { "block_size": _block_size, "iterations": _iterations, "sphere_radius": _sphere_radius }
+
+
+func get_metrics() -> Dictionary:
+	return _metrics
+
+
+func _add_times(name: String, times_usec: Array) -> void:
+	_metrics[name + "_p50_usec"] = BenchUtil.get_percentile(times_usec, 50.0)
+	_metrics[name + "_p95_usec"] = BenchUtil.get_percentile(times_usec, 95.0)
@@ -0,0 +1,225 @@
+# Moves a viewer along a scripted trajectory through a VoxelTerrain, and measures how fast blocks go through
+# streaming, generation and meshing, how long tasks wait in queues, frame times and peak memory.
+#
+# Options:
+# --duration=<seconds>      How long the viewer moves. Default is 20.
+# --trajectory=<name>       How the viewer moves:
+#                           - static: stays in place, measures how long the initial area takes to load
+#                           - line: flies in a straight line
+#                           - circle: flies in circles, coming back to areas loaded before
+#                           - teleport: jumps to an area far away every few seconds, loading it all at once
+# --speed=<voxels/second>   Speed of the viewer for line and circle trajectories. Default is 40.
+# --teleport_period=<sec>   Time between jumps of the teleport trajectory. Default is 2.
+# --view_distance=<voxels>  Default is 256.
+# --stream=<type>           Where generated blocks are saved: none (default), region or sqlite.
+#                           Previous data is deleted first.
+# --threads=<count>         Size of the voxel thread pool. Uses the default if not specified.
+extends Reference
+
+const BenchUtil = preload("res://util/bench_util.gd")
+
+const DATA_PATH = "user://pipeline_benchmark"
+const CIRCLE_RADIUS = 300.0
+const TELEPORT_DISTANCE = 8192.0
+const IDLE_CHECK_PERIOD_FRAMES = 10
+
+var _config := {}
+var _duration_sec := 20.0
+var _trajectory := "line"
+var _speed := 40.0
+var _teleport_period_sec := 2.0
+
+var _terrain: VoxelTerrain
+var _viewer: VoxelViewer
+
+var _start_time_usec := 0
+var _last_frame_time_usec := 0
+var _frame_times_usec := []
+var _frame_count := 0
+var _terrain_loaded_blocks := 0
+var _time_to_idle_sec := -1.0
+var _metrics := {}
+
+
+func start(tree: SceneTree, args: Dictionary) -> int:
+	_duration_sec = float(args.get("duration", "20"))
+	_trajectory = args.get("trajectory", "line")
+	_speed = float(args.get("speed", "40"))
+	_teleport_period_sec = float(args.get("teleport_period", "2"))
+	var view_distance := int(args.get("view_distance", "256"))
+	var stream_type: String = args.get("stream", "none")
+
+	if not _trajectory in ["static", "line", "circle", "teleport"]:
+		printerr("Unknown trajectory '", _trajectory, "'")
+		return ERR_INVALID_PARAMETER
+
+	# Methods which older versions of the module don't have are called by name, so they can still be compared
+	var can_set_thread_count := VoxelServer.has_method("set_thread_count")
+	if args.has("threads"):
+		if not can_set_thread_count:
+			printerr("This version of the module can't change its thread count")
+			return ERR_UNAVAILABLE
+		VoxelServer.call("set_thread_count", int(args["threads"]))
+
+	_config = {
+		"duration": _duration_sec,
+		"trajectory": _trajectory,
+		"speed": _speed,
+		"view_distance": view_distance,
+		"stream": stream_type,
+		"threads": VoxelServer.call("get_thread_count") if can_set_thread_count else "default"
+	}
+
+	var noise := OpenSimplexNoise.new()
+	noise.seed = 1337
+	noise.period = 128.0
+	noise.octaves = 4
+	var generator := VoxelGeneratorNoise2D.new()
+	generator.noise = noise
+	generator.channel = VoxelBuffer.CHANNEL_SDF
+	generator.height_start = -40.0
+	generator.height_range = 80.0
+
+	_terrain = VoxelTerrain.new()
+	_terrain.generator = generator
+	_terrain.mesher = VoxelMesherTransvoxel.new()
+	_terrain.max_view_distance = view_distance
+
+	match stream_type:
+		"none":
+			pass
+		"region":
+			BenchUtil.remove_directory(DATA_PATH)
+			var stream := VoxelStreamRegionFiles.new()
+			stream.directory = DATA_PATH
+			stream.save_generator_output = true
+			_terrain.stream = stream
+		"sqlite":
+			BenchUtil.remove_directory(DATA_PATH)
+			Directory.new().make_dir_recursive(DATA_PATH)
+			var stream := VoxelStreamSQLite.new()
+			stream.database_path = ProjectSettings.globalize_path(DATA_PATH.plus_file("world.sqlite"))
+			stream.save_generator_output = true
+			_terrain.stream = stream
+		_:
+			printerr("Unknown stream '", stream_type, "'")
+			return ERR_INVALID_PARAMETER
+
+	_terrain.connect("block_loaded", self, "_on_terrain_block_loaded")
+	tree.root.add_child(_terrain)
+
+	_viewer = VoxelViewer.new()
+	_viewer.view_distance = view_distance
+	tree.root.add_child(_viewer)
+	_move_viewer(0.0)
+
+	return OK
+
+
+# Returns true when the benchmark is done
+func update() -> bool:
+	var now := OS.get_ticks_usec()
+	if _start_time_usec == 0:
+		_start_time_usec = now
+	else:
+		_frame_times_usec.append(now - _last_frame_time_usec)
+	_last_frame_time_usec = now
+	_frame_count += 1
+
+	var time_sec := (now - _start_time_usec) / 1000000.0
+
+	if _time_to_idle_sec < 0.0 and _frame_count % IDLE_CHECK_PERIOD_FRAMES == 0 and _is_idle():
+		_time_to_idle_sec = time_sec
+
+	if time_sec >= _duration_sec:
+		_collect_metrics(time_sec)
+		_terrain.queue_free()
+		_viewer.queue_free()
+		return true
+
+	_move_viewer(time_sec)
+	return false
+
+
+func get_config() -> Dictionary:
+	return _config
+
+
+func get_metrics() -> Dictionary:
+	return _metrics
+
+
+func _get_viewer_position(time_sec: float) -> Vector3:
+	match _trajectory:
+		"line":
+			return Vector3(time_sec * _speed, 0.0, 0.0)
+		"circle":
+			var angle := time_sec * _speed / CIRCLE_RADIUS
+			return Vector3(cos(angle) * CIRCLE_RADIUS, 0.0, sin(angle) * CIRCLE_RADIUS)
+		"teleport":
+			return Vector3(floor(time_sec / _teleport_period_sec) * TELEPORT_DISTANCE, 0.0, 0.0)
+	return Vector3()
+
+
+func _move_viewer(time_sec: float) -> void:
+	var pos := _get_viewer_position(time_sec)
+	if _trajectory == "line" or _trajectory == "circle":
+		# Look where the viewer is going, since tasks are prioritized according to it
+		_viewer.look_at_from_position(pos, _get_viewer_position(time_sec + 0.1), Vector3.UP)
+	else:
+		_viewer.translation = pos
+
+
+# Tells if there is nothing left to load or mesh around the viewer
+func _is_idle() -> bool:
+	if _terrain_loaded_blocks == 0:
+		return false
+	var stats := VoxelServer.get_stats()
+	for stage in ["streaming", "generation", "meshing"]:
+		if stats.has(stage) and stats[stage]["tasks"] > 0:
+			return false
+	var terrain_stats := _terrain.get_statistics()
+	return terrain_stats["remaining_main_thread_blocks"] == 0
+
+
+func _collect_metrics(duration_sec: float) -> void:
+	_metrics["frame_p50_msec"] = BenchUtil.get_percentile(_frame_times_usec, 50.0) / 1000.0
+	_metrics["frame_p95_msec"] = BenchUtil.get_percentile(_frame_times_usec, 95.0) / 1000.0
+	_metrics["frame_p99_msec"] = BenchUtil.get_percentile(_frame_times_usec, 99.0) / 1000.0
+	_metrics["frame_max_msec"] = BenchUtil.get_percentile(_frame_times_usec, 100.0) / 1000.0
+	_metrics["terrain_loaded_blocks_per_sec"] = _terrain_loaded_blocks / duration_sec
+	if _time_to_idle_sec >= 0.0:
+		_metrics["time_to_idle_sec"] = _time_to_idle_sec
+
+	# Only available in debug builds of the engine
+	_metrics["static_memory_peak_bytes"] = OS.get_static_memory_peak_usage()
+
+	# Older versions of the module report less statistics
+	var stats := VoxelServer.get_stats()
+
+	if stats.has("processed_blocks"):
+		var processed: Dictionary = stats["processed_blocks"]
+		var tasks := 0
+		for key in ["loaded", "generated", "meshed", "saved"]:
+			_metrics["%s_blocks_per_sec" % key] = processed[key] / duration_sec
+			tasks += processed[key]
+		_metrics["tasks_per_sec"] = tasks / duration_sec
+
+	if stats.has("task_stats"):
+		for stage in ["streaming", "generation", "meshing"]:
+			var queue_time: Dictionary = stats["task_stats"][stage]["queue_time"]
+			if queue_time["count"] == 0:
+				continue
+			for percentile in ["p50", "p95", "p99"]:
+				var key: String = percentile + "_usec"
+				if queue_time.has(key):
+					_metrics["%s_queue_%s_usec" % [stage, percentile]] = queue_time[key]
+		if stats["task_stats"].has("stolen"):
+			_metrics["stolen_tasks_per_sec"] = stats["task_stats"]["stolen"] / duration_sec
+
+	if stats.has("memory_pool"):
+		_metrics["voxel_memory_peak_bytes"] = stats["memory_pool"]["peak_used_bytes"]
+
+
+func _on_terrain_block_loaded(_position: Vector3, _voxels: VoxelBuffer) -> void:
+	_terrain_loaded_blocks += 1
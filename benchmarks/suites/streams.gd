@@ -0,0 +1,166 @@
+# Saves generated blocks into a stream with each kind of compression, then loads them back with a new instance of
+# the stream, so nothing comes from its memory. Measures how fast blocks are saved and loaded, and how much space
+# they take on disk.
+#
+# Options:
+# --stream=<type>           region (default) or sqlite.
+# --compression=<names>     Comma-separated list of compressions to measure among none, lz4 and zstd.
+#                           Default is all of them.
+# --blocks=<count>          Blocks along each axis of the saved area. Default is 8, so 512 blocks are saved.
+# --load_threads=<count>    Threads loading blocks at the same time. Default is 1.
+# --page_cache_size_kb=<kb> SQLite page cache size. Uses the default of the stream if not specified.
+# --mmap_size_mb=<mb>       SQLite memory-mapped size. Uses the default of the stream if not specified.
+extends Reference
+
+const BenchUtil = preload("res://util/bench_util.gd")
+
+const DATA_PATH = "user://streams_benchmark"
+const BLOCK_SIZE = 16
+# Values of the `compression` property of streams
+const COMPRESSIONS = {
+	"none": 0,
+	"lz4": 1,
+	"zstd": 2,
+}
+
+var _stream_type := "region"
+var _compression_names := []
+var _blocks_per_axis := 8
+var _load_thread_count := 1
+var _sqlite_options := {}
+var _metrics := {}
+
+
+func start(_tree: SceneTree, args: Dictionary) -> int:
+	_stream_type = args.get("stream", "region")
+	_compression_names = Array(args.get("compression", "none,lz4,zstd").split(",", false))
+	_blocks_per_axis = int(args.get("blocks", "8"))
+	_load_thread_count = int(max(int(args.get("load_threads", "1")), 1))
+	for key in ["page_cache_size_kb", "mmap_size_mb"]:
+		if args.has(key):
+			_sqlite_options[key] = int(args[key])
+
+	if not _stream_type in ["region", "sqlite"]:
+		printerr("Unknown stream '", _stream_type, "'")
+		return ERR_INVALID_PARAMETER
+	for name in _compression_names:
+		if not COMPRESSIONS.has(name):
+			printerr("Unknown compression '", name, "'")
+			return ERR_INVALID_PARAMETER
+	return OK
+
+
+# Runs everything in one go, since frames don't matter here
+func update() -> bool:
+	var blocks := _generate_blocks()
+
+	for compression_name in _compression_names:
+		BenchUtil.remove_directory(DATA_PATH)
+		Directory.new().make_dir_recursive(DATA_PATH)
+
+		var stream := _create_stream(COMPRESSIONS[compression_name])
+		var time_before := OS.get_ticks_usec()
+		for origin in blocks:
+			stream.immerge_block(blocks[origin], origin, 0)
+		# Streams may keep blocks in memory and write them when they are freed
+		stream = null
+		var save_time_sec := (OS.get_ticks_usec() - time_before) / 1000000.0
+
+		var data_size := BenchUtil.get_directory_size(DATA_PATH)
+
+		stream = _create_stream(COMPRESSIONS[compression_name])
+		time_before = OS.get_ticks_usec()
+		_load_blocks_in_threads(stream, blocks.keys())
+		var load_time_sec := (OS.get_ticks_usec() - time_before) / 1000000.0
+		stream = null
+
+		_metrics[compression_name + "_saved_blocks_per_sec"] = blocks.size() / max(save_time_sec, 0.000001)
+		_metrics[compression_name + "_loaded_blocks_per_sec"] = blocks.size() / max(load_time_sec, 0.000001)
+		_metrics[compression_name + "_bytes_per_block"] = float(data_size) / blocks.size()
+		if _metrics.has("none_bytes_per_block"):
+			_metrics[compression_name + "_size_ratio"] = \
+					_metrics["none_bytes_per_block"] / max(_metrics[compression_name + "_bytes_per_block"], 1.0)
+
+	BenchUtil.remove_directory(DATA_PATH)
+	return true
+
+
+func get_config() -> Dictionary:
+	var config := {
+		"stream": _stream_type,
+		"compression": _compression_names,
+		"blocks": _blocks_per_axis,
+		"load_threads": _load_thread_count
+	}
+	for key in _sqlite_options:
+		config[key] = _sqlite_options[key]
+	return config
+
+
+func get_metrics() -> Dictionary:
+	return _metrics
+
+
+func _create_stream(compression: int) -> VoxelStream:
+	if _stream_type == "sqlite":
+		var sqlite_stream := VoxelStreamSQLite.new()
+		sqlite_stream.database_path = ProjectSettings.globalize_path(DATA_PATH.plus_file("world.sqlite"))
+		sqlite_stream.compression = compression
+		for key in _sqlite_options:
+			sqlite_stream.set(key, _sqlite_options[key])
+		return sqlite_stream
+	var region_stream := VoxelStreamRegionFiles.new()
+	region_stream.directory = DATA_PATH
+	region_stream.compression = compression
+	return region_stream
+
+
+# Loads blocks split evenly between threads, and waits for all of them to finish
+func _load_blocks_in_threads(stream: VoxelStream, origins: Array) -> void:
+	if _load_thread_count == 1:
+		_load_blocks([stream, origins])
+		return
+	var threads := []
+	for thread_index in _load_thread_count:
+		var thread_origins := []
+		for i in range(thread_index, origins.size(), _load_thread_count):
+			thread_origins.append(origins[i])
+		var thread := Thread.new()
+		thread.start(self, "_load_blocks", [stream, thread_origins])
+		threads.append(thread)
+	for thread in threads:
+		thread.wait_to_finish()
+
+
+func _load_blocks(userdata: Array) -> void:
+	var stream: VoxelStream = userdata[0]
+	for origin in userdata[1]:
+		var buffer := VoxelBuffer.new()
+		buffer.create(BLOCK_SIZE, BLOCK_SIZE, BLOCK_SIZE)
+		stream.emerge_block(buffer, origin, 0)
+
+
+# Generates a terrain crossing the saved area, so it contains air, ground and the surface between them
+func _generate_blocks() -> Dictionary:
+	var noise := OpenSimplexNoise.new()
+	noise.seed = 1337
+	noise.period = 128.0
+	noise.octaves = 4
+	var generator := VoxelGeneratorNoise2D.new()
+	generator.noise = noise
+	generator.channel = VoxelBuffer.CHANNEL_SDF
+	var area_size := _blocks_per_axis * BLOCK_SIZE
+	generator.height_start = -area_size / 4
+	generator.height_range = area_size / 2
+
+	var blocks := {}
+	var half := _blocks_per_axis / 2
+	for z in _blocks_per_axis:
+		for x in _blocks_per_axis:
+			for y in _blocks_per_axis:
+				var origin := Vector3(x - half, y - half, z - half) * BLOCK_SIZE
+				var buffer := VoxelBuffer.new()
+				buffer.create(BLOCK_SIZE, BLOCK_SIZE, BLOCK_SIZE)
+				generator.generate_block(buffer, origin, 0)
+				blocks[origin] = buffer
+	return blocks
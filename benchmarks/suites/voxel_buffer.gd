@@ -0,0 +1,83 @@
+# Measures bulk operations of VoxelBuffer on uncompressed channels of each depth.
+# Each operation is timed over several calls, and its median and 95th percentile are reported.
+#
+# Options:
+# --size=<voxels>       Size of the buffers. Default is 32.
+# --iterations=<count>  How many times each operation runs. Default is 200.
+extends Reference
+
+const BenchUtil = preload("res://util/bench_util.gd")
+
+const DEPTHS = {
+	"8bit": VoxelBuffer.DEPTH_8_BIT,
+	"16bit": VoxelBuffer.DEPTH_16_BIT,
+	"32bit": VoxelBuffer.DEPTH_32_BIT,
+}
+const CHANNEL = VoxelBuffer.CHANNEL_TYPE
+
+var _size := 32
+var _iterations := 200
+var _metrics := {}
+
+
+func start(_tree: SceneTree, args: Dictionary) -> int:
+	_size = int(args.get("size", "32"))
+	_iterations = int(args.get("iterations", "200"))
+	if _size < 4 or _size % 2 != 0:
+		printerr("Size must be an even number of at least 4")
+		return ERR_INVALID_PARAMETER
+	return OK
+
+
+# Runs everything in one go, since frames don't matter here
+func update() -> bool:
+	for depth_name in DEPTHS:
+		var depth: int = DEPTHS[depth_name]
+		var src := _create_buffer(_size, depth)
+		_fill_pattern(src)
+		var dst := _create_buffer(_size, depth)
+		var half_dst := _create_buffer(_size / 2, depth)
+
+		# Areas don't start at the origin, so they don't take shortcuts for whole buffers
+		var area_min := Vector3(1, 1, 1)
+		var area_max := Vector3(_size - 1, _size - 1, _size - 1)
+
+		_add_times("fill_area_" + depth_name,
+				BenchUtil.time_calls(dst, "fill_area", [42, area_min, area_max, CHANNEL], _iterations))
+
+		_add_times("copy_channel_from_area_" + depth_name, BenchUtil.time_calls(
+				dst, "copy_channel_from_area", [src, area_min, area_max, area_min, CHANNEL], _iterations))
+
+		_add_times("downscale_to_" + depth_name, BenchUtil.time_calls(
+				src, "downscale_to", [half_dst, Vector3(), src.get_size(), Vector3()], _iterations))
+
+	return true
+
+
+func get_config() -> Dictionary:
+	return { "size": _size, "iterations": _iterations }
+
+
+func get_metrics() -> Dictionary:
+	return _metrics
+
+
+func _create_buffer(size: int, depth: int) -> VoxelBuffer:
+	var buffer := VoxelBuffer.new()
+	buffer.create(size, size, size)
+	buffer.set_channel_depth(CHANNEL, depth)
+	return buffer
+
+
+# Writes varied values so the channel is not uniform
+func _fill_pattern(buffer: VoxelBuffer) -> void:
+	var size := buffer.get_size()
+	for z in size.z:
+		for x in size.x:
+			for y in size.y:
+				buffer.set_voxel((x + y * 3 + z * 7) % 200, x, y, z, CHANNEL)
+
+
+func _add_times(name: String, times_usec: Array) -> void:
+	_metrics[name + "_p50_usec"] = BenchUtil.get_percentile(times_usec, 50.0)
+	_metrics[name + "_p95_usec"] = BenchUtil.get_percentile(times_usec, 95.0)
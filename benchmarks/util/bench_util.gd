@@ -0,0 +1,115 @@
+# Helpers shared by benchmark suites.
+extends Reference
+
+
+# Gets `--key=value` options from command line arguments. Other arguments are ignored,
+# since they may belong to the engine.
+static func parse_args(args: PoolStringArray) -> Dictionary:
+	var options := {}
+	for arg in args:
+		if not arg.begins_with("--"):
+			continue
+		var sep: int = arg.find("=")
+		if sep == -1:
+			continue
+		options[arg.substr(2, sep - 2)] = arg.substr(sep + 1, arg.length() - sep - 1)
+	return options
+
+
+# Parses a comma-separated list of integers, like "4,8,16"
+static func parse_int_list(text: String) -> Array:
+	var values := []
+	for item in text.split(",", false):
+		values.append(int(item))
+	return values
+
+
+# Gets the value below which `percent` of the given values fall.
+static func get_percentile(values: Array, percent: float) -> float:
+	if values.size() == 0:
+		return 0.0
+	var sorted_values := values.duplicate()
+	sorted_values.sort()
+	var i := int(ceil(percent / 100.0 * sorted_values.size())) - 1
+	return float(sorted_values[int(clamp(i, 0, sorted_values.size() - 1))])
+
+
+static func write_json(path: String, data) -> int:
+	var f := File.new()
+	var err := f.open(path, File.WRITE)
+	if err != OK:
+		printerr("Could not open ", path, " for writing: error ", err)
+		return err
+	f.store_string(JSON.print(data, "\t"))
+	f.close()
+	return OK
+
+
+static func read_json(path: String):
+	var f := File.new()
+	var err := f.open(path, File.READ)
+	if err != OK:
+		printerr("Could not open ", path, ": error ", err)
+		return null
+	var res := JSON.parse(f.get_as_text())
+	f.close()
+	if res.error != OK:
+		printerr("Could not parse ", path, " line ", res.error_line, ": ", res.error_string)
+		return null
+	return res.result
+
+
+# Deletes a directory and everything inside it, if it exists
+static func remove_directory(path: String) -> void:
+	var dir := Directory.new()
+	if dir.open(path) != OK:
+		return
+	dir.list_dir_begin(true, false)
+	var name := dir.get_next()
+	while name != "":
+		var child_path := path.plus_file(name)
+		if dir.current_is_dir():
+			remove_directory(child_path)
+		else:
+			dir.remove(child_path)
+		name = dir.get_next()
+	dir.list_dir_end()
+	dir.remove(path)
+
+
+# Gets the size of all files in a directory and its subdirectories
+static func get_directory_size(path: String) -> int:
+	var size := 0
+	var dir := Directory.new()
+	if dir.open(path) != OK:
+		return 0
+	dir.list_dir_begin(true, false)
+	var name := dir.get_next()
+	while name != "":
+		var child_path := path.plus_file(name)
+		if dir.current_is_dir():
+			size += get_directory_size(child_path)
+		else:
+			size += get_file_size(child_path)
+		name = dir.get_next()
+	dir.list_dir_end()
+	return size
+
+
+static func get_file_size(path: String) -> int:
+	var f := File.new()
+	if f.open(path, File.READ) != OK:
+		return 0
+	var size := f.get_len()
+	f.close()
+	return size
+
+
+# Calls a method several times, and returns how long each call took in microseconds
+static func time_calls(object: Object, method: String, args: Array, iterations: int) -> Array:
+	var times := []
+	for i in iterations:
+		var time_before := OS.get_ticks_usec()
+		object.callv(method, args)
+		times.append(OS.get_ticks_usec() - time_before)
+	return times
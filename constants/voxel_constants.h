@@ -10,7 +10,18 @@ static const float MAXIMUM_LOD_SPLIT_SCALE = 5.f;
 static const unsigned int MAX_LOD = 32;
 static const unsigned int MAX_VOLUME_EXTENT = 0x1fffffff;
 static const unsigned int MAX_VOLUME_SIZE = 2 * MAX_VOLUME_EXTENT; // 1,073,741,822 voxels
-static const unsigned int MAIN_THREAD_MESHING_BUDGET_MS = 8;
+// Time terrains can spend each frame applying results of background tasks on the main thread
+static const unsigned int DEFAULT_MAIN_THREAD_TIME_BUDGET_USEC = 8000;
+// Edited blocks are compressed again after they were left alone for this long
+static const unsigned int BLOCK_RECOMPRESSION_IDLE_DELAY_USEC = 2000000;
+
+// Memory kept for reuse by VoxelMemoryPool and not needed during this time is released
+static const unsigned int MEMORY_POOL_TRIM_INTERVAL_USEC = 10000000;
+
+// When voxel memory is over budget, terrains evict at most this amount of blocks per frame
+static const unsigned int MAX_BLOCK_EVICTIONS_PER_FRAME = 64;
+// When terrains find no block they can evict, they wait this long before looking again
+static const unsigned int BLOCK_EVICTION_SCAN_BACKOFF_USEC = 1000000;
 
 static const float INV_0x7f = 1.f / 0x7f;
 static const float INV_0x7fff = 1.f / 0x7fff;
@@ -0,0 +1,74 @@
+#ifndef VOXEL_EDITION_FUNCS_H
+#define VOXEL_EDITION_FUNCS_H
+
+#include "../util/math/vector3i.h"
+#include "voxel_tool.h"
+
+inline float sdf_blend(float src_value, float dst_value, VoxelTool::Mode mode) {
+	float res;
+	switch (mode) {
+		case VoxelTool::MODE_ADD:
+			// Union
+			res = min(src_value, dst_value);
+			break;
+
+		case VoxelTool::MODE_REMOVE:
+			// Relative complement (or difference)
+			res = max(-src_value, dst_value);
+			break;
+
+		case VoxelTool::MODE_SET:
+			res = src_value;
+			break;
+
+		default:
+			res = 0;
+			break;
+	}
+	return res;
+}
+
+// Operations run on every voxel of an edited box.
+// They have the signature expected by `read_write_action` (or `read_write_action_f` for SDF),
+// so they can be given to a VoxelBuffer or a VoxelMap and get inlined in their loops.
+
+struct SdfSphereOp {
+	Vector3 center;
+	float radius;
+	float sdf_scale;
+	VoxelTool::Mode mode;
+
+	inline real_t operator()(Vector3i pos, real_t v) const {
+		const float d = sdf_scale * (pos.to_vec3().distance_to(center) - radius);
+		return sdf_blend(d, v, mode);
+	}
+};
+
+struct SphereOp {
+	Vector3 center;
+	float radius;
+	uint64_t value;
+
+	inline uint64_t operator()(Vector3i pos, uint64_t v) const {
+		return pos.to_vec3().distance_to(center) <= radius ? value : v;
+	}
+};
+
+struct SdfBoxOp {
+	VoxelTool::Mode mode;
+
+	inline real_t operator()(Vector3i pos, real_t v) const {
+		// TODO Better quality
+		return sdf_blend(-1.0, v, mode);
+	}
+};
+
+struct FillOp {
+	uint64_t value;
+
+	inline uint64_t operator()(Vector3i pos, uint64_t v) const {
+		return value;
+	}
+};
+
+#endif // VOXEL_EDITION_FUNCS_H
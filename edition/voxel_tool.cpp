@@ -1,4 +1,5 @@
 #include "voxel_tool.h"
+#include "funcs.h"
 #include "../storage/voxel_buffer.h"
 #include "../terrain/voxel_lod_terrain.h"
 #include "../util/macros.h"
@@ -146,59 +147,31 @@ void VoxelTool::_set_voxel_f(Vector3i pos, float v) {
 	ERR_PRINT("Not implemented");
 }
 
-// TODO May be worth using VoxelBuffer::read_write_action() in the future with a lambda,
-// so we avoid the burden of going through get/set, validation and rehash access to blocks.
-// Would work well by avoiding virtual as well using a specialized implementation.
-
-namespace {
-inline float sdf_blend(float src_value, float dst_value, VoxelTool::Mode mode) {
-	float res;
-	switch (mode) {
-		case VoxelTool::MODE_ADD:
-			// Union
-			res = min(src_value, dst_value);
-			break;
-
-		case VoxelTool::MODE_REMOVE:
-			// Relative complement (or difference)
-			res = max(-src_value, dst_value);
-			break;
-
-		case VoxelTool::MODE_SET:
-			res = src_value;
-			break;
-
-		default:
-			res = 0;
-			break;
-	}
-	return res;
-}
-} // namespace
-
 void VoxelTool::do_sphere(Vector3 center, float radius) {
 	VOXEL_PROFILE_SCOPE();
 
-	const Rect3i box(Vector3i(center) - Vector3i(Math::floor(radius)), Vector3i(Math::ceil(radius) * 2));
+	const Rect3i box = get_sphere_box(center, radius);
 
 	if (!is_area_editable(box)) {
 		PRINT_VERBOSE("Area not editable");
 		return;
 	}
 
+	// Generic path going through per-voxel access.
+	// Tools having direct access to voxels override this with `read_write_action`.
 	if (_channel == VoxelBuffer::CHANNEL_SDF) {
-		box.for_each_cell([this, center, radius](Vector3i pos) {
-			float d = _sdf_scale * (pos.to_vec3().distance_to(center) - radius);
-			_set_voxel_f(pos, sdf_blend(d, get_voxel_f(pos), _mode));
+		const SdfSphereOp op{ center, radius, _sdf_scale, _mode };
+		box.for_each_cell_zxy([this, &op](Vector3i pos) {
+			_set_voxel_f(pos, op(pos, get_voxel_f(pos)));
 		});
 
 	} else {
-		int value = _mode == MODE_REMOVE ? _eraser_value : _value;
-
-		box.for_each_cell([this, center, radius, value](Vector3i pos) {
-			float d = pos.to_vec3().distance_to(center);
-			if (d <= radius) {
-				_set_voxel(pos, value);
+		const SphereOp op{ center, radius, get_brush_value() };
+		box.for_each_cell_zxy([this, &op](Vector3i pos) {
+			const uint64_t v0 = get_voxel(pos);
+			const uint64_t v1 = op(pos, v0);
+			if (v0 != v1) {
+				_set_voxel(pos, v1);
 			}
 		});
 	}
@@ -208,8 +181,7 @@ void VoxelTool::do_sphere(Vector3 center, float radius) {
 
 void VoxelTool::do_box(Vector3i begin, Vector3i end) {
 	VOXEL_PROFILE_SCOPE();
-	Vector3i::sort_min_max(begin, end);
-	Rect3i box = Rect3i::from_min_max(begin, end + Vector3i(1, 1, 1));
+	const Rect3i box = get_box(begin, end);
 
 	if (!is_area_editable(box)) {
 		PRINT_VERBOSE("Area not editable");
@@ -217,14 +189,14 @@ void VoxelTool::do_box(Vector3i begin, Vector3i end) {
 	}
 
 	if (_channel == VoxelBuffer::CHANNEL_SDF) {
-		// TODO Better quality
-		box.for_each_cell([this](Vector3i pos) {
-			_set_voxel_f(pos, sdf_blend(-1.0, get_voxel_f(pos), _mode));
+		const SdfBoxOp op{ _mode };
+		box.for_each_cell_zxy([this, &op](Vector3i pos) {
+			_set_voxel_f(pos, op(pos, get_voxel_f(pos)));
 		});
 
 	} else {
-		int value = _mode == MODE_REMOVE ? _eraser_value : _value;
-		box.for_each_cell([this, value](Vector3i pos) {
+		const uint64_t value = get_brush_value();
+		box.for_each_cell_zxy([this, value](Vector3i pos) {
 			_set_voxel(pos, value);
 		});
 	}
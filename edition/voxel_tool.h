@@ -90,6 +90,21 @@ protected:
 	virtual void _set_voxel_f(Vector3i pos, float v);
 	virtual void _post_edit(const Rect3i &box);
 
+	// Value written by edits on channels other than SDF
+	inline uint64_t get_brush_value() const {
+		return _mode == MODE_REMOVE ? _eraser_value : _value;
+	}
+
+	static inline Rect3i get_sphere_box(Vector3 center, float radius) {
+		return Rect3i(Vector3i(center) - Vector3i(Math::floor(radius)), Vector3i(Math::ceil(radius) * 2));
+	}
+
+	// Box including both corners
+	static inline Rect3i get_box(Vector3i begin, Vector3i end) {
+		Vector3i::sort_min_max(begin, end);
+		return Rect3i::from_min_max(begin, end + Vector3i(1, 1, 1));
+	}
+
 private:
 	// Bindings to convert to more specialized C++ types and handle virtuality,
 	// cuz I don't know if it works by binding straight
@@ -1,5 +1,8 @@
 #include "voxel_tool_buffer.h"
 #include "../storage/voxel_buffer.h"
+#include "../util/macros.h"
+#include "../util/profiling.h"
+#include "funcs.h"
 
 VoxelToolBuffer::VoxelToolBuffer(Ref<VoxelBuffer> vb) {
 	ERR_FAIL_COND(vb.is_null());
@@ -11,6 +14,46 @@ bool VoxelToolBuffer::is_area_editable(const Rect3i &box) const {
 	return Rect3i(Vector3i(), _buffer->get_size()).encloses(box);
 }
 
+void VoxelToolBuffer::do_sphere(Vector3 center, float radius) {
+	VOXEL_PROFILE_SCOPE();
+	ERR_FAIL_COND(_buffer.is_null());
+
+	const Rect3i box = get_sphere_box(center, radius);
+
+	if (!is_area_editable(box)) {
+		PRINT_VERBOSE("Area not editable");
+		return;
+	}
+
+	if (_channel == VoxelBuffer::CHANNEL_SDF) {
+		_buffer->read_write_action_f(box, _channel, SdfSphereOp{ center, radius, _sdf_scale, _mode });
+	} else {
+		_buffer->read_write_action(box, _channel, SphereOp{ center, radius, get_brush_value() });
+	}
+
+	_post_edit(box);
+}
+
+void VoxelToolBuffer::do_box(Vector3i begin, Vector3i end) {
+	VOXEL_PROFILE_SCOPE();
+	ERR_FAIL_COND(_buffer.is_null());
+
+	const Rect3i box = get_box(begin, end);
+
+	if (!is_area_editable(box)) {
+		PRINT_VERBOSE("Area not editable");
+		return;
+	}
+
+	if (_channel == VoxelBuffer::CHANNEL_SDF) {
+		_buffer->read_write_action_f(box, _channel, SdfBoxOp{ _mode });
+	} else {
+		_buffer->read_write_action(box, _channel, FillOp{ get_brush_value() });
+	}
+
+	_post_edit(box);
+}
+
 uint64_t VoxelToolBuffer::_get_voxel(Vector3i pos) const {
 	ERR_FAIL_COND_V(_buffer.is_null(), 0);
 	return _buffer->get_voxel(pos, _channel);
@@ -1,7 +1,10 @@
 #include "voxel_tool_lod_terrain.h"
 #include "../terrain/voxel_lod_terrain.h"
 #include "../terrain/voxel_map.h"
+#include "../util/macros.h"
+#include "../util/profiling.h"
 #include "../util/voxel_raycast.h"
+#include "funcs.h"
 
 VoxelToolLodTerrain::VoxelToolLodTerrain(VoxelLodTerrain *terrain, VoxelMap &map) :
 		_terrain(terrain), _map(&map) {
@@ -149,6 +152,46 @@ Ref<VoxelRaycastResult> VoxelToolLodTerrain::raycast(
 	return res;
 }
 
+void VoxelToolLodTerrain::do_sphere(Vector3 center, float radius) {
+	VOXEL_PROFILE_SCOPE();
+	ERR_FAIL_COND(_terrain == nullptr);
+
+	const Rect3i box = get_sphere_box(center, radius);
+
+	if (!is_area_editable(box)) {
+		PRINT_VERBOSE("Area not editable");
+		return;
+	}
+
+	if (_channel == VoxelBuffer::CHANNEL_SDF) {
+		_map->read_write_action_f(box, _channel, SdfSphereOp{ center, radius, _sdf_scale, _mode });
+	} else {
+		_map->read_write_action(box, _channel, SphereOp{ center, radius, get_brush_value() });
+	}
+
+	_post_edit(box);
+}
+
+void VoxelToolLodTerrain::do_box(Vector3i begin, Vector3i end) {
+	VOXEL_PROFILE_SCOPE();
+	ERR_FAIL_COND(_terrain == nullptr);
+
+	const Rect3i box = get_box(begin, end);
+
+	if (!is_area_editable(box)) {
+		PRINT_VERBOSE("Area not editable");
+		return;
+	}
+
+	if (_channel == VoxelBuffer::CHANNEL_SDF) {
+		_map->read_write_action_f(box, _channel, SdfBoxOp{ _mode });
+	} else {
+		_map->read_write_action(box, _channel, FillOp{ get_brush_value() });
+	}
+
+	_post_edit(box);
+}
+
 uint64_t VoxelToolLodTerrain::_get_voxel(Vector3i pos) const {
 	ERR_FAIL_COND_V(_terrain == nullptr, 0);
 	return _map->get_voxel(pos, _channel);
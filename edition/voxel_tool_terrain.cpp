@@ -1,7 +1,10 @@
 #include "voxel_tool_terrain.h"
 #include "../terrain/voxel_map.h"
 #include "../terrain/voxel_terrain.h"
+#include "../util/macros.h"
+#include "../util/profiling.h"
 #include "../util/voxel_raycast.h"
+#include "funcs.h"
 #include <core/func_ref.h>
 
 VoxelToolTerrain::VoxelToolTerrain() {
@@ -16,6 +19,8 @@ VoxelToolTerrain::VoxelToolTerrain(VoxelTerrain *terrain) {
 bool VoxelToolTerrain::is_area_editable(const Rect3i &box) const {
 	ERR_FAIL_COND_V(_terrain == nullptr, false);
 	// TODO Take volume bounds into account
+	// Blocks unloaded to save memory come back, so the area can be edited a few frames later
+	_terrain->reload_evicted_blocks_in_area(box.padded(1));
 	return _terrain->get_storage().is_area_fully_loaded(box.padded(1));
 }
 
@@ -103,6 +108,46 @@ void VoxelToolTerrain::paste(Vector3i pos, Ref<VoxelBuffer> p_voxels, uint8_t ch
 	_post_edit(Rect3i(pos, p_voxels->get_size()));
 }
 
+void VoxelToolTerrain::do_sphere(Vector3 center, float radius) {
+	VOXEL_PROFILE_SCOPE();
+	ERR_FAIL_COND(_terrain == nullptr);
+
+	const Rect3i box = get_sphere_box(center, radius);
+
+	if (!is_area_editable(box)) {
+		PRINT_VERBOSE("Area not editable");
+		return;
+	}
+
+	if (_channel == VoxelBuffer::CHANNEL_SDF) {
+		_terrain->get_storage().read_write_action_f(box, _channel, SdfSphereOp{ center, radius, _sdf_scale, _mode });
+	} else {
+		_terrain->get_storage().read_write_action(box, _channel, SphereOp{ center, radius, get_brush_value() });
+	}
+
+	_post_edit(box);
+}
+
+void VoxelToolTerrain::do_box(Vector3i begin, Vector3i end) {
+	VOXEL_PROFILE_SCOPE();
+	ERR_FAIL_COND(_terrain == nullptr);
+
+	const Rect3i box = get_box(begin, end);
+
+	if (!is_area_editable(box)) {
+		PRINT_VERBOSE("Area not editable");
+		return;
+	}
+
+	if (_channel == VoxelBuffer::CHANNEL_SDF) {
+		_terrain->get_storage().read_write_action_f(box, _channel, SdfBoxOp{ _mode });
+	} else {
+		_terrain->get_storage().read_write_action(box, _channel, FillOp{ get_brush_value() });
+	}
+
+	_post_edit(box);
+}
+
 uint64_t VoxelToolTerrain::_get_voxel(Vector3i pos) const {
 	ERR_FAIL_COND_V(_terrain == nullptr, 0);
 	return _terrain->get_storage().get_voxel(pos, _channel);
@@ -8,6 +8,7 @@
 #include <editor/editor_scale.h>
 #include <scene/3d/camera.h>
 #include <scene/gui/menu_button.h>
+#include <scene/resources/world.h>
 
 class VoxelTerrainEditorTaskIndicator : public HBoxContainer {
 	GDCLASS(VoxelTerrainEditorTaskIndicator, HBoxContainer)
@@ -122,11 +123,13 @@ void VoxelTerrainEditorPlugin::_notification(int p_what) {
 			int main_thread_tasks = 0;
 			VoxelLodTerrain *vlt = Object::cast_to<VoxelLodTerrain>(_node);
 			if (vlt != nullptr) {
-				main_thread_tasks = vlt->get_stats().remaining_main_thread_blocks;
+				const VoxelLodTerrain::Stats &stats = vlt->get_stats();
+				main_thread_tasks = stats.remaining_main_thread_blocks + stats.remaining_main_thread_data_blocks;
 			} else {
 				VoxelTerrain *vt = Object::cast_to<VoxelTerrain>(_node);
 				if (vt != nullptr) {
-					main_thread_tasks = vt->get_stats().remaining_main_thread_blocks;
+					const VoxelTerrain::Stats &stats = vt->get_stats();
+					main_thread_tasks = stats.remaining_main_thread_blocks + stats.remaining_main_thread_data_blocks;
 				}
 			}
 			_task_indicator->update_stats(main_thread_tasks);
@@ -220,10 +223,17 @@ void VoxelTerrainEditorPlugin::make_visible(bool visible) {
 
 bool VoxelTerrainEditorPlugin::forward_spatial_gui_input(Camera *p_camera, const Ref<InputEvent> &p_event) {
 	VoxelServer::get_singleton()->set_viewer_distance(_editor_viewer_id, p_camera->get_zfar());
-	_editor_camera_last_position = p_camera->get_global_transform().origin;
+	if (_node != nullptr && _node->is_inside_tree()) {
+		// The editor viewer must be in the same world as the edited terrain for it to be seen
+		VoxelServer::get_singleton()->set_viewer_world(_editor_viewer_id, _node->get_world()->get_instance_id());
+	}
+	const Transform camera_transform = p_camera->get_global_transform();
+	_editor_camera_last_position = camera_transform.origin;
 
 	if (_editor_viewer_follows_camera) {
 		VoxelServer::get_singleton()->set_viewer_position(_editor_viewer_id, _editor_camera_last_position);
+		VoxelServer::get_singleton()->set_viewer_direction(
+				_editor_viewer_id, -camera_transform.basis.get_axis(Vector3::AXIS_Z));
 	}
 
 	return false;
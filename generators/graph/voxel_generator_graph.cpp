@@ -268,6 +268,8 @@ void VoxelGeneratorGraph::generate_block(VoxelBlockRequest &input) {
 		}
 	}
 
+	const int slice_size_x = rmax.x - rmin.x;
+
 	for (int ry = rmin.y, gy = gmin.y; ry < rmax.y; ++ry, gy += (1 << input.lod)) {
 		VOXEL_PROFILE_SCOPE();
 
@@ -275,14 +277,11 @@ void VoxelGeneratorGraph::generate_block(VoxelBlockRequest &input) {
 
 		runtime->generate_set(cache.state, x_cache, y_cache, z_cache, slice_cache, ry != rmin.y);
 
-		// TODO Flatten this further
-		unsigned int i = 0;
-		for (int rz = rmin.z; rz < rmax.z; ++rz) {
-			for (int rx = rmin.x; rx < rmax.x; ++rx) {
-				out_buffer.set_voxel_f(sdf_scale * slice_cache[i], rx, ry, rz, channel);
-				++i;
-			}
-		}
+		const Rect3i slice_box(Vector3i(rmin.x, ry, rmin.z), Vector3i(slice_size_x, 1, rmax.z - rmin.z));
+		out_buffer.read_write_action_f(slice_box, channel,
+				[&slice_cache, rmin, slice_size_x, sdf_scale](Vector3i pos, real_t v) {
+					return sdf_scale * slice_cache[(pos.z - rmin.z) * slice_size_x + (pos.x - rmin.x)];
+				});
 	}
 
 	out_buffer.compress_uniform_channels();
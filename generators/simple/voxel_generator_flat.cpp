@@ -81,21 +81,11 @@ void VoxelGeneratorFlat::generate_block(VoxelBlockRequest &input) {
 	const int stride = 1 << lod;
 
 	if (use_sdf) {
-
-		int gz = origin.z;
-		for (int z = 0; z < bs.z; ++z, gz += stride) {
-
-			int gx = origin.x;
-			for (int x = 0; x < bs.x; ++x, gx += stride) {
-
-				int gy = origin.y;
-				for (int y = 0; y < bs.y; ++y, gy += stride) {
-					float sdf = params.iso_scale * (gy - params.height);
-					out_buffer.set_voxel_f(sdf, x, y, z, channel);
-				}
-
-			} // for x
-		} // for z
+		out_buffer.read_write_action_f(Rect3i(Vector3i(), bs), channel,
+				[&params, origin, stride](Vector3i pos, real_t v) {
+					const int gy = origin.y + pos.y * stride;
+					return params.iso_scale * (gy - params.height);
+				});
 
 	} else {
 		// Blocky
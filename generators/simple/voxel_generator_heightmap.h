@@ -50,21 +50,18 @@ protected:
 		const int stride = 1 << lod;
 
 		if (use_sdf) {
-			int gz = origin.z;
-
-			for (int z = 0; z < bs.z; ++z, gz += stride) {
-				int gx = origin.x;
-
-				for (int x = 0; x < bs.x; ++x, gx += stride) {
-					float h = params.range.xform(height_func(gx, gz));
-					int gy = origin.y;
-					for (int y = 0; y < bs.y; ++y, gy += stride) {
-						float sdf = params.iso_scale * (gy - h);
-						out_buffer.set_voxel_f(sdf, x, y, z, channel);
-					}
-
-				} // for x
-			} // for z
+			// Voxels are visited column by column, so the height only needs to be sampled at the bottom of each
+			float h = 0.f;
+			out_buffer.read_write_action_f(Rect3i(Vector3i(), bs), channel,
+					[&params, &height_func, &h, origin, stride](Vector3i pos, real_t v) {
+						if (pos.y == 0) {
+							const int gx = origin.x + pos.x * stride;
+							const int gz = origin.z + pos.z * stride;
+							h = params.range.xform(height_func(gx, gz));
+						}
+						const int gy = origin.y + pos.y * stride;
+						return params.iso_scale * (gy - h);
+					});
 
 		} else {
 			// Blocky
@@ -39,6 +39,24 @@ inline bool is_face_visible(const VoxelLibrary::BakedData &lib, const Voxel::Bak
 	return true;
 }
 
+// Tells if a block filled with only this type of voxel has no visible geometry
+bool is_uniform_type_empty(const VoxelLibrary::BakedData &lib, uint32_t voxel_id) {
+	if (voxel_id == 0 || !lib.has_model(voxel_id)) {
+		return true;
+	}
+	const Voxel::BakedData &voxel = lib.models[voxel_id];
+	if (voxel.model.positions.size() != 0) {
+		// Inside geometry, like plants or custom meshes, is never culled
+		return false;
+	}
+	for (unsigned int side = 0; side < Cube::SIDE_COUNT; ++side) {
+		if (voxel.model.side_positions[side].size() != 0 && is_face_visible(lib, voxel, voxel_id, side)) {
+			return false;
+		}
+	}
+	return true;
+}
+
 inline bool contributes_to_ao(const VoxelLibrary::BakedData &lib, uint32_t voxel_id) {
 	if (voxel_id < lib.models.size()) {
 		const Voxel::BakedData &t = lib.models[voxel_id];
@@ -434,22 +452,48 @@ void VoxelMesherBlocky::build(VoxelMesher::Output &output, const VoxelMesher::In
 	// That means we can use raw pointers to voxel data inside instead of using the higher-level getters,
 	// and then save a lot of time.
 
+	const Vector3i block_size = voxels.get_size();
+	const VoxelBuffer::Depth channel_depth = voxels.get_channel_depth(channel);
+
+	ArraySlice<uint8_t> raw_channel;
+
 	if (voxels.get_channel_compression(channel) == VoxelBuffer::COMPRESSION_UNIFORM) {
 		// All voxels have the same type.
 		// If it's all air, nothing to do. If it's all cubes, nothing to do either.
-		// TODO Handle edge case of uniform block with non-cubic voxels!
-		// If the type of voxel still produces geometry in this situation (which is an absurd use case but not an error),
-		// decompress into a backing array to still allow the use of the same algorithm.
-		return;
+		const uint64_t voxel_id = voxels.get_voxel(0, 0, 0, channel);
+		{
+			RWLockRead lock(params.library->get_baked_data_rw_lock());
+			if (is_uniform_type_empty(params.library->get_baked_data(), voxel_id)) {
+				return;
+			}
+		}
+
+		// The type of voxel still produces geometry (like a block full of plants),
+		// so decompress into a backing array to still allow the use of the same algorithm.
+		std::vector<uint8_t> &uniform_channel = cache.uniform_channel;
+		uniform_channel.resize(VoxelBuffer::get_size_in_bytes_for_volume(block_size, channel_depth));
+		raw_channel = to_slice(uniform_channel);
+
+		switch (channel_depth) {
+			case VoxelBuffer::DEPTH_8_BIT:
+				raw_channel.fill(static_cast<uint8_t>(voxel_id));
+				break;
+
+			case VoxelBuffer::DEPTH_16_BIT:
+				raw_channel.reinterpret_cast_to<uint16_t>().fill(static_cast<uint16_t>(voxel_id));
+				break;
+
+			default:
+				ERR_PRINT("Unsupported voxel depth");
+				return;
+		}
 
 	} else if (voxels.get_channel_compression(channel) != VoxelBuffer::COMPRESSION_NONE) {
 		// No other form of compression is allowed
 		ERR_PRINT("VoxelMesherBlocky received unsupported voxel compression");
 		return;
-	}
 
-	ArraySlice<uint8_t> raw_channel;
-	if (!voxels.get_channel_raw(channel, raw_channel)) {
+	} else if (!voxels.get_channel_raw(channel, raw_channel)) {
 		/*       _
 		//      | \
 		//     /\ \\
@@ -465,9 +509,6 @@ void VoxelMesherBlocky::build(VoxelMesher::Output &output, const VoxelMesher::In
 		return;
 	}
 
-	const Vector3i block_size = voxels.get_size();
-	const VoxelBuffer::Depth channel_depth = voxels.get_channel_depth(channel);
-
 	{
 		// We can only access baked data. Only this data is made for multithreaded access.
 		RWLockRead lock(params.library->get_baked_data_rw_lock());
@@ -555,6 +596,19 @@ int VoxelMesherBlocky::get_used_channels_mask() const {
 	return (1 << VoxelBuffer::CHANNEL_TYPE);
 }
 
+bool VoxelMesherBlocky::is_uniform_empty(unsigned int channel_index, uint64_t value) const {
+	if (channel_index != VoxelBuffer::CHANNEL_TYPE) {
+		return true;
+	}
+	Ref<VoxelLibrary> library = get_library();
+	if (library.is_null()) {
+		// `build` would not produce anything either
+		return true;
+	}
+	RWLockRead lock(library->get_baked_data_rw_lock());
+	return is_uniform_type_empty(library->get_baked_data(), value);
+}
+
 void VoxelMesherBlocky::_bind_methods() {
 	ClassDB::bind_method(D_METHOD("set_library", "voxel_library"), &VoxelMesherBlocky::set_library);
 	ClassDB::bind_method(D_METHOD("get_library"), &VoxelMesherBlocky::get_library);
@@ -34,6 +34,7 @@ public:
 
 	Ref<Resource> duplicate(bool p_subresources = false) const override;
 	int get_used_channels_mask() const override;
+	bool is_uniform_empty(unsigned int channel_index, uint64_t value) const override;
 
 	// Using std::vector because they make this mesher twice as fast than Godot Vectors.
 	// See why: https://github.com/godotengine/godot/issues/24731
@@ -67,6 +68,8 @@ private:
 
 	struct Cache {
 		FixedArray<Arrays, MAX_MATERIALS> arrays_per_material;
+		// Uniform channels are expanded here when their voxels still produce geometry
+		std::vector<uint8_t> uniform_channel;
 	};
 
 	// Parameters
@@ -20,10 +20,10 @@ const float SQRT3 = 1.7320508075688772;
 // Helper to access padded voxel data
 struct VoxelAccess {
 
-	const VoxelBuffer &buffer;
+	const VoxelBlockNeighborhood &buffer;
 	const Vector3i offset;
 
-	VoxelAccess(const VoxelBuffer &p_buffer, Vector3i p_offset) :
+	VoxelAccess(const VoxelBlockNeighborhood &p_buffer, Vector3i p_offset) :
 			buffer(p_buffer),
 			offset(p_offset) {}
 
@@ -1393,7 +1393,7 @@ inline void polygonize_dual_grid(const DualGrid &grid, const VoxelAccess &voxels
 	}
 }
 
-void polygonize_volume_directly(const VoxelBuffer &voxels, Vector3i min, Vector3i size, MeshBuilder &mesh_builder, bool skirts_enabled) {
+void polygonize_volume_directly(const VoxelBlockNeighborhood &voxels, Vector3i min, Vector3i size, MeshBuilder &mesh_builder, bool skirts_enabled) {
 
 	Vector3 corners[8];
 	HermiteValue values[8];
@@ -1494,18 +1494,32 @@ VoxelMesherDMC::SeamMode VoxelMesherDMC::get_seam_mode() const {
 }
 
 void VoxelMesherDMC::build(VoxelMesher::Output &output, const VoxelMesher::Input &input) {
-	// Requirements:
-	// - Voxel data must be padded
-	// - The non-padded area size is cubic and power of two
+	if (input.voxels.is_uniform(VoxelBuffer::CHANNEL_SDF)) {
+		// That won't produce any polygon
+		_stats = {};
+		return;
+	}
 
-	const VoxelBuffer &voxels = input.voxels;
+	build_internal(output, VoxelBlockNeighborhood(input.voxels), input.lod);
+}
 
+bool VoxelMesherDMC::build_from_neighborhood(
+		VoxelMesher::Output &output, const VoxelBlockNeighborhood &voxels, int lod) {
+	// Voxels are sampled through the neighborhood, so they don't need to be copied
 	if (voxels.is_uniform(VoxelBuffer::CHANNEL_SDF)) {
-		// That won't produce any polygon
 		_stats = {};
-		return;
+		return true;
 	}
 
+	build_internal(output, voxels, lod);
+	return true;
+}
+
+void VoxelMesherDMC::build_internal(VoxelMesher::Output &output, const VoxelBlockNeighborhood &voxels, int lod) {
+	// Requirements:
+	// - Voxel data must be padded
+	// - The non-padded area size is cubic and power of two
+
 	const Vector3i buffer_size = voxels.get_size();
 	// Taking previous power of two because the algorithm uses an integer cubic octree, and data should be padded
 	const int chunk_size = previous_power_of_2(MIN(MIN(buffer_size.x, buffer_size.y), buffer_size.z));
@@ -1572,7 +1586,7 @@ void VoxelMesherDMC::build(VoxelMesher::Output &output, const VoxelMesher::Input
 
 	if (root != nullptr) {
 		if (params.mesh_mode == MESH_DEBUG_OCTREE) {
-			surface = dmc::generate_debug_octree_mesh(root, 1 << input.lod);
+			surface = dmc::generate_debug_octree_mesh(root, 1 << lod);
 
 		} else {
 			time_before = OS::get_singleton()->get_ticks_usec();
@@ -1584,7 +1598,7 @@ void VoxelMesherDMC::build(VoxelMesher::Output &output, const VoxelMesher::Input
 			stats.dualgrid_derivation_time = OS::get_singleton()->get_ticks_usec() - time_before;
 
 			if (params.mesh_mode == MESH_DEBUG_DUAL_GRID) {
-				surface = dmc::generate_debug_dual_grid_mesh(cache.dual_grid, 1 << input.lod);
+				surface = dmc::generate_debug_dual_grid_mesh(cache.dual_grid, 1 << lod);
 
 			} else {
 				time_before = OS::get_singleton()->get_ticks_usec();
@@ -1608,8 +1622,8 @@ void VoxelMesherDMC::build(VoxelMesher::Output &output, const VoxelMesher::Input
 
 	if (surface.empty()) {
 		time_before = OS::get_singleton()->get_ticks_usec();
-		if (input.lod > 0) {
-			cache.mesh_builder.scale(1 << input.lod);
+		if (lod > 0) {
+			cache.mesh_builder.scale(1 << lod);
 		}
 		surface = cache.mesh_builder.commit(params.mesh_mode == MESH_WIREFRAME);
 		stats.commit_time = OS::get_singleton()->get_ticks_usec() - time_before;
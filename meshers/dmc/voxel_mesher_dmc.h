@@ -103,6 +103,8 @@ public:
 	SeamMode get_seam_mode() const;
 
 	void build(VoxelMesher::Output &output, const VoxelMesher::Input &input) override;
+	bool build_from_neighborhood(
+			VoxelMesher::Output &output, const VoxelBlockNeighborhood &voxels, int lod) override;
 
 	Dictionary get_statistics() const;
 
@@ -113,6 +115,8 @@ protected:
 	static void _bind_methods();
 
 private:
+	void build_internal(VoxelMesher::Output &output, const VoxelBlockNeighborhood &voxels, int lod);
+
 	struct Parameters {
 		real_t geometric_error = 0.1;
 		MeshMode mesh_mode = MESH_NORMAL;
@@ -364,11 +364,14 @@ void VoxelMesherTransvoxelInternal::build_internal(const VoxelBuffer &voxels, un
 	FixedArray<Vector3i, 8> padded_corner_positions;
 	FixedArray<Vector3i, 8> corner_positions;
 
-	// Iterate all cells with padding (expected to be neighbors)
+	// Iterate all cells with padding (expected to be neighbors).
+	// Cells are visited in the same ZXY order voxels are stored, so consecutive cells read neighboring memory.
+	// Vertex reuse only needs cells of lower coordinates to be visited first, which is true with any order as long as
+	// Z is the outer loop, since reuse decks are per Z slice.
 	Vector3i pos;
 	for (pos.z = min_pos.z; pos.z < max_pos.z; ++pos.z) {
-		for (pos.y = min_pos.y; pos.y < max_pos.y; ++pos.y) {
-			for (pos.x = min_pos.x; pos.x < max_pos.x; ++pos.x) {
+		for (pos.x = min_pos.x; pos.x < max_pos.x; ++pos.x) {
+			for (pos.y = min_pos.y; pos.y < max_pos.y; ++pos.y) {
 
 				//    6-------7
 				//   /|      /|
@@ -1,12 +1,29 @@
 #include "voxel_mesher.h"
-#include "../storage/voxel_buffer.h"
+#include "../storage/voxel_block_neighborhood.h"
 #include "../util/godot/funcs.h"
+#include "blocky/voxel.h"
 
 Ref<Mesh> VoxelMesher::build_mesh(Ref<VoxelBuffer> voxels, Array materials) {
 	ERR_FAIL_COND_V(voxels.is_null(), Ref<ArrayMesh>());
 
+	// Meshers read channels directly, so encoded ones are decoded in a copy
+	Ref<VoxelBuffer> dense_voxels = voxels;
+	const int channels_mask = get_used_channels_mask();
+	for (unsigned int channel_index = 0; channel_index < VoxelBuffer::MAX_CHANNELS; ++channel_index) {
+		if ((channels_mask & (1 << channel_index)) == 0) {
+			continue;
+		}
+		const VoxelBuffer::Compression compression = voxels->get_channel_compression(channel_index);
+		if (compression == VoxelBuffer::COMPRESSION_PALETTE || compression == VoxelBuffer::COMPRESSION_RLE) {
+			if (dense_voxels == voxels) {
+				dense_voxels = voxels->duplicate(false);
+			}
+			dense_voxels->decompress_channel(channel_index);
+		}
+	}
+
 	Output output;
-	Input input = { **voxels, 0 };
+	Input input = { **dense_voxels, 0 };
 	build(output, input);
 
 	if (output.surfaces.empty()) {
@@ -42,6 +59,39 @@ void VoxelMesher::build(Output &output, const Input &input) {
 	ERR_PRINT("Not implemented");
 }
 
+bool VoxelMesher::build_from_neighborhood(Output &output, const VoxelBlockNeighborhood &voxels, int lod) {
+	const int channels_mask = get_used_channels_mask();
+	if (channels_mask == 0) {
+		return false;
+	}
+	for (unsigned int channel_index = 0; channel_index < VoxelBuffer::MAX_CHANNELS; ++channel_index) {
+		if ((channels_mask & (1 << channel_index)) == 0) {
+			continue;
+		}
+		if (!voxels.is_uniform(channel_index) ||
+				!is_uniform_empty(channel_index, voxels.get_voxel(0, 0, 0, channel_index))) {
+			return false;
+		}
+	}
+	// Nothing to mesh
+	return true;
+}
+
+bool VoxelMesher::is_block_empty(const VoxelBuffer &voxels) const {
+	const int used_channels_mask = get_used_channels_mask();
+	// Smooth meshing works on more neighbors, so checking a single block isn't enough to ignore it
+	if ((used_channels_mask & (1 << VoxelBuffer::CHANNEL_SDF)) != 0) {
+		return false;
+	}
+	// Only types are known to produce no geometry when they are air. Other channels, like colors, can't be judged.
+	if (used_channels_mask != (1 << VoxelBuffer::CHANNEL_TYPE)) {
+		return false;
+	}
+	RWLockRead lock(voxels.get_lock());
+	return voxels.is_uniform(VoxelBuffer::CHANNEL_TYPE) &&
+		   voxels.get_voxel(0, 0, 0, VoxelBuffer::CHANNEL_TYPE) == Voxel::AIR_ID;
+}
+
 unsigned int VoxelMesher::get_minimum_padding() const {
 	return _minimum_padding;
 }
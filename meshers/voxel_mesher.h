@@ -6,6 +6,7 @@
 #include <scene/resources/mesh.h>
 
 class VoxelBuffer;
+class VoxelBlockNeighborhood;
 
 class VoxelMesher : public Resource {
 	GDCLASS(VoxelMesher, Resource)
@@ -26,6 +27,23 @@ public:
 	// This can be called from multiple threads at once. Make sure member vars are protected or thread-local.
 	virtual void build(Output &output, const Input &voxels);
 
+	// Builds a mesh by reading voxels directly from a block and its neighbors, without copying them first.
+	// Returns false if the mesher can't do it, in which case `build` must be used with a padded copy.
+	// The default implementation only handles voxels which are all the same and produce no geometry,
+	// as told by `is_uniform_empty`.
+	// Like `build`, this can be called from multiple threads at once.
+	virtual bool build_from_neighborhood(Output &output, const VoxelBlockNeighborhood &voxels, int lod);
+
+	// Tells if voxels all having the given value in a channel produce no geometry.
+	// That is the case of smooth meshers, since surfaces only appear where values change.
+	// This can be called from multiple threads at once.
+	virtual bool is_uniform_empty(unsigned int channel_index, uint64_t value) const { return true; }
+
+	// Tells if a block can be skipped without meshing it, because looking at its voxels alone shows it would produce
+	// nothing. Terrains and the server use it to avoid sending blocks to meshing tasks.
+	// This can be called from multiple threads at once.
+	bool is_block_empty(const VoxelBuffer &voxels) const;
+
 	// Builds a mesh from the given voxels. This function is simplified to be used by the script API.
 	Ref<Mesh> build_mesh(Ref<VoxelBuffer> voxels, Array materials);
 
@@ -36,6 +36,7 @@
 #include "terrain/voxel_terrain.h"
 #include "terrain/voxel_viewer.h"
 #include "util/macros.h"
+#include "util/trace_recorder.h"
 #ifdef VOXEL_FAST_NOISE_2_SUPPORT
 #include "util/noise/fast_noise_2.h"
 #endif
@@ -158,6 +159,9 @@ void unregister_voxel_types() {
 	VoxelMemoryPool::destroy_singleton();
 	// TODO No remove?
 
+	// Threads using it are gone at this point
+	TraceRecorder::free_resources();
+
 #ifdef TOOLS_ENABLED
 	VoxelDebug::free_resources();
 
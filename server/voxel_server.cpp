@@ -1,9 +1,11 @@
 #include "voxel_server.h"
 #include "../constants/voxel_constants.h"
 #include "../meshers/transvoxel/voxel_mesher_transvoxel.h"
+#include "../storage/voxel_block_neighborhood.h"
 #include "../util/funcs.h"
 #include "../util/macros.h"
 #include "../util/profiling.h"
+#include "../util/trace_recorder.h"
 #include <core/os/memory.h>
 #include <scene/main/viewport.h>
 #include <thread>
@@ -48,27 +50,24 @@ void VoxelServer::destroy_singleton() {
 VoxelServer::VoxelServer() {
 	const unsigned int hw_threads_hint = std::thread::hardware_concurrency();
 	PRINT_VERBOSE(String("HW threads hint: {0}").format(varray(hw_threads_hint)));
-	// TODO Automatic thread assignment and project settings
+	// TODO Project settings
 
-	// Can't be more than 1 thread. File access with more threads isn't worth it.
-	_streaming_thread_pool.set_name("Voxel streaming");
-	_streaming_thread_pool.set_thread_count(1);
-	_streaming_thread_pool.set_priority_update_period(300);
-	_streaming_thread_pool.set_batch_count(16);
+	// All stages share the same threads, so that none of them sits idle while another has a backlog.
+	_general_thread_pool.set_name("Voxel general");
+	set_thread_count(0);
+	// Meshing works on visuals so it must have lower latency
+	_general_thread_pool.set_priority_update_period(64);
+	_general_thread_pool.set_batch_count(1);
 
-	_generation_thread_pool.set_name("Voxel generation");
-	_generation_thread_pool.set_thread_count(2);
-	_generation_thread_pool.set_priority_update_period(300);
-	_generation_thread_pool.set_batch_count(1);
+	// Can't be more than 1 thread. File access with more threads isn't worth it.
+	_general_thread_pool.set_stage_max_threads(STAGE_STREAMING, 1);
+	// Compression is not urgent, it must not take threads away from other stages
+	_general_thread_pool.set_stage_max_threads(STAGE_COMPRESSION, 1);
 
-	// This pool works on visuals so it must have lower latency
-	_meshing_thread_pool.set_name("Voxel meshing");
-	_meshing_thread_pool.set_thread_count(2);
-	_meshing_thread_pool.set_priority_update_period(64);
-	_meshing_thread_pool.set_batch_count(1);
+	_dropped_results.fill(0);
 
-	// Init world
-	_world.shared_priority_dependency = gd_make_shared<PriorityDependencyShared>();
+	// Volumes and viewers go there until they are assigned another world
+	_default_world_id = get_or_create_world(0);
 
 	PRINT_VERBOSE(String("Size of BlockDataRequest: {0}").format(varray((int)sizeof(BlockDataRequest))));
 	PRINT_VERBOSE(String("Size of BlockMeshRequest: {0}").format(varray((int)sizeof(BlockMeshRequest))));
@@ -84,88 +83,179 @@ VoxelServer::~VoxelServer() {
 }
 
 void VoxelServer::wait_and_clear_all_tasks(bool warn) {
-	_streaming_thread_pool.wait_for_all_tasks();
-	_generation_thread_pool.wait_for_all_tasks();
-
-	// Wait a second time because the generation pool can generate streaming requests
-	_streaming_thread_pool.wait_for_all_tasks();
+	_general_thread_pool.wait_for_all_tasks();
 
-	_meshing_thread_pool.wait_for_all_tasks();
+	// Wait a second time because generation tasks can generate streaming requests
+	_general_thread_pool.wait_for_all_tasks();
 
-	_streaming_thread_pool.dequeue_completed_tasks([warn](IVoxelTask *task) {
+	_general_thread_pool.dequeue_completed_tasks(STAGE_STREAMING, [warn](IVoxelTask *task) {
 		if (warn) {
 			WARN_PRINT("Streaming tasks remain on module cleanup, "
 					   "this could become a problem if they reference scripts");
 		}
-		memdelete(task);
+		BlockDataRequest *r = must_be_cast<BlockDataRequest>(task);
+		--r->task_counter->count;
+		memdelete(r);
 	});
 
-	_meshing_thread_pool.dequeue_completed_tasks([](IVoxelTask *task) {
-		memdelete(task);
+	_general_thread_pool.dequeue_completed_tasks(STAGE_MESHING, [](IVoxelTask *task) {
+		BlockMeshRequest *r = must_be_cast<BlockMeshRequest>(task);
+		--r->task_counter->count;
+		memdelete(r);
 	});
 
-	_generation_thread_pool.dequeue_completed_tasks([warn](IVoxelTask *task) {
+	_general_thread_pool.dequeue_completed_tasks(STAGE_GENERATION, [warn](IVoxelTask *task) {
 		if (warn) {
 			WARN_PRINT("Generator tasks remain on module cleanup, "
 					   "this could become a problem if they reference scripts");
 		}
-		memdelete(task);
+		BlockGenerateRequest *r = must_be_cast<BlockGenerateRequest>(task);
+		--r->task_counter->count;
+		memdelete(r);
+	});
+
+	_general_thread_pool.dequeue_completed_tasks(STAGE_COMPRESSION, [](IVoxelTask *task) {
+		BlockCompressRequest *r = must_be_cast<BlockCompressRequest>(task);
+		--r->task_counter->count;
+		memdelete(r);
 	});
 }
 
+namespace {
+// How far ahead in time viewers are assumed to go when prioritizing blocks
+const float VIEWER_PREDICTION_TIME = 0.5f;
+// Blocks straight behind a viewer are prioritized as if they were that many times further away (squared)
+const float VIEWER_BEHIND_DISTANCE_SQ_FACTOR = 4.f;
+const float MAX_PRIORITY_DISTANCE_SQ = 1000000.f;
+// Lower than any priority computed from viewers, so compression only runs when threads have nothing else to do
+const int COMPRESSION_TASK_PRIORITY = 0x7fffffff;
+} // namespace
+
+// Gets a squared distance from a viewer, modified so blocks in front of it and where it goes come first
+float VoxelServer::get_viewer_priority_distance_sq(
+		const ViewerPriorityInfo &viewer, Vector3 block_position, float distance_sq) {
+
+	float priority_distance_sq = viewer.predicted_position.distance_squared_to(block_position);
+
+	if (viewer.direction != Vector3() && distance_sq > 0.f) {
+		// 1 when the block is straight ahead, -1 when straight behind
+		const float cos_angle = viewer.direction.dot(block_position - viewer.position) / Math::sqrt(distance_sq);
+		priority_distance_sq *= Math::lerp(1.f, VIEWER_BEHIND_DISTANCE_SQ_FACTOR, 0.5f * (1.f - cos_angle));
+	}
+
+	return priority_distance_sq;
+}
+
 int VoxelServer::get_priority(const PriorityDependency &dep, uint8_t lod, float *out_closest_distance_sq) {
-	const std::vector<Vector3> &viewer_positions = dep.shared->viewers;
+	const PriorityDependencyShared &shared = *dep.shared;
+	const size_t viewer_count = min(static_cast<size_t>(shared.viewer_count), shared.viewers.size());
 	const Vector3 block_position = dep.world_position;
 
-	float closest_distance_sq = 99999.f;
-	if (viewer_positions.size() == 0) {
+	float closest_distance_sq;
+	float priority_distance_sq;
+
+	if (viewer_count == 0) {
 		// Assume origin
 		closest_distance_sq = block_position.length_squared();
+		priority_distance_sq = closest_distance_sq;
+
 	} else {
-		for (size_t i = 0; i < viewer_positions.size(); ++i) {
-			float d = viewer_positions[i].distance_squared_to(block_position);
-			if (d < closest_distance_sq) {
+		closest_distance_sq = MAX_PRIORITY_DISTANCE_SQ;
+		priority_distance_sq = MAX_PRIORITY_DISTANCE_SQ;
+
+		for (size_t i = 0; i < viewer_count; ++i) {
+			const ViewerPriorityInfo &viewer = shared.viewers[i];
+			const float d = viewer.position.distance_squared_to(block_position);
+			if (i == 0 || d < closest_distance_sq) {
 				closest_distance_sq = d;
 			}
+			const float pd = get_viewer_priority_distance_sq(viewer, block_position, d);
+			if (pd < priority_distance_sq) {
+				priority_distance_sq = pd;
+			}
 		}
 	}
 
-	int priority = static_cast<int>(closest_distance_sq);
+	int priority = static_cast<int>(min(priority_distance_sq, MAX_PRIORITY_DISTANCE_SQ));
 
+	// Distance is used for cancellation, it must not be affected by the direction of the viewer
 	if (out_closest_distance_sq != nullptr) {
 		*out_closest_distance_sq = closest_distance_sq;
 	}
 
 	// Higher lod indexes come first to allow the octree to subdivide.
-	// Then comes distance, which is modified by how much in view the block is
+	// Then comes distance, which is modified by how much in view the block is, and where viewers are going
 	priority += (VoxelConstants::MAX_LOD - lod) * 10000;
 
 	return priority;
 }
 
+uint32_t VoxelServer::get_or_create_world(ObjectID godot_world_id) {
+	const uint32_t *existing_id = _world_ids.getptr(godot_world_id);
+	if (existing_id != nullptr) {
+		return *existing_id;
+	}
+	World world;
+	world.godot_world_id = godot_world_id;
+	world.shared_priority_dependency = gd_make_shared<PriorityDependencyShared>();
+	world.shared_priority_dependency->viewers.resize(4);
+	world.task_counter = gd_make_shared<TaskCounter>();
+	const uint32_t world_id = _worlds.create(world);
+	_world_ids.set(godot_world_id, world_id);
+	PRINT_VERBOSE(String("Created voxel world for Godot world {0}").format(varray(godot_world_id)));
+	return world_id;
+}
+
+void VoxelServer::remove_world_if_unused(uint32_t world_id) {
+	if (world_id == _default_world_id) {
+		return;
+	}
+	const World &world = _worlds.get(world_id);
+	if (world.volume_count != 0 || world.viewer_count != 0) {
+		return;
+	}
+	// Tasks still in flight keep their own references to priority data and counters
+	_world_ids.erase(world.godot_world_id);
+	_worlds.destroy(world_id);
+}
+
 uint32_t VoxelServer::add_volume(ReceptionBuffers *buffers, VolumeType type) {
 	CRASH_COND(buffers == nullptr);
 	Volume volume;
 	volume.type = type;
 	volume.reception_buffers = buffers;
 	volume.meshing_dependency = gd_make_shared<MeshingDependency>();
-	return _world.volumes.create(volume);
+	volume.world_id = _default_world_id;
+	++_worlds.get(_default_world_id).volume_count;
+	return _volumes.create(volume);
+}
+
+void VoxelServer::set_volume_world(uint32_t volume_id, ObjectID godot_world_id) {
+	Volume &volume = _volumes.get(volume_id);
+	const uint32_t world_id = get_or_create_world(godot_world_id);
+	if (world_id == volume.world_id) {
+		return;
+	}
+	const uint32_t prev_world_id = volume.world_id;
+	--_worlds.get(prev_world_id).volume_count;
+	++_worlds.get(world_id).volume_count;
+	volume.world_id = world_id;
+	remove_world_if_unused(prev_world_id);
 }
 
 void VoxelServer::set_volume_transform(uint32_t volume_id, Transform t) {
-	Volume &volume = _world.volumes.get(volume_id);
+	Volume &volume = _volumes.get(volume_id);
 	volume.transform = t;
+	update_meshing_pipeline(volume);
 }
 
 void VoxelServer::set_volume_block_size(uint32_t volume_id, uint32_t block_size) {
-	Volume &volume = _world.volumes.get(volume_id);
+	Volume &volume = _volumes.get(volume_id);
 	volume.block_size = block_size;
+	update_meshing_pipeline(volume);
 }
 
-void VoxelServer::set_volume_stream(uint32_t volume_id, Ref<VoxelStream> stream) {
-	Volume &volume = _world.volumes.get(volume_id);
-	volume.stream = stream;
-
+void VoxelServer::create_stream_dependency(Volume &volume) {
 	// Commit a new dependency to process requests with
 	if (volume.stream_dependency != nullptr) {
 		volume.stream_dependency->valid = false;
@@ -174,39 +264,60 @@ void VoxelServer::set_volume_stream(uint32_t volume_id, Ref<VoxelStream> stream)
 	volume.stream_dependency = gd_make_shared<StreamingDependency>();
 	volume.stream_dependency->generator = volume.generator;
 	volume.stream_dependency->stream = volume.stream;
-}
 
-void VoxelServer::set_volume_generator(uint32_t volume_id, Ref<VoxelGenerator> generator) {
-	Volume &volume = _world.volumes.get(volume_id);
-	volume.generator = generator;
+	if (volume.type == VOLUME_SPARSE_GRID) {
+		// Blocks known by the previous pipeline won't be loaded anymore, so we start from an empty one
+		volume.stream_dependency->meshing_pipeline = gd_make_shared<MeshingPipeline>();
+		update_meshing_pipeline(volume);
+	}
+}
 
-	// Commit a new dependency to process requests with
-	if (volume.stream_dependency != nullptr) {
-		volume.stream_dependency->valid = false;
+void VoxelServer::update_meshing_pipeline(const Volume &volume) {
+	if (volume.stream_dependency == nullptr || volume.stream_dependency->meshing_pipeline == nullptr) {
+		return;
+	}
+	MeshingPipeline &pipeline = *volume.stream_dependency->meshing_pipeline;
+	MutexLock lock(pipeline.mutex);
+	if (pipeline.meshing_dependency != volume.meshing_dependency) {
+		// These were found with the previous mesher
+		pipeline.empty_blocks.clear();
 	}
+	pipeline.meshing_dependency = volume.meshing_dependency;
+	pipeline.transform = volume.transform;
+	pipeline.block_size = volume.block_size;
+}
 
-	volume.stream_dependency = gd_make_shared<StreamingDependency>();
-	volume.stream_dependency->generator = volume.generator;
-	volume.stream_dependency->stream = volume.stream;
+void VoxelServer::set_volume_stream(uint32_t volume_id, Ref<VoxelStream> stream) {
+	Volume &volume = _volumes.get(volume_id);
+	volume.stream = stream;
+	create_stream_dependency(volume);
+}
+
+void VoxelServer::set_volume_generator(uint32_t volume_id, Ref<VoxelGenerator> generator) {
+	Volume &volume = _volumes.get(volume_id);
+	volume.generator = generator;
+	create_stream_dependency(volume);
 }
 
 void VoxelServer::set_volume_mesher(uint32_t volume_id, Ref<VoxelMesher> mesher) {
-	Volume &volume = _world.volumes.get(volume_id);
+	Volume &volume = _volumes.get(volume_id);
 	volume.mesher = mesher;
 	volume.meshing_dependency = gd_make_shared<MeshingDependency>();
 	volume.meshing_dependency->mesher = volume.mesher;
+	update_meshing_pipeline(volume);
 }
 
 void VoxelServer::set_volume_octree_split_scale(uint32_t volume_id, float split_scale) {
-	Volume &volume = _world.volumes.get(volume_id);
+	Volume &volume = _volumes.get(volume_id);
 	volume.octree_split_scale = split_scale;
 }
 
 void VoxelServer::invalidate_volume_mesh_requests(uint32_t volume_id) {
-	Volume &volume = _world.volumes.get(volume_id);
+	Volume &volume = _volumes.get(volume_id);
 	volume.meshing_dependency->valid = false;
 	volume.meshing_dependency = gd_make_shared<MeshingDependency>();
 	volume.meshing_dependency->mesher = volume.mesher;
+	update_meshing_pipeline(volume);
 }
 
 static inline Vector3i get_block_center(Vector3i pos, int bs, int lod) {
@@ -218,7 +329,8 @@ void VoxelServer::init_priority_dependency(
 
 	const Vector3i voxel_pos = get_block_center(block_position, volume.block_size, lod);
 	const float block_radius = (volume.block_size << lod) / 2;
-	dep.shared = _world.shared_priority_dependency;
+	const World &world = _worlds.get(volume.world_id);
+	dep.shared = world.shared_priority_dependency;
 	dep.world_position = volume.transform.xform(voxel_pos.to_vec3());
 	const float transformed_block_radius =
 			volume.transform.basis.xform(Vector3(block_radius, block_radius, block_radius)).length();
@@ -227,7 +339,7 @@ void VoxelServer::init_priority_dependency(
 		case VOLUME_SPARSE_GRID:
 			// Distance beyond which no field of view can overlap the block
 			dep.drop_distance_squared =
-					squared(_world.shared_priority_dependency->highest_view_distance + transformed_block_radius);
+					squared(world.shared_priority_dependency->highest_view_distance + transformed_block_radius);
 			break;
 
 		case VOLUME_SPARSE_OCTREE:
@@ -243,8 +355,15 @@ void VoxelServer::init_priority_dependency(
 	}
 }
 
+void VoxelServer::enqueue_task(IVoxelTask *task, Stage stage, const std::shared_ptr<TaskCounter> &task_counter) {
+	// This can be called from another thread
+	CRASH_COND(task_counter == nullptr);
+	++task_counter->count;
+	_general_thread_pool.enqueue(task, stage);
+}
+
 void VoxelServer::request_block_mesh(uint32_t volume_id, BlockMeshInput &input) {
-	const Volume &volume = _world.volumes.get(volume_id);
+	const Volume &volume = _volumes.get(volume_id);
 	ERR_FAIL_COND(volume.meshing_dependency == nullptr);
 
 	BlockMeshRequest *r = memnew(BlockMeshRequest);
@@ -253,15 +372,181 @@ void VoxelServer::request_block_mesh(uint32_t volume_id, BlockMeshInput &input)
 	r->position = input.position;
 	r->lod = input.lod;
 	r->meshing_dependency = volume.meshing_dependency;
+	r->task_counter = _worlds.get(volume.world_id).task_counter;
 
 	init_priority_dependency(r->priority_dependency, input.position, input.lod, volume);
 
 	// We'll allocate this quite often. If it becomes a problem, it should be easy to pool.
-	_meshing_thread_pool.enqueue(r);
+	enqueue_task(r, STAGE_MESHING, r->task_counter);
+}
+
+void VoxelServer::remove_volume_pipeline_block(uint32_t volume_id, Vector3i block_pos) {
+	const Volume &volume = _volumes.get(volume_id);
+	if (volume.stream_dependency == nullptr || volume.stream_dependency->meshing_pipeline == nullptr) {
+		return;
+	}
+	MeshingPipeline &pipeline = *volume.stream_dependency->meshing_pipeline;
+	MutexLock lock(pipeline.mutex);
+	pipeline.blocks.erase(block_pos);
+}
+
+// Gets voxels of a block and its neighbors, returns false if any of them isn't loaded.
+// The pipeline must be locked.
+bool VoxelServer::get_pipeline_neighborhood(const MeshingPipeline &pipeline, Vector3i block_pos,
+		FixedArray<Ref<VoxelBuffer>, Cube::MOORE_AREA_3D_COUNT> &out_blocks) {
+	for (unsigned int i = 0; i < Cube::MOORE_AREA_3D_COUNT; ++i) {
+		const MeshingPipeline::Block *b = pipeline.blocks.getptr(block_pos + Cube::g_ordered_moore_area_3d[i]);
+		if (b == nullptr || b->voxels.is_null()) {
+			return false;
+		}
+		out_blocks[i] = b->voxels;
+	}
+	return true;
+}
+
+bool VoxelServer::set_volume_pipeline_block_mesh_wanted(uint32_t volume_id, Vector3i block_pos, bool wanted) {
+	const Volume &volume = _volumes.get(volume_id);
+	if (volume.stream_dependency == nullptr || volume.stream_dependency->meshing_pipeline == nullptr) {
+		return false;
+	}
+	MeshingPipeline &pipeline = *volume.stream_dependency->meshing_pipeline;
+	MutexLock lock(pipeline.mutex);
+
+	MeshingPipeline::Block *block = pipeline.blocks.getptr(block_pos);
+
+	if (!wanted) {
+		if (block != nullptr) {
+			if (block->voxels.is_null()) {
+				// Was only there to remember the block is wanted
+				pipeline.blocks.erase(block_pos);
+			} else {
+				block->mesh_wanted = false;
+			}
+		}
+		return false;
+	}
+
+	if (block == nullptr) {
+		// Not loaded yet, it will be meshed once it is surrounded
+		MeshingPipeline::Block new_block;
+		new_block.mesh_wanted = true;
+		pipeline.blocks.set(block_pos, new_block);
+		return true;
+	}
+
+	block->mesh_wanted = true;
+
+	if (block->mesh_scheduled) {
+		// The pipeline is done with that block, further updates are up to the volume
+		return false;
+	}
+
+	FixedArray<Ref<VoxelBuffer>, Cube::MOORE_AREA_3D_COUNT> blocks;
+	if (block->voxels.is_null() || !get_pipeline_neighborhood(pipeline, block_pos, blocks)) {
+		// It will be meshed once it is surrounded
+		return true;
+	}
+
+	if (volume.meshing_dependency == nullptr || volume.meshing_dependency->mesher.is_null()) {
+		return false;
+	}
+
+	// The block got surrounded while nothing wanted its mesh, so the pipeline skipped it. Schedule it now.
+	block->mesh_scheduled = true;
+
+	if (volume.meshing_dependency->mesher->is_block_empty(**block->voxels)) {
+		// Let the volume find it has no mesh
+		return false;
+	}
+
+	BlockMeshRequest *r = memnew(BlockMeshRequest);
+	r->volume_id = volume_id;
+	r->blocks = blocks;
+	r->position = block_pos;
+	r->lod = 0;
+	r->meshing_dependency = volume.meshing_dependency;
+	r->task_counter = _worlds.get(volume.world_id).task_counter;
+
+	init_priority_dependency(r->priority_dependency, block_pos, 0, volume);
+
+	enqueue_task(r, STAGE_MESHING, r->task_counter);
+	return true;
+}
+
+void VoxelServer::on_pipeline_block_loaded(MeshingPipeline &pipeline, uint32_t volume_id, Vector3i block_pos,
+		Ref<VoxelBuffer> voxels, const PriorityDependency &priority_dependency,
+		const std::shared_ptr<TaskCounter> &task_counter) {
+	// This is called from block processing threads
+
+	VOXEL_PROFILE_SCOPE();
+	CRASH_COND(voxels.is_null());
+
+	std::vector<IVoxelTask *> mesh_requests;
+	{
+		MutexLock lock(pipeline.mutex);
+
+		MeshingPipeline::Block *block = pipeline.blocks.getptr(block_pos);
+		if (block == nullptr) {
+			MeshingPipeline::Block new_block;
+			new_block.voxels = voxels;
+			pipeline.blocks.set(block_pos, new_block);
+		} else {
+			// The volume may have told us it wants that block meshed before it got loaded
+			block->voxels = voxels;
+		}
+
+		if (pipeline.meshing_dependency == nullptr || pipeline.meshing_dependency->mesher.is_null()) {
+			// Meshing is off, the volume will request meshes itself when it gets a mesher
+			return;
+		}
+		const VoxelMesher &mesher = **pipeline.meshing_dependency->mesher;
+
+		// All neighbors have to be checked. If they are now surrounded, they can be meshed
+		for (unsigned int i = 0; i < Cube::MOORE_AREA_3D_COUNT; ++i) {
+			const Vector3i npos = block_pos + Cube::g_ordered_moore_area_3d[i];
+			MeshingPipeline::Block *nblock = pipeline.blocks.getptr(npos);
+			// Blocks nothing wants to see are not meshed. If that changes, the volume tells us so.
+			if (nblock == nullptr || nblock->voxels.is_null() || nblock->mesh_scheduled || !nblock->mesh_wanted) {
+				continue;
+			}
+
+			FixedArray<Ref<VoxelBuffer>, Cube::MOORE_AREA_3D_COUNT> blocks;
+			if (!get_pipeline_neighborhood(pipeline, npos, blocks)) {
+				continue;
+			}
+
+			nblock->mesh_scheduled = true;
+
+			if (mesher.is_block_empty(**nblock->voxels)) {
+				pipeline.empty_blocks.push_back(npos);
+				continue;
+			}
+
+			BlockMeshRequest *r = memnew(BlockMeshRequest);
+			r->volume_id = volume_id;
+			r->blocks = blocks;
+			r->position = npos;
+			r->lod = 0;
+			r->meshing_dependency = pipeline.meshing_dependency;
+			r->task_counter = task_counter;
+			// Neighbors have the same size and LOD, so only their position differs
+			r->priority_dependency = priority_dependency;
+			const Vector3i voxel_pos = get_block_center(npos, pipeline.block_size, 0);
+			r->priority_dependency.world_position = pipeline.transform.xform(voxel_pos.to_vec3());
+
+			mesh_requests.push_back(r);
+		}
+	}
+
+	if (mesh_requests.size() > 0) {
+		task_counter->count += mesh_requests.size();
+		_general_thread_pool.enqueue(ArraySlice<IVoxelTask *>(mesh_requests, 0, mesh_requests.size()),
+				STAGE_MESHING);
+	}
 }
 
 void VoxelServer::request_block_load(uint32_t volume_id, Vector3i block_pos, int lod, bool request_instances) {
-	const Volume &volume = _world.volumes.get(volume_id);
+	const Volume &volume = _volumes.get(volume_id);
 	ERR_FAIL_COND(volume.stream_dependency == nullptr);
 
 	if (volume.stream_dependency->stream.is_valid()) {
@@ -273,10 +558,11 @@ void VoxelServer::request_block_load(uint32_t volume_id, Vector3i block_pos, int
 		r->block_size = volume.block_size;
 		r->stream_dependency = volume.stream_dependency;
 		r->request_instances = request_instances;
+		r->task_counter = _worlds.get(volume.world_id).task_counter;
 
 		init_priority_dependency(r->priority_dependency, block_pos, lod, volume);
 
-		_streaming_thread_pool.enqueue(r);
+		enqueue_task(r, STAGE_STREAMING, r->task_counter);
 
 	} else {
 		// Directly generate the block without checking the stream
@@ -288,16 +574,17 @@ void VoxelServer::request_block_load(uint32_t volume_id, Vector3i block_pos, int
 		r.lod = lod;
 		r.block_size = volume.block_size;
 		r.stream_dependency = volume.stream_dependency;
+		r.task_counter = _worlds.get(volume.world_id).task_counter;
 
 		init_priority_dependency(r.priority_dependency, block_pos, lod, volume);
 
 		BlockGenerateRequest *rp = memnew(BlockGenerateRequest(r));
-		_generation_thread_pool.enqueue(rp);
+		enqueue_task(rp, STAGE_GENERATION, rp->task_counter);
 	}
 }
 
 void VoxelServer::request_voxel_block_save(uint32_t volume_id, Ref<VoxelBuffer> voxels, Vector3i block_pos, int lod) {
-	const Volume &volume = _world.volumes.get(volume_id);
+	const Volume &volume = _volumes.get(volume_id);
 	ERR_FAIL_COND(volume.stream.is_null());
 	CRASH_COND(volume.stream_dependency == nullptr);
 
@@ -311,16 +598,28 @@ void VoxelServer::request_voxel_block_save(uint32_t volume_id, Ref<VoxelBuffer>
 	r->stream_dependency = volume.stream_dependency;
 	r->request_instances = false;
 	r->request_voxels = true;
+	r->task_counter = _worlds.get(volume.world_id).task_counter;
 
 	// No priority data, saving doesnt need sorting
 
-	_streaming_thread_pool.enqueue(r);
+	enqueue_task(r, STAGE_STREAMING, r->task_counter);
+}
+
+void VoxelServer::request_block_compression(uint32_t volume_id, Ref<VoxelBuffer> voxels) {
+	const Volume &volume = _volumes.get(volume_id);
+	ERR_FAIL_COND(voxels.is_null());
+
+	BlockCompressRequest *r = memnew(BlockCompressRequest);
+	r->voxels = voxels;
+	r->task_counter = _worlds.get(volume.world_id).task_counter;
+
+	enqueue_task(r, STAGE_COMPRESSION, r->task_counter);
 }
 
 void VoxelServer::request_instance_block_save(uint32_t volume_id, std::unique_ptr<VoxelInstanceBlockData> instances,
 		Vector3i block_pos, int lod) {
 
-	const Volume &volume = _world.volumes.get(volume_id);
+	const Volume &volume = _volumes.get(volume_id);
 	ERR_FAIL_COND(volume.stream.is_null());
 	CRASH_COND(volume.stream_dependency == nullptr);
 
@@ -334,10 +633,11 @@ void VoxelServer::request_instance_block_save(uint32_t volume_id, std::unique_pt
 	r->stream_dependency = volume.stream_dependency;
 	r->request_instances = true;
 	r->request_voxels = false;
+	r->task_counter = _worlds.get(volume.world_id).task_counter;
 
 	// No priority data, saving doesnt need sorting
 
-	_streaming_thread_pool.enqueue(r);
+	enqueue_task(r, STAGE_STREAMING, r->task_counter);
 }
 
 void VoxelServer::request_block_generate_from_data_request(BlockDataRequest *src) {
@@ -351,9 +651,10 @@ void VoxelServer::request_block_generate_from_data_request(BlockDataRequest *src
 	r.block_size = src->block_size;
 	r.stream_dependency = src->stream_dependency;
 	r.priority_dependency = src->priority_dependency;
+	r.task_counter = src->task_counter;
 
 	BlockGenerateRequest *rp = memnew(BlockGenerateRequest(r));
-	_generation_thread_pool.enqueue(rp);
+	enqueue_task(rp, STAGE_GENERATION, rp->task_counter);
 }
 
 void VoxelServer::request_block_save_from_generate_request(BlockGenerateRequest *src) {
@@ -372,28 +673,33 @@ void VoxelServer::request_block_save_from_generate_request(BlockGenerateRequest
 	r->type = BlockDataRequest::TYPE_SAVE;
 	r->block_size = src->block_size;
 	r->stream_dependency = src->stream_dependency;
+	r->task_counter = src->task_counter;
 
 	// No instances, generators are not designed to produce them at this stage yet.
 	// No priority data, saving doesnt need sorting
 
-	_streaming_thread_pool.enqueue(r);
+	enqueue_task(r, STAGE_STREAMING, r->task_counter);
 }
 
 void VoxelServer::remove_volume(uint32_t volume_id) {
+	uint32_t world_id;
 	{
-		Volume &volume = _world.volumes.get(volume_id);
+		Volume &volume = _volumes.get(volume_id);
 		if (volume.stream_dependency != nullptr) {
 			volume.stream_dependency->valid = false;
 		}
 		if (volume.meshing_dependency != nullptr) {
 			volume.meshing_dependency->valid = false;
 		}
+		world_id = volume.world_id;
 	}
 
-	_world.volumes.destroy(volume_id);
+	_volumes.destroy(volume_id);
+	--_worlds.get(world_id).volume_count;
+	remove_world_if_unused(world_id);
 	// TODO How to cancel meshing tasks?
 
-	if (_world.volumes.count() == 0) {
+	if (_volumes.count() == 0) {
 		// To workaround https://github.com/Zylann/godot_voxel/issues/189
 		// When the last remaining volume got destroyed (as in game exit)
 		wait_and_clear_all_tasks(false);
@@ -401,50 +707,78 @@ void VoxelServer::remove_volume(uint32_t volume_id) {
 }
 
 uint32_t VoxelServer::add_viewer() {
-	return _world.viewers.create(Viewer());
+	Viewer viewer;
+	viewer.world_id = _default_world_id;
+	++_worlds.get(_default_world_id).viewer_count;
+	return _viewers.create(viewer);
 }
 
 void VoxelServer::remove_viewer(uint32_t viewer_id) {
-	_world.viewers.destroy(viewer_id);
+	const uint32_t world_id = _viewers.get(viewer_id).world_id;
+	_viewers.destroy(viewer_id);
+	--_worlds.get(world_id).viewer_count;
+	remove_world_if_unused(world_id);
+}
+
+void VoxelServer::set_viewer_world(uint32_t viewer_id, ObjectID godot_world_id) {
+	Viewer &viewer = _viewers.get(viewer_id);
+	const uint32_t world_id = get_or_create_world(godot_world_id);
+	if (world_id == viewer.world_id) {
+		return;
+	}
+	const uint32_t prev_world_id = viewer.world_id;
+	--_worlds.get(prev_world_id).viewer_count;
+	++_worlds.get(world_id).viewer_count;
+	viewer.world_id = world_id;
+	remove_world_if_unused(prev_world_id);
 }
 
 void VoxelServer::set_viewer_position(uint32_t viewer_id, Vector3 position) {
-	Viewer &viewer = _world.viewers.get(viewer_id);
+	Viewer &viewer = _viewers.get(viewer_id);
 	viewer.world_position = position;
 }
 
+void VoxelServer::set_viewer_direction(uint32_t viewer_id, Vector3 direction) {
+	Viewer &viewer = _viewers.get(viewer_id);
+	viewer.view_direction = direction == Vector3() ? direction : direction.normalized();
+}
+
 void VoxelServer::set_viewer_distance(uint32_t viewer_id, unsigned int distance) {
-	Viewer &viewer = _world.viewers.get(viewer_id);
+	Viewer &viewer = _viewers.get(viewer_id);
 	viewer.view_distance = distance;
 }
 
 unsigned int VoxelServer::get_viewer_distance(uint32_t viewer_id) const {
-	const Viewer &viewer = _world.viewers.get(viewer_id);
+	const Viewer &viewer = _viewers.get(viewer_id);
 	return viewer.view_distance;
 }
 
 void VoxelServer::set_viewer_requires_visuals(uint32_t viewer_id, bool enabled) {
-	Viewer &viewer = _world.viewers.get(viewer_id);
+	Viewer &viewer = _viewers.get(viewer_id);
 	viewer.require_visuals = enabled;
 }
 
 bool VoxelServer::is_viewer_requiring_visuals(uint32_t viewer_id) const {
-	const Viewer &viewer = _world.viewers.get(viewer_id);
+	const Viewer &viewer = _viewers.get(viewer_id);
 	return viewer.require_visuals;
 }
 
 void VoxelServer::set_viewer_requires_collisions(uint32_t viewer_id, bool enabled) {
-	Viewer &viewer = _world.viewers.get(viewer_id);
+	Viewer &viewer = _viewers.get(viewer_id);
 	viewer.require_collisions = enabled;
 }
 
 bool VoxelServer::is_viewer_requiring_collisions(uint32_t viewer_id) const {
-	const Viewer &viewer = _world.viewers.get(viewer_id);
+	const Viewer &viewer = _viewers.get(viewer_id);
 	return viewer.require_collisions;
 }
 
 bool VoxelServer::viewer_exists(uint32_t viewer_id) const {
-	return _world.viewers.is_valid(viewer_id);
+	return _viewers.is_valid(viewer_id);
+}
+
+bool VoxelServer::is_viewer_in_volume_world(uint32_t viewer_id, uint32_t volume_id) const {
+	return _viewers.get(viewer_id).world_id == _volumes.get(volume_id).world_id;
 }
 
 void VoxelServer::process() {
@@ -454,9 +788,17 @@ void VoxelServer::process() {
 	VOXEL_PROFILE_SCOPE();
 
 	// Receive data updates
-	_streaming_thread_pool.dequeue_completed_tasks([this](IVoxelTask *task) {
+	_general_thread_pool.dequeue_completed_tasks(STAGE_STREAMING, [this](IVoxelTask *task) {
 		BlockDataRequest *r = must_be_cast<BlockDataRequest>(task);
-		Volume *volume = _world.volumes.try_get(r->volume_id);
+		--r->task_counter->count;
+		if (r->has_run) {
+			if (r->type == BlockDataRequest::TYPE_LOAD) {
+				++_processed_blocks.loaded;
+			} else if (r->type == BlockDataRequest::TYPE_SAVE) {
+				++_processed_blocks.saved;
+			}
+		}
+		Volume *volume = _volumes.try_get(r->volume_id);
 
 		if (volume != nullptr) {
 			// TODO Comparing pointer may not be guaranteed
@@ -485,20 +827,28 @@ void VoxelServer::process() {
 				}
 
 				volume->reception_buffers->data_output.push_back(std::move(o));
+
+			} else if (r->type != BlockDataRequest::TYPE_FALLBACK_ON_GENERATOR) {
+				++_dropped_results[STAGE_STREAMING];
 			}
 
 		} else {
 			// This can happen if the user removes the volume while requests are still about to return
 			PRINT_VERBOSE("Stream data request response came back but volume wasn't found");
+			++_dropped_results[STAGE_STREAMING];
 		}
 
 		memdelete(r);
 	});
 
 	// Receive generation updates
-	_generation_thread_pool.dequeue_completed_tasks([this](IVoxelTask *task) {
+	_general_thread_pool.dequeue_completed_tasks(STAGE_GENERATION, [this](IVoxelTask *task) {
 		BlockGenerateRequest *r = must_be_cast<BlockGenerateRequest>(task);
-		Volume *volume = _world.volumes.try_get(r->volume_id);
+		--r->task_counter->count;
+		if (r->has_run) {
+			++_processed_blocks.generated;
+		}
+		Volume *volume = _volumes.try_get(r->volume_id);
 
 		if (volume != nullptr) {
 			// TODO Comparing pointer may not be guaranteed
@@ -512,20 +862,28 @@ void VoxelServer::process() {
 				o.dropped = !r->has_run;
 				o.type = BlockDataOutput::TYPE_LOAD;
 				volume->reception_buffers->data_output.push_back(std::move(o));
+
+			} else {
+				++_dropped_results[STAGE_GENERATION];
 			}
 
 		} else {
 			// This can happen if the user removes the volume while requests are still about to return
 			PRINT_VERBOSE("Gemerated data request response came back but volume wasn't found");
+			++_dropped_results[STAGE_GENERATION];
 		}
 
 		memdelete(r);
 	});
 
 	// Receive mesh updates
-	_meshing_thread_pool.dequeue_completed_tasks([this](IVoxelTask *task) {
+	_general_thread_pool.dequeue_completed_tasks(STAGE_MESHING, [this](IVoxelTask *task) {
 		BlockMeshRequest *r = must_be_cast<BlockMeshRequest>(task);
-		Volume *volume = _world.volumes.try_get(r->volume_id);
+		--r->task_counter->count;
+		if (r->has_run) {
+			++_processed_blocks.meshed;
+		}
+		Volume *volume = _volumes.try_get(r->volume_id);
 
 		if (volume != nullptr) {
 			// TODO Comparing pointer may not be guaranteed
@@ -547,38 +905,213 @@ void VoxelServer::process() {
 				o.surfaces = r->surfaces_output;
 
 				volume->reception_buffers->mesh_output.push_back(o);
+
+			} else {
+				++_dropped_results[STAGE_MESHING];
 			}
 
 		} else {
 			// This can happen if the user removes the volume while requests are still about to return
 			PRINT_VERBOSE("Mesh request response came back but volume wasn't found");
+			++_dropped_results[STAGE_MESHING];
 		}
 
 		memdelete(r);
 	});
 
-	// Update viewer dependencies
-	{
-		const size_t viewer_count = _world.viewers.count();
-		if (_world.shared_priority_dependency->viewers.size() != viewer_count) {
-			// TODO We can avoid the invalidation by using an atomic size or memory barrier?
-			_world.shared_priority_dependency = gd_make_shared<PriorityDependencyShared>();
-			_world.shared_priority_dependency->viewers.resize(viewer_count);
-		}
-		size_t i = 0;
-		unsigned int max_distance = 0;
-		_world.viewers.for_each([&i, &max_distance, this](Viewer &viewer) {
-			_world.shared_priority_dependency->viewers[i] = viewer.world_position;
-			if (viewer.view_distance > max_distance) {
-				max_distance = viewer.view_distance;
-			}
-			++i;
-		});
-		// Cancel distance is increased because of two reasons:
-		// - Some volumes use a cubic area which has higher distances on their corners
-		// - Hysteresis is needed to reduce ping-pong
-		_world.shared_priority_dependency->highest_view_distance = max_distance * 2;
+	// Tell volumes about blocks their meshing pipeline skipped, so they don't keep waiting for a mesh
+	_volumes.for_each([](Volume &volume) {
+		if (volume.stream_dependency == nullptr || volume.stream_dependency->meshing_pipeline == nullptr) {
+			return;
+		}
+		MeshingPipeline &pipeline = *volume.stream_dependency->meshing_pipeline;
+		std::vector<Vector3i> empty_blocks;
+		{
+			MutexLock lock(pipeline.mutex);
+			empty_blocks.swap(pipeline.empty_blocks);
+		}
+		for (size_t i = 0; i < empty_blocks.size(); ++i) {
+			BlockMeshOutput o;
+			o.type = BlockMeshOutput::TYPE_EMPTY;
+			o.position = empty_blocks[i];
+			o.lod = 0;
+			volume.reception_buffers->mesh_output.push_back(o);
+		}
+	});
+
+	_general_thread_pool.dequeue_completed_tasks(STAGE_COMPRESSION, [this](IVoxelTask *task) {
+		BlockCompressRequest *r = must_be_cast<BlockCompressRequest>(task);
+		--r->task_counter->count;
+		if (r->has_run) {
+			++_processed_blocks.compressed;
+		}
+		memdelete(r);
+	});
+
+	update_viewer_priority_infos();
+
+	update_stage_partitioning();
+
+	const uint64_t now = OS::get_singleton()->get_ticks_usec();
+	if (now - _last_memory_pool_trim_time_usec > VoxelConstants::MEMORY_POOL_TRIM_INTERVAL_USEC) {
+		VoxelMemoryPool::get_singleton()->trim();
+		_last_memory_pool_trim_time_usec = now;
+	}
+}
+
+void VoxelServer::set_main_thread_time_budget_usec(unsigned int usec) {
+	// Zero would prevent any result from being applied
+	ERR_FAIL_COND(usec == 0);
+	_main_thread_time_budget_usec = usec;
+}
+
+unsigned int VoxelServer::get_main_thread_time_budget_usec() const {
+	return _main_thread_time_budget_usec;
+}
+
+void VoxelServer::record_main_thread_apply_time(MainThreadApplyType type, uint64_t usec) {
+	ERR_FAIL_INDEX(type, APPLY_TYPE_COUNT);
+	_main_thread_apply_times[type].record(usec);
+}
+
+void VoxelServer::set_thread_count(unsigned int count) {
+	if (count == 0) {
+		const unsigned int hw_threads_hint = std::thread::hardware_concurrency();
+		// Leave one core for the main thread
+		count = hw_threads_hint != 0 ? MAX(2, hw_threads_hint - 1) : 4;
+	}
+	if (count == _general_thread_pool.get_thread_count()) {
+		return;
+	}
+	PRINT_VERBOSE(String("Setting voxel thread count to {0}").format(varray(count)));
+	// Pending tasks are kept
+	_general_thread_pool.set_thread_count(count);
+	update_stage_partitioning();
+}
+
+unsigned int VoxelServer::get_thread_count() const {
+	return _general_thread_pool.get_thread_count();
+}
+
+void VoxelServer::set_memory_pool_max_pooled_bytes(int64_t bytes) {
+	VoxelMemoryPool::get_singleton()->set_max_pooled_bytes(bytes);
+}
+
+int64_t VoxelServer::get_memory_pool_max_pooled_bytes() const {
+	return VoxelMemoryPool::get_singleton()->get_max_pooled_bytes();
+}
+
+void VoxelServer::set_voxel_memory_budget_bytes(int64_t bytes) {
+	ERR_FAIL_COND(bytes < 0);
+	_voxel_memory_budget_bytes = bytes;
+}
+
+int64_t VoxelServer::get_voxel_memory_budget_bytes() const {
+	return _voxel_memory_budget_bytes;
+}
+
+bool VoxelServer::is_voxel_memory_over_budget() const {
+	if (_voxel_memory_budget_bytes == 0) {
+		return false;
 	}
+	return VoxelMemoryPool::get_singleton()->get_used_bytes() > _voxel_memory_budget_bytes;
+}
+
+void VoxelServer::update_viewer_priority_infos() {
+	VOXEL_PROFILE_SCOPE();
+
+	const uint64_t now = OS::get_singleton()->get_ticks_usec();
+	const float delta = _last_process_time_usec != 0 ? (now - _last_process_time_usec) / 1000000.f : 0.f;
+	_last_process_time_usec = now;
+
+	_viewers.for_each([delta](Viewer &viewer) {
+		if (viewer.has_prev_world_position && delta > 0.f) {
+			const Vector3 instant_velocity = (viewer.world_position - viewer.prev_world_position) / delta;
+			// Smoothed, because positions don't necessarily change every frame
+			viewer.velocity = viewer.velocity.linear_interpolate(instant_velocity, 0.5f);
+		}
+		viewer.prev_world_position = viewer.world_position;
+		viewer.has_prev_world_position = true;
+	});
+
+	// Each world has its own priority data, so viewers of one world don't affect tasks of another
+	_worlds.for_each_with_id([this](World &world, uint32_t world_id) {
+		update_world_priority_infos(world_id, world);
+	});
+}
+
+void VoxelServer::update_world_priority_infos(uint32_t world_id, World &world) {
+	const size_t viewer_count = world.viewer_count;
+	if (world.shared_priority_dependency->viewers.size() < viewer_count) {
+		// Tasks already queued keep the previous instance, which won't be updated anymore.
+		// Leave some room so it doesn't happen often.
+		world.shared_priority_dependency = gd_make_shared<PriorityDependencyShared>();
+		world.shared_priority_dependency->viewers.resize(viewer_count * 2);
+	}
+
+	PriorityDependencyShared &shared = *world.shared_priority_dependency;
+	size_t i = 0;
+	unsigned int max_distance = 0;
+
+	_viewers.for_each([world_id, &i, &max_distance, &shared](const Viewer &viewer) {
+		if (viewer.world_id != world_id) {
+			return;
+		}
+
+		// Don't look too far ahead, teleports would make us prioritize blocks that are not needed
+		Vector3 prediction = viewer.velocity * VIEWER_PREDICTION_TIME;
+		const float max_prediction_distance = 0.5f * viewer.view_distance;
+		if (prediction.length_squared() > squared(max_prediction_distance)) {
+			prediction = prediction.normalized() * max_prediction_distance;
+		}
+
+		ViewerPriorityInfo &info = shared.viewers[i];
+		info.position = viewer.world_position;
+		info.direction = viewer.view_direction;
+		info.predicted_position = viewer.world_position + prediction;
+
+		if (viewer.view_distance > max_distance) {
+			max_distance = viewer.view_distance;
+		}
+		++i;
+	});
+
+	CRASH_COND(i != viewer_count);
+	shared.viewer_count = viewer_count;
+
+	// Cancel distance is increased because of two reasons:
+	// - Some volumes use a cubic area which has higher distances on their corners
+	// - Hysteresis is needed to reduce ping-pong
+	shared.highest_view_distance = max_distance * 2;
+}
+
+void VoxelServer::update_stage_partitioning() {
+	// Threads are shared by all stages, but we don't want one kind of work to starve the others.
+	// So the amount of threads each stage can use is adjusted based on how much work is pending in each of them.
+	const unsigned int thread_count = _general_thread_pool.get_thread_count();
+	const unsigned int streaming_tasks = _general_thread_pool.get_stage_remaining_tasks(STAGE_STREAMING);
+	const unsigned int generation_tasks = _general_thread_pool.get_stage_remaining_tasks(STAGE_GENERATION);
+	const unsigned int meshing_tasks = _general_thread_pool.get_stage_remaining_tasks(STAGE_MESHING);
+
+	// Streaming is limited to one thread, which we reserve only if there is work for it
+	unsigned int available_threads = thread_count;
+	if (streaming_tasks > 0 && available_threads > 1) {
+		--available_threads;
+	}
+
+	unsigned int generation_max_threads = available_threads;
+	unsigned int meshing_max_threads = available_threads;
+
+	if (generation_tasks > 0 && meshing_tasks > 0) {
+		// Share threads proportionally to the backlog of each stage, with at least one thread each
+		const float generation_ratio = static_cast<float>(generation_tasks) / (generation_tasks + meshing_tasks);
+		generation_max_threads = static_cast<unsigned int>(Math::round(available_threads * generation_ratio));
+		generation_max_threads = CLAMP(generation_max_threads, 1u, available_threads);
+		meshing_max_threads = MAX(1u, available_threads - generation_max_threads);
+	}
+
+	_general_thread_pool.set_stage_max_threads(STAGE_GENERATION, generation_max_threads);
+	_general_thread_pool.set_stage_max_threads(STAGE_MESHING, meshing_max_threads);
 }
 
 static unsigned int debug_get_active_thread_count(const VoxelThreadPool &pool) {
@@ -600,11 +1133,47 @@ static VoxelServer::Stats::ThreadPoolStats debug_get_pool_stats(const VoxelThrea
 	return d;
 }
 
+static VoxelServer::Stats::ThreadPoolStats debug_get_stage_stats(const VoxelThreadPool &pool, uint8_t stage) {
+	VoxelServer::Stats::ThreadPoolStats d;
+	d.tasks = pool.get_stage_remaining_tasks(stage);
+	d.active_threads = pool.get_stage_active_threads(stage);
+	// This is the amount of threads the stage is currently allowed to use
+	d.thread_count = MIN(pool.get_stage_max_threads(stage), pool.get_thread_count());
+	return d;
+}
+
+VoxelServer::Stats::TaskStats VoxelServer::get_task_stats(Stage stage) const {
+	Stats::TaskStats s;
+	s.queue_time = _general_thread_pool.get_stage_queue_time(stage).get_summary();
+	s.run_time = _general_thread_pool.get_stage_run_time(stage).get_summary();
+	s.cancelled = _general_thread_pool.get_stage_cancelled_tasks(stage);
+	s.dropped = _dropped_results[stage];
+	return s;
+}
+
 VoxelServer::Stats VoxelServer::get_stats() const {
 	Stats s;
-	s.streaming = debug_get_pool_stats(_streaming_thread_pool);
-	s.generation = debug_get_pool_stats(_generation_thread_pool);
-	s.meshing = debug_get_pool_stats(_meshing_thread_pool);
+	s.general = debug_get_pool_stats(_general_thread_pool);
+	s.streaming = debug_get_stage_stats(_general_thread_pool, STAGE_STREAMING);
+	s.generation = debug_get_stage_stats(_general_thread_pool, STAGE_GENERATION);
+	s.meshing = debug_get_stage_stats(_general_thread_pool, STAGE_MESHING);
+	s.compression = debug_get_stage_stats(_general_thread_pool, STAGE_COMPRESSION);
+	_worlds.for_each([&s](const World &world) {
+		Stats::WorldStats ws;
+		ws.volumes = world.volume_count;
+		ws.viewers = world.viewer_count;
+		ws.tasks = world.task_counter->count;
+		s.worlds.push_back(ws);
+	});
+	s.processed_blocks = _processed_blocks;
+	s.streaming_tasks = get_task_stats(STAGE_STREAMING);
+	s.generation_tasks = get_task_stats(STAGE_GENERATION);
+	s.meshing_tasks = get_task_stats(STAGE_MESHING);
+	s.compression_tasks = get_task_stats(STAGE_COMPRESSION);
+	s.stolen_tasks = _general_thread_pool.get_stolen_tasks();
+	s.data_apply_time = _main_thread_apply_times[APPLY_BLOCK_DATA].get_summary();
+	s.mesh_apply_time = _main_thread_apply_times[APPLY_BLOCK_MESH].get_summary();
+	s.memory_pool = VoxelMemoryPool::get_singleton()->get_stats();
 	return s;
 }
 
@@ -612,12 +1181,70 @@ Dictionary VoxelServer::_b_get_stats() {
 	return get_stats().to_dict();
 }
 
+void VoxelServer::_b_set_trace_recording_enabled(bool enabled) {
+	TraceRecorder::set_enabled(enabled);
+}
+
+bool VoxelServer::_b_is_trace_recording_enabled() const {
+	return TraceRecorder::is_enabled();
+}
+
+Error VoxelServer::_b_save_trace(String fpath) {
+	return TraceRecorder::save_chrome_trace(fpath);
+}
+
 void VoxelServer::_bind_methods() {
 	ClassDB::bind_method(D_METHOD("get_stats"), &VoxelServer::_b_get_stats);
+
+	ClassDB::bind_method(D_METHOD("set_main_thread_time_budget_usec", "usec"),
+			&VoxelServer::set_main_thread_time_budget_usec);
+	ClassDB::bind_method(D_METHOD("get_main_thread_time_budget_usec"),
+			&VoxelServer::get_main_thread_time_budget_usec);
+
+	ClassDB::bind_method(D_METHOD("set_thread_count", "count"), &VoxelServer::set_thread_count);
+	ClassDB::bind_method(D_METHOD("get_thread_count"), &VoxelServer::get_thread_count);
+
+	ClassDB::bind_method(D_METHOD("set_memory_pool_max_pooled_bytes", "bytes"),
+			&VoxelServer::set_memory_pool_max_pooled_bytes);
+	ClassDB::bind_method(D_METHOD("get_memory_pool_max_pooled_bytes"),
+			&VoxelServer::get_memory_pool_max_pooled_bytes);
+
+	ClassDB::bind_method(D_METHOD("set_voxel_memory_budget_bytes", "bytes"),
+			&VoxelServer::set_voxel_memory_budget_bytes);
+	ClassDB::bind_method(D_METHOD("get_voxel_memory_budget_bytes"),
+			&VoxelServer::get_voxel_memory_budget_bytes);
+	ClassDB::bind_method(D_METHOD("is_voxel_memory_over_budget"), &VoxelServer::is_voxel_memory_over_budget);
+
+	ClassDB::bind_method(D_METHOD("set_trace_recording_enabled", "enabled"),
+			&VoxelServer::_b_set_trace_recording_enabled);
+	ClassDB::bind_method(D_METHOD("is_trace_recording_enabled"), &VoxelServer::_b_is_trace_recording_enabled);
+	ClassDB::bind_method(D_METHOD("save_trace", "path"), &VoxelServer::_b_save_trace);
 }
 
 //----------------------------------------------------------------------------------------------------------------------
 
+namespace {
+
+// Picks the compression using the least memory for each channel of a block which is going to stay loaded
+void compress_block_for_storage(VoxelBuffer &voxels) {
+	VOXEL_PROFILE_SCOPE();
+
+	for (unsigned int channel_index = 0; channel_index < VoxelBuffer::MAX_CHANNELS; ++channel_index) {
+		if (voxels.compress_channel(channel_index, VoxelBuffer::COMPRESSION_UNIFORM)) {
+			continue;
+		}
+		if (channel_index == VoxelBuffer::CHANNEL_SDF) {
+			// Columns of smooth terrain are mostly air or matter, with few distinct values near the surface
+			voxels.compress_channel(channel_index, VoxelBuffer::COMPRESSION_RLE);
+
+		} else if (!voxels.compress_channel(channel_index, VoxelBuffer::COMPRESSION_PALETTE)) {
+			voxels.compress_channel(channel_index, VoxelBuffer::COMPRESSION_RLE);
+		}
+	}
+}
+
+} // namespace
+
 void VoxelServer::BlockDataRequest::run(VoxelTaskContext ctx) {
 	VOXEL_PROFILE_SCOPE();
 
@@ -641,6 +1268,10 @@ void VoxelServer::BlockDataRequest::run(VoxelTaskContext ctx) {
 			if (voxel_result == VoxelStream::RESULT_ERROR) {
 				ERR_PRINT("Error loading voxel block");
 
+			} else if (voxel_result == VoxelStream::RESULT_BLOCK_FOUND) {
+				// Blocks can stay loaded for a long time, make them smaller
+				compress_block_for_storage(**voxels);
+
 			} else if (voxel_result == VoxelStream::RESULT_BLOCK_NOT_FOUND) {
 				Ref<VoxelGenerator> generator = stream_dependency->generator;
 				if (generator.is_valid()) {
@@ -674,6 +1305,13 @@ void VoxelServer::BlockDataRequest::run(VoxelTaskContext ctx) {
 				// If not found, instances will return null,
 				// which means it can be generated by the instancer after the meshing process
 			}
+
+			// Unless the generator takes over, this block is going to be given to the volume as it is
+			if (type == TYPE_LOAD && stream_dependency->meshing_pipeline != nullptr) {
+				VoxelServer::get_singleton()->on_pipeline_block_loaded(
+						*stream_dependency->meshing_pipeline, volume_id, position, voxels, priority_dependency,
+						task_counter);
+			}
 		} break;
 
 		case TYPE_SAVE: {
@@ -744,12 +1382,19 @@ void VoxelServer::BlockGenerateRequest::run(VoxelTaskContext ctx) {
 
 	VoxelBlockRequest r{ voxels, origin_in_voxels, lod };
 	generator->generate_block(r);
+	compress_block_for_storage(**voxels);
 
 	if (stream_dependency->valid) {
 		Ref<VoxelStream> stream = stream_dependency->stream;
 		if (stream.is_valid() && stream->get_save_generator_output()) {
 			VoxelServer::get_singleton()->request_block_save_from_generate_request(this);
 		}
+
+		if (stream_dependency->meshing_pipeline != nullptr) {
+			VoxelServer::get_singleton()->on_pipeline_block_loaded(
+					*stream_dependency->meshing_pipeline, volume_id, position, voxels, priority_dependency,
+					task_counter);
+		}
 	}
 
 	has_run = true;
@@ -768,54 +1413,33 @@ bool VoxelServer::BlockGenerateRequest::is_cancelled() {
 
 //----------------------------------------------------------------------------------------------------------------------
 
-static void copy_block_and_neighbors(const FixedArray<Ref<VoxelBuffer>, Cube::MOORE_AREA_3D_COUNT> &moore_blocks,
-		VoxelBuffer &dst, int min_padding, int max_padding, int channels_mask) {
-
-	VOXEL_PROFILE_SCOPE();
+namespace {
 
-	FixedArray<uint8_t, VoxelBuffer::MAX_CHANNELS> channels;
-	unsigned int channels_count = 0;
-	for (unsigned int i = 0; i < VoxelBuffer::MAX_CHANNELS; ++i) {
-		if ((channels_mask & (1 << i)) != 0) {
-			channels[channels_count] = i;
-			++channels_count;
+// Prevents a block and its neighbors from being modified while they are read
+class MooreAreaReadLock {
+public:
+	MooreAreaReadLock(const FixedArray<Ref<VoxelBuffer>, Cube::MOORE_AREA_3D_COUNT> &blocks) :
+			_blocks(blocks) {
+		for (unsigned int i = 0; i < _blocks.size(); ++i) {
+			if (_blocks[i].is_valid()) {
+				_blocks[i]->get_lock().read_lock();
+			}
 		}
 	}
 
-	Ref<VoxelBuffer> central_buffer = moore_blocks[Cube::MOORE_AREA_3D_CENTRAL_INDEX];
-	CRASH_COND_MSG(central_buffer.is_null(), "Central buffer must be valid");
-	const int block_size = central_buffer->get_size().x;
-	const unsigned int padded_block_size = block_size + min_padding + max_padding;
-
-	dst.create(padded_block_size, padded_block_size, padded_block_size);
-
-	for (unsigned int ci = 0; ci < channels.size(); ++ci) {
-		dst.set_channel_depth(ci, central_buffer->get_channel_depth(ci));
-	}
-
-	const Vector3i min_pos = -Vector3i(min_padding);
-	const Vector3i max_pos = Vector3i(block_size + max_padding);
-
-	for (unsigned int i = 0; i < Cube::MOORE_AREA_3D_COUNT; ++i) {
-		const Vector3i offset = block_size * Cube::g_ordered_moore_area_3d[i];
-		Ref<VoxelBuffer> src = moore_blocks[i];
-
-		if (src.is_null()) {
-			continue;
-		}
-
-		const Vector3i src_min = min_pos - offset;
-		const Vector3i src_max = max_pos - offset;
-		const Vector3i dst_min = offset - min_pos;
-
-		{
-			RWLockRead read(src->get_lock());
-			for (unsigned int ci = 0; ci < channels.size(); ++ci) {
-				dst.copy_from(**src, src_min, src_max, dst_min, ci);
+	~MooreAreaReadLock() {
+		for (unsigned int i = 0; i < _blocks.size(); ++i) {
+			if (_blocks[i].is_valid()) {
+				_blocks[i]->get_lock().read_unlock();
 			}
 		}
 	}
-}
+
+private:
+	const FixedArray<Ref<VoxelBuffer>, Cube::MOORE_AREA_3D_COUNT> &_blocks;
+};
+
+} // namespace
 
 void VoxelServer::BlockMeshRequest::run(VoxelTaskContext ctx) {
 	VOXEL_PROFILE_SCOPE();
@@ -826,10 +1450,23 @@ void VoxelServer::BlockMeshRequest::run(VoxelTaskContext ctx) {
 	const unsigned int min_padding = mesher->get_minimum_padding();
 	const unsigned int max_padding = mesher->get_maximum_padding();
 
+	const VoxelBlockNeighborhood neighborhood(blocks, min_padding, max_padding);
+
 	// TODO Cache?
 	Ref<VoxelBuffer> voxels;
-	voxels.instance();
-	copy_block_and_neighbors(blocks, **voxels, min_padding, max_padding, mesher->get_used_channels_mask());
+	{
+		// Edits of these blocks wait until voxels were read, which includes meshing if it is done directly
+		const MooreAreaReadLock rlock(blocks);
+
+		if (mesher->build_from_neighborhood(surfaces_output, neighborhood, lod)) {
+			has_run = true;
+			return;
+		}
+
+		// The mesher needs voxels to be contiguous
+		voxels.instance();
+		neighborhood.copy_to(**voxels, mesher->get_used_channels_mask());
+	}
 
 	VoxelMesher::Input input = { **voxels, lod };
 
@@ -851,6 +1488,32 @@ bool VoxelServer::BlockMeshRequest::is_cancelled() {
 
 //----------------------------------------------------------------------------------------------------------------------
 
+void VoxelServer::BlockCompressRequest::run(VoxelTaskContext ctx) {
+	VOXEL_PROFILE_SCOPE();
+
+	// The block may be in use by the main thread or another task. Waiting would hold a thread for nothing,
+	// and the block will likely be requested again after its next edit anyways.
+	RWLock &lock = voxels->get_lock();
+	if (lock.write_try_lock() != OK) {
+		return;
+	}
+	compress_block_for_storage(**voxels);
+	lock.write_unlock();
+
+	has_run = true;
+}
+
+int VoxelServer::BlockCompressRequest::get_priority() {
+	return COMPRESSION_TASK_PRIORITY;
+}
+
+bool VoxelServer::BlockCompressRequest::is_cancelled() {
+	// If only the task holds a reference, the block was unloaded
+	return voxels->reference_get_count() <= 1;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
 namespace {
 bool g_updater_created = false;
 }
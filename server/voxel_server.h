@@ -1,12 +1,15 @@
 #ifndef VOXEL_SERVER_H
 #define VOXEL_SERVER_H
 
+#include "../constants/voxel_constants.h"
 #include "../generators/voxel_generator.h"
 #include "../meshers/blocky/voxel_mesher_blocky.h"
+#include "../storage/voxel_memory_pool.h"
 #include "../streams/voxel_stream.h"
 #include "../util/file_locker.h"
 #include "struct_db.h"
 #include "voxel_thread_pool.h"
+#include <core/os/os.h>
 #include <scene/main/node.h>
 
 #include <memory>
@@ -21,7 +24,8 @@ public:
 	struct BlockMeshOutput {
 		enum Type {
 			TYPE_MESHED, // Contains mesh
-			TYPE_DROPPED // Indicates the meshing was cancelled
+			TYPE_DROPPED, // Indicates the meshing was cancelled
+			TYPE_EMPTY // The block was not meshed because it would have no mesh
 		};
 
 		Type type;
@@ -64,9 +68,19 @@ public:
 		// 	FLAGS_COUNT = 3
 		// };
 		Vector3 world_position;
+		// Normalized direction the viewer is looking at, or zero if it has none
+		Vector3 view_direction;
 		unsigned int view_distance = 128;
 		bool require_collisions = false;
 		bool require_visuals = true;
+
+		// Estimated by the server from position changes
+		Vector3 velocity;
+		Vector3 prev_world_position;
+		bool has_prev_world_position = false;
+
+		// Only volumes of the same world take this viewer into account
+		uint32_t world_id = 0;
 	};
 
 	enum VolumeType {
@@ -83,6 +97,11 @@ public:
 
 	// TODO Rename functions to C convention
 	uint32_t add_volume(ReceptionBuffers *buffers, VolumeType type);
+	// Worlds are isolated from each other: volumes only take into account viewers of their own world,
+	// and tasks are prioritized and dropped independently in each of them. They still share the same threads.
+	// Worlds are identified by the ID of a Godot World. They are created when first used and removed
+	// when no volume or viewer is left in them. Zero is the default world, which is never removed.
+	void set_volume_world(uint32_t volume_id, ObjectID godot_world_id);
 	void set_volume_transform(uint32_t volume_id, Transform t);
 	void set_volume_block_size(uint32_t volume_id, uint32_t block_size);
 	void set_volume_stream(uint32_t volume_id, Ref<VoxelStream> stream);
@@ -91,16 +110,28 @@ public:
 	void set_volume_octree_split_scale(uint32_t volume_id, float split_scale);
 	void invalidate_volume_mesh_requests(uint32_t volume_id);
 	void request_block_mesh(uint32_t volume_id, BlockMeshInput &input);
+	// Volumes without LOD get their meshing scheduled by the server as soon as a block and its neighbors are loaded.
+	// When such a volume unloads a block, it must tell the server so it no longer takes part in meshing.
+	void remove_volume_pipeline_block(uint32_t volume_id, Vector3i block_pos);
+	// Tells if a block of such a volume needs a mesh, because it has mesh or collision viewers.
+	// Other blocks are not meshed by the server. Returns true if the server will take care of meshing the block,
+	// either right away or once its neighbors are loaded. Otherwise, the volume has to request the mesh itself.
+	bool set_volume_pipeline_block_mesh_wanted(uint32_t volume_id, Vector3i block_pos, bool wanted);
 	void request_block_load(uint32_t volume_id, Vector3i block_pos, int lod, bool request_instances);
 	void request_voxel_block_save(uint32_t volume_id, Ref<VoxelBuffer> voxels, Vector3i block_pos, int lod);
 	void request_instance_block_save(uint32_t volume_id, std::unique_ptr<VoxelInstanceBlockData> instances,
 			Vector3i block_pos, int lod);
+	// Compresses voxels of a block in the background, when threads have nothing more urgent to do.
+	// Meant for blocks which were edited and then left alone for a while. The block is skipped if it is locked.
+	void request_block_compression(uint32_t volume_id, Ref<VoxelBuffer> voxels);
 	void remove_volume(uint32_t volume_id);
 
 	// TODO Rename functions to C convention
 	uint32_t add_viewer();
 	void remove_viewer(uint32_t viewer_id);
+	void set_viewer_world(uint32_t viewer_id, ObjectID godot_world_id);
 	void set_viewer_position(uint32_t viewer_id, Vector3 position);
+	void set_viewer_direction(uint32_t viewer_id, Vector3 direction);
 	void set_viewer_distance(uint32_t viewer_id, unsigned int distance);
 	unsigned int get_viewer_distance(uint32_t viewer_id) const;
 	void set_viewer_requires_visuals(uint32_t viewer_id, bool enabled);
@@ -108,10 +139,17 @@ public:
 	void set_viewer_requires_collisions(uint32_t viewer_id, bool enabled);
 	bool is_viewer_requiring_collisions(uint32_t viewer_id) const;
 	bool viewer_exists(uint32_t viewer_id) const;
+	bool is_viewer_in_volume_world(uint32_t viewer_id, uint32_t volume_id) const;
 
+	// Iterates viewers that are in the same world as the given volume
 	template <typename F>
-	inline void for_each_viewer(F f) const {
-		_world.viewers.for_each_with_id(f);
+	inline void for_each_volume_viewer(uint32_t volume_id, F f) const {
+		const uint32_t world_id = _volumes.get(volume_id).world_id;
+		_viewers.for_each_with_id([world_id, &f](const Viewer &viewer, uint32_t viewer_id) {
+			if (viewer.world_id == world_id) {
+				f(viewer, viewer_id);
+			}
+		});
 	}
 
 	// Gets by how much voxels must be padded with neighbors in order to be polygonized properly
@@ -122,6 +160,36 @@ public:
 	void process();
 	void wait_and_clear_all_tasks(bool warn);
 
+	// Time each volume can spend per frame applying results on the main thread.
+	// Remaining results are deferred to the next frames.
+	void set_main_thread_time_budget_usec(unsigned int usec);
+	unsigned int get_main_thread_time_budget_usec() const;
+
+	enum MainThreadApplyType {
+		APPLY_BLOCK_DATA = 0,
+		APPLY_BLOCK_MESH,
+		APPLY_TYPE_COUNT
+	};
+
+	// Volumes report how long it took to apply each result on the main thread, for statistics.
+	// See VoxelServerApplyTimer.
+	void record_main_thread_apply_time(MainThreadApplyType type, uint64_t usec);
+
+	// Amount of threads shared by all voxel tasks. Zero picks a default depending on the hardware.
+	void set_thread_count(unsigned int count);
+	unsigned int get_thread_count() const;
+
+	// Voxel memory freed beyond this amount is given back to the system instead of being kept for reuse.
+	// Unused memory kept for reuse is also released periodically.
+	void set_memory_pool_max_pooled_bytes(int64_t bytes);
+	int64_t get_memory_pool_max_pooled_bytes() const;
+
+	// When voxel memory exceeds this amount, terrains unload their least recently used blocks that are not needed
+	// for meshes or edits, until it goes back under. Zero means no limit.
+	void set_voxel_memory_budget_bytes(int64_t bytes);
+	int64_t get_voxel_memory_budget_bytes() const;
+	bool is_voxel_memory_over_budget() const;
+
 	inline VoxelFileLocker &get_file_locker() {
 		return _file_locker;
 	}
@@ -148,15 +216,138 @@ public:
 			}
 		};
 
+		// Totals of the thread pool shared by all stages
+		ThreadPoolStats general;
+		// Stages running in the general pool. Their thread count is how many threads they are currently allowed to use.
 		ThreadPoolStats streaming;
 		ThreadPoolStats generation;
 		ThreadPoolStats meshing;
+		ThreadPoolStats compression;
+
+		struct WorldStats {
+			unsigned int volumes;
+			unsigned int viewers;
+			// Tasks of this world which did not come back to the main thread yet
+			unsigned int tasks;
+
+			Dictionary to_dict() {
+				Dictionary d;
+				d["volumes"] = volumes;
+				d["viewers"] = viewers;
+				d["tasks"] = tasks;
+				return d;
+			}
+		};
+
+		std::vector<WorldStats> worlds;
+
+		// Amount of blocks processed since the server started. Sampling it over time gives throughput.
+		struct ProcessedBlocks {
+			uint64_t loaded = 0;
+			uint64_t generated = 0;
+			uint64_t meshed = 0;
+			uint64_t saved = 0;
+			uint64_t compressed = 0;
+
+			Dictionary to_dict() {
+				Dictionary d;
+				d["loaded"] = loaded;
+				d["generated"] = generated;
+				d["meshed"] = meshed;
+				d["saved"] = saved;
+				d["compressed"] = compressed;
+				return d;
+			}
+		};
+
+		ProcessedBlocks processed_blocks;
+
+		static Dictionary latency_to_dict(const LatencyHistogram::Summary &s) {
+			Dictionary d;
+			d["count"] = s.count;
+			d["mean_usec"] = s.mean_usec;
+			d["p50_usec"] = s.p50_usec;
+			d["p90_usec"] = s.p90_usec;
+			d["p95_usec"] = s.p95_usec;
+			d["p99_usec"] = s.p99_usec;
+			d["max_usec"] = s.max_usec;
+			return d;
+		}
+
+		struct TaskStats {
+			// Time spent waiting in a queue before running
+			LatencyHistogram::Summary queue_time;
+			LatencyHistogram::Summary run_time;
+			// Tasks which didn't run because they were no longer needed
+			uint64_t cancelled = 0;
+			// Results discarded when they came back, because their volume was removed or changed its settings
+			uint64_t dropped = 0;
+
+			Dictionary to_dict() {
+				Dictionary d;
+				d["queue_time"] = latency_to_dict(queue_time);
+				d["run_time"] = latency_to_dict(run_time);
+				d["cancelled"] = cancelled;
+				d["dropped"] = dropped;
+				return d;
+			}
+		};
+
+		static Dictionary memory_pool_to_dict(const VoxelMemoryPool::Stats &s) {
+			Dictionary d;
+			d["used_bytes"] = s.used_bytes;
+			d["peak_used_bytes"] = s.peak_used_bytes;
+			d["pooled_bytes"] = s.pooled_bytes;
+			d["max_pooled_bytes"] = s.max_pooled_bytes;
+			Array sizes;
+			for (size_t i = 0; i < s.sizes.size(); ++i) {
+				const VoxelMemoryPool::SizeStats &ss = s.sizes[i];
+				Dictionary sd;
+				sd["size"] = ss.size;
+				sd["used_blocks"] = ss.used_blocks;
+				sd["pooled_blocks"] = ss.pooled_blocks;
+				sizes.append(sd);
+			}
+			d["sizes"] = sizes;
+			return d;
+		}
+
+		VoxelMemoryPool::Stats memory_pool;
+
+		TaskStats streaming_tasks;
+		TaskStats generation_tasks;
+		TaskStats meshing_tasks;
+		TaskStats compression_tasks;
+		// Tasks moved to another thread's queue because it ran out of work
+		uint64_t stolen_tasks = 0;
+		LatencyHistogram::Summary data_apply_time;
+		LatencyHistogram::Summary mesh_apply_time;
 
 		Dictionary to_dict() {
 			Dictionary d;
+			d["general"] = general.to_dict();
 			d["streaming"] = streaming.to_dict();
 			d["generation"] = generation.to_dict();
 			d["meshing"] = meshing.to_dict();
+			d["compression"] = compression.to_dict();
+			Array worlds_array;
+			for (size_t i = 0; i < worlds.size(); ++i) {
+				worlds_array.append(worlds[i].to_dict());
+			}
+			d["worlds"] = worlds_array;
+			d["processed_blocks"] = processed_blocks.to_dict();
+			Dictionary task_stats;
+			task_stats["streaming"] = streaming_tasks.to_dict();
+			task_stats["generation"] = generation_tasks.to_dict();
+			task_stats["meshing"] = meshing_tasks.to_dict();
+			task_stats["compression"] = compression_tasks.to_dict();
+			task_stats["stolen"] = stolen_tasks;
+			Dictionary main_thread;
+			main_thread["data_apply_time"] = latency_to_dict(data_apply_time);
+			main_thread["mesh_apply_time"] = latency_to_dict(mesh_apply_time);
+			task_stats["main_thread"] = main_thread;
+			d["task_stats"] = task_stats;
+			d["memory_pool"] = memory_pool_to_dict(memory_pool);
 			return d;
 		}
 	};
@@ -167,10 +358,24 @@ private:
 	class BlockDataRequest;
 	class BlockGenerateRequest;
 
+	// Kinds of tasks running in the general thread pool
+	enum Stage {
+		STAGE_STREAMING = 0,
+		STAGE_GENERATION,
+		STAGE_MESHING,
+		STAGE_COMPRESSION
+	};
+
 	void request_block_generate_from_data_request(BlockDataRequest *src);
 	void request_block_save_from_generate_request(BlockGenerateRequest *src);
 
+	void update_stage_partitioning();
+	Stats::TaskStats get_task_stats(Stage stage) const;
+
 	Dictionary _b_get_stats();
+	void _b_set_trace_recording_enabled(bool enabled);
+	bool _b_is_trace_recording_enabled() const;
+	Error _b_save_trace(String fpath);
 
 	static void _bind_methods();
 
@@ -186,19 +391,50 @@ private:
 	//   If such data sets change structurally (like their size, or other non-dirty-readable fields),
 	//   then a new instance is created and old references are left to "die out".
 
+	struct MeshingDependency {
+		Ref<VoxelMesher> mesher;
+		bool valid = true;
+	};
+
+	// Keeps track of the blocks loaded for a volume, so block processing threads can schedule meshing
+	// as soon as a block and all its neighbors are available, without a round trip to the main thread.
+	// Only used for volumes without LOD.
+	struct MeshingPipeline {
+		struct Block {
+			// Null if the block is not loaded yet, but is already wanted
+			Ref<VoxelBuffer> voxels;
+			bool mesh_wanted = false;
+			bool mesh_scheduled = false;
+		};
+
+		// Protects all fields, because blocks are added by threads
+		Mutex mutex;
+		HashMap<Vector3i, Block, Vector3iHasher> blocks;
+		// Blocks which were not meshed because they are empty. The volume is told about them on the main thread.
+		std::vector<Vector3i> empty_blocks;
+		// Copied from the volume, which threads can't access
+		std::shared_ptr<MeshingDependency> meshing_dependency;
+		Transform transform;
+		uint32_t block_size = 16;
+	};
+
 	struct StreamingDependency {
 		Ref<VoxelStream> stream;
 		Ref<VoxelGenerator> generator;
+		// Null if the volume schedules meshing by itself
+		std::shared_ptr<MeshingPipeline> meshing_pipeline;
 		bool valid = true;
 	};
 
-	struct MeshingDependency {
-		Ref<VoxelMesher> mesher;
-		bool valid = true;
+	// Counts tasks of a world, so it can be known how much work each world has pending.
+	// Incremented when tasks are scheduled, decremented when they come back to the main thread.
+	struct TaskCounter {
+		std::atomic<unsigned int> count{ 0 };
 	};
 
 	struct Volume {
 		VolumeType type;
+		uint32_t world_id = 0;
 		ReceptionBuffers *reception_buffers = nullptr;
 		Transform transform;
 		Ref<VoxelStream> stream;
@@ -210,32 +446,60 @@ private:
 		std::shared_ptr<MeshingDependency> meshing_dependency;
 	};
 
+	struct ViewerPriorityInfo {
+		Vector3 position;
+		// Normalized, or zero if the viewer doesn't look in a particular direction
+		Vector3 direction;
+		// Where the viewer is expected to be soon, based on its velocity
+		Vector3 predicted_position;
+	};
+
 	struct PriorityDependencyShared {
-		// These positions are written by the main thread and read by block processing threads.
+		// These are written by the main thread and read by block processing threads.
 		// Order doesn't matter.
 		// It's only used to adjust task priority so using a lock isn't worth it. In worst case scenario,
 		// a task will run much sooner or later than expected, but it will run in any case.
-		std::vector<Vector3> viewers;
+		// The vector is never resized after creation, so queued tasks keep seeing viewers move
+		// even when viewers are added or removed. Only the first `viewer_count` items are used.
+		std::vector<ViewerPriorityInfo> viewers;
+		std::atomic<unsigned int> viewer_count{ 0 };
 		float highest_view_distance = 999999;
 	};
 
 	struct World {
-		StructDB<Volume> volumes;
-		StructDB<Viewer> viewers;
+		ObjectID godot_world_id = 0;
+		unsigned int volume_count = 0;
+		unsigned int viewer_count = 0;
 
 		// Must be overwritten with a new instance if count changes.
 		std::shared_ptr<PriorityDependencyShared> shared_priority_dependency;
+		std::shared_ptr<TaskCounter> task_counter;
 	};
 
 	struct PriorityDependency {
 		std::shared_ptr<PriorityDependencyShared> shared;
-		Vector3 world_position; // TODO Won't update while in queue. Can it be bad?
+		Vector3 world_position; // TODO Won't update if the volume moves while in queue. Can it be bad?
 		// If the closest viewer is further away than this distance, the request can be cancelled as not worth it
 		float drop_distance_squared;
 	};
 
+	uint32_t get_or_create_world(ObjectID godot_world_id);
+	void remove_world_if_unused(uint32_t world_id);
+
 	void init_priority_dependency(PriorityDependency &dep, Vector3i block_position, uint8_t lod, const Volume &volume);
+	void enqueue_task(IVoxelTask *task, Stage stage, const std::shared_ptr<TaskCounter> &task_counter);
+	void update_viewer_priority_infos();
+	void update_world_priority_infos(uint32_t world_id, World &world);
+	void create_stream_dependency(Volume &volume);
+	void update_meshing_pipeline(const Volume &volume);
+	static bool get_pipeline_neighborhood(const MeshingPipeline &pipeline, Vector3i block_pos,
+			FixedArray<Ref<VoxelBuffer>, Cube::MOORE_AREA_3D_COUNT> &out_blocks);
+	void on_pipeline_block_loaded(MeshingPipeline &pipeline, uint32_t volume_id, Vector3i block_pos,
+			Ref<VoxelBuffer> voxels, const PriorityDependency &priority_dependency,
+			const std::shared_ptr<TaskCounter> &task_counter);
 	static int get_priority(const PriorityDependency &dep, uint8_t lod, float *out_closest_distance_sq);
+	static float get_viewer_priority_distance_sq(
+			const ViewerPriorityInfo &viewer, Vector3 block_position, float distance_sq);
 
 	class BlockDataRequest : public IVoxelTask {
 	public:
@@ -262,6 +526,7 @@ private:
 		bool request_voxels = false;
 		PriorityDependency priority_dependency;
 		std::shared_ptr<StreamingDependency> stream_dependency;
+		std::shared_ptr<TaskCounter> task_counter;
 		// TODO Find a way to separate save, it doesnt need sorting
 	};
 
@@ -280,6 +545,7 @@ private:
 		bool too_far = false;
 		PriorityDependency priority_dependency;
 		std::shared_ptr<StreamingDependency> stream_dependency;
+		std::shared_ptr<TaskCounter> task_counter;
 	};
 
 	class BlockMeshRequest : public IVoxelTask {
@@ -296,15 +562,37 @@ private:
 		bool too_far = false;
 		PriorityDependency priority_dependency;
 		std::shared_ptr<MeshingDependency> meshing_dependency;
+		std::shared_ptr<TaskCounter> task_counter;
 		VoxelMesher::Output surfaces_output;
 	};
 
-	// TODO multi-world support in the future
-	World _world;
+	class BlockCompressRequest : public IVoxelTask {
+	public:
+		void run(VoxelTaskContext ctx) override;
+		int get_priority() override;
+		bool is_cancelled() override;
 
-	VoxelThreadPool _streaming_thread_pool;
-	VoxelThreadPool _generation_thread_pool;
-	VoxelThreadPool _meshing_thread_pool;
+		Ref<VoxelBuffer> voxels;
+		bool has_run = false;
+		std::shared_ptr<TaskCounter> task_counter;
+	};
+
+	StructDB<World> _worlds;
+	HashMap<ObjectID, uint32_t> _world_ids;
+	uint32_t _default_world_id = 0;
+
+	StructDB<Volume> _volumes;
+	StructDB<Viewer> _viewers;
+
+	VoxelThreadPool _general_thread_pool;
+
+	uint64_t _last_process_time_usec = 0;
+	uint64_t _last_memory_pool_trim_time_usec = 0;
+	int64_t _voxel_memory_budget_bytes = 0;
+	unsigned int _main_thread_time_budget_usec = VoxelConstants::DEFAULT_MAIN_THREAD_TIME_BUDGET_USEC;
+	Stats::ProcessedBlocks _processed_blocks;
+	FixedArray<uint64_t, VoxelThreadPool::MAX_STAGES> _dropped_results;
+	FixedArray<LatencyHistogram, APPLY_TYPE_COUNT> _main_thread_apply_times;
 
 	VoxelFileLocker _file_locker;
 };
@@ -323,6 +611,21 @@ private:
 	VoxelServerUpdater();
 };
 
+// Measures the time spent in the scope applying a result on the main thread, and records it in server statistics
+struct VoxelServerApplyTimer {
+	VoxelServerApplyTimer(VoxelServer::MainThreadApplyType type) :
+			_type(type),
+			_begin_usec(OS::get_singleton()->get_ticks_usec()) {}
+
+	~VoxelServerApplyTimer() {
+		VoxelServer::get_singleton()->record_main_thread_apply_time(
+				_type, OS::get_singleton()->get_ticks_usec() - _begin_usec);
+	}
+
+	VoxelServer::MainThreadApplyType _type;
+	uint64_t _begin_usec;
+};
+
 struct VoxelFileLockerRead {
 	VoxelFileLockerRead(String path) :
 			_path(path) {
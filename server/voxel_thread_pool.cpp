@@ -15,15 +15,32 @@
 // 	return false;
 // }
 
-VoxelThreadPool::VoxelThreadPool() {
+VoxelThreadPool::VoxelThreadPool() :
+		_next_queue_index(0), _stolen_tasks(0), _batch_count(1), _priority_update_period(32) {
+	for (unsigned int i = 0; i < _stages.size(); ++i) {
+		Stage &stage = _stages[i];
+		stage.max_threads = UNLIMITED_STAGE_THREADS;
+		stage.active_threads = 0;
+		stage.received_tasks = 0;
+		stage.completed_tasks_count = 0;
+		stage.cancelled_tasks = 0;
+	}
 }
 
 VoxelThreadPool::~VoxelThreadPool() {
-	destroy_all_threads();
+	std::vector<TaskItem> remaining_tasks;
+	destroy_all_threads(remaining_tasks);
+
+	if (remaining_tasks.size() != 0 || _orphan_tasks.size() != 0) {
+		ERR_PRINT("There are unprocessed tasks remaining!");
+	}
 
-	if (_completed_tasks.size() != 0) {
-		// We don't have ownership over tasks, so it's an error to destroy the pool without handling them
-		ERR_PRINT("There are unhandled completed tasks remaining!");
+	for (unsigned int i = 0; i < _stages.size(); ++i) {
+		if (!_stages[i].completed_tasks.is_empty()) {
+			// We don't have ownership over tasks, so it's an error to destroy the pool without handling them
+			ERR_PRINT("There are unhandled completed tasks remaining!");
+			break;
+		}
 	}
 }
 
@@ -38,23 +55,37 @@ void VoxelThreadPool::create_thread(ThreadData &d, uint32_t i) {
 	d.thread.start(thread_func_static, &d);
 }
 
-void VoxelThreadPool::destroy_all_threads() {
+void VoxelThreadPool::destroy_all_threads(std::vector<TaskItem> &out_remaining_tasks) {
 	// We have only one semaphore to signal threads to resume, and one `post()` lets only one pass.
 	// We cannot tell one single thread to stop, because when we post and other threads are waiting, we can't guarantee
 	// the one to pass will be the one we want.
 	// So we can only choose to stop ALL threads, and then start them again if we want to adjust their count.
-	// Also, it shouldn't drop tasks. Any tasks the thread was working on should still complete normally.
-	for (size_t i = 0; i < _thread_count; ++i) {
-		ThreadData &d = _threads[i];
+	// Also, it shouldn't drop tasks. Any tasks the thread was working on should still complete normally,
+	// and tasks remaining in their queues are given back so they can be redistributed.
+	for (size_t i = 0; i < _threads.size(); ++i) {
+		ThreadData &d = *_threads[i];
 		d.stop = true;
 	}
-	for (size_t i = 0; i < _thread_count; ++i) {
+	for (size_t i = 0; i < _threads.size(); ++i) {
 		_tasks_semaphore.post();
 	}
-	for (size_t i = 0; i < _thread_count; ++i) {
-		ThreadData &d = _threads[i];
-		d.wait_to_finish_and_reset();
+	// Not locking while waiting: stopping threads may still push tasks, and steal from threads not stopped yet,
+	// so their data must remain valid until all of them have finished.
+	for (size_t i = 0; i < _threads.size(); ++i) {
+		_threads[i]->thread.wait_to_finish();
+	}
+
+	RWLockWrite wlock(_threads_lock);
+	for (size_t i = 0; i < _threads.size(); ++i) {
+		ThreadData &d = *_threads[i];
+		// Tasks pushed while threads were stopping are in there too
+		for (size_t j = 0; j < d.tasks.size(); ++j) {
+			out_remaining_tasks.push_back(d.tasks[j]);
+		}
+		memdelete(&d);
 	}
+	_threads.clear();
+	_thread_count = 0;
 }
 
 void VoxelThreadPool::set_name(String name) {
@@ -62,15 +93,45 @@ void VoxelThreadPool::set_name(String name) {
 }
 
 void VoxelThreadPool::set_thread_count(uint32_t count) {
-	if (count > MAX_THREADS) {
-		count = MAX_THREADS;
+	std::vector<TaskItem> remaining_tasks;
+	destroy_all_threads(remaining_tasks);
+
+	{
+		// Tasks pushed from now on wait until the new threads are ready to receive them
+		RWLockWrite wlock(_threads_lock);
+
+		{
+			MutexLock lock(_orphan_tasks_mutex);
+			for (size_t i = 0; i < _orphan_tasks.size(); ++i) {
+				remaining_tasks.push_back(_orphan_tasks[i]);
+			}
+			_orphan_tasks.clear();
+
+			if (count == 0) {
+				_orphan_tasks = remaining_tasks;
+				return;
+			}
+		}
+
+		for (uint32_t i = 0; i < count; ++i) {
+			_threads.push_back(memnew(ThreadData));
+		}
+
+		// Distribute tasks before threads start, so we don't need to lock
+		for (size_t i = 0; i < remaining_tasks.size(); ++i) {
+			_threads[i % count]->tasks.push_back(remaining_tasks[i]);
+		}
+
+		_thread_count = count;
+	}
+
+	for (uint32_t i = 0; i < count; ++i) {
+		create_thread(*_threads[i], i);
 	}
-	destroy_all_threads();
-	for (uint32_t i = _thread_count; i < count; ++i) {
-		ThreadData &d = _threads[i];
-		create_thread(d, i);
+
+	for (size_t i = 0; i < remaining_tasks.size(); ++i) {
+		_tasks_semaphore.post();
 	}
-	_thread_count = count;
 }
 
 void VoxelThreadPool::set_batch_count(uint32_t count) {
@@ -81,29 +142,60 @@ void VoxelThreadPool::set_priority_update_period(uint32_t milliseconds) {
 	_priority_update_period = milliseconds;
 }
 
-void VoxelThreadPool::enqueue(IVoxelTask *task) {
-	CRASH_COND(task == nullptr);
-	{
-		MutexLock lock(_tasks_mutex);
-		TaskItem t;
-		t.task = task;
-		_tasks.push_back(t);
-		++_debug_received_tasks;
+void VoxelThreadPool::set_stage_max_threads(uint8_t stage, uint32_t count) {
+	ERR_FAIL_COND(stage >= MAX_STAGES);
+	const uint32_t prev_count = _stages[stage].max_threads.exchange(count);
+	if (count > prev_count) {
+		// Threads may have gone waiting while tasks of this stage were blocked
+		for (uint32_t i = 0; i < _thread_count; ++i) {
+			_tasks_semaphore.post();
+		}
 	}
+}
+
+uint32_t VoxelThreadPool::get_stage_max_threads(uint8_t stage) const {
+	ERR_FAIL_COND_V(stage >= MAX_STAGES, 0);
+	return _stages[stage].max_threads;
+}
+
+void VoxelThreadPool::push_task(TaskItem item) {
+	++_stages[item.stage].received_tasks;
+	// This can be called from any thread, while threads are being changed
+	RWLockRead rlock(_threads_lock);
+	if (_thread_count == 0) {
+		MutexLock lock(_orphan_tasks_mutex);
+		_orphan_tasks.push_back(item);
+		return;
+	}
+	// Round-robin, threads running out of work will steal from others anyways
+	const uint32_t i = _next_queue_index.fetch_add(1) % _thread_count;
+	ThreadData &d = *_threads[i];
+	MutexLock lock(d.tasks_mutex);
+	d.tasks.push_back(item);
+}
+
+void VoxelThreadPool::enqueue(IVoxelTask *task, uint8_t stage) {
+	CRASH_COND(task == nullptr);
+	CRASH_COND(stage >= MAX_STAGES);
+	TaskItem t;
+	t.task = task;
+	t.stage = stage;
+	t.enqueue_time_usec = OS::get_singleton()->get_ticks_usec();
+	push_task(t);
 	// TODO Do I need to post a certain amount of times?
 	_tasks_semaphore.post();
 }
 
-void VoxelThreadPool::enqueue(ArraySlice<IVoxelTask *> tasks) {
-	{
-		MutexLock lock(_tasks_mutex);
-		for (size_t i = 0; i < tasks.size(); ++i) {
-			TaskItem t;
-			t.task = tasks[i];
-			CRASH_COND(t.task == nullptr);
-			_tasks.push_back(t);
-			++_debug_received_tasks;
-		}
+void VoxelThreadPool::enqueue(ArraySlice<IVoxelTask *> tasks, uint8_t stage) {
+	CRASH_COND(stage >= MAX_STAGES);
+	const uint64_t now = OS::get_singleton()->get_ticks_usec();
+	for (size_t i = 0; i < tasks.size(); ++i) {
+		TaskItem t;
+		t.task = tasks[i];
+		t.stage = stage;
+		t.enqueue_time_usec = now;
+		CRASH_COND(t.task == nullptr);
+		push_task(t);
 	}
 	// TODO Do I need to post a certain amount of times?
 	for (size_t i = 0; i < tasks.size(); ++i) {
@@ -118,78 +210,177 @@ void VoxelThreadPool::thread_func_static(void *p_data) {
 	if (!data.name.empty()) {
 		Thread::set_name(data.name);
 
-#ifdef VOXEL_PROFILER_ENABLED
 		CharString thread_name = data.name.utf8();
 		VOXEL_PROFILE_SET_THREAD_NAME(thread_name.get_data());
-#endif
 	}
 
 	pool.thread_func(data);
 }
 
+bool VoxelThreadPool::try_acquire_stage(uint8_t stage) {
+	Stage &s = _stages[stage];
+	uint32_t active_threads = s.active_threads;
+	do {
+		if (active_threads >= s.max_threads) {
+			return false;
+		}
+	} while (!s.active_threads.compare_exchange_weak(active_threads, active_threads + 1));
+	return true;
+}
+
+void VoxelThreadPool::release_stage(uint8_t stage) {
+	--_stages[stage].active_threads;
+	// Tasks of that stage might have been left in queue because of the limit, wake up a thread to pick them
+	_tasks_semaphore.post();
+}
+
+// Picks the best tasks from the thread's own queue.
+// All tasks of a batch belong to the same stage, so the thread only occupies one slot of that stage.
+void VoxelThreadPool::pick_tasks(ThreadData &data, std::vector<TaskItem> &tasks,
+		std::vector<TaskItem> &cancelled_tasks) {
+
+	VOXEL_PROFILE_SCOPE();
+
+	const uint32_t now = OS::get_singleton()->get_ticks_msec();
+
+	MutexLock lock(data.tasks_mutex);
+	std::vector<TaskItem> &queue = data.tasks;
+	int batch_stage = -1;
+
+	for (uint32_t bi = 0; bi < _batch_count && queue.size() != 0; ++bi) {
+		size_t best_index = 0;
+		int best_priority = 999999;
+		bool found = false;
+
+		// TODO This takes a lot of time when there are many queued tasks. Use a better container?
+		for (size_t i = 0; i < queue.size(); ++i) {
+			TaskItem &item = queue[i];
+			CRASH_COND(item.task == nullptr);
+
+			if (now - item.last_priority_update_time > _priority_update_period) {
+				// Calling `get_priority()` first since it can update cancellation
+				// (not clear API tho, might review that in the future)
+				item.cached_priority = item.task->get_priority();
+
+				if (item.task->is_cancelled()) {
+					cancelled_tasks.push_back(item);
+					queue[i] = queue.back();
+					queue.pop_back();
+					--i;
+					continue;
+				}
+
+				item.last_priority_update_time = now;
+			}
+
+			if (batch_stage == -1) {
+				const Stage &stage = _stages[item.stage];
+				if (stage.active_threads >= stage.max_threads) {
+					continue;
+				}
+			} else if (item.stage != batch_stage) {
+				continue;
+			}
+
+			if (!found || item.cached_priority < best_priority) {
+				best_priority = item.cached_priority;
+				best_index = i;
+				found = true;
+			}
+		}
+
+		if (!found) {
+			// All tasks were cancelled, or belong to stages that already have enough threads working on them
+			break;
+		}
+
+		CRASH_COND(best_index >= queue.size());
+		const TaskItem item = queue[best_index];
+
+		if (batch_stage == -1) {
+			if (!try_acquire_stage(item.stage)) {
+				// Another thread took the last slot in the meantime
+				break;
+			}
+			batch_stage = item.stage;
+		}
+
+		tasks.push_back(item);
+		queue[best_index] = queue.back();
+		queue.pop_back();
+	}
+}
+
+// Moves up to half of the tasks of another thread into the queue of the given thread.
+// Only tasks of stages that can currently run are taken.
+// Returns false if no other thread had tasks to steal.
+bool VoxelThreadPool::steal_tasks(ThreadData &thief) {
+	VOXEL_PROFILE_SCOPE();
+
+	std::vector<TaskItem> stolen_tasks;
+
+	// Start with the next thread so all threads don't rob the same victim
+	for (uint32_t offset = 1; offset < _thread_count && stolen_tasks.empty(); ++offset) {
+		ThreadData &victim = *_threads[(thief.index + offset) % _thread_count];
+
+		MutexLock lock(victim.tasks_mutex);
+		std::vector<TaskItem> &queue = victim.tasks;
+		const size_t max_steal_count = (queue.size() + 1) / 2;
+
+		// Iterate from the front, older tasks were queued first
+		for (size_t i = 0; i < queue.size() && stolen_tasks.size() < max_steal_count;) {
+			const TaskItem &item = queue[i];
+			const Stage &stage = _stages[item.stage];
+			if (stage.active_threads < stage.max_threads) {
+				stolen_tasks.push_back(item);
+				queue[i] = queue.back();
+				queue.pop_back();
+			} else {
+				++i;
+			}
+		}
+	}
+
+	if (stolen_tasks.empty()) {
+		return false;
+	}
+	_stolen_tasks += stolen_tasks.size();
+
+	// Locks are never nested, to prevent deadlocks between two threads stealing from each other
+	MutexLock lock(thief.tasks_mutex);
+	thief.tasks.insert(thief.tasks.end(), stolen_tasks.begin(), stolen_tasks.end());
+	return true;
+}
+
+void VoxelThreadPool::push_completed_tasks(const std::vector<TaskItem> &tasks) {
+	for (size_t i = 0; i < tasks.size(); ++i) {
+		const TaskItem &item = tasks[i];
+		Stage &stage = _stages[item.stage];
+		stage.completed_tasks.push(item.task);
+		++stage.completed_tasks_count;
+	}
+}
+
 void VoxelThreadPool::thread_func(ThreadData &data) {
 	data.debug_state = STATE_RUNNING;
 
 	std::vector<TaskItem> tasks;
-	std::vector<IVoxelTask *> cancelled_tasks;
+	std::vector<TaskItem> cancelled_tasks;
 
 	while (!data.stop) {
-		{
-			VOXEL_PROFILE_SCOPE();
-
-			data.debug_state = STATE_PICKING;
-			const uint32_t now = OS::get_singleton()->get_ticks_msec();
-
-			MutexLock lock(_tasks_mutex);
-
-			// Pick best tasks
-			for (uint32_t bi = 0; bi < _batch_count && _tasks.size() != 0; ++bi) {
-				size_t best_index = 0; // Take first by default, this is a valid index
-				int best_priority = 999999;
-
-				// TODO This takes a lot of time when there are many queued tasks. Use a better container?
-				for (size_t i = 0; i < _tasks.size(); ++i) {
-					TaskItem &item = _tasks[i];
-					CRASH_COND(item.task == nullptr);
-
-					if (now - item.last_priority_update_time > _priority_update_period) {
-						// Calling `get_priority()` first since it can update cancellation
-						// (not clear API tho, might review that in the future)
-						item.cached_priority = item.task->get_priority();
-
-						if (item.task->is_cancelled()) {
-							cancelled_tasks.push_back(item.task);
-							_tasks[i] = _tasks.back();
-							_tasks.pop_back();
-							--i;
-							continue;
-						}
-
-						item.last_priority_update_time = now;
-					}
-
-					if (item.cached_priority < best_priority) {
-						best_priority = item.cached_priority;
-						best_index = i;
-					}
-				}
+		data.debug_state = STATE_PICKING;
 
-				// If not all tasks were cancelled
-				if (_tasks.size() != 0) {
-					tasks.push_back(_tasks[best_index]);
-					CRASH_COND(best_index >= _tasks.size());
-					_tasks[best_index] = _tasks.back();
-					_tasks.pop_back();
-				}
-			}
+		pick_tasks(data, tasks, cancelled_tasks);
+
+		if (tasks.empty() && steal_tasks(data)) {
+			pick_tasks(data, tasks, cancelled_tasks);
 		}
 
 		if (cancelled_tasks.size() > 0) {
-			MutexLock lock(_completed_tasks_mutex);
 			for (size_t i = 0; i < cancelled_tasks.size(); ++i) {
-				_completed_tasks.push_back(cancelled_tasks[i]);
-				++_debug_completed_tasks;
+				++_stages[cancelled_tasks[i].stage].cancelled_tasks;
 			}
+			push_completed_tasks(cancelled_tasks);
 		}
 		cancelled_tasks.clear();
 
@@ -206,28 +397,33 @@ void VoxelThreadPool::thread_func(ThreadData &data) {
 		} else {
 			data.debug_state = STATE_RUNNING;
 
+			// All tasks of a batch are from the same stage
+			Stage &stage = _stages[tasks[0].stage];
+
 			for (size_t i = 0; i < tasks.size(); ++i) {
 				TaskItem &item = tasks[i];
-				if (!item.task->is_cancelled()) {
-					VoxelTaskContext ctx;
-					ctx.thread_index = data.index;
-					item.task->run(ctx);
-				}
-			}
-			{
-				MutexLock lock(_completed_tasks_mutex);
-				for (size_t i = 0; i < tasks.size(); ++i) {
-					TaskItem &item = tasks[i];
-					_completed_tasks.push_back(item.task);
-					++_debug_completed_tasks;
+				if (item.task->is_cancelled()) {
+					++stage.cancelled_tasks;
+					continue;
 				}
+				const uint64_t begin_time = OS::get_singleton()->get_ticks_usec();
+				stage.queue_time.record(begin_time - item.enqueue_time_usec);
+				VoxelTaskContext ctx;
+				ctx.thread_index = data.index;
+				item.task->run(ctx);
+				stage.run_time.record(OS::get_singleton()->get_ticks_usec() - begin_time);
 			}
+			push_completed_tasks(tasks);
+			release_stage(tasks[0].stage);
 
 			tasks.clear();
 		}
 	}
 
 	data.debug_state = STATE_STOPPED;
+
+	// Threads are recreated when their count changes, the next ones can reuse what this one used for profiling
+	VOXEL_PROFILE_THREAD_EXIT();
 }
 
 void VoxelThreadPool::wait_for_all_tasks() {
@@ -238,12 +434,18 @@ void VoxelThreadPool::wait_for_all_tasks() {
 
 	// Wait until all tasks have been taken
 	while (true) {
-		{
-			MutexLock lock(_tasks_mutex);
-			if (_tasks.size() == 0) {
+		bool any_queued_task = false;
+		for (size_t i = 0; i < _thread_count; ++i) {
+			ThreadData &d = *_threads[i];
+			MutexLock lock(d.tasks_mutex);
+			if (d.tasks.size() != 0) {
+				any_queued_task = true;
 				break;
 			}
 		}
+		if (!any_queued_task) {
+			break;
+		}
 
 		OS::get_singleton()->delay_usec(2000);
 
@@ -261,7 +463,7 @@ void VoxelThreadPool::wait_for_all_tasks() {
 	while (any_working_thread) {
 		any_working_thread = false;
 		for (size_t i = 0; i < _thread_count; ++i) {
-			const ThreadData &t = _threads[i];
+			const ThreadData &t = *_threads[i];
 			if (t.waiting == false) {
 				any_working_thread = true;
 				break;
@@ -282,9 +484,43 @@ void VoxelThreadPool::wait_for_all_tasks() {
 // Thought it wasnt worth locking for debugging.
 
 VoxelThreadPool::State VoxelThreadPool::get_thread_debug_state(uint32_t i) const {
-	return _threads[i].debug_state;
+	return _threads[i]->debug_state;
 }
 
 unsigned int VoxelThreadPool::get_debug_remaining_tasks() const {
-	return _debug_received_tasks - _debug_completed_tasks;
+	unsigned int count = 0;
+	for (unsigned int i = 0; i < _stages.size(); ++i) {
+		count += get_stage_remaining_tasks(i);
+	}
+	return count;
+}
+
+unsigned int VoxelThreadPool::get_stage_remaining_tasks(uint8_t stage) const {
+	ERR_FAIL_COND_V(stage >= MAX_STAGES, 0);
+	const Stage &s = _stages[stage];
+	return s.received_tasks - s.completed_tasks_count;
+}
+
+unsigned int VoxelThreadPool::get_stage_active_threads(uint8_t stage) const {
+	ERR_FAIL_COND_V(stage >= MAX_STAGES, 0);
+	return _stages[stage].active_threads;
+}
+
+const LatencyHistogram &VoxelThreadPool::get_stage_queue_time(uint8_t stage) const {
+	CRASH_COND(stage >= MAX_STAGES);
+	return _stages[stage].queue_time;
+}
+
+const LatencyHistogram &VoxelThreadPool::get_stage_run_time(uint8_t stage) const {
+	CRASH_COND(stage >= MAX_STAGES);
+	return _stages[stage].run_time;
+}
+
+uint64_t VoxelThreadPool::get_stage_cancelled_tasks(uint8_t stage) const {
+	ERR_FAIL_COND_V(stage >= MAX_STAGES, 0);
+	return _stages[stage].cancelled_tasks;
+}
+
+uint64_t VoxelThreadPool::get_stolen_tasks() const {
+	return _stolen_tasks;
 }
@@ -4,11 +4,15 @@
 #include "../storage/voxel_buffer.h"
 #include "../util/array_slice.h"
 #include "../util/fixed_array.h"
+#include "../util/latency_histogram.h"
+#include "../util/mpsc_queue.h"
 #include <core/os/mutex.h>
+#include <core/os/rw_lock.h>
 #include <core/os/semaphore.h>
 #include <core/os/thread.h>
 
-#include <queue>
+#include <atomic>
+#include <vector>
 
 class Thread;
 
@@ -26,12 +30,22 @@ public:
 	virtual int get_priority() { return 0; }
 
 	virtual bool is_cancelled() { return false; }
+
+	// Used by the pool to link completed tasks, so publishing them doesn't allocate
+	IVoxelTask *mpsc_next = nullptr;
 };
 
-// Generic thread pool that performs batches of tasks based on priority
+// Generic thread pool that performs batches of tasks based on priority.
+// Each thread owns its own queue of tasks. Threads pick the most important tasks from their own queue,
+// and steal from other threads when they run out of work. This avoids having all threads contend on a single lock.
+//
+// Tasks can be assigned to a stage, so different kinds of work can share the same threads.
+// Each stage can be limited in how many threads can work on it at the same time,
+// and these limits can be changed while running.
 class VoxelThreadPool {
 public:
-	static const uint32_t MAX_THREADS = 8;
+	static const uint32_t MAX_STAGES = 4;
+	static const uint32_t UNLIMITED_STAGE_THREADS = 0xffffffff;
 
 	enum State {
 		STATE_RUNNING = 0,
@@ -47,33 +61,41 @@ public:
 	// Must be called before configuring thread count.
 	void set_name(String name);
 
-	// TODO Add ability to change it while running without skipping tasks
-	// Can't be changed after tasks have been queued
+	// Can be changed while running. Threads finish the tasks they are running and get restarted,
+	// tasks still in queues are given to the new threads.
+	// Must be called from the thread owning the pool.
 	void set_thread_count(uint32_t count);
 	uint32_t get_thread_count() const { return _thread_count; }
 
-	// TODO Add ability to change it while running
-	// Can't be changed after tasks have been queued
 	void set_batch_count(uint32_t count);
 
-	// TODO Add ability to change it while running
-	// Can't be changed after tasks have been queued
 	void set_priority_update_period(uint32_t milliseconds);
 
+	// Sets how many threads can run tasks of the given stage at the same time.
+	// Can be changed while running. Threads already working on the stage won't be interrupted.
+	void set_stage_max_threads(uint8_t stage, uint32_t count);
+	uint32_t get_stage_max_threads(uint8_t stage) const;
+
 	// Schedules a task.
 	// Ownership is NOT passed to the pool, so make sure you get them back when completed if you want to delete them.
-	void enqueue(IVoxelTask *task);
-	void enqueue(ArraySlice<IVoxelTask *> tasks);
+	void enqueue(IVoxelTask *task, uint8_t stage = 0);
+	void enqueue(ArraySlice<IVoxelTask *> tasks, uint8_t stage = 0);
 
-	// TODO Lambda might not be the best API. memcpying to a vector would ensure we lock for a shorter time.
+	// Must be called from a single thread.
+	// Completed tasks are published without locking, so threads never wait for this to finish.
 	template <typename F>
-	void dequeue_completed_tasks(F f) {
-		MutexLock lock(_completed_tasks_mutex);
-		for (size_t i = 0; i < _completed_tasks.size(); ++i) {
-			IVoxelTask *task = _completed_tasks[i];
+	void dequeue_completed_tasks(uint8_t stage, F f) {
+		CRASH_COND(stage >= MAX_STAGES);
+		_stages[stage].completed_tasks.pop_all([&f](IVoxelTask *task) {
 			f(task);
+		});
+	}
+
+	template <typename F>
+	void dequeue_completed_tasks(F f) {
+		for (uint8_t stage = 0; stage < MAX_STAGES; ++stage) {
+			dequeue_completed_tasks(stage, f);
 		}
-		_completed_tasks.clear();
 	}
 
 	// Blocks and wait for all tasks to finish (assuming no more are getting added!)
@@ -82,11 +104,26 @@ public:
 	State get_thread_debug_state(uint32_t i) const;
 	unsigned int get_debug_remaining_tasks() const;
 
+	// Tasks of the stage which have been enqueued and didn't complete yet
+	unsigned int get_stage_remaining_tasks(uint8_t stage) const;
+	// Amount of threads currently working on the stage
+	unsigned int get_stage_active_threads(uint8_t stage) const;
+	// Time tasks of the stage spent waiting in queues before running
+	const LatencyHistogram &get_stage_queue_time(uint8_t stage) const;
+	// Time tasks of the stage spent running
+	const LatencyHistogram &get_stage_run_time(uint8_t stage) const;
+	// Tasks of the stage which were cancelled instead of running
+	uint64_t get_stage_cancelled_tasks(uint8_t stage) const;
+	// Tasks which threads took from the queue of another thread after running out of work
+	uint64_t get_stolen_tasks() const;
+
 private:
 	struct TaskItem {
 		IVoxelTask *task = nullptr;
 		int cached_priority = 99999;
 		uint32_t last_priority_update_time = 0;
+		uint64_t enqueue_time_usec = 0;
+		uint8_t stage = 0;
 	};
 
 	struct ThreadData {
@@ -98,41 +135,57 @@ private:
 		State debug_state = STATE_STOPPED;
 		String name;
 
-		void wait_to_finish_and_reset() {
-			thread.wait_to_finish();
-			pool = nullptr;
-			index = 0;
-			stop = false;
-			waiting = false;
-			debug_state = STATE_STOPPED;
-			name.clear();
-		}
+		// Tasks assigned to this thread. Other threads may steal from it when they are out of work.
+		std::vector<TaskItem> tasks;
+		Mutex tasks_mutex;
+	};
+
+	struct Stage {
+		std::atomic<uint32_t> max_threads;
+		std::atomic<uint32_t> active_threads;
+		std::atomic<unsigned int> received_tasks;
+		std::atomic<unsigned int> completed_tasks_count;
+		std::atomic<uint64_t> cancelled_tasks;
+		MPSCQueue<IVoxelTask> completed_tasks;
+		LatencyHistogram queue_time;
+		LatencyHistogram run_time;
 	};
 
 	static void thread_func_static(void *p_data);
 	void thread_func(ThreadData &data);
 
+	bool try_acquire_stage(uint8_t stage);
+	void release_stage(uint8_t stage);
+	void pick_tasks(ThreadData &data, std::vector<TaskItem> &tasks, std::vector<TaskItem> &cancelled_tasks);
+	bool steal_tasks(ThreadData &thief);
+	void push_task(TaskItem item);
+	void push_completed_tasks(const std::vector<TaskItem> &tasks);
+
 	void create_thread(ThreadData &d, uint32_t i);
-	void destroy_all_threads();
+	void destroy_all_threads(std::vector<TaskItem> &out_remaining_tasks);
 
-	FixedArray<ThreadData, MAX_THREADS> _threads;
+	// Threads only change when all of them are stopped, so threads can use these without locking.
+	// Other threads pushing tasks must lock.
+	std::vector<ThreadData *> _threads;
 	uint32_t _thread_count = 0;
+	RWLock _threads_lock;
+
+	// Tasks enqueued while there are no threads to run them
+	std::vector<TaskItem> _orphan_tasks;
+	Mutex _orphan_tasks_mutex;
+
+	// Used to distribute new tasks across thread queues
+	std::atomic<uint32_t> _next_queue_index;
+	std::atomic<uint64_t> _stolen_tasks;
 
-	// TODO Optimize this with a less naive design? Maybe moodycamel
-	std::vector<TaskItem> _tasks;
-	Mutex _tasks_mutex;
 	Semaphore _tasks_semaphore;
 
-	std::vector<IVoxelTask *> _completed_tasks;
-	Mutex _completed_tasks_mutex;
+	FixedArray<Stage, MAX_STAGES> _stages;
 
-	uint32_t _batch_count = 1;
-	uint32_t _priority_update_period = 32;
+	std::atomic<uint32_t> _batch_count;
+	std::atomic<uint32_t> _priority_update_period;
 
 	String _name;
-
-	unsigned int _debug_received_tasks = 0;
-	unsigned int _debug_completed_tasks = 0;
 };
 
 #endif // VOXEL_THREAD_TASK_MANAGER_H
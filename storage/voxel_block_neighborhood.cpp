@@ -0,0 +1,142 @@
+#include "voxel_block_neighborhood.h"
+#include "../util/profiling.h"
+
+VoxelBlockNeighborhood::VoxelBlockNeighborhood(
+		const FixedArray<Ref<VoxelBuffer>, Cube::MOORE_AREA_3D_COUNT> &blocks,
+		unsigned int min_padding, unsigned int max_padding) {
+
+	for (unsigned int i = 0; i < blocks.size(); ++i) {
+		_blocks[i] = blocks[i].ptr();
+	}
+
+	const VoxelBuffer *central_buffer = _blocks[Cube::MOORE_AREA_3D_CENTRAL_INDEX];
+	CRASH_COND_MSG(central_buffer == nullptr, "Central buffer must be valid");
+	_block_size = central_buffer->get_size();
+	// Padding must not reach further than neighbors
+	CRASH_COND(static_cast<int>(MAX(min_padding, max_padding)) > _block_size.x);
+
+	_min_padding = Vector3i(min_padding);
+	_size = _block_size + Vector3i(min_padding + max_padding);
+}
+
+VoxelBlockNeighborhood::VoxelBlockNeighborhood(const VoxelBuffer &padded_voxels) {
+	_blocks.fill(nullptr);
+	_blocks[Cube::MOORE_AREA_3D_CENTRAL_INDEX] = &padded_voxels;
+	_block_size = padded_voxels.get_size();
+	_size = _block_size;
+}
+
+uint64_t VoxelBlockNeighborhood::get_voxel(int x, int y, int z, unsigned int channel_index) const {
+	const VoxelBuffer *block = get_block_and_local_position(x, y, z);
+	if (block == nullptr) {
+		return VoxelBuffer::get_default_channel_value(channel_index);
+	}
+	return block->get_voxel(x, y, z, channel_index);
+}
+
+real_t VoxelBlockNeighborhood::get_voxel_f(int x, int y, int z, unsigned int channel_index) const {
+	const VoxelBuffer *block = get_block_and_local_position(x, y, z);
+	if (block == nullptr) {
+		return VoxelBuffer::raw_voxel_to_real(
+				VoxelBuffer::get_default_channel_value(channel_index), get_channel_depth(channel_index));
+	}
+	return block->get_voxel_f(x, y, z, channel_index);
+}
+
+VoxelBuffer::Depth VoxelBlockNeighborhood::get_channel_depth(unsigned int channel_index) const {
+	return _blocks[Cube::MOORE_AREA_3D_CENTRAL_INDEX]->get_channel_depth(channel_index);
+}
+
+bool VoxelBlockNeighborhood::is_block_viewed(unsigned int i) const {
+	const Vector3i npos = Cube::g_ordered_moore_area_3d[i];
+	const Vector3i max_padding = _size - _block_size - _min_padding;
+	for (unsigned int axis = 0; axis < Vector3i::AXIS_COUNT; ++axis) {
+		if ((npos[axis] < 0 && _min_padding[axis] == 0) || (npos[axis] > 0 && max_padding[axis] == 0)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool VoxelBlockNeighborhood::is_uniform(unsigned int channel_index) const {
+	bool has_value = false;
+	uint64_t value = 0;
+
+	for (unsigned int i = 0; i < Cube::MOORE_AREA_3D_COUNT; ++i) {
+		if (!is_block_viewed(i)) {
+			continue;
+		}
+
+		const VoxelBuffer *block = _blocks[i];
+		uint64_t block_value;
+
+		if (block == nullptr) {
+			block_value = VoxelBuffer::get_default_channel_value(channel_index);
+
+		} else if (block->get_channel_compression(channel_index) == VoxelBuffer::COMPRESSION_UNIFORM) {
+			block_value = block->get_voxel(0, 0, 0, channel_index);
+
+		} else {
+			return false;
+		}
+
+		if (has_value && block_value != value) {
+			return false;
+		}
+		value = block_value;
+		has_value = true;
+	}
+
+	return true;
+}
+
+void VoxelBlockNeighborhood::copy_to(VoxelBuffer &dst, int channels_mask) const {
+	VOXEL_PROFILE_SCOPE();
+
+	const VoxelBuffer &central_buffer = *_blocks[Cube::MOORE_AREA_3D_CENTRAL_INDEX];
+
+	// Setting the format first so channels don't get allocated and reset
+	dst.clear();
+	for (unsigned int channel_index = 0; channel_index < VoxelBuffer::MAX_CHANNELS; ++channel_index) {
+		dst.set_channel_depth(channel_index, central_buffer.get_channel_depth(channel_index));
+	}
+	dst.create(_size);
+
+	const Vector3i min_pos = -_min_padding;
+	const Vector3i max_pos = _size - _min_padding;
+
+	for (unsigned int channel_index = 0; channel_index < VoxelBuffer::MAX_CHANNELS; ++channel_index) {
+		if ((channels_mask & (1 << channel_index)) == 0) {
+			continue;
+		}
+
+		if (is_uniform(channel_index)) {
+			// Keep the channel compressed, meshers can skip it quickly
+			dst.clear_channel(channel_index, get_voxel(0, 0, 0, channel_index));
+			continue;
+		}
+
+		// Missing neighbors are left with default values
+		dst.clear_channel(channel_index, VoxelBuffer::get_default_channel_value(channel_index));
+
+		for (unsigned int i = 0; i < Cube::MOORE_AREA_3D_COUNT; ++i) {
+			const VoxelBuffer *src = _blocks[i];
+			if (src == nullptr || !is_block_viewed(i)) {
+				continue;
+			}
+
+			const Vector3i offset = _block_size * Cube::g_ordered_moore_area_3d[i];
+			const Vector3i src_min = min_pos - offset;
+			const Vector3i src_max = max_pos - offset;
+			const Vector3i dst_min = offset - min_pos;
+
+			dst.copy_from(*src, src_min, src_max, dst_min, channel_index);
+		}
+
+		// Blocks copied whole keep their compression, but meshers read channels directly
+		const VoxelBuffer::Compression compression = dst.get_channel_compression(channel_index);
+		if (compression == VoxelBuffer::COMPRESSION_PALETTE || compression == VoxelBuffer::COMPRESSION_RLE) {
+			dst.decompress_channel(channel_index);
+		}
+	}
+}
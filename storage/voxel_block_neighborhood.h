@@ -0,0 +1,72 @@
+#ifndef VOXEL_BLOCK_NEIGHBORHOOD_H
+#define VOXEL_BLOCK_NEIGHBORHOOD_H
+
+#include "../constants/cube_tables.h"
+#include "voxel_buffer.h"
+
+// Read-only view of a block and its 26 neighbors, seen as a single padded buffer.
+// Meshers can sample it directly instead of getting voxels copied into a padded buffer first.
+// Coordinates are padded: (0, 0, 0) is `min_padding` voxels before the origin of the central block.
+// Blocks are neither owned nor locked by the view, so they must not be destroyed or modified while it is used.
+class VoxelBlockNeighborhood {
+public:
+	// Blocks are in the same order as `Cube::g_ordered_moore_area_3d`, and must all have the same size.
+	// Neighbors can be null, in which case they read as the default values of a new buffer.
+	VoxelBlockNeighborhood(const FixedArray<Ref<VoxelBuffer>, Cube::MOORE_AREA_3D_COUNT> &blocks,
+			unsigned int min_padding, unsigned int max_padding);
+
+	// Views a buffer which already contains padding
+	VoxelBlockNeighborhood(const VoxelBuffer &padded_voxels);
+
+	inline const Vector3i &get_size() const { return _size; }
+
+	uint64_t get_voxel(int x, int y, int z, unsigned int channel_index) const;
+	real_t get_voxel_f(int x, int y, int z, unsigned int channel_index) const;
+
+	// Format of the central block
+	VoxelBuffer::Depth get_channel_depth(unsigned int channel_index) const;
+
+	// Tells if all viewed voxels of the channel have the same value.
+	// This is only based on compression of the blocks, so it is fast, but it can return false when voxels of
+	// uncompressed blocks happen to be all the same.
+	bool is_uniform(unsigned int channel_index) const;
+
+	// Copies viewed voxels into a regular buffer, for meshers which need them to be contiguous.
+	// Only channels in the mask are copied.
+	void copy_to(VoxelBuffer &dst, int channels_mask) const;
+
+private:
+	// Returns which block contains the given position, and converts it to be local to that block.
+	// The result can be null if the neighbor is missing.
+	inline const VoxelBuffer *get_block_and_local_position(int &x, int &y, int &z) const {
+		x -= _min_padding.x;
+		y -= _min_padding.y;
+		z -= _min_padding.z;
+		const unsigned int bx = get_block_coordinate(x, _block_size.x);
+		const unsigned int by = get_block_coordinate(y, _block_size.y);
+		const unsigned int bz = get_block_coordinate(z, _block_size.z);
+		return _blocks[bx + 3 * by + 9 * bz];
+	}
+
+	// Tells if the block at the given index has voxels within the padding
+	bool is_block_viewed(unsigned int i) const;
+
+	static inline unsigned int get_block_coordinate(int &x, int block_size) {
+		if (x < 0) {
+			x += block_size;
+			return 0;
+		}
+		if (x >= block_size) {
+			x -= block_size;
+			return 2;
+		}
+		return 1;
+	}
+
+	FixedArray<const VoxelBuffer *, Cube::MOORE_AREA_3D_COUNT> _blocks;
+	Vector3i _block_size;
+	Vector3i _min_padding;
+	Vector3i _size;
+};
+
+#endif // VOXEL_BLOCK_NEIGHBORHOOD_H
@@ -6,6 +6,7 @@
 
 #include "../edition/voxel_tool_buffer.h"
 #include "voxel_buffer.h"
+#include "voxel_buffer_kernels.h"
 
 #include <core/func_ref.h>
 #include <core/image.h>
@@ -13,21 +14,38 @@
 #include <core/math/math_funcs.h>
 #include <string.h>
 
+#include <algorithm>
+#include <atomic>
+
 namespace {
 
+// Channel data is preceded by a count of channels sharing it.
+// The header is 8 bytes so 64-bit values that follow remain aligned.
+typedef std::atomic<uint32_t> ChannelDataRefCount;
+const uint32_t CHANNEL_DATA_HEADER_SIZE = 8;
+static_assert(sizeof(ChannelDataRefCount) <= CHANNEL_DATA_HEADER_SIZE, "Channel data header is too small");
+
+inline ChannelDataRefCount &get_channel_data_ref_count(uint8_t *data) {
+	return *reinterpret_cast<ChannelDataRefCount *>(data - CHANNEL_DATA_HEADER_SIZE);
+}
+
 inline uint8_t *allocate_channel_data(uint32_t size) {
 #ifdef VOXEL_BUFFER_USE_MEMORY_POOL
-	return VoxelMemoryPool::get_singleton()->allocate(size);
+	uint8_t *block = VoxelMemoryPool::get_singleton()->allocate(size + CHANNEL_DATA_HEADER_SIZE);
 #else
-	return (uint8_t *)memalloc(size * sizeof(uint8_t));
+	uint8_t *block = (uint8_t *)memalloc((size + CHANNEL_DATA_HEADER_SIZE) * sizeof(uint8_t));
 #endif
+	ChannelDataRefCount *ref_count = memnew_placement(block, ChannelDataRefCount);
+	ref_count->store(1);
+	return block + CHANNEL_DATA_HEADER_SIZE;
 }
 
 inline void free_channel_data(uint8_t *data, uint32_t size) {
+	uint8_t *block = data - CHANNEL_DATA_HEADER_SIZE;
 #ifdef VOXEL_BUFFER_USE_MEMORY_POOL
-	VoxelMemoryPool::get_singleton()->recycle(data, size);
+	VoxelMemoryPool::get_singleton()->recycle(block, size + CHANNEL_DATA_HEADER_SIZE);
 #else
-	memfree(data);
+	memfree(block);
 #endif
 }
 
@@ -86,26 +104,19 @@ inline uint64_t real_to_raw_voxel(real_t value, VoxelBuffer::Depth depth) {
 	}
 }
 
-inline real_t raw_voxel_to_real(uint64_t value, VoxelBuffer::Depth depth) {
-	// Depths below 32 are normalized between -1 and 1
+inline uint64_t read_raw_value(const uint8_t *data, uint32_t i, VoxelBuffer::Depth depth) {
 	switch (depth) {
 		case VoxelBuffer::DEPTH_8_BIT:
-			return VoxelBuffer::u8_to_norm(value);
+			return data[i];
 
 		case VoxelBuffer::DEPTH_16_BIT:
-			return VoxelBuffer::u16_to_norm(value);
+			return reinterpret_cast<const uint16_t *>(data)[i];
 
-		case VoxelBuffer::DEPTH_32_BIT: {
-			MarshallFloat m;
-			m.i = value;
-			return m.f;
-		}
+		case VoxelBuffer::DEPTH_32_BIT:
+			return reinterpret_cast<const uint32_t *>(data)[i];
 
-		case VoxelBuffer::DEPTH_64_BIT: {
-			MarshallDouble m;
-			m.l = value;
-			return m.d;
-		}
+		case VoxelBuffer::DEPTH_64_BIT:
+			return reinterpret_cast<const uint64_t *>(data)[i];
 
 		default:
 			CRASH_NOW();
@@ -113,6 +124,117 @@ inline real_t raw_voxel_to_real(uint64_t value, VoxelBuffer::Depth depth) {
 	}
 }
 
+inline void write_raw_value(uint8_t *data, uint32_t i, uint64_t value, VoxelBuffer::Depth depth) {
+	switch (depth) {
+		case VoxelBuffer::DEPTH_8_BIT:
+			data[i] = value;
+			break;
+
+		case VoxelBuffer::DEPTH_16_BIT:
+			reinterpret_cast<uint16_t *>(data)[i] = value;
+			break;
+
+		case VoxelBuffer::DEPTH_32_BIT:
+			reinterpret_cast<uint32_t *>(data)[i] = value;
+			break;
+
+		case VoxelBuffer::DEPTH_64_BIT:
+			reinterpret_cast<uint64_t *>(data)[i] = value;
+			break;
+
+		default:
+			CRASH_NOW();
+			break;
+	}
+}
+
+// Writes `count` times the same value, starting at index `i`
+inline void fill_raw_values(uint8_t *data, uint32_t i, uint32_t count, uint64_t value, VoxelBuffer::Depth depth) {
+	switch (depth) {
+		case VoxelBuffer::DEPTH_8_BIT:
+			VoxelBufferKernels::fill_row<uint8_t>(data + i, value, count);
+			break;
+
+		case VoxelBuffer::DEPTH_16_BIT:
+			VoxelBufferKernels::fill_row<uint16_t>(reinterpret_cast<uint16_t *>(data) + i, value, count);
+			break;
+
+		case VoxelBuffer::DEPTH_32_BIT:
+			VoxelBufferKernels::fill_row<uint32_t>(reinterpret_cast<uint32_t *>(data) + i, value, count);
+			break;
+
+		case VoxelBuffer::DEPTH_64_BIT:
+			VoxelBufferKernels::fill_row<uint64_t>(reinterpret_cast<uint64_t *>(data) + i, value, count);
+			break;
+
+		default:
+			CRASH_NOW();
+			break;
+	}
+}
+
+// Writes `count` values taken every two values of the source, starting at index `src_i`
+inline void downscale_raw_values(uint8_t *dst, uint32_t dst_i, const uint8_t *src, uint32_t src_i, uint32_t count,
+		VoxelBuffer::Depth depth) {
+	switch (depth) {
+		case VoxelBuffer::DEPTH_8_BIT:
+			VoxelBufferKernels::downscale_row(dst + dst_i, src + src_i, count);
+			break;
+
+		case VoxelBuffer::DEPTH_16_BIT:
+			VoxelBufferKernels::downscale_row(reinterpret_cast<uint16_t *>(dst) + dst_i,
+					reinterpret_cast<const uint16_t *>(src) + src_i, count);
+			break;
+
+		case VoxelBuffer::DEPTH_32_BIT:
+			VoxelBufferKernels::downscale_row(reinterpret_cast<uint32_t *>(dst) + dst_i,
+					reinterpret_cast<const uint32_t *>(src) + src_i, count);
+			break;
+
+		case VoxelBuffer::DEPTH_64_BIT:
+			VoxelBufferKernels::downscale_row(reinterpret_cast<uint64_t *>(dst) + dst_i,
+					reinterpret_cast<const uint64_t *>(src) + src_i, count);
+			break;
+
+		default:
+			CRASH_NOW();
+			break;
+	}
+}
+
+inline uint32_t get_palette_indices_size_in_bytes(uint32_t volume, unsigned int index_bits) {
+	return (volume * index_bits + 7) >> 3;
+}
+
+inline unsigned int read_palette_index(const uint8_t *indices, uint32_t i, unsigned int index_bits) {
+	const uint32_t bit_pos = i * index_bits;
+	return (indices[bit_pos >> 3] >> (bit_pos & 7)) & ((1 << index_bits) - 1);
+}
+
+inline void write_palette_index(uint8_t *indices, uint32_t i, unsigned int index_bits, unsigned int index) {
+	const uint32_t bit_pos = i * index_bits;
+	const unsigned int shift = bit_pos & 7;
+	const uint8_t mask = ((1 << index_bits) - 1) << shift;
+	uint8_t &b = indices[bit_pos >> 3];
+	b = (b & ~mask) | ((index << shift) & mask);
+}
+
+// A palette is only worth it if indices are at most half as large as values
+inline unsigned int get_max_palette_index_bits(VoxelBuffer::Depth depth) {
+	return MIN(VoxelBuffer::MAX_PALETTE_INDEX_BITS, get_depth_bit_count(depth) / 2);
+}
+
+// Run ends are stored first, then values, aligned so they can be read with their own type
+inline uint32_t get_rle_values_offset(uint32_t run_count) {
+	return (run_count * sizeof(uint32_t) + 7) & ~7;
+}
+
+inline uint32_t get_rle_size_in_bytes(uint32_t run_count, VoxelBuffer::Depth depth) {
+	const uint32_t size_in_bytes = get_rle_values_offset(run_count) + run_count * (get_depth_bit_count(depth) >> 3);
+	// Allocations are recycled by size in the memory pool, so only a few sizes are used
+	return next_power_of_2(size_in_bytes);
+}
+
 } // namespace
 
 const char *VoxelBuffer::CHANNEL_ID_HINT_STRING = "Type,Sdf,Data2,Data3,Data4,Data5,Data6,Data7";
@@ -120,17 +242,52 @@ const char *VoxelBuffer::CHANNEL_ID_HINT_STRING = "Type,Sdf,Data2,Data3,Data4,Da
 VoxelBuffer::VoxelBuffer() {
 	// Minecraft uses way more than 255 block types and there is room for eventual metadata such as rotation
 	_channels[CHANNEL_TYPE].depth = VoxelBuffer::DEFAULT_TYPE_CHANNEL_DEPTH;
-	_channels[CHANNEL_TYPE].defval = 0;
+	_channels[CHANNEL_TYPE].defval = get_default_channel_value(CHANNEL_TYPE);
 
 	// 16-bit is better on average to handle large worlds
 	_channels[CHANNEL_SDF].depth = VoxelBuffer::DEFAULT_SDF_CHANNEL_DEPTH;
-	_channels[CHANNEL_SDF].defval = 0xffff;
+	_channels[CHANNEL_SDF].defval = get_default_channel_value(CHANNEL_SDF);
 }
 
 VoxelBuffer::~VoxelBuffer() {
 	clear();
 }
 
+real_t VoxelBuffer::raw_voxel_to_real(uint64_t value, Depth depth) {
+	// Depths below 32 are normalized between -1 and 1
+	switch (depth) {
+		case VoxelBuffer::DEPTH_8_BIT:
+			return VoxelBuffer::u8_to_norm(value);
+
+		case VoxelBuffer::DEPTH_16_BIT:
+			return VoxelBuffer::u16_to_norm(value);
+
+		case VoxelBuffer::DEPTH_32_BIT: {
+			MarshallFloat m;
+			m.i = value;
+			return m.f;
+		}
+
+		case VoxelBuffer::DEPTH_64_BIT: {
+			MarshallDouble m;
+			m.l = value;
+			return m.d;
+		}
+
+		default:
+			CRASH_NOW();
+			return 0;
+	}
+}
+
+uint64_t VoxelBuffer::get_default_channel_value(unsigned int channel_index) {
+	// SDF defaults to the maximum distance, as if there was only air
+	if (channel_index == CHANNEL_SDF) {
+		return 0xffff;
+	}
+	return 0;
+}
+
 void VoxelBuffer::create(unsigned int sx, unsigned int sy, unsigned int sz) {
 	ERR_FAIL_COND(sx > MAX_SIZE || sy > MAX_SIZE || sz > MAX_SIZE);
 
@@ -192,25 +349,7 @@ uint64_t VoxelBuffer::get_voxel(int x, int y, int z, unsigned int channel_index)
 	const Channel &channel = _channels[channel_index];
 
 	if (is_position_valid(x, y, z) && channel.data != nullptr) {
-		const uint32_t i = get_index(x, y, z);
-
-		switch (channel.depth) {
-			case DEPTH_8_BIT:
-				return channel.data[i];
-
-			case DEPTH_16_BIT:
-				return reinterpret_cast<uint16_t *>(channel.data)[i];
-
-			case DEPTH_32_BIT:
-				return reinterpret_cast<uint32_t *>(channel.data)[i];
-
-			case DEPTH_64_BIT:
-				return reinterpret_cast<uint64_t *>(channel.data)[i];
-
-			default:
-				CRASH_NOW();
-				return 0;
-		}
+		return read_channel_value(channel, get_index(x, y, z));
 
 	} else {
 		return channel.defval;
@@ -233,32 +372,119 @@ void VoxelBuffer::set_voxel(uint64_t value, int x, int y, int z, unsigned int ch
 		} else {
 			do_set = false;
 		}
+
+	} else if (channel.run_count != 0) {
+		if (read_channel_value(channel, get_index(x, y, z)) == value) {
+			do_set = false;
+		} else {
+			// Runs would have to be split, so the channel stays decompressed until it gets compressed again
+			decompress_channel(channel_index);
+		}
 	}
 
 	if (do_set) {
 		const uint32_t i = get_index(x, y, z);
+		make_channel_unique(channel);
+
+		if (channel.palette != nullptr) {
+			set_voxel_in_palette(channel_index, i, value);
+		} else {
+			write_raw_value(channel.data, i, value, channel.depth);
+		}
+	}
+}
+
+uint64_t VoxelBuffer::read_channel_value(const Channel &channel, uint32_t i) {
+	if (channel.palette != nullptr) {
+		return channel.palette->values[read_palette_index(channel.data, i, channel.palette->index_bits)];
+	}
+	if (channel.run_count != 0) {
+		return get_rle_run_value(channel, find_rle_run(channel, i));
+	}
+	return read_raw_value(channel.data, i, channel.depth);
+}
+
+uint32_t VoxelBuffer::find_rle_run(const Channel &channel, uint32_t i) {
+	// Runs are sorted by where they end, so the run containing `i` is the first one ending after it
+	const uint32_t *run_ends = reinterpret_cast<const uint32_t *>(channel.data);
+	return std::upper_bound(run_ends, run_ends + channel.run_count, i) - run_ends;
+}
+
+uint32_t VoxelBuffer::get_rle_run_end(const Channel &channel, uint32_t run_index) {
+	return reinterpret_cast<const uint32_t *>(channel.data)[run_index];
+}
+
+uint64_t VoxelBuffer::get_rle_run_value(const Channel &channel, uint32_t run_index) {
+	return read_raw_value(channel.data + get_rle_values_offset(channel.run_count), run_index, channel.depth);
+}
+
+void VoxelBuffer::set_voxel_in_palette(unsigned int channel_index, uint32_t i, uint64_t value) {
+	Channel &channel = _channels[channel_index];
+	Palette &palette = *channel.palette;
+
+	unsigned int palette_index = 0;
+	while (palette_index < palette.values.size() && palette.values[palette_index] != value) {
+		++palette_index;
+	}
+
+	if (palette_index == palette.values.size()) {
+		if (palette.values.size() == (1u << palette.index_bits)) {
+			// Indices are too small to refer to one more value
+			const unsigned int new_index_bits = palette.index_bits * 2;
+			if (new_index_bits > get_max_palette_index_bits(channel.depth)) {
+				// The palette would no longer save memory
+				decompress_channel(channel_index);
+				write_raw_value(channel.data, i, value, channel.depth);
+				return;
+			}
+			repack_palette_channel(channel_index, new_index_bits);
+		}
+		palette.values.push_back(value);
+	}
+
+	write_palette_index(channel.data, i, palette.index_bits, palette_index);
+}
+
+void VoxelBuffer::repack_palette_channel(unsigned int channel_index, unsigned int new_index_bits) {
+	Channel &channel = _channels[channel_index];
+	const unsigned int old_index_bits = channel.palette->index_bits;
+	const uint32_t volume = get_volume();
 
-		switch (channel.depth) {
-			case DEPTH_8_BIT:
-				channel.data[i] = value;
-				break;
+	const uint32_t new_size_in_bytes = get_palette_indices_size_in_bytes(volume, new_index_bits);
+	uint8_t *new_indices = allocate_channel_data(new_size_in_bytes);
+	memset(new_indices, 0, new_size_in_bytes);
 
-			case DEPTH_16_BIT:
-				reinterpret_cast<uint16_t *>(channel.data)[i] = value;
-				break;
+	for (uint32_t i = 0; i < volume; ++i) {
+		write_palette_index(new_indices, i, new_index_bits, read_palette_index(channel.data, i, old_index_bits));
+	}
 
-			case DEPTH_32_BIT:
-				reinterpret_cast<uint32_t *>(channel.data)[i] = value;
-				break;
+	free_channel_data(channel.data, channel.size_in_bytes);
+	channel.data = new_indices;
+	channel.size_in_bytes = new_size_in_bytes;
+	channel.palette->index_bits = new_index_bits;
+}
 
-			case DEPTH_64_BIT:
-				reinterpret_cast<uint64_t *>(channel.data)[i] = value;
-				break;
+void VoxelBuffer::decode_channel(const Channel &channel, uint32_t volume, uint8_t *dst) {
+	if (channel.palette != nullptr) {
+		const Palette &palette = *channel.palette;
+		for (uint32_t i = 0; i < volume; ++i) {
+			const unsigned int palette_index = read_palette_index(channel.data, i, palette.index_bits);
+			write_raw_value(dst, i, palette.values[palette_index], channel.depth);
+		}
 
-			default:
-				CRASH_NOW();
-				break;
+	} else if (channel.run_count != 0) {
+		uint32_t i = 0;
+		for (uint32_t run_index = 0; run_index < channel.run_count; ++run_index) {
+			const uint32_t run_end = get_rle_run_end(channel, run_index);
+			const uint64_t v = get_rle_run_value(channel, run_index);
+			for (; i < run_end; ++i) {
+				write_raw_value(dst, i, v, channel.depth);
+			}
 		}
+		CRASH_COND(i != volume);
+
+	} else {
+		CRASH_NOW_MSG("Channel is not encoded");
 	}
 }
 
@@ -291,35 +517,13 @@ void VoxelBuffer::fill(uint64_t defval, unsigned int channel_index) {
 		}
 	}
 
-	unsigned int volume = get_volume();
-
-	switch (channel.depth) {
-		case DEPTH_8_BIT:
-			memset(channel.data, defval, channel.size_in_bytes);
-			break;
-
-		case DEPTH_16_BIT:
-			for (uint32_t i = 0; i < volume; ++i) {
-				reinterpret_cast<uint16_t *>(channel.data)[i] = defval;
-			}
-			break;
-
-		case DEPTH_32_BIT:
-			for (uint32_t i = 0; i < volume; ++i) {
-				reinterpret_cast<uint32_t *>(channel.data)[i] = defval;
-			}
-			break;
-
-		case DEPTH_64_BIT:
-			for (uint32_t i = 0; i < volume; ++i) {
-				reinterpret_cast<uint64_t *>(channel.data)[i] = defval;
-			}
-			break;
-
-		default:
-			CRASH_NOW();
-			break;
+	if (is_channel_encoded(channel) || is_channel_shared(channel)) {
+		// Encoding would end up with a single value, and shared data doesn't need to be copied to be overwritten
+		clear_channel(channel_index, defval);
+		return;
 	}
+
+	fill_raw_values(channel.data, 0, get_volume(), defval, channel.depth);
 }
 
 void VoxelBuffer::fill_area(uint64_t defval, Vector3i min, Vector3i max, unsigned int channel_index) {
@@ -344,43 +548,23 @@ void VoxelBuffer::fill_area(uint64_t defval, Vector3i min, Vector3i max, unsigne
 		} else {
 			create_channel(channel_index, _size, channel.defval);
 		}
+
+	} else if (is_channel_encoded(channel)) {
+		// Rows are filled directly
+		decompress_channel(channel_index);
+
+	} else {
+		make_channel_unique(channel);
 	}
 
 	Vector3i pos;
 	unsigned int volume = get_volume();
 	for (pos.z = min.z; pos.z < max.z; ++pos.z) {
 		for (pos.x = min.x; pos.x < max.x; ++pos.x) {
-			unsigned int dst_ri = get_index(pos.x, pos.y + min.y, pos.z);
+			// Fill row by row
+			const unsigned int dst_ri = get_index(pos.x, pos.y + min.y, pos.z);
 			CRASH_COND(dst_ri >= volume);
-
-			switch (channel.depth) {
-				case DEPTH_8_BIT:
-					// Fill row by row
-					memset(&channel.data[dst_ri], defval, area_size.y * sizeof(uint8_t));
-					break;
-
-				case DEPTH_16_BIT:
-					for (int i = 0; i < area_size.y; ++i) {
-						((uint16_t *)channel.data)[dst_ri + i] = defval;
-					}
-					break;
-
-				case DEPTH_32_BIT:
-					for (int i = 0; i < area_size.y; ++i) {
-						((uint32_t *)channel.data)[dst_ri + i] = defval;
-					}
-					break;
-
-				case DEPTH_64_BIT:
-					for (int i = 0; i < area_size.y; ++i) {
-						((uint64_t *)channel.data)[dst_ri + i] = defval;
-					}
-					break;
-
-				default:
-					CRASH_NOW();
-					break;
-			}
+			fill_raw_values(channel.data, dst_ri, area_size.y, defval, channel.depth);
 		}
 	}
 }
@@ -413,6 +597,23 @@ bool VoxelBuffer::is_uniform(unsigned int channel_index) const {
 
 	unsigned int volume = get_volume();
 
+	if (channel.palette != nullptr) {
+		// Values in the palette are all different, so comparing indices is enough
+		const unsigned int index_bits = channel.palette->index_bits;
+		const unsigned int i0 = read_palette_index(channel.data, 0, index_bits);
+		for (unsigned int i = 1; i < volume; ++i) {
+			if (read_palette_index(channel.data, i, index_bits) != i0) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	if (channel.run_count != 0) {
+		// Consecutive runs never have the same value
+		return channel.run_count == 1;
+	}
+
 	// Channel isn't optimized, so must look at each voxel
 	switch (channel.depth) {
 		case DEPTH_8_BIT:
@@ -434,16 +635,181 @@ bool VoxelBuffer::is_uniform(unsigned int channel_index) const {
 void VoxelBuffer::compress_uniform_channels() {
 	for (unsigned int i = 0; i < MAX_CHANNELS; ++i) {
 		if (_channels[i].data && is_uniform(i)) {
-			clear_channel(i, _channels[i].data[0]);
+			clear_channel(i, get_voxel(0, 0, 0, i));
+		}
+	}
+}
+
+void VoxelBuffer::compress_palette_channels() {
+	for (unsigned int channel_index = 0; channel_index < MAX_CHANNELS; ++channel_index) {
+		const Channel &channel = _channels[channel_index];
+		if (channel.data != nullptr && !is_channel_encoded(channel)) {
+			compress_channel_to_palette(channel_index);
+		}
+	}
+}
+
+bool VoxelBuffer::compress_channel(unsigned int channel_index, Compression compression) {
+	ERR_FAIL_INDEX_V(channel_index, MAX_CHANNELS, false);
+
+	const Compression current_compression = get_channel_compression(channel_index);
+	if (current_compression == compression ||
+			(current_compression == COMPRESSION_UNIFORM && compression != COMPRESSION_NONE)) {
+		return true;
+	}
+
+	switch (compression) {
+		case COMPRESSION_NONE:
+			decompress_channel(channel_index);
+			return true;
+
+		case COMPRESSION_UNIFORM:
+			if (is_uniform(channel_index)) {
+				clear_channel(channel_index, get_voxel(0, 0, 0, channel_index));
+				return true;
+			}
+			return false;
+
+		case COMPRESSION_PALETTE:
+			return compress_channel_to_palette(channel_index);
+
+		case COMPRESSION_RLE:
+			return compress_channel_to_rle(channel_index);
+
+		default:
+			ERR_PRINT("Unhandled compression mode");
+			return false;
+	}
+}
+
+bool VoxelBuffer::compress_channel_to_palette(unsigned int channel_index) {
+	Channel &channel = _channels[channel_index];
+	CRASH_COND(channel.data == nullptr);
+
+	const uint32_t volume = get_volume();
+	const unsigned int max_palette_size = 1 << get_max_palette_index_bits(channel.depth);
+	std::vector<uint64_t> values;
+	std::vector<uint8_t> indices;
+	indices.resize(volume);
+	unsigned int palette_index = 0;
+
+	for (uint32_t i = 0; i < volume; ++i) {
+		const uint64_t v = read_channel_value(channel, i);
+
+		// Consecutive voxels often have the same value
+		if (palette_index >= values.size() || values[palette_index] != v) {
+			palette_index = 0;
+			while (palette_index < values.size() && values[palette_index] != v) {
+				++palette_index;
+			}
+			if (palette_index == values.size()) {
+				if (values.size() == max_palette_size) {
+					// Too many different values
+					return false;
+				}
+				values.push_back(v);
+			}
+		}
+
+		indices[i] = palette_index;
+	}
+
+	if (values.size() == 1) {
+		clear_channel(channel_index, values[0]);
+		return true;
+	}
+
+	unsigned int index_bits = 1;
+	while ((1u << index_bits) < values.size()) {
+		index_bits *= 2;
+	}
+
+	const uint32_t size_in_bytes = get_palette_indices_size_in_bytes(volume, index_bits);
+	uint8_t *packed_indices = allocate_channel_data(size_in_bytes);
+	memset(packed_indices, 0, size_in_bytes);
+	for (uint32_t i = 0; i < volume; ++i) {
+		write_palette_index(packed_indices, i, index_bits, indices[i]);
+	}
+
+	delete_channel(channel_index);
+	channel.data = packed_indices;
+	channel.size_in_bytes = size_in_bytes;
+	channel.palette = memnew(Palette);
+	channel.palette->values = values;
+	channel.palette->index_bits = index_bits;
+	return true;
+}
+
+bool VoxelBuffer::compress_channel_to_rle(unsigned int channel_index) {
+	Channel &channel = _channels[channel_index];
+	CRASH_COND(channel.data == nullptr);
+
+	const uint32_t volume = get_volume();
+	const uint32_t max_size_in_bytes = get_size_in_bytes_for_volume(_size, channel.depth);
+
+	// Count runs first, giving up as soon as they would take as much memory as uncompressed values
+	uint32_t run_count = 1;
+	uint64_t prev_value = read_channel_value(channel, 0);
+	for (uint32_t i = 1; i < volume; ++i) {
+		const uint64_t v = read_channel_value(channel, i);
+		if (v != prev_value) {
+			++run_count;
+			if (get_rle_size_in_bytes(run_count, channel.depth) >= max_size_in_bytes) {
+				return false;
+			}
+			prev_value = v;
+		}
+	}
+
+	if (run_count == 1) {
+		clear_channel(channel_index, prev_value);
+		return true;
+	}
+
+	const uint32_t size_in_bytes = get_rle_size_in_bytes(run_count, channel.depth);
+	uint8_t *rle_data = allocate_channel_data(size_in_bytes);
+	uint32_t *run_ends = reinterpret_cast<uint32_t *>(rle_data);
+	uint8_t *run_values = rle_data + get_rle_values_offset(run_count);
+
+	uint32_t run_index = 0;
+	prev_value = read_channel_value(channel, 0);
+	for (uint32_t i = 1; i < volume; ++i) {
+		const uint64_t v = read_channel_value(channel, i);
+		if (v != prev_value) {
+			run_ends[run_index] = i;
+			write_raw_value(run_values, run_index, prev_value, channel.depth);
+			++run_index;
+			prev_value = v;
 		}
 	}
+	run_ends[run_index] = volume;
+	write_raw_value(run_values, run_index, prev_value, channel.depth);
+
+	delete_channel(channel_index);
+	channel.data = rle_data;
+	channel.size_in_bytes = size_in_bytes;
+	channel.run_count = run_count;
+	return true;
 }
 
 void VoxelBuffer::decompress_channel(unsigned int channel_index) {
 	ERR_FAIL_INDEX(channel_index, MAX_CHANNELS);
 	Channel &channel = _channels[channel_index];
-	if (channel.data == nullptr) {
+
+	if (is_channel_encoded(channel)) {
+		const uint32_t size_in_bytes = get_size_in_bytes_for_volume(_size, channel.depth);
+		uint8_t *data = allocate_channel_data(size_in_bytes);
+		decode_channel(channel, get_volume(), data);
+		delete_channel(channel_index);
+		channel.data = data;
+		channel.size_in_bytes = size_in_bytes;
+
+	} else if (channel.data == nullptr) {
 		create_channel(channel_index, _size, channel.defval);
+
+	} else {
+		// The channel may be written through `get_channel_raw` after this
+		make_channel_unique(channel);
 	}
 }
 
@@ -453,9 +819,30 @@ VoxelBuffer::Compression VoxelBuffer::get_channel_compression(unsigned int chann
 	if (channel.data == nullptr) {
 		return COMPRESSION_UNIFORM;
 	}
+	if (channel.palette != nullptr) {
+		return COMPRESSION_PALETTE;
+	}
+	if (channel.run_count != 0) {
+		return COMPRESSION_RLE;
+	}
 	return COMPRESSION_NONE;
 }
 
+uint32_t VoxelBuffer::get_channels_size_in_bytes() const {
+	uint32_t size_in_bytes = 0;
+	for (unsigned int i = 0; i < MAX_CHANNELS; ++i) {
+		const Channel &channel = _channels[i];
+		if (channel.data == nullptr) {
+			continue;
+		}
+		size_in_bytes += channel.size_in_bytes;
+		if (channel.palette != nullptr) {
+			size_in_bytes += channel.palette->values.size() * sizeof(uint64_t);
+		}
+	}
+	return size_in_bytes;
+}
+
 void VoxelBuffer::copy_format(const VoxelBuffer &other) {
 	for (unsigned int i = 0; i < MAX_CHANNELS; ++i) {
 		set_channel_depth(i, other.get_channel_depth(i));
@@ -478,15 +865,21 @@ void VoxelBuffer::copy_from(const VoxelBuffer &other, unsigned int channel_index
 
 	ERR_FAIL_COND(other_channel.depth != channel.depth);
 
-	if (other_channel.data != nullptr) {
-		if (channel.data == nullptr) {
-			create_channel_noinit(channel_index, _size);
-		}
-		CRASH_COND(channel.size_in_bytes != other_channel.size_in_bytes);
-		memcpy(channel.data, other_channel.data, channel.size_in_bytes);
+	if (channel.data == other_channel.data) {
+		// Already shared, or both uniform
 
-	} else if (channel.data != nullptr) {
-		delete_channel(channel_index);
+	} else {
+		if (channel.data != nullptr) {
+			delete_channel(channel_index);
+		}
+		if (other_channel.data != nullptr) {
+			// Data is not copied, it will be when one of the two buffers writes to it
+			++get_channel_data_ref_count(other_channel.data);
+			channel.data = other_channel.data;
+			channel.palette = other_channel.palette;
+			channel.run_count = other_channel.run_count;
+			channel.size_in_bytes = other_channel.size_in_bytes;
+		}
 	}
 
 	channel.defval = other_channel.defval;
@@ -526,30 +919,38 @@ void VoxelBuffer::copy_from(const VoxelBuffer &other, Vector3i src_min, Vector3i
 
 			if (channel.data == nullptr) {
 				create_channel(channel_index, _size, channel.defval);
+			} else if (is_channel_encoded(channel)) {
+				decompress_channel(channel_index);
+			} else {
+				make_channel_unique(channel);
 			}
 
-			if (channel.depth == DEPTH_8_BIT) {
-				// Native format
-				// Copy row by row
+			if (is_channel_encoded(other_channel)) {
+				// Copy spans of identical values
 				Vector3i pos;
 				for (pos.z = 0; pos.z < area_size.z; ++pos.z) {
 					for (pos.x = 0; pos.x < area_size.x; ++pos.x) {
-						// Row direction is Y
-						const unsigned int src_ri = other.get_index(pos.x + src_min.x, pos.y + src_min.y, pos.z + src_min.z);
-						const unsigned int dst_ri = get_index(pos.x + dst_min.x, pos.y + dst_min.y, pos.z + dst_min.z);
-						memcpy(&channel.data[dst_ri], &other_channel.data[src_ri], area_size.y * sizeof(uint8_t));
+						const unsigned int dst_ri = get_index(pos.x + dst_min.x, dst_min.y, pos.z + dst_min.z);
+						other.for_each_span_in_column(pos.x + src_min.x, pos.z + src_min.z, src_min.y, src_max.y,
+								channel_index, [&channel, dst_ri, src_min](int y_begin, int y_end, uint64_t v) {
+									fill_raw_values(channel.data, dst_ri + y_begin - src_min.y, y_end - y_begin, v,
+											channel.depth);
+								});
 					}
 				}
 
 			} else {
-				// TODO Optimized versions
+				// Native format, both channels have the same depth
+				// Copy row by row
+				const unsigned int item_size = get_depth_bit_count(channel.depth) >> 3;
 				Vector3i pos;
 				for (pos.z = 0; pos.z < area_size.z; ++pos.z) {
 					for (pos.x = 0; pos.x < area_size.x; ++pos.x) {
-						for (pos.y = 0; pos.y < area_size.y; ++pos.y) {
-							const uint64_t v = other.get_voxel(src_min + pos, channel_index);
-							set_voxel(v, dst_min + pos, channel_index);
-						}
+						// Row direction is Y
+						const unsigned int src_ri = other.get_index(pos.x + src_min.x, pos.y + src_min.y, pos.z + src_min.z);
+						const unsigned int dst_ri = get_index(pos.x + dst_min.x, pos.y + dst_min.y, pos.z + dst_min.z);
+						memcpy(&channel.data[dst_ri * item_size], &other_channel.data[src_ri * item_size],
+								area_size.y * item_size);
 					}
 				}
 			}
@@ -578,7 +979,7 @@ Ref<VoxelBuffer> VoxelBuffer::duplicate(bool include_metadata) const {
 
 bool VoxelBuffer::get_channel_raw(unsigned int channel_index, ArraySlice<uint8_t> &slice) const {
 	const Channel &channel = _channels[channel_index];
-	if (channel.data != nullptr) {
+	if (channel.data != nullptr && !is_channel_encoded(channel)) {
 		slice = ArraySlice<uint8_t>(channel.data, 0, channel.size_in_bytes);
 		return true;
 	}
@@ -586,6 +987,29 @@ bool VoxelBuffer::get_channel_raw(unsigned int channel_index, ArraySlice<uint8_t
 	return false;
 }
 
+void VoxelBuffer::decode_channel_raw(unsigned int channel_index, ArraySlice<uint8_t> dst) const {
+	ERR_FAIL_INDEX(channel_index, MAX_CHANNELS);
+	const Channel &channel = _channels[channel_index];
+	ERR_FAIL_COND(dst.size() != get_size_in_bytes_for_volume(_size, channel.depth));
+
+	const uint32_t volume = get_volume();
+
+	if (is_channel_encoded(channel)) {
+		decode_channel(channel, volume, dst.data());
+
+	} else if (channel.data != nullptr) {
+		memcpy(dst.data(), channel.data, channel.size_in_bytes);
+
+	} else if (channel.depth == DEPTH_8_BIT) {
+		memset(dst.data(), channel.defval, dst.size());
+
+	} else {
+		for (uint32_t i = 0; i < volume; ++i) {
+			write_raw_value(dst.data(), i, channel.defval, channel.depth);
+		}
+	}
+}
+
 void VoxelBuffer::create_channel(int i, Vector3i size, uint64_t defval) {
 	create_channel_noinit(i, size);
 	fill(defval, i);
@@ -610,9 +1034,82 @@ void VoxelBuffer::create_channel_noinit(int i, Vector3i size) {
 void VoxelBuffer::delete_channel(int i) {
 	Channel &channel = _channels[i];
 	ERR_FAIL_COND(channel.data == nullptr);
-	free_channel_data(channel.data, channel.size_in_bytes);
+	// Other buffers may still be using the data
+	if (--get_channel_data_ref_count(channel.data) == 0) {
+		free_channel_data(channel.data, channel.size_in_bytes);
+		if (channel.palette != nullptr) {
+			memdelete(channel.palette);
+		}
+	}
 	channel.data = nullptr;
+	channel.palette = nullptr;
 	channel.size_in_bytes = 0;
+	channel.run_count = 0;
+}
+
+bool VoxelBuffer::is_channel_shared(const Channel &channel) {
+	return channel.data != nullptr && get_channel_data_ref_count(channel.data) > 1;
+}
+
+void VoxelBuffer::make_channel_unique(Channel &channel) {
+	if (!is_channel_shared(channel)) {
+		return;
+	}
+
+	uint8_t *data = allocate_channel_data(channel.size_in_bytes);
+	memcpy(data, channel.data, channel.size_in_bytes);
+	Palette *palette = nullptr;
+	if (channel.palette != nullptr) {
+		palette = memnew(Palette(*channel.palette));
+	}
+
+	// Other buffers may have released the data in the meantime, in which case we are the last one using it
+	if (--get_channel_data_ref_count(channel.data) == 0) {
+		free_channel_data(channel.data, channel.size_in_bytes);
+		if (channel.palette != nullptr) {
+			memdelete(channel.palette);
+		}
+	}
+
+	channel.data = data;
+	channel.palette = palette;
+}
+
+void VoxelBuffer::downscale_channel_to(VoxelBuffer &dst, Vector3i src_min, Vector3i dst_min, Vector3i dst_max,
+		unsigned int channel_index) const {
+
+	const Vector3i dst_size = dst_max - dst_min;
+	if (dst_size.x <= 0 || dst_size.y <= 0 || dst_size.z <= 0) {
+		return;
+	}
+
+	const Channel &src_channel = _channels[channel_index];
+	dst.decompress_channel(channel_index);
+	Channel &dst_channel = dst._channels[channel_index];
+
+	// Rows are downscaled one at a time, taking every other voxel along Y
+	Vector3i pos;
+	for (pos.z = dst_min.z; pos.z < dst_max.z; ++pos.z) {
+		for (pos.x = dst_min.x; pos.x < dst_max.x; ++pos.x) {
+			const Vector3i src_pos = src_min + (Vector3i(pos.x, dst_min.y, pos.z) - dst_min) * 2;
+			const uint32_t dst_ri = dst.get_index(pos.x, dst_min.y, pos.z);
+
+			if (is_channel_encoded(src_channel)) {
+				// Spans of identical values are mapped to spans in the destination
+				const int src_y = src_pos.y;
+				for_each_span_in_column(src_pos.x, src_pos.z, src_y, src_y + dst_size.y * 2 - 1, channel_index,
+						[&dst_channel, dst_ri, src_y](int y_begin, int y_end, uint64_t v) {
+							const int i_begin = (y_begin - src_y + 1) / 2;
+							const int i_end = (y_end - src_y + 1) / 2;
+							fill_raw_values(dst_channel.data, dst_ri + i_begin, i_end - i_begin, v, dst_channel.depth);
+						});
+
+			} else {
+				downscale_raw_values(dst_channel.data, dst_ri, src_channel.data,
+						get_index(src_pos.x, src_pos.y, src_pos.z), dst_size.y, dst_channel.depth);
+			}
+		}
+	}
 }
 
 void VoxelBuffer::downscale_to(VoxelBuffer &dst, Vector3i src_min, Vector3i src_max, Vector3i dst_min) const {
@@ -637,6 +1134,17 @@ void VoxelBuffer::downscale_to(VoxelBuffer &dst, Vector3i src_min, Vector3i src_
 
 		// Nearest-neighbor downscaling
 
+		if (src_channel.data == nullptr) {
+			dst.fill_area(src_channel.defval, dst_min, dst_max, channel_index);
+			continue;
+		}
+
+		if (src_channel.depth == dst_channel.depth) {
+			downscale_channel_to(dst, src_min, dst_min, dst_max, channel_index);
+			continue;
+		}
+
+		// Formats differ, values get converted voxel by voxel
 		Vector3i pos;
 		for (pos.z = dst_min.z; pos.z < dst_max.z; ++pos.z) {
 			for (pos.x = dst_min.x; pos.x < dst_max.x; ++pos.x) {
@@ -693,6 +1201,18 @@ bool VoxelBuffer::equals(const VoxelBuffer *p_other) const {
 				return false;
 			}
 
+		} else if (channel.data == other_channel.data) {
+			// Shared data
+
+		} else if (is_channel_encoded(channel) || is_channel_encoded(other_channel)) {
+			// Encodings can differ while values are the same
+			const uint32_t volume = get_volume();
+			for (uint32_t i = 0; i < volume; ++i) {
+				if (read_channel_value(channel, i) != read_channel_value(other_channel, i)) {
+					return false;
+				}
+			}
+
 		} else {
 			CRASH_COND(channel.size_in_bytes != other_channel.size_in_bytes);
 			for (unsigned int i = 0; i < channel.size_in_bytes; ++i) {
@@ -750,9 +1270,9 @@ void VoxelBuffer::set_block_metadata(Variant meta) {
 
 Variant VoxelBuffer::get_voxel_metadata(Vector3i pos) const {
 	ERR_FAIL_COND_V(!is_position_valid(pos), Variant());
-	const Map<Vector3i, Variant>::Element *elem = _voxel_metadata.find(pos);
-	if (elem != nullptr) {
-		return elem->value();
+	const Variant *value = _voxel_metadata.find(get_index(pos.x, pos.y, pos.z));
+	if (value != nullptr) {
+		return *value;
 	} else {
 		return Variant();
 	}
@@ -760,52 +1280,73 @@ Variant VoxelBuffer::get_voxel_metadata(Vector3i pos) const {
 
 void VoxelBuffer::set_voxel_metadata(Vector3i pos, Variant meta) {
 	ERR_FAIL_COND(!is_position_valid(pos));
+	const uint32_t i = get_index(pos.x, pos.y, pos.z);
 	if (meta.get_type() == Variant::NIL) {
-		_voxel_metadata.erase(pos);
+		_voxel_metadata.erase(i);
 	} else {
-		_voxel_metadata[pos] = meta;
+		_voxel_metadata.set(i, meta);
 	}
 }
 
-void VoxelBuffer::for_each_voxel_metadata(Ref<FuncRef> callback) const {
-	ERR_FAIL_COND(callback.is_null());
-	const Map<Vector3i, Variant>::Element *elem = _voxel_metadata.front();
+namespace {
 
-	while (elem != nullptr) {
-		const Variant key = elem->key().to_vec3();
-		const Variant *args[2] = { &key, &elem->value() };
-		Variant::CallError err;
-		callback->call_func(args, 2, err);
+bool call_voxel_metadata_callback(FuncRef &callback, Vector3i pos, const Variant &value) {
+	const Variant key = pos.to_vec3();
+	const Variant *args[2] = { &key, &value };
+	Variant::CallError err;
+	callback.call_func(args, 2, err);
+
+	ERR_FAIL_COND_V_MSG(err.error != Variant::CallError::CALL_OK, false,
+			String("FuncRef call failed at {0}").format(varray(key)));
+	// TODO Can't provide detailed error because FuncRef doesn't give us access to the object
+	// ERR_FAIL_COND_MSG(err.error != Variant::CallError::CALL_OK, false,
+	// 		Variant::get_call_error_text(callback->get_object(), method_name, nullptr, 0, err));
+	return true;
+}
 
-		ERR_FAIL_COND_MSG(err.error != Variant::CallError::CALL_OK,
-				String("FuncRef call failed at {0}").format(varray(key)));
-		// TODO Can't provide detailed error because FuncRef doesn't give us access to the object
-		// ERR_FAIL_COND_MSG(err.error != Variant::CallError::CALL_OK, false,
-		// 		Variant::get_call_error_text(callback->get_object(), method_name, nullptr, 0, err));
+} // namespace
 
-		elem = elem->next();
+void VoxelBuffer::for_each_voxel_metadata(Ref<FuncRef> callback) const {
+	ERR_FAIL_COND(callback.is_null());
+	// The callback may modify metadata, which moves entries around. So they are copied before calling it.
+	std::vector<VoxelMetadataMap::Entry> entries;
+	entries.reserve(_voxel_metadata.size());
+	for (unsigned int i = 0; i < _voxel_metadata.size(); ++i) {
+		entries.push_back(_voxel_metadata.get_entry(i));
+	}
+	for (size_t i = 0; i < entries.size(); ++i) {
+		const VoxelMetadataMap::Entry &entry = entries[i];
+		if (!call_voxel_metadata_callback(**callback, get_position_from_index(entry.index), entry.value)) {
+			return;
+		}
 	}
 }
 
 void VoxelBuffer::for_each_voxel_metadata_in_area(Ref<FuncRef> callback, Rect3i box) const {
 	ERR_FAIL_COND(callback.is_null());
-	const Map<Vector3i, Variant>::Element *elem = _voxel_metadata.front();
-
-	while (elem != nullptr) {
-		if (box.contains(elem->key())) {
-			const Variant key = elem->key().to_vec3();
-			const Variant *args[2] = { &key, &elem->value() };
-			Variant::CallError err;
-			callback->call_func(args, 2, err);
-
-			ERR_FAIL_COND_MSG(err.error != Variant::CallError::CALL_OK,
-					String("FuncRef call failed at {0}").format(varray(key)));
-			// TODO Can't provide detailed error because FuncRef doesn't give us access to the object
-			// ERR_FAIL_COND_MSG(err.error != Variant::CallError::CALL_OK, false,
-			// 		Variant::get_call_error_text(callback->get_object(), method_name, nullptr, 0, err));
+	box.clip(Rect3i(Vector3i(), _size));
+	const Vector3i max_pos = box.pos + box.size;
+
+	// The callback may modify metadata, which moves entries around. So they are copied before calling it.
+	std::vector<VoxelMetadataMap::Entry> entries;
+
+	// Each column of the box is a contiguous range of keys
+	for (int z = box.pos.z; z < max_pos.z; ++z) {
+		for (int x = box.pos.x; x < max_pos.x; ++x) {
+			unsigned int begin;
+			unsigned int end;
+			_voxel_metadata.find_range(get_index(x, box.pos.y, z), get_index(x, max_pos.y, z), begin, end);
+			for (unsigned int i = begin; i < end; ++i) {
+				entries.push_back(_voxel_metadata.get_entry(i));
+			}
+		}
+	}
 
+	for (size_t i = 0; i < entries.size(); ++i) {
+		const VoxelMetadataMap::Entry &entry = entries[i];
+		if (!call_voxel_metadata_callback(**callback, get_position_from_index(entry.index), entry.value)) {
+			return;
 		}
-		elem = elem->next();
 	}
 }
 
@@ -814,45 +1355,62 @@ void VoxelBuffer::clear_voxel_metadata() {
 }
 
 void VoxelBuffer::clear_voxel_metadata_in_area(Rect3i box) {
-	Map<Vector3i, Variant>::Element *elem = _voxel_metadata.front();
-	while (elem != nullptr) {
-		Map<Vector3i, Variant>::Element *next_elem = elem->next();
-		if (box.contains(elem->key())) {
-			_voxel_metadata.erase(elem);
+	struct InBox {
+		const VoxelBuffer &buffer;
+		const Rect3i &box;
+		inline bool operator()(uint32_t i) const {
+			return box.contains(buffer.get_position_from_index(i));
 		}
-		elem = next_elem;
-	}
+	};
+	_voxel_metadata.erase_if(InBox{ *this, box });
 }
 
 void VoxelBuffer::copy_voxel_metadata_in_area(Ref<VoxelBuffer> src_buffer, Rect3i src_box, Vector3i dst_origin) {
 	ERR_FAIL_COND(src_buffer.is_null());
-	ERR_FAIL_COND(src_buffer->is_box_valid(src_box));
+	ERR_FAIL_COND(!src_buffer->is_box_valid(src_box));
 
 	const Rect3i clipped_src_box = src_box.clipped(Rect3i(src_box.pos - dst_origin, _size));
-	const Vector3i clipped_dst_offset = dst_origin + clipped_src_box.pos - src_box.pos;
-
-	const Map<Vector3i, Variant>::Element *elem = src_buffer->_voxel_metadata.front();
-
-	while (elem != nullptr) {
-		const Vector3i src_pos = elem->key();
-		if (src_box.contains(src_pos)) {
-			const Vector3i dst_pos = src_pos + clipped_dst_offset;
-			CRASH_COND(!is_position_valid(dst_pos));
-			_voxel_metadata[dst_pos] = elem->value().duplicate();
+	const Vector3i clipped_src_max = clipped_src_box.pos + clipped_src_box.size;
+	const Vector3i src_to_dst = dst_origin - src_box.pos;
+	const VoxelBuffer &src = **src_buffer;
+
+	// Gather first, in case the source is this buffer
+	std::vector<VoxelMetadataMap::Entry> entries;
+	for (int z = clipped_src_box.pos.z; z < clipped_src_max.z; ++z) {
+		for (int x = clipped_src_box.pos.x; x < clipped_src_max.x; ++x) {
+			unsigned int begin;
+			unsigned int end;
+			src._voxel_metadata.find_range(src.get_index(x, clipped_src_box.pos.y, z),
+					src.get_index(x, clipped_src_max.y, z), begin, end);
+			for (unsigned int i = begin; i < end; ++i) {
+				const VoxelMetadataMap::Entry &src_entry = src._voxel_metadata.get_entry(i);
+				const Vector3i dst_pos = src.get_position_from_index(src_entry.index) + src_to_dst;
+				CRASH_COND(!is_position_valid(dst_pos));
+				entries.push_back(VoxelMetadataMap::Entry{ get_index(dst_pos.x, dst_pos.y, dst_pos.z), src_entry.value });
+			}
 		}
-		elem = elem->next();
+	}
+
+	for (auto it = entries.begin(); it != entries.end(); ++it) {
+		_voxel_metadata.set(it->index, it->value.duplicate());
 	}
 }
 
 void VoxelBuffer::copy_voxel_metadata(const VoxelBuffer &src_buffer) {
 	ERR_FAIL_COND(src_buffer.get_size() != _size);
 
-	const Map<Vector3i, Variant>::Element *elem = src_buffer._voxel_metadata.front();
-
-	while (elem != nullptr) {
-		const Vector3i pos = elem->key();
-		_voxel_metadata[pos] = elem->value().duplicate();
-		elem = elem->next();
+	// Both buffers have the same size, so keys are the same
+	if (_voxel_metadata.is_empty()) {
+		_voxel_metadata = src_buffer._voxel_metadata;
+		for (unsigned int i = 0; i < _voxel_metadata.size(); ++i) {
+			Variant &value = _voxel_metadata.get_entry(i).value;
+			value = value.duplicate();
+		}
+	} else {
+		for (unsigned int i = 0; i < src_buffer._voxel_metadata.size(); ++i) {
+			const VoxelMetadataMap::Entry &entry = src_buffer._voxel_metadata.get_entry(i);
+			_voxel_metadata.set(entry.index, entry.value.duplicate());
+		}
 	}
 
 	_block_metadata = src_buffer._block_metadata.duplicate();
@@ -910,6 +1468,8 @@ void VoxelBuffer::_bind_methods() {
 	ClassDB::bind_method(D_METHOD("is_uniform", "channel"), &VoxelBuffer::is_uniform);
 	// TODO Rename `compress_uniform_channels`
 	ClassDB::bind_method(D_METHOD("optimize"), &VoxelBuffer::compress_uniform_channels);
+	ClassDB::bind_method(D_METHOD("compress_palette_channels"), &VoxelBuffer::compress_palette_channels);
+	ClassDB::bind_method(D_METHOD("compress_channel", "channel", "compression"), &VoxelBuffer::compress_channel);
 	ClassDB::bind_method(D_METHOD("get_channel_compression", "channel"), &VoxelBuffer::get_channel_compression);
 
 	ClassDB::bind_method(D_METHOD("get_block_metadata"), &VoxelBuffer::get_block_metadata);
@@ -942,6 +1502,8 @@ void VoxelBuffer::_bind_methods() {
 
 	BIND_ENUM_CONSTANT(COMPRESSION_NONE);
 	BIND_ENUM_CONSTANT(COMPRESSION_UNIFORM);
+	BIND_ENUM_CONSTANT(COMPRESSION_PALETTE);
+	BIND_ENUM_CONSTANT(COMPRESSION_RLE);
 	BIND_ENUM_CONSTANT(COMPRESSION_COUNT);
 
 	BIND_CONSTANT(MAX_SIZE);
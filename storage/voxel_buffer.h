@@ -5,11 +5,14 @@
 #include "../util/array_slice.h"
 #include "../util/fixed_array.h"
 #include "../util/math/rect3i.h"
+#include "voxel_metadata_map.h"
 
 #include <core/map.h>
 #include <core/reference.h>
 #include <core/vector.h>
 
+#include <vector>
+
 class VoxelTool;
 class Image;
 class FuncRef;
@@ -40,7 +43,8 @@ public:
 	enum Compression {
 		COMPRESSION_NONE = 0,
 		COMPRESSION_UNIFORM,
-		//COMPRESSION_RLE,
+		COMPRESSION_PALETTE,
+		COMPRESSION_RLE,
 		COMPRESSION_COUNT
 	};
 
@@ -56,6 +60,9 @@ public:
 	static const Depth DEFAULT_TYPE_CHANNEL_DEPTH = DEPTH_16_BIT;
 	static const Depth DEFAULT_SDF_CHANNEL_DEPTH = DEPTH_16_BIT;
 
+	// Value of voxels in channels of a newly created buffer
+	static uint64_t get_default_channel_value(unsigned int channel_index);
+
 	// Limit was made explicit for serialization reasons, and also because there must be a reasonable one
 	static const uint32_t MAX_SIZE = 65535;
 
@@ -92,8 +99,22 @@ public:
 	bool is_uniform(unsigned int channel_index) const;
 
 	void compress_uniform_channels();
+	// Stores channels having few distinct values as a palette and bit-packed indices.
+	// Channels with too many values to save memory are left uncompressed.
+	void compress_palette_channels();
+	// Attempts to store a channel with the given compression, whatever its current one is.
+	// Returns true if the channel now uses it, or became uniform. Otherwise the channel is left as it was,
+	// which happens if the compression would not save memory.
+	bool compress_channel(unsigned int channel_index, Compression compression);
+	// Makes the channel a plain array of values owned by this buffer, which `get_channel_raw` can give access to.
 	void decompress_channel(unsigned int channel_index);
 	Compression get_channel_compression(unsigned int channel_index) const;
+	// Memory used by voxels of all channels, including palettes. Metadata is not included.
+	// Channels shared with other buffers are counted in full.
+	uint32_t get_channels_size_in_bytes() const;
+
+	// Largest size of index into the palette of a palette-compressed channel
+	static const unsigned int MAX_PALETTE_INDEX_BITS = 8;
 
 	static uint32_t get_size_in_bytes_for_volume(Vector3i size, Depth depth);
 
@@ -102,34 +123,128 @@ public:
 	// Specialized copy functions.
 	// Note: these functions don't include metadata on purpose.
 	// If you also want to copy metadata, use the specialized functions.
+	// Whole channels are not actually copied: both buffers share them until one of them is modified.
 	void copy_from(const VoxelBuffer &other);
 	void copy_from(const VoxelBuffer &other, unsigned int channel_index);
 	void copy_from(const VoxelBuffer &other, Vector3i src_min, Vector3i src_max, Vector3i dst_min,
 			unsigned int channel_index);
 
 	// Executes a read-write action on all cells of the provided box that intersect with this buffer.
-	// `action_func` receives a voxel value from the channel, and returns a modified value.
-	// if the returned value is different, it will be applied to the buffer.
+	// `action_func` receives a position and a voxel value from the channel, and returns a modified value.
+	// Values are written back clamped to the depth of the channel, like `set_voxel` does.
 	// Can be used to blend voxels together.
+	// The channel gets decompressed, and the depth is only checked once rather than for every voxel.
 	template <typename F>
 	inline void read_write_action(Rect3i box, unsigned int channel_index, F action_func) {
 		ERR_FAIL_INDEX(channel_index, MAX_CHANNELS);
 
 		box.clip(Rect3i(Vector3i(), _size));
-		Vector3i min_pos = box.pos;
-		Vector3i max_pos = box.pos + box.size;
-		Vector3i pos;
-		for (pos.z = min_pos.z; pos.z < max_pos.z; ++pos.z) {
-			for (pos.x = min_pos.x; pos.x < max_pos.x; ++pos.x) {
-				for (pos.y = min_pos.y; pos.y < max_pos.y; ++pos.y) {
-					// TODO Optimization: a bunch of checks and branching could be skipped
-					const uint64_t v0 = get_voxel(pos, channel_index);
-					const uint64_t v1 = action_func(pos, v0);
-					if (v0 != v1) {
-						set_voxel(v1, pos, channel_index);
-					}
+		if (box.size.x <= 0 || box.size.y <= 0 || box.size.z <= 0) {
+			return;
+		}
+
+		decompress_channel(channel_index);
+		Channel &channel = _channels[channel_index];
+
+		switch (channel.depth) {
+			case DEPTH_8_BIT:
+				for_each_value_in_box(reinterpret_cast<uint8_t *>(channel.data), box,
+						RawValueAction<uint8_t, F>(action_func));
+				break;
+			case DEPTH_16_BIT:
+				for_each_value_in_box(reinterpret_cast<uint16_t *>(channel.data), box,
+						RawValueAction<uint16_t, F>(action_func));
+				break;
+			case DEPTH_32_BIT:
+				for_each_value_in_box(reinterpret_cast<uint32_t *>(channel.data), box,
+						RawValueAction<uint32_t, F>(action_func));
+				break;
+			case DEPTH_64_BIT:
+				for_each_value_in_box(reinterpret_cast<uint64_t *>(channel.data), box,
+						RawValueAction<uint64_t, F>(action_func));
+				break;
+			default:
+				CRASH_NOW();
+				break;
+		}
+	}
+
+	// Same as `read_write_action`, but values are seen as floats, the same way `get_voxel_f` and `set_voxel_f` do.
+	// Typically used for signed distance fields.
+	template <typename F>
+	inline void read_write_action_f(Rect3i box, unsigned int channel_index, F action_func) {
+		ERR_FAIL_INDEX(channel_index, MAX_CHANNELS);
+
+		box.clip(Rect3i(Vector3i(), _size));
+		if (box.size.x <= 0 || box.size.y <= 0 || box.size.z <= 0) {
+			return;
+		}
+
+		decompress_channel(channel_index);
+		Channel &channel = _channels[channel_index];
+
+		switch (channel.depth) {
+			case DEPTH_8_BIT:
+				for_each_value_in_box(reinterpret_cast<uint8_t *>(channel.data), box,
+						RealValueAction<uint8_t, F>(action_func));
+				break;
+			case DEPTH_16_BIT:
+				for_each_value_in_box(reinterpret_cast<uint16_t *>(channel.data), box,
+						RealValueAction<uint16_t, F>(action_func));
+				break;
+			case DEPTH_32_BIT:
+				for_each_value_in_box(reinterpret_cast<uint32_t *>(channel.data), box,
+						RealValueAction<uint32_t, F>(action_func));
+				break;
+			case DEPTH_64_BIT:
+				for_each_value_in_box(reinterpret_cast<uint64_t *>(channel.data), box,
+						RealValueAction<uint64_t, F>(action_func));
+				break;
+			default:
+				CRASH_NOW();
+				break;
+		}
+	}
+
+	// Calls `f(y_begin, y_end, value)` for each span of identical values found in the column at (x, z),
+	// between `y_min` included and `y_max` excluded.
+	// This is fast with RLE channels, because their runs go along Y.
+	template <typename F>
+	void for_each_span_in_column(int x, int z, int y_min, int y_max, unsigned int channel_index, F f) const {
+		ERR_FAIL_INDEX(channel_index, MAX_CHANNELS);
+		ERR_FAIL_COND(!is_position_valid(x, y_min, z));
+		ERR_FAIL_COND(y_max > _size.y);
+
+		const Channel &channel = _channels[channel_index];
+		if (channel.data == nullptr) {
+			f(y_min, y_max, channel.defval);
+			return;
+		}
+
+		const uint32_t column_begin = get_index(x, 0, z);
+
+		if (channel.run_count != 0) {
+			uint32_t run_index = find_rle_run(channel, column_begin + y_min);
+			int y = y_min;
+			while (y < y_max) {
+				const int run_end_y = MIN(static_cast<int>(get_rle_run_end(channel, run_index) - column_begin), y_max);
+				f(y, run_end_y, get_rle_run_value(channel, run_index));
+				y = run_end_y;
+				++run_index;
+			}
+
+		} else {
+			int span_begin = y_min;
+			uint64_t span_value = read_channel_value(channel, column_begin + y_min);
+			for (int y = y_min + 1; y < y_max; ++y) {
+				const uint64_t v = read_channel_value(channel, column_begin + y);
+				if (v != span_value) {
+					f(span_begin, y, span_value);
+					span_begin = y;
+					span_value = v;
 				}
 			}
+			f(span_begin, y_max, span_value);
 		}
 	}
 
@@ -172,6 +287,10 @@ public:
 		return y + _size.y * (x + _size.x * z); // ZXY index
 	}
 
+	_FORCE_INLINE_ Vector3i get_position_from_index(unsigned int i) const {
+		return Vector3i::from_zxy_index(i, _size);
+	}
+
 	//	_FORCE_INLINE_ unsigned int row_index(unsigned int x, unsigned int y, unsigned int z) const {
 	//		return _size.y * (x + _size.x * z);
 	//	}
@@ -180,9 +299,30 @@ public:
 		return _size.x * _size.y * _size.z;
 	}
 
-	// TODO Have a template version based on channel depth
+	// Returns false if the channel is not stored as a plain array, in which case `decode_channel_raw` can be used.
+	// The data may be shared with copies of the buffer, so `decompress_channel` must be called before writing to it.
 	bool get_channel_raw(unsigned int channel_index, ArraySlice<uint8_t> &slice) const;
 
+	// Same as `get_channel_raw`, but values are seen with the integer type matching the depth of the channel.
+	// Returns false if the type doesn't match.
+	template <typename T>
+	bool get_channel_data(unsigned int channel_index, ArraySlice<T> &slice) const {
+		ERR_FAIL_INDEX_V(channel_index, MAX_CHANNELS, false);
+		if (sizeof(T) * 8 != get_depth_bit_count(_channels[channel_index].depth)) {
+			return false;
+		}
+		ArraySlice<uint8_t> raw;
+		if (!get_channel_raw(channel_index, raw)) {
+			return false;
+		}
+		slice = raw.reinterpret_cast_to<T>();
+		return true;
+	}
+
+	// Writes all values of a channel into `dst` in the same layout as an uncompressed channel,
+	// whatever compression it uses. `dst` must be `get_size_in_bytes_for_volume` bytes large.
+	void decode_channel_raw(unsigned int channel_index, ArraySlice<uint8_t> dst) const;
+
 	void downscale_to(VoxelBuffer &dst, Vector3i src_min, Vector3i src_max, Vector3i dst_min) const;
 	Ref<VoxelTool> get_voxel_tool();
 
@@ -205,6 +345,9 @@ public:
 		return (static_cast<float>(v) - 0x7fff) * VoxelConstants::INV_0x7fff;
 	}
 
+	// Converts a raw voxel value into a float, the same way `get_voxel_f` does
+	static real_t raw_voxel_to_real(uint64_t value, Depth depth);
+
 	static inline uint8_t norm_to_u8(float v) {
 		return clamp(static_cast<int>(128.f * v + 128.f), 0, 0xff);
 	}
@@ -213,6 +356,46 @@ public:
 		return clamp(static_cast<int>(0x7fff * v + 0x7fff), 0, 0xffff);
 	}
 
+	// Typed versions of `raw_voxel_to_real` and its reverse, for when the depth is known at compile time
+
+	static inline real_t raw_to_real(uint8_t v) {
+		return u8_to_norm(v);
+	}
+
+	static inline real_t raw_to_real(uint16_t v) {
+		return u16_to_norm(v);
+	}
+
+	static inline real_t raw_to_real(uint32_t v) {
+		float f;
+		memcpy(&f, &v, sizeof(f));
+		return f;
+	}
+
+	static inline real_t raw_to_real(uint64_t v) {
+		double d;
+		memcpy(&d, &v, sizeof(d));
+		return d;
+	}
+
+	static inline void real_to_raw(real_t v, uint8_t &out) {
+		out = norm_to_u8(v);
+	}
+
+	static inline void real_to_raw(real_t v, uint16_t &out) {
+		out = norm_to_u16(v);
+	}
+
+	static inline void real_to_raw(real_t v, uint32_t &out) {
+		const float f = v;
+		memcpy(&out, &f, sizeof(out));
+	}
+
+	static inline void real_to_raw(real_t v, uint64_t &out) {
+		const double d = v;
+		memcpy(&out, &d, sizeof(out));
+	}
+
 	/*static inline float quantized_u8_to_real(uint8_t v) {
 		return u8_to_norm(v) * VoxelConstants::QUANTIZED_SDF_8_BITS_SCALE_INV;
 	}
@@ -242,7 +425,8 @@ public:
 	void copy_voxel_metadata_in_area(Ref<VoxelBuffer> src_buffer, Rect3i src_box, Vector3i dst_origin);
 	void copy_voxel_metadata(const VoxelBuffer &src_buffer);
 
-	const Map<Vector3i, Variant> &get_voxel_metadata() const { return _voxel_metadata; }
+	// Keys are voxel indices, see `get_position_from_index`
+	const VoxelMetadataMap &get_voxel_metadata_map() const { return _voxel_metadata; }
 
 	// Internal synchronization.
 	// This lock is optional, and used internally at the moment, only in multithreaded areas.
@@ -254,10 +438,58 @@ public:
 	Ref<Image> debug_print_sdf_to_image_top_down();
 
 private:
+	// Calls `action(pos, value)` with a reference to every value of a decompressed channel within the box.
+	// Inner loop goes along Y, because that's how voxels are laid out in memory.
+	template <typename T, typename A>
+	inline void for_each_value_in_box(T *data, Rect3i box, A action) {
+		const Vector3i max_pos = box.pos + box.size;
+		Vector3i pos;
+		for (pos.z = box.pos.z; pos.z < max_pos.z; ++pos.z) {
+			for (pos.x = box.pos.x; pos.x < max_pos.x; ++pos.x) {
+				T *column = data + get_index(pos.x, 0, pos.z);
+				for (pos.y = box.pos.y; pos.y < max_pos.y; ++pos.y) {
+					action(pos, column[pos.y]);
+				}
+			}
+		}
+	}
+
+	template <typename T, typename F>
+	struct RawValueAction {
+		F &f;
+		RawValueAction(F &p_f) :
+				f(p_f) {}
+		inline void operator()(Vector3i pos, T &value) const {
+			const uint64_t v = f(pos, static_cast<uint64_t>(value));
+			// Largest value that fits in T
+			const uint64_t max_value = static_cast<T>(-1);
+			value = static_cast<T>(MIN(v, max_value));
+		}
+	};
+
+	template <typename T, typename F>
+	struct RealValueAction {
+		F &f;
+		RealValueAction(F &p_f) :
+				f(p_f) {}
+		inline void operator()(Vector3i pos, T &value) const {
+			real_to_raw(f(pos, raw_to_real(value)), value);
+		}
+	};
+
 	void create_channel_noinit(int i, Vector3i size);
 	void create_channel(int i, Vector3i size, uint64_t defval);
 	void delete_channel(int i);
 
+	void set_voxel_in_palette(unsigned int channel_index, uint32_t i, uint64_t value);
+	void repack_palette_channel(unsigned int channel_index, unsigned int new_index_bits);
+	bool compress_channel_to_palette(unsigned int channel_index);
+	bool compress_channel_to_rle(unsigned int channel_index);
+
+	// Fast path of `downscale_to`, when both channels have the same depth
+	void downscale_channel_to(VoxelBuffer &dst, Vector3i src_min, Vector3i dst_min, Vector3i dst_max,
+			unsigned int channel_index) const;
+
 	static void _bind_methods();
 
 	int get_size_x() const { return _size.x; }
@@ -282,11 +514,27 @@ private:
 	void _b_copy_voxel_metadata_in_area(Ref<VoxelBuffer> src_buffer, Vector3 src_min_pos, Vector3 src_max_pos, Vector3 dst_pos);
 
 private:
+	struct Palette {
+		// Distinct values found in the channel. Values are never removed, so some may no longer be used.
+		std::vector<uint64_t> values;
+		// Can be 1, 2, 4 or 8, so indices never straddle two bytes
+		unsigned int index_bits = 1;
+	};
+
 	struct Channel {
 		// Allocated when the channel is populated.
 		// Flat array, in order [z][x][y] because it allows faster vertical-wise access (the engine is Y-up).
+		// If the channel has a palette, it contains bit-packed indices into it instead of values.
+		// It is reference-counted, so copies of the buffer share it until one of them writes to it.
 		uint8_t *data = nullptr;
 
+		// Allocated when the channel is palette-compressed. Shared along with `data`.
+		Palette *palette = nullptr;
+
+		// When not zero, the channel is RLE-compressed along the [z][x][y] order. `data` then contains
+		// the index at which each run ends, followed by the value of each run.
+		uint32_t run_count = 0;
+
 		// Default value when data is null
 		uint64_t defval = 0;
 
@@ -295,6 +543,24 @@ private:
 		uint32_t size_in_bytes = 0;
 	};
 
+	// Tells if `data` is not a plain array of values
+	static inline bool is_channel_encoded(const Channel &channel) {
+		return channel.palette != nullptr || channel.run_count != 0;
+	}
+
+	// Tells if other buffers use the same data
+	static bool is_channel_shared(const Channel &channel);
+	// Gives the channel its own copy of the data if it is shared, so it can be modified.
+	// Must be called before writing into `data` or the palette.
+	static void make_channel_unique(Channel &channel);
+
+	static uint64_t read_channel_value(const Channel &channel, uint32_t i);
+	static void decode_channel(const Channel &channel, uint32_t volume, uint8_t *dst);
+
+	static uint32_t find_rle_run(const Channel &channel, uint32_t i);
+	static uint32_t get_rle_run_end(const Channel &channel, uint32_t run_index);
+	static uint64_t get_rle_run_value(const Channel &channel, uint32_t run_index);
+
 	// Each channel can store arbitary data.
 	// For example, you can decide to store colors (R, G, B, A), gameplay types (type, state, light) or both.
 	FixedArray<Channel, MAX_CHANNELS> _channels;
@@ -303,7 +569,7 @@ private:
 	Vector3i _size;
 
 	Variant _block_metadata;
-	Map<Vector3i, Variant> _voxel_metadata;
+	VoxelMetadataMap _voxel_metadata;
 
 	RWLock _rw_lock;
 };
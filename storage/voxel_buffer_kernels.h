@@ -0,0 +1,88 @@
+#ifndef VOXEL_BUFFER_KERNELS_H
+#define VOXEL_BUFFER_KERNELS_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VOXEL_KERNELS_SSE2
+#include <emmintrin.h>
+#endif
+
+// Loops working on rows of voxels, which are contiguous along Y in VoxelBuffer channels.
+// Fills end up in `memset` or loops the compiler vectorizes, and copies are done with `memcpy`, which already use the widest
+// instructions available on the running CPU. Downscaling needs to pick every other value, which compilers don't
+// vectorize well, so it has an SSE2 version on x86. Other platforms use the scalar version.
+namespace VoxelBufferKernels {
+
+template <typename T>
+inline void fill_row(T *dst, T value, uint32_t count) {
+	std::fill(dst, dst + count, value);
+}
+
+template <>
+inline void fill_row<uint8_t>(uint8_t *dst, uint8_t value, uint32_t count) {
+	memset(dst, value, count);
+}
+
+// dst[i] = src[i * 2]. `src` must have at least `count * 2` values.
+template <typename T>
+inline void downscale_row_scalar(T *dst, const T *src, uint32_t count) {
+	for (uint32_t i = 0; i < count; ++i) {
+		dst[i] = src[i * 2];
+	}
+}
+
+template <typename T>
+inline void downscale_row(T *dst, const T *src, uint32_t count) {
+	downscale_row_scalar(dst, src, count);
+}
+
+#ifdef VOXEL_KERNELS_SSE2
+
+template <>
+inline void downscale_row<uint8_t>(uint8_t *dst, const uint8_t *src, uint32_t count) {
+	const __m128i low_bytes = _mm_set1_epi16(0x00ff);
+	uint32_t i = 0;
+	for (; i + 16 <= count; i += 16) {
+		const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i * 2));
+		const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i * 2 + 16));
+		// Even bytes are the low halves of 16-bit lanes, which fit without saturation
+		const __m128i r = _mm_packus_epi16(_mm_and_si128(a, low_bytes), _mm_and_si128(b, low_bytes));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), r);
+	}
+	downscale_row_scalar(dst + i, src + i * 2, count - i);
+}
+
+template <>
+inline void downscale_row<uint16_t>(uint16_t *dst, const uint16_t *src, uint32_t count) {
+	uint32_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i * 2));
+		const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i * 2 + 8));
+		// Sign-extending even values to 32 bits lets the signed pack keep their bits unchanged
+		const __m128i a32 = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+		const __m128i b32 = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_packs_epi32(a32, b32));
+	}
+	downscale_row_scalar(dst + i, src + i * 2, count - i);
+}
+
+template <>
+inline void downscale_row<uint32_t>(uint32_t *dst, const uint32_t *src, uint32_t count) {
+	uint32_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		const __m128 a = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i * 2)));
+		const __m128 b = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i * 2 + 4)));
+		const __m128 r = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_castps_si128(r));
+	}
+	downscale_row_scalar(dst + i, src + i * 2, count - i);
+}
+
+#endif // VOXEL_KERNELS_SSE2
+
+} // namespace VoxelBufferKernels
+
+#endif // VOXEL_BUFFER_KERNELS_H
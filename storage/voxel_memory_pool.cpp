@@ -6,6 +6,7 @@
 
 namespace {
 VoxelMemoryPool *g_memory_pool = nullptr;
+std::atomic<unsigned int> g_next_thread_cache_index(0);
 } // namespace
 
 void VoxelMemoryPool::create_singleton() {
@@ -25,7 +26,8 @@ VoxelMemoryPool *VoxelMemoryPool::get_singleton() {
 	return g_memory_pool;
 }
 
-VoxelMemoryPool::VoxelMemoryPool() {
+VoxelMemoryPool::VoxelMemoryPool() :
+		_used_bytes(0), _peak_used_bytes(0) {
 }
 
 VoxelMemoryPool::~VoxelMemoryPool() {
@@ -39,29 +41,188 @@ VoxelMemoryPool::~VoxelMemoryPool() {
 
 uint8_t *VoxelMemoryPool::allocate(uint32_t size) {
 	VOXEL_PROFILE_SCOPE();
-	MutexLock lock(_mutex);
-	Pool *pool = get_or_create_pool(size);
-	uint8_t *block;
-	if (pool->blocks.size() > 0) {
-		block = pool->blocks.back();
-		pool->blocks.pop_back();
-	} else {
+	uint8_t *block = nullptr;
+	{
+		ThreadCache &cache = get_thread_cache();
+		MutexLock lock(cache.mutex);
+		ThreadCache::Bucket &bucket = cache.get_or_create_bucket(size);
+		if (bucket.blocks.size() == 0) {
+			take_batch(size, bucket.blocks);
+		}
+		if (bucket.blocks.size() > 0) {
+			block = bucket.blocks.back();
+			bucket.blocks.pop_back();
+		}
+		++bucket.allocated_count;
+	}
+	if (block == nullptr) {
 		block = (uint8_t *)memalloc(size * sizeof(uint8_t));
 	}
-	++_used_blocks;
+	add_used_bytes(size);
 	return block;
 }
 
 void VoxelMemoryPool::recycle(uint8_t *block, uint32_t size) {
+	CRASH_COND(block == nullptr);
+	{
+		ThreadCache &cache = get_thread_cache();
+		MutexLock lock(cache.mutex);
+		ThreadCache::Bucket &bucket = cache.get_or_create_bucket(size);
+		bucket.blocks.push_back(block);
+		if (bucket.blocks.size() > THREAD_CACHE_MAX_BLOCKS) {
+			give_batch(size, bucket.blocks);
+		}
+		++bucket.recycled_count;
+	}
+	add_used_bytes(-static_cast<int64_t>(size));
+}
+
+VoxelMemoryPool::ThreadCache &VoxelMemoryPool::get_thread_cache() {
+	// Threads get a cache the first time they use the pool, and keep it
+	static thread_local unsigned int tls_cache_index = g_next_thread_cache_index++ % THREAD_CACHE_COUNT;
+	return _thread_caches[tls_cache_index];
+}
+
+VoxelMemoryPool::ThreadCache::Bucket &VoxelMemoryPool::ThreadCache::get_or_create_bucket(uint32_t size) {
+	for (auto it = buckets.begin(); it != buckets.end(); ++it) {
+		if (it->size == size) {
+			return *it;
+		}
+	}
+	Bucket bucket;
+	bucket.size = size;
+	buckets.push_back(bucket);
+	return buckets.back();
+}
+
+void VoxelMemoryPool::take_batch(uint32_t size, std::vector<uint8_t *> &dst) {
+	MutexLock lock(_mutex);
+	Pool **ppool = _pools.getptr(size);
+	if (ppool == nullptr) {
+		return;
+	}
+	Pool *pool = *ppool;
+	const unsigned int count = MIN(BATCH_SIZE, pool->blocks.size());
+	for (unsigned int i = 0; i < count; ++i) {
+		dst.push_back(pool->blocks.back());
+		pool->blocks.pop_back();
+	}
+	_pooled_bytes -= static_cast<int64_t>(count) * size;
+	pool->low_water_mark = MIN(pool->low_water_mark, pool->blocks.size());
+}
+
+void VoxelMemoryPool::give_batch(uint32_t size, std::vector<uint8_t *> &src) {
+	MutexLock lock(_mutex);
+	Pool *pool = get_or_create_pool(size);
+	const unsigned int count = MIN(BATCH_SIZE, src.size());
+	for (unsigned int i = 0; i < count; ++i) {
+		uint8_t *block = src.back();
+		src.pop_back();
+		if (_pooled_bytes + size > _max_pooled_bytes) {
+			memfree(block);
+		} else {
+			pool->blocks.push_back(block);
+			_pooled_bytes += size;
+		}
+	}
+}
+
+void VoxelMemoryPool::add_used_bytes(int64_t bytes) {
+	const int64_t used_bytes = _used_bytes.fetch_add(bytes) + bytes;
+	int64_t peak = _peak_used_bytes.load();
+	while (used_bytes > peak && !_peak_used_bytes.compare_exchange_weak(peak, used_bytes)) {
+	}
+}
+
+void VoxelMemoryPool::set_max_pooled_bytes(int64_t bytes) {
+	ERR_FAIL_COND(bytes < 0);
 	MutexLock lock(_mutex);
-	Pool *pool = _pools[size]; // If not found, entry will be created! It would be an error
-	// Check recycling before having allocated
-	CRASH_COND(pool == nullptr);
-	pool->blocks.push_back(block);
-	--_used_blocks;
+	_max_pooled_bytes = bytes;
+}
+
+int64_t VoxelMemoryPool::get_max_pooled_bytes() const {
+	MutexLock lock(_mutex);
+	return _max_pooled_bytes;
+}
+
+void VoxelMemoryPool::trim() {
+	VOXEL_PROFILE_SCOPE();
+	MutexLock lock(_mutex);
+	const uint32_t *key = nullptr;
+	while ((key = _pools.next(key))) {
+		Pool *pool = _pools.get(*key);
+		CRASH_COND(pool == nullptr);
+		// Blocks above the low water mark were not needed since last time, so they are unlikely to be needed soon
+		for (unsigned int i = 0; i < pool->low_water_mark; ++i) {
+			memfree(pool->blocks.back());
+			pool->blocks.pop_back();
+		}
+		_pooled_bytes -= static_cast<int64_t>(pool->low_water_mark) * (*key);
+		pool->low_water_mark = pool->blocks.size();
+		if (pool->blocks.size() == 0) {
+			// Release the vector itself too
+			std::vector<uint8_t *>().swap(pool->blocks);
+		}
+	}
+}
+
+VoxelMemoryPool::Stats VoxelMemoryPool::get_stats() const {
+	Stats stats;
+	stats.used_bytes = _used_bytes.load();
+	stats.peak_used_bytes = _peak_used_bytes.load();
+
+	struct L {
+		static SizeStats &get_or_create(std::vector<SizeStats> &sizes, uint32_t size) {
+			for (auto it = sizes.begin(); it != sizes.end(); ++it) {
+				if (it->size == size) {
+					return *it;
+				}
+			}
+			SizeStats s;
+			s.size = size;
+			s.used_blocks = 0;
+			s.pooled_blocks = 0;
+			sizes.push_back(s);
+			return sizes.back();
+		}
+	};
+
+	for (unsigned int i = 0; i < THREAD_CACHE_COUNT; ++i) {
+		const ThreadCache &cache = _thread_caches[i];
+		MutexLock lock(cache.mutex);
+		for (auto it = cache.buckets.begin(); it != cache.buckets.end(); ++it) {
+			SizeStats &s = L::get_or_create(stats.sizes, it->size);
+			s.used_blocks += it->allocated_count - it->recycled_count;
+			s.pooled_blocks += it->blocks.size();
+		}
+	}
+
+	{
+		MutexLock lock(_mutex);
+		stats.pooled_bytes = _pooled_bytes;
+		stats.max_pooled_bytes = _max_pooled_bytes;
+		const uint32_t *key = nullptr;
+		while ((key = _pools.next(key))) {
+			const Pool *pool = _pools.get(*key);
+			L::get_or_create(stats.sizes, *key).pooled_blocks += pool->blocks.size();
+		}
+	}
+
+	return stats;
 }
 
 void VoxelMemoryPool::clear() {
+	for (unsigned int i = 0; i < THREAD_CACHE_COUNT; ++i) {
+		ThreadCache &cache = _thread_caches[i];
+		MutexLock lock(cache.mutex);
+		for (auto bit = cache.buckets.begin(); bit != cache.buckets.end(); ++bit) {
+			for (auto it = bit->blocks.begin(); it != bit->blocks.end(); ++it) {
+				memfree(*it);
+			}
+		}
+		cache.buckets.clear();
+	}
+
 	MutexLock lock(_mutex);
 	const uint32_t *key = nullptr;
 	while ((key = _pools.next(key))) {
@@ -72,25 +233,30 @@ void VoxelMemoryPool::clear() {
 			CRASH_COND(ptr == nullptr);
 			memfree(ptr);
 		}
+		memdelete(pool);
 	}
 	_pools.clear();
+	_pooled_bytes = 0;
 }
 
 void VoxelMemoryPool::debug_print() {
-	MutexLock lock(_mutex);
+	const Stats stats = get_stats();
 	print_line("-------- VoxelMemoryPool ----------");
-	const uint32_t *key = nullptr;
-	int i = 0;
-	while ((key = _pools.next(key))) {
-		Pool *pool = _pools.get(*key);
-		print_line(String("Pool {0} for size {1}: {2} blocks").format(varray(i, *key, static_cast<int>(pool->blocks.size()))));
-		++i;
+	for (unsigned int i = 0; i < stats.sizes.size(); ++i) {
+		const SizeStats &s = stats.sizes[i];
+		print_line(String("Pool {0} for size {1}: {2} used blocks, {3} pooled blocks")
+						   .format(varray(i, s.size, s.used_blocks, s.pooled_blocks)));
 	}
+	print_line(String("Peak used memory: {0} bytes").format(varray(stats.peak_used_bytes)));
 }
 
 unsigned int VoxelMemoryPool::debug_get_used_blocks() const {
-	MutexLock lock(_mutex);
-	return _used_blocks;
+	const Stats stats = get_stats();
+	unsigned int used_blocks = 0;
+	for (auto it = stats.sizes.begin(); it != stats.sizes.end(); ++it) {
+		used_blocks += it->used_blocks;
+	}
+	return used_blocks;
 }
 
 VoxelMemoryPool::Pool *VoxelMemoryPool::get_or_create_pool(uint32_t size) {
@@ -1,20 +1,38 @@
 #ifndef VOXEL_MEMORY_POOL_H
 #define VOXEL_MEMORY_POOL_H
 
+#include "../util/fixed_array.h"
 #include "core/hash_map.h"
 #include "core/os/mutex.h"
 
+#include <atomic>
 #include <vector>
 
 // Pool based on a scenario where allocated blocks are often the same size.
 // A pool of blocks is assigned for each size.
+// Threads allocate from and recycle into a cache of their own first, which exchanges blocks with the shared pools
+// in batches, so threads rarely wait on each other.
+// Free blocks beyond a limit are given back to the system, and `trim` releases those which weren't needed lately.
 class VoxelMemoryPool {
-private:
-	struct Pool {
-		std::vector<uint8_t *> blocks;
+public:
+	struct SizeStats {
+		uint32_t size;
+		// Blocks allocated and not recycled yet
+		unsigned int used_blocks;
+		// Free blocks kept for reuse, in the shared pool and thread caches
+		unsigned int pooled_blocks;
 	};
 
-public:
+	struct Stats {
+		int64_t used_bytes;
+		int64_t peak_used_bytes;
+		int64_t pooled_bytes;
+		int64_t max_pooled_bytes;
+		std::vector<SizeStats> sizes;
+	};
+
+	static const int64_t DEFAULT_MAX_POOLED_BYTES = 256 * 1024 * 1024;
+
 	static void create_singleton();
 	static void destroy_singleton();
 	static VoxelMemoryPool *get_singleton();
@@ -25,16 +43,74 @@ public:
 	uint8_t *allocate(uint32_t size);
 	void recycle(uint8_t *block, uint32_t size);
 
+	// Free blocks beyond this amount of memory are given back to the system instead of being pooled.
+	// Thread caches are not included, they are limited to a few blocks per size.
+	void set_max_pooled_bytes(int64_t bytes);
+	int64_t get_max_pooled_bytes() const;
+
+	// Frees blocks of the shared pool which stayed unused since the previous call.
+	// Meant to be called periodically, so memory goes back to the system some time after a spike.
+	void trim();
+
+	// Memory currently allocated from the pool and not recycled yet.
+	// Cheaper than `get_stats`, so it can be polled every frame.
+	inline int64_t get_used_bytes() const {
+		return _used_bytes.load();
+	}
+
+	Stats get_stats() const;
+
 	void debug_print();
 	unsigned int debug_get_used_blocks() const;
 
 private:
+	// Threads get assigned one of these caches. More threads than that will share them.
+	static const unsigned int THREAD_CACHE_COUNT = 16;
+	// Blocks a thread cache can hold for each size before giving some to the shared pool
+	static const unsigned int THREAD_CACHE_MAX_BLOCKS = 32;
+	// How many blocks move at once between thread caches and the shared pool
+	static const unsigned int BATCH_SIZE = 16;
+
+	struct Pool {
+		std::vector<uint8_t *> blocks;
+		// Lowest amount of blocks the pool had since the last trim. That many blocks were not needed meanwhile.
+		unsigned int low_water_mark = 0;
+	};
+
+	struct ThreadCache {
+		struct Bucket {
+			uint32_t size;
+			std::vector<uint8_t *> blocks;
+			// Counted separately because a block can be recycled by a different thread than the one allocating it
+			int64_t allocated_count = 0;
+			int64_t recycled_count = 0;
+		};
+
+		// There are only a few different sizes, so they are searched linearly
+		std::vector<Bucket> buckets;
+		Mutex mutex;
+
+		Bucket &get_or_create_bucket(uint32_t size);
+	};
+
+	ThreadCache &get_thread_cache();
+	void take_batch(uint32_t size, std::vector<uint8_t *> &dst);
+	void give_batch(uint32_t size, std::vector<uint8_t *> &src);
+	void add_used_bytes(int64_t bytes);
+
 	Pool *get_or_create_pool(uint32_t size);
 	void clear();
 
+	FixedArray<ThreadCache, THREAD_CACHE_COUNT> _thread_caches;
+
+	// Shared pool
 	HashMap<uint32_t, Pool *> _pools;
-	unsigned int _used_blocks = 0;
+	int64_t _pooled_bytes = 0;
+	int64_t _max_pooled_bytes = DEFAULT_MAX_POOLED_BYTES;
 	Mutex _mutex;
+
+	std::atomic<int64_t> _used_bytes;
+	std::atomic<int64_t> _peak_used_bytes;
 };
 
 #endif // VOXEL_MEMORY_POOL_H
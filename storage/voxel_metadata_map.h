@@ -0,0 +1,122 @@
+#ifndef VOXEL_METADATA_MAP_H
+#define VOXEL_METADATA_MAP_H
+
+#include <core/variant.h>
+
+#include <algorithm>
+#include <vector>
+
+// Metadata attached to voxels of a block, keyed by the index of voxels in the block.
+// Entries are stored sorted in a flat array, so lookups are binary searches and copies or serialization go through
+// contiguous memory. Since voxels are indexed in ZXY order, a column of voxels along Y is a contiguous range of keys.
+// Inserting in the middle moves entries after it, which is cheap for the amount of metadata a block usually has.
+// Keys appended in increasing order, like when deserializing, don't move anything.
+class VoxelMetadataMap {
+public:
+	struct Entry {
+		uint32_t index;
+		Variant value;
+	};
+
+	inline unsigned int size() const {
+		return _entries.size();
+	}
+
+	inline bool is_empty() const {
+		return _entries.size() == 0;
+	}
+
+	inline const Entry &get_entry(unsigned int i) const {
+#ifdef DEBUG_ENABLED
+		CRASH_COND(i >= _entries.size());
+#endif
+		return _entries[i];
+	}
+
+	inline Entry &get_entry(unsigned int i) {
+#ifdef DEBUG_ENABLED
+		CRASH_COND(i >= _entries.size());
+#endif
+		return _entries[i];
+	}
+
+	inline void reserve(unsigned int count) {
+		_entries.reserve(count);
+	}
+
+	inline void clear() {
+		_entries.clear();
+	}
+
+	// Returns null if there is no metadata at this index
+	inline const Variant *find(uint32_t index) const {
+		const unsigned int i = lower_bound(index);
+		if (i < _entries.size() && _entries[i].index == index) {
+			return &_entries[i].value;
+		}
+		return nullptr;
+	}
+
+	void set(uint32_t index, const Variant &value) {
+		if (_entries.size() == 0 || _entries.back().index < index) {
+			_entries.push_back(Entry{ index, value });
+			return;
+		}
+		const unsigned int i = lower_bound(index);
+		if (_entries[i].index == index) {
+			_entries[i].value = value;
+		} else {
+			_entries.insert(_entries.begin() + i, Entry{ index, value });
+		}
+	}
+
+	bool erase(uint32_t index) {
+		const unsigned int i = lower_bound(index);
+		if (i < _entries.size() && _entries[i].index == index) {
+			_entries.erase(_entries.begin() + i);
+			return true;
+		}
+		return false;
+	}
+
+	// Gets the range of entries whose keys are in [begin_index, end_index)
+	inline void find_range(uint32_t begin_index, uint32_t end_index,
+			unsigned int &out_begin, unsigned int &out_end) const {
+		out_begin = lower_bound(begin_index);
+		out_end = out_begin;
+		while (out_end < _entries.size() && _entries[out_end].index < end_index) {
+			++out_end;
+		}
+	}
+
+	// Removes entries for which `predicate(index)` returns true, in a single pass
+	template <typename Predicate_T>
+	void erase_if(Predicate_T predicate) {
+		unsigned int dst = 0;
+		for (unsigned int src = 0; src < _entries.size(); ++src) {
+			if (predicate(_entries[src].index)) {
+				continue;
+			}
+			if (dst != src) {
+				_entries[dst] = _entries[src];
+			}
+			++dst;
+		}
+		_entries.resize(dst);
+	}
+
+private:
+	struct EntryLess {
+		inline bool operator()(const Entry &entry, uint32_t index) const {
+			return entry.index < index;
+		}
+	};
+
+	inline unsigned int lower_bound(uint32_t index) const {
+		return std::lower_bound(_entries.begin(), _entries.end(), index, EntryLess()) - _entries.begin();
+	}
+
+	std::vector<Entry> _entries;
+};
+
+#endif // VOXEL_METADATA_MAP_H
@@ -6,9 +6,45 @@
 #include <core/io/file_access_memory.h>
 #include <core/variant.h>
 #include <limits>
+#include <zstd.h>
 
 namespace VoxelCompressedData {
 
+namespace {
+
+// Zstandard contexts hold buffers which are costly to allocate for every block, so each thread keeps its own
+struct ZstdContexts {
+	ZSTD_CCtx *cctx = nullptr;
+	ZSTD_DCtx *dctx = nullptr;
+
+	~ZstdContexts() {
+		if (cctx != nullptr) {
+			ZSTD_freeCCtx(cctx);
+		}
+		if (dctx != nullptr) {
+			ZSTD_freeDCtx(dctx);
+		}
+	}
+
+	ZSTD_CCtx *get_cctx() {
+		if (cctx == nullptr) {
+			cctx = ZSTD_createCCtx();
+		}
+		return cctx;
+	}
+
+	ZSTD_DCtx *get_dctx() {
+		if (dctx == nullptr) {
+			dctx = ZSTD_createDCtx();
+		}
+		return dctx;
+	}
+};
+
+thread_local ZstdContexts tls_zstd_contexts;
+
+} // namespace
+
 bool decompress(ArraySlice<const uint8_t> src, std::vector<uint8_t> &dst) {
 	VOXEL_PROFILE_SCOPE();
 
@@ -45,6 +81,39 @@ bool decompress(ArraySlice<const uint8_t> src, std::vector<uint8_t> &dst) {
 							.format(varray(decompressed_size, actually_decompressed_size)));
 		} break;
 
+		case COMPRESSION_ZSTD: {
+			const uint32_t header_size = sizeof(uint8_t) + sizeof(uint32_t);
+			ERR_FAIL_COND_V(src.size() < header_size, false);
+			const uint32_t decompressed_size = f.get_32();
+			ERR_FAIL_COND_V_MSG(decompressed_size > MAX_DECOMPRESSED_SIZE, false,
+					String("Decompressed size {0} is too large").format(varray(decompressed_size)));
+
+			// The frame records its size too, both must agree
+			const unsigned long long frame_content_size =
+					ZSTD_getFrameContentSize(src.data() + header_size, src.size() - header_size);
+			ERR_FAIL_COND_V_MSG(frame_content_size == ZSTD_CONTENTSIZE_ERROR, false, "Invalid Zstd frame");
+			ERR_FAIL_COND_V_MSG(frame_content_size != decompressed_size, false,
+					String("Expected {0} bytes, Zstd frame contains {1}")
+							.format(varray(decompressed_size, (int64_t)frame_content_size)));
+
+			ZSTD_DCtx *dctx = tls_zstd_contexts.get_dctx();
+			ERR_FAIL_COND_V(dctx == nullptr, false);
+
+			dst.resize(decompressed_size);
+
+			const size_t actually_decompressed_size = ZSTD_decompressDCtx(dctx,
+					dst.data(), dst.size(),
+					src.data() + header_size, src.size() - header_size);
+
+			ERR_FAIL_COND_V_MSG(ZSTD_isError(actually_decompressed_size), false,
+					String("Zstd decompression error: {0}").format(
+							varray(ZSTD_getErrorName(actually_decompressed_size))));
+
+			ERR_FAIL_COND_V_MSG(actually_decompressed_size != decompressed_size, false,
+					String("Expected {0} bytes, obtained {1}")
+							.format(varray(decompressed_size, (int64_t)actually_decompressed_size)));
+		} break;
+
 		default:
 			ERR_PRINT("Invalid compression header");
 			return false;
@@ -88,6 +157,33 @@ bool compress(ArraySlice<const uint8_t> src, std::vector<uint8_t> &dst, Compress
 			dst.resize(header_size + compressed_size);
 		} break;
 
+		case COMPRESSION_ZSTD: {
+			ERR_FAIL_COND_V(src.size() > std::numeric_limits<uint32_t>::max(), false);
+
+			ZSTD_CCtx *cctx = tls_zstd_contexts.get_cctx();
+			ERR_FAIL_COND_V(cctx == nullptr, false);
+
+			// Write header
+			// Must clear first because MemoryWriter writes from the end
+			dst.clear();
+			VoxelUtility::MemoryWriter f(dst, VoxelUtility::ENDIANESS_BIG_ENDIAN);
+			f.store_8(comp);
+			f.store_32(src.size());
+
+			const uint32_t header_size = sizeof(uint8_t) + sizeof(uint32_t);
+			dst.resize(header_size + ZSTD_compressBound(src.size()));
+
+			const size_t compressed_size = ZSTD_compressCCtx(cctx,
+					dst.data() + header_size, dst.size() - header_size,
+					src.data(), src.size(),
+					ZSTD_COMPRESSION_LEVEL);
+
+			ERR_FAIL_COND_V_MSG(ZSTD_isError(compressed_size), false,
+					String("Zstd compression error: {0}").format(varray(ZSTD_getErrorName(compressed_size))));
+
+			dst.resize(header_size + compressed_size);
+		} break;
+
 		default:
 			ERR_PRINT("Invalid compression header");
 			return false;
@@ -16,9 +16,19 @@ enum Compression {
 	// All following bytes are compressed data using LZ4 defaults.
 	// This is the fastest compression format.
 	COMPRESSION_LZ4 = 1,
-	COMPRESSION_COUNT = 2
+	// The next uint32_t will be the size of decompressed data.
+	// All following bytes are a Zstandard frame.
+	// Slower to compress than LZ4, but produces smaller data and decompresses quickly.
+	COMPRESSION_ZSTD = 2,
+	COMPRESSION_COUNT = 3
 };
 
+// Zstandard level used with COMPRESSION_ZSTD. Low levels are close to LZ4 in speed while compressing better.
+static const int ZSTD_COMPRESSION_LEVEL = 3;
+// Sizes of decompressed data are read from the data itself, so they are checked before allocating memory.
+// Serialized blocks are far smaller than this, larger sizes come from corrupted data.
+static const uint32_t MAX_DECOMPRESSED_SIZE = 1 << 28;
+
 bool compress(ArraySlice<const uint8_t> src, std::vector<uint8_t> &dst, Compression comp);
 bool decompress(ArraySlice<const uint8_t> src, std::vector<uint8_t> &dst);
 
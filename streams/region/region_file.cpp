@@ -3,6 +3,7 @@
 #include "../../util/macros.h"
 #include "../../util/profiling.h"
 #include "../file_utils.h"
+#include <core/io/marshalls.h>
 #include <core/os/file_access.h>
 #include <algorithm>
 
@@ -268,6 +269,14 @@ Error VoxelRegionFile::open(const String &fpath, bool create_if_not_found) {
 Error VoxelRegionFile::close() {
 	VOXEL_PROFILE_SCOPE();
 	Error err = OK;
+	{
+		MutexLock lock(_read_handles_mutex);
+		for (auto it = _read_handles.begin(); it != _read_handles.end(); ++it) {
+			memdelete(*it);
+		}
+		_read_handles.clear();
+		_read_handle_count = 0;
+	}
 	if (_file_access != nullptr) {
 		if (_header_modified) {
 			_file_access->seek(MAGIC_AND_VERSION_SIZE);
@@ -281,6 +290,7 @@ Error VoxelRegionFile::close() {
 		_file_access = nullptr;
 	}
 	_sectors.clear();
+	drop_preloaded_data();
 	return err;
 }
 
@@ -308,50 +318,114 @@ Error VoxelRegionFile::load_block(
 
 	ERR_FAIL_COND_V(out_block.is_null(), ERR_INVALID_PARAMETER);
 	ERR_FAIL_COND_V(_file_access == nullptr, ERR_FILE_CANT_READ);
-	FileAccess *f = _file_access;
 
 	const unsigned int lut_index = get_block_index_in_header(position);
 	ERR_FAIL_COND_V(lut_index >= _header.blocks.size(), ERR_INVALID_PARAMETER);
-	const VoxelRegionBlockInfo &block_info = _header.blocks[lut_index];
 
-	if (block_info.data == 0) {
-		return ERR_DOES_NOT_EXIST;
-	}
-
-	ERR_FAIL_COND_V(out_block->get_size() != out_block->get_size(), ERR_INVALID_PARAMETER);
 	// Configure block format
 	for (unsigned int channel_index = 0; channel_index < _header.format.channel_depths.size(); ++channel_index) {
 		out_block->set_channel_depth(channel_index, _header.format.channel_depths[channel_index]);
 	}
 
-	const unsigned int sector_index = block_info.get_sector_index();
-	const unsigned int block_begin = _blocks_begin_offset + sector_index * _header.format.sector_size;
+	bool preload_enabled;
+	{
+		RWLockRead rlock(_rw_lock);
+		if (_preloaded) {
+			return load_block_from_preloaded_data(lut_index, position, **out_block, serializer);
+		}
+		preload_enabled = _preload_enabled;
+	}
 
-	f->seek(block_begin);
+	if (preload_enabled) {
+		{
+			RWLockWrite wlock(_rw_lock);
+			if (_preload_enabled && !_preloaded) {
+				preload_data();
+			}
+		}
+		RWLockRead rlock(_rw_lock);
+		if (_preloaded) {
+			return load_block_from_preloaded_data(lut_index, position, **out_block, serializer);
+		}
+		// Otherwise it was disabled in between, or it could not be read. Fallback on reading the block alone.
+	}
 
-	unsigned int block_data_size = f->get_32();
-	CRASH_COND(f->eof_reached());
+	// Compressed data is read into this, then decompressed without holding any lock
+	static thread_local std::vector<uint8_t> tls_compressed_data;
 
-	ERR_FAIL_COND_V_MSG(!serializer.decompress_and_deserialize(f, block_data_size, **out_block), ERR_PARSE_ERROR,
+	Error err;
+	FileAccess *f = acquire_read_handle();
+	if (f != nullptr) {
+		{
+			RWLockRead rlock(_rw_lock);
+			err = read_block_data(f, lut_index, tls_compressed_data);
+		}
+		release_read_handle(f);
+
+	} else {
+		// All read handles are in use. Use the main one instead, which saves also move around.
+		RWLockWrite wlock(_rw_lock);
+		err = read_block_data(_file_access, lut_index, tls_compressed_data);
+	}
+
+	if (err == ERR_FILE_CORRUPT) {
+		ERR_PRINT(String("Failed to read block {0} from {1}").format(varray(position.to_vec3(), _file_path)));
+	}
+	if (err != OK) {
+		return err;
+	}
+
+	ERR_FAIL_COND_V_MSG(!serializer.decompress_and_deserialize(tls_compressed_data, **out_block), ERR_PARSE_ERROR,
 			String("Failed to read block {0}").format(varray(position.to_vec3())));
 
 	return OK;
 }
 
-Error VoxelRegionFile::save_block(Vector3i position, Ref<VoxelBuffer> block, VoxelBlockSerializerInternal &serializer) {
+// The header must be locked
+Error VoxelRegionFile::read_block_data(FileAccess *f, unsigned int lut_index, std::vector<uint8_t> &out_data) const {
+	const VoxelRegionBlockInfo block_info = _header.blocks[lut_index];
+	if (block_info.data == 0) {
+		return ERR_DOES_NOT_EXIST;
+	}
+
+	const unsigned int sector_index = block_info.get_sector_index();
+	const unsigned int block_begin = _blocks_begin_offset + sector_index * _header.format.sector_size;
+
+	f->seek(block_begin);
+	const unsigned int block_data_size = f->get_32();
+	out_data.resize(block_data_size);
+	const unsigned int read_size = f->get_buffer(out_data.data(), block_data_size);
+	if (read_size != block_data_size) {
+		return ERR_FILE_CORRUPT;
+	}
+	return OK;
+}
+
+Error VoxelRegionFile::save_block(Vector3i position, Ref<VoxelBuffer> block, VoxelBlockSerializerInternal &serializer,
+		VoxelCompressedData::Compression compression) {
 	ERR_FAIL_COND_V(block.is_null(), ERR_INVALID_PARAMETER);
 	ERR_FAIL_COND_V(_header.format.verify_block(**block) == false, ERR_INVALID_PARAMETER);
 
 	ERR_FAIL_COND_V(_file_access == nullptr, ERR_FILE_CANT_WRITE);
 	FileAccess *f = _file_access;
 
+	const unsigned int lut_index = get_block_index_in_header(position);
+	ERR_FAIL_COND_V(lut_index >= _header.blocks.size(), ERR_INVALID_PARAMETER);
+
+	// Done before locking, so loads can go on meanwhile
+	VoxelBlockSerializerInternal::SerializeResult res = serializer.serialize_and_compress(**block, compression);
+	ERR_FAIL_COND_V(!res.success, ERR_INVALID_PARAMETER);
+	const std::vector<uint8_t> &data = res.data;
+
+	RWLockWrite wlock(_rw_lock);
+
 	// We should be allowed to migrate before write operations
 	if (_header.version != FORMAT_VERSION) {
+		// The whole file may change
+		drop_preloaded_data();
 		ERR_FAIL_COND_V(migrate_to_latest(f) == false, ERR_UNAVAILABLE);
 	}
 
-	const unsigned int lut_index = get_block_index_in_header(position);
-	ERR_FAIL_COND_V(lut_index >= _header.blocks.size(), ERR_INVALID_PARAMETER);
 	VoxelRegionBlockInfo &block_info = _header.blocks[lut_index];
 
 	if (block_info.data == 0) {
@@ -363,15 +437,14 @@ Error VoxelRegionFile::save_block(Vector3i position, Ref<VoxelBuffer> block, Vox
 		// Check position matches the sectors rule
 		CRASH_COND((block_offset - _blocks_begin_offset) % _header.format.sector_size != 0);
 
-		VoxelBlockSerializerInternal::SerializeResult res = serializer.serialize_and_compress(**block);
-		ERR_FAIL_COND_V(!res.success, ERR_INVALID_PARAMETER);
-		f->store_32(res.data.size());
-		const unsigned int written_size = sizeof(int) + res.data.size();
-		f->store_buffer(res.data.data(), res.data.size());
+		f->store_32(data.size());
+		const unsigned int written_size = sizeof(int) + data.size();
+		f->store_buffer(data.data(), data.size());
 
 		const unsigned int end_pos = f->get_position();
 		CRASH_COND(written_size != (end_pos - block_offset));
 		pad_to_sector_size(f);
+		write_block_to_preloaded_data(block_offset, data);
 
 		block_info.set_sector_index((block_offset - _blocks_begin_offset) / _header.format.sector_size);
 		block_info.set_sector_count(get_sector_count_from_bytes(written_size));
@@ -391,9 +464,6 @@ Error VoxelRegionFile::save_block(Vector3i position, Ref<VoxelBuffer> block, Vox
 		const int old_sector_count = block_info.get_sector_count();
 		CRASH_COND(old_sector_count < 1);
 
-		VoxelBlockSerializerInternal::SerializeResult res = serializer.serialize_and_compress(**block);
-		ERR_FAIL_COND_V(!res.success, ERR_INVALID_PARAMETER);
-		const std::vector<uint8_t> &data = res.data;
 		const int written_size = sizeof(int) + data.size();
 
 		const int new_sector_count = get_sector_count_from_bytes(written_size);
@@ -416,6 +486,7 @@ Error VoxelRegionFile::save_block(Vector3i position, Ref<VoxelBuffer> block, Vox
 
 			int end_pos = f->get_position();
 			CRASH_COND(written_size != (end_pos - block_offset));
+			write_block_to_preloaded_data(block_offset, data);
 
 		} else {
 			// The block now uses more sectors, we have to move others.
@@ -434,6 +505,7 @@ Error VoxelRegionFile::save_block(Vector3i position, Ref<VoxelBuffer> block, Vox
 			CRASH_COND(written_size != (end_pos - block_offset));
 
 			pad_to_sector_size(f);
+			write_block_to_preloaded_data(block_offset, data);
 
 			block_info.set_sector_index(_sectors.size());
 			for (int i = 0; i < new_sector_count; ++i) {
@@ -446,9 +518,119 @@ Error VoxelRegionFile::save_block(Vector3i position, Ref<VoxelBuffer> block, Vox
 		block_info.set_sector_count(new_sector_count);
 	}
 
+	// Make written data visible to read handles
+	f->flush();
+
 	return OK;
 }
 
+void VoxelRegionFile::set_preload_enabled(bool enabled) {
+	RWLockWrite wlock(_rw_lock);
+	_preload_enabled = enabled;
+	if (!enabled) {
+		drop_preloaded_data();
+	}
+}
+
+bool VoxelRegionFile::preload_data() {
+	VOXEL_PROFILE_SCOPE();
+	ERR_FAIL_COND_V(_file_access == nullptr, false);
+	FileAccess *f = _file_access;
+	const size_t len = f->get_len();
+	_preloaded_data.resize(len);
+	f->seek(0);
+	const size_t read_size = f->get_buffer(_preloaded_data.data(), len);
+	if (read_size != len) {
+		drop_preloaded_data();
+		ERR_PRINT(String("Could not preload {0}").format(varray(_file_path)));
+		return false;
+	}
+	_preloaded = true;
+	return true;
+}
+
+// Writes are mirrored in the preloaded copy of the file, so it doesn't have to be read again after saves
+void VoxelRegionFile::write_to_preloaded_data(unsigned int offset, const uint8_t *data, unsigned int size) {
+	if (!_preloaded) {
+		return;
+	}
+	if (offset + size > _preloaded_data.size()) {
+		_preloaded_data.resize(offset + size);
+	}
+	memcpy(_preloaded_data.data() + offset, data, size);
+}
+
+void VoxelRegionFile::write_block_to_preloaded_data(unsigned int block_offset, const std::vector<uint8_t> &data) {
+	if (!_preloaded) {
+		return;
+	}
+	uint8_t size_bytes[sizeof(uint32_t)];
+	encode_uint32(data.size(), size_bytes);
+	write_to_preloaded_data(block_offset, size_bytes, sizeof(uint32_t));
+	write_to_preloaded_data(block_offset + sizeof(uint32_t), data.data(), data.size());
+}
+
+void VoxelRegionFile::drop_preloaded_data() {
+	_preloaded = false;
+	// Release memory too, files can be big
+	std::vector<uint8_t>().swap(_preloaded_data);
+}
+
+Error VoxelRegionFile::load_block_from_preloaded_data(unsigned int lut_index, Vector3i position,
+		VoxelBuffer &out_block, VoxelBlockSerializerInternal &serializer) const {
+
+	const VoxelRegionBlockInfo block_info = _header.blocks[lut_index];
+	if (block_info.data == 0) {
+		return ERR_DOES_NOT_EXIST;
+	}
+
+	const size_t block_begin = _blocks_begin_offset + block_info.get_sector_index() * _header.format.sector_size;
+	ERR_FAIL_COND_V(block_begin + sizeof(uint32_t) > _preloaded_data.size(), ERR_FILE_CORRUPT);
+
+	// Same encoding as `FileAccess::get_32()`
+	const uint32_t block_data_size = decode_uint32(_preloaded_data.data() + block_begin);
+
+	const size_t data_begin = block_begin + sizeof(uint32_t);
+	const size_t data_end = data_begin + block_data_size;
+	ERR_FAIL_COND_V(data_end > _preloaded_data.size(), ERR_FILE_CORRUPT);
+
+	ERR_FAIL_COND_V_MSG(!serializer.decompress_and_deserialize(
+								ArraySlice<const uint8_t>(_preloaded_data.data(), data_begin, data_end), out_block),
+			ERR_PARSE_ERROR, String("Failed to read block {0}").format(varray(position.to_vec3())));
+
+	return OK;
+}
+
+// Returns null if the maximum amount of read handles are in use
+FileAccess *VoxelRegionFile::acquire_read_handle() {
+	{
+		MutexLock lock(_read_handles_mutex);
+		if (_read_handles.size() > 0) {
+			FileAccess *f = _read_handles.back();
+			_read_handles.pop_back();
+			return f;
+		}
+		if (_read_handle_count == MAX_READ_HANDLES) {
+			return nullptr;
+		}
+		// Counted before opening, so other threads can't open more meanwhile
+		++_read_handle_count;
+	}
+	Error err;
+	FileAccess *f = FileAccess::open(_file_path, FileAccess::READ, &err);
+	if (f == nullptr) {
+		MutexLock lock(_read_handles_mutex);
+		--_read_handle_count;
+		ERR_PRINT(String("Could not open {0} for reading, error {1}").format(varray(_file_path, err)));
+	}
+	return f;
+}
+
+void VoxelRegionFile::release_read_handle(FileAccess *f) {
+	MutexLock lock(_read_handles_mutex);
+	_read_handles.push_back(f);
+}
+
 void VoxelRegionFile::pad_to_sector_size(FileAccess *f) {
 	int rpos = f->get_position() - _blocks_begin_offset;
 	if (rpos == 0) {
@@ -504,6 +686,7 @@ void VoxelRegionFile::remove_sectors_from_block(Vector3i block_pos, unsigned int
 
 		f->seek(dst_offset);
 		f->store_buffer(temp.data(), sector_size);
+		write_to_preloaded_data(dst_offset, temp.data(), sector_size);
 
 		src_offset += sector_size;
 		dst_offset += sector_size;
@@ -628,12 +811,14 @@ unsigned int VoxelRegionFile::get_header_block_count() const {
 bool VoxelRegionFile::has_block(Vector3i position) const {
 	ERR_FAIL_COND_V(!is_open(), false);
 	const unsigned int bi = get_block_index_in_header(position);
+	RWLockRead rlock(_rw_lock);
 	return _header.blocks[bi].data != 0;
 }
 
 bool VoxelRegionFile::has_block(unsigned int index) const {
 	ERR_FAIL_COND_V(!is_open(), false);
 	CRASH_COND(index >= _header.blocks.size());
+	RWLockRead rlock(_rw_lock);
 	return _header.blocks[index].data != 0;
 }
 
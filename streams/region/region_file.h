@@ -5,6 +5,10 @@
 #include "../../util/fixed_array.h"
 #include "../../util/math/color8.h"
 #include "../../util/math/vector3i.h"
+#include "../compressed_data.h"
+
+#include <core/os/mutex.h>
+#include <core/os/rw_lock.h>
 #include <vector>
 
 class FileAccess;
@@ -65,10 +69,17 @@ struct VoxelRegionBlockInfo {
 //
 // This is a stream implementation, where the file handle remains in use for read and write and only keeps a fraction
 // of data in memory.
-// It isn't thread-safe.
+// Blocks can be loaded and saved from multiple threads. Loads only lock the header while they read bytes, using file
+// handles of their own, so they run concurrently. Saves are exclusive, because they can move sectors around.
+// Opening, closing and setting the format are not thread-safe.
 //
 class VoxelRegionFile {
 public:
+	// Loads beyond this amount at the same time use the main file handle, taking turns with saves
+	static const unsigned int MAX_READ_HANDLES = 2;
+	// Files an open region can use at most
+	static const unsigned int MAX_OPEN_FILES = 1 + MAX_READ_HANDLES;
+
 	VoxelRegionFile();
 	~VoxelRegionFile();
 
@@ -79,8 +90,14 @@ public:
 	bool set_format(const VoxelRegionFormat &format);
 	const VoxelRegionFormat &get_format() const;
 
+	// Reads the whole file in memory the next time a block is loaded, and decompresses blocks directly from there
+	// instead of reading them one by one. Meant for regions which are mostly read, such as shipped maps.
+	// Saved blocks are written to that copy as well as to the file.
+	void set_preload_enabled(bool enabled);
+
 	Error load_block(Vector3i position, Ref<VoxelBuffer> out_block, VoxelBlockSerializerInternal &serializer);
-	Error save_block(Vector3i position, Ref<VoxelBuffer> block, VoxelBlockSerializerInternal &serializer);
+	Error save_block(Vector3i position, Ref<VoxelBuffer> block, VoxelBlockSerializerInternal &serializer,
+			VoxelCompressedData::Compression compression);
 
 	unsigned int get_header_block_count() const;
 	bool has_block(Vector3i position) const;
@@ -96,6 +113,18 @@ private:
 	unsigned int get_block_index_in_header(const Vector3i &rpos) const;
 	uint32_t get_sector_count_from_bytes(uint32_t size_in_bytes) const;
 
+	bool preload_data();
+	void write_to_preloaded_data(unsigned int offset, const uint8_t *data, unsigned int size);
+	void write_block_to_preloaded_data(unsigned int block_offset, const std::vector<uint8_t> &data);
+	void drop_preloaded_data();
+	Error load_block_from_preloaded_data(unsigned int lut_index, Vector3i position, VoxelBuffer &out_block,
+			VoxelBlockSerializerInternal &serializer) const;
+
+	Error read_block_data(FileAccess *f, unsigned int lut_index, std::vector<uint8_t> &out_data) const;
+
+	FileAccess *acquire_read_handle();
+	void release_read_handle(FileAccess *f);
+
 	void pad_to_sector_size(FileAccess *f);
 	void remove_sectors_from_block(Vector3i block_pos, unsigned int p_sector_count);
 
@@ -114,6 +143,22 @@ private:
 	FileAccess *_file_access = nullptr;
 	bool _header_modified = false;
 
+	// Protects the header and sectors. Loads lock it for reading, saves for writing.
+	RWLock _rw_lock;
+
+	// Read-only handles used by `load_block`, so threads don't share the cursor of `_file_access`.
+	// A thread takes one for the duration of a read, and more are opened when threads read at the same time,
+	// up to `MAX_READ_HANDLES`.
+	std::vector<FileAccess *> _read_handles;
+	// Handles opened, including those in use
+	unsigned int _read_handle_count = 0;
+	Mutex _read_handles_mutex;
+
+	// Copy of the whole file when preloading is enabled, protected by `_rw_lock`
+	bool _preload_enabled = false;
+	bool _preloaded = false;
+	std::vector<uint8_t> _preloaded_data;
+
 	Header _header;
 
 	struct Vector3u16 {
@@ -113,50 +113,61 @@ VoxelStreamRegionFiles::EmergeResult VoxelStreamRegionFiles::_emerge_block(
 	VOXEL_PROFILE_SCOPE();
 	ERR_FAIL_COND_V(out_buffer.is_null(), EMERGE_FAILED);
 
-	MutexLock lock(_mutex);
+	CachedRegion *cache = nullptr;
+	Vector3i block_rpos;
+	{
+		MutexLock lock(_mutex);
 
-	if (_directory_path.empty()) {
-		return EMERGE_OK_FALLBACK;
-	}
+		if (_directory_path.empty()) {
+			return EMERGE_OK_FALLBACK;
+		}
 
-	if (!_meta_loaded) {
-		VoxelFileResult load_res = load_meta();
-		if (load_res != VOXEL_FILE_OK) {
-			if (!_meta_saved && load_res == VOXEL_FILE_CANT_OPEN) {
-				// TODO Is it a good idea to save on read?
-				// New data folder, save it for first time
-				VoxelFileResult save_res = save_meta();
-				ERR_FAIL_COND_V(save_res != VOXEL_FILE_OK, EMERGE_FAILED);
-			} else {
-				return EMERGE_FAILED;
+		if (!_meta_loaded) {
+			VoxelFileResult load_res = load_meta();
+			if (load_res != VOXEL_FILE_OK) {
+				if (!_meta_saved && load_res == VOXEL_FILE_CANT_OPEN) {
+					// TODO Is it a good idea to save on read?
+					// New data folder, save it for first time
+					VoxelFileResult save_res = save_meta();
+					ERR_FAIL_COND_V(save_res != VOXEL_FILE_OK, EMERGE_FAILED);
+				} else {
+					return EMERGE_FAILED;
+				}
 			}
 		}
-	}
 
-	const Vector3i block_size = Vector3i(1 << _meta.block_size_po2);
-	const Vector3i region_size = Vector3i(1 << _meta.region_size_po2);
+		const Vector3i block_size = Vector3i(1 << _meta.block_size_po2);
+		const Vector3i region_size = Vector3i(1 << _meta.region_size_po2);
 
-	CRASH_COND(!_meta_loaded);
-	ERR_FAIL_COND_V(lod >= _meta.lod_count, EMERGE_FAILED);
-	ERR_FAIL_COND_V(block_size != out_buffer->get_size(), EMERGE_FAILED);
+		CRASH_COND(!_meta_loaded);
+		ERR_FAIL_COND_V(lod >= _meta.lod_count, EMERGE_FAILED);
+		ERR_FAIL_COND_V(block_size != out_buffer->get_size(), EMERGE_FAILED);
 
-	// Configure depths, as they currently are only specified in the meta file.
-	// Regions are expected to contain such depths, and use those in the buffer to know how much data to read.
-	for (unsigned int channel_index = 0; channel_index < _meta.channel_depths.size(); ++channel_index) {
-		out_buffer->set_channel_depth(channel_index, _meta.channel_depths[channel_index]);
-	}
+		// Configure depths, as they currently are only specified in the meta file.
+		// Regions are expected to contain such depths, and use those in the buffer to know how much data to read.
+		for (unsigned int channel_index = 0; channel_index < _meta.channel_depths.size(); ++channel_index) {
+			out_buffer->set_channel_depth(channel_index, _meta.channel_depths[channel_index]);
+		}
+
+		const Vector3i block_pos = get_block_position_from_voxels(origin_in_voxels) >> lod;
+		const Vector3i region_pos = get_region_position_from_blocks(block_pos);
 
-	const Vector3i block_pos = get_block_position_from_voxels(origin_in_voxels) >> lod;
-	const Vector3i region_pos = get_region_position_from_blocks(block_pos);
+		// The region stays pinned until we are done reading from it
+		cache = open_region(region_pos, lod, false);
+		if (cache == nullptr) {
+			return EMERGE_OK_FALLBACK;
+		}
 
-	CachedRegion *cache = open_region(region_pos, lod, false);
-	if (cache == nullptr || !cache->file_exists) {
-		return EMERGE_OK_FALLBACK;
+		block_rpos = block_pos.wrap(region_size);
 	}
 
-	const Vector3i block_rpos = block_pos.wrap(region_size);
+	// Reading and decompressing is done without the stream lock, so other threads can load blocks meanwhile
+	const Error err = cache->region.load_block(block_rpos, out_buffer, _block_serializer);
+	{
+		MutexLock lock(_mutex);
+		unpin_region(cache);
+	}
 
-	Error err = cache->region.load_block(block_rpos, out_buffer, _block_serializer);
 	switch (err) {
 		case OK:
 			return EMERGE_OK;
@@ -172,47 +183,61 @@ VoxelStreamRegionFiles::EmergeResult VoxelStreamRegionFiles::_emerge_block(
 void VoxelStreamRegionFiles::_immerge_block(Ref<VoxelBuffer> voxel_buffer, Vector3i origin_in_voxels, int lod) {
 	VOXEL_PROFILE_SCOPE();
 
-	MutexLock lock(_mutex);
-
-	ERR_FAIL_COND(_directory_path.empty());
 	ERR_FAIL_COND(voxel_buffer.is_null());
 
-	if (!_meta_loaded) {
-		// If it's not loaded, always try to load meta file first if it exists already,
-		// because we could want to save blocks without reading any
-		VoxelFileResult load_res = load_meta();
-		if (load_res != VOXEL_FILE_OK && load_res != VOXEL_FILE_CANT_OPEN) {
-			// The file is present but there is a problem with it
-			String meta_path = _directory_path.plus_file(META_FILE_NAME);
-			ERR_PRINT(String("Could not read {0}: error {1}").format(varray(meta_path, ::to_string(load_res))));
-			return;
+	CachedRegion *cache = nullptr;
+	Vector3i block_rpos;
+	VoxelCompressedData::Compression compression;
+	{
+		MutexLock lock(_mutex);
+
+		ERR_FAIL_COND(_directory_path.empty());
+		compression = _compression;
+
+		if (!_meta_loaded) {
+			// If it's not loaded, always try to load meta file first if it exists already,
+			// because we could want to save blocks without reading any
+			VoxelFileResult load_res = load_meta();
+			if (load_res != VOXEL_FILE_OK && load_res != VOXEL_FILE_CANT_OPEN) {
+				// The file is present but there is a problem with it
+				String meta_path = _directory_path.plus_file(META_FILE_NAME);
+				ERR_PRINT(String("Could not read {0}: error {1}").format(varray(meta_path, ::to_string(load_res))));
+				return;
+			}
 		}
-	}
 
-	if (!_meta_saved) {
-		// First time we save the meta file, initialize it from the first block format
-		for (unsigned int i = 0; i < _meta.channel_depths.size(); ++i) {
-			_meta.channel_depths[i] = voxel_buffer->get_channel_depth(i);
+		if (!_meta_saved) {
+			// First time we save the meta file, initialize it from the first block format
+			for (unsigned int i = 0; i < _meta.channel_depths.size(); ++i) {
+				_meta.channel_depths[i] = voxel_buffer->get_channel_depth(i);
+			}
+			VoxelFileResult err = save_meta();
+			ERR_FAIL_COND(err != VOXEL_FILE_OK);
 		}
-		VoxelFileResult err = save_meta();
-		ERR_FAIL_COND(err != VOXEL_FILE_OK);
-	}
 
-	// Verify format
-	const Vector3i block_size = Vector3i(1 << _meta.block_size_po2);
-	ERR_FAIL_COND(voxel_buffer->get_size() != block_size);
-	for (unsigned int i = 0; i < VoxelBuffer::MAX_CHANNELS; ++i) {
-		ERR_FAIL_COND(voxel_buffer->get_channel_depth(i) != _meta.channel_depths[i]);
-	}
+		// Verify format
+		const Vector3i block_size = Vector3i(1 << _meta.block_size_po2);
+		ERR_FAIL_COND(voxel_buffer->get_size() != block_size);
+		for (unsigned int i = 0; i < VoxelBuffer::MAX_CHANNELS; ++i) {
+			ERR_FAIL_COND(voxel_buffer->get_channel_depth(i) != _meta.channel_depths[i]);
+		}
+
+		const Vector3i region_size = Vector3i(1 << _meta.region_size_po2);
+		const Vector3i block_pos = get_block_position_from_voxels(origin_in_voxels) >> lod;
+		const Vector3i region_pos = get_region_position_from_blocks(block_pos);
+		block_rpos = block_pos.wrap(region_size);
 
-	const Vector3i region_size = Vector3i(1 << _meta.region_size_po2);
-	Vector3i block_pos = get_block_position_from_voxels(origin_in_voxels) >> lod;
-	Vector3i region_pos = get_region_position_from_blocks(block_pos);
-	Vector3i block_rpos = block_pos.wrap(region_size);
+		cache = open_region(region_pos, lod, true);
+		ERR_FAIL_COND_MSG(cache == nullptr, "Could not save region file data");
+	}
 
-	CachedRegion *cache = open_region(region_pos, lod, true);
-	ERR_FAIL_COND_MSG(cache == nullptr, "Could not save region file data");
-	ERR_FAIL_COND(cache->region.save_block(block_rpos, voxel_buffer, _block_serializer) != OK);
+	// The region file locks itself while it writes, only while sectors and its header are modified
+	const Error err = cache->region.save_block(block_rpos, voxel_buffer, _block_serializer, compression);
+	{
+		MutexLock lock(_mutex);
+		unpin_region(cache);
+	}
+	ERR_FAIL_COND(err != OK);
 }
 
 String VoxelStreamRegionFiles::get_directory() const {
@@ -400,6 +425,8 @@ Vector3i VoxelStreamRegionFiles::get_region_position_from_blocks(const Vector3i
 void VoxelStreamRegionFiles::close_all_regions() {
 	for (unsigned int i = 0; i < _region_cache.size(); ++i) {
 		CachedRegion *cache = _region_cache[i];
+		// Changing directory or format while blocks are being loaded or saved is not supported
+		ERR_CONTINUE(cache->users > 0);
 		close_region(cache);
 		memdelete(cache);
 	}
@@ -438,11 +465,15 @@ VoxelStreamRegionFiles::CachedRegion *VoxelStreamRegionFiles::open_region(
 
 	CachedRegion *cached_region = get_region_from_cache(region_pos, lod);
 	if (cached_region != nullptr) {
+		++cached_region->users;
 		return cached_region;
 	}
 
 	while (_region_cache.size() > _max_open_regions - 1) {
-		close_oldest_region();
+		if (!close_oldest_region()) {
+			// All regions are in use by other threads
+			break;
+		}
 	}
 	// Not in cache, we'll have to open or create it
 
@@ -461,6 +492,7 @@ VoxelStreamRegionFiles::CachedRegion *VoxelStreamRegionFiles::open_region(
 		format.sector_size = _meta.sector_size;
 
 		cached_region->region.set_format(format);
+		cached_region->region.set_preload_enabled(_preload_regions);
 		cached_region->position = region_pos;
 		cached_region->lod = lod;
 	}
@@ -503,20 +535,26 @@ VoxelStreamRegionFiles::CachedRegion *VoxelStreamRegionFiles::open_region(
 
 	cached_region->file_exists = true;
 	cached_region->last_opened = OS::get_singleton()->get_ticks_usec();
+	cached_region->users = 1;
 
 	return cached_region;
 }
 
+void VoxelStreamRegionFiles::unpin_region(CachedRegion *cache) {
+	CRASH_COND(cache->users == 0);
+	--cache->users;
+}
+
 // TODO Get rid of to simplify?
 void VoxelStreamRegionFiles::close_region(CachedRegion *region) {
 	region->region.close();
 }
 
-void VoxelStreamRegionFiles::close_oldest_region() {
+bool VoxelStreamRegionFiles::close_oldest_region() {
 	// Close region assumed to be the least recently used
 
 	if (_region_cache.size() == 0) {
-		return;
+		return false;
 	}
 
 	int oldest_index = -1;
@@ -525,17 +563,26 @@ void VoxelStreamRegionFiles::close_oldest_region() {
 
 	for (unsigned int i = 0; i < _region_cache.size(); ++i) {
 		const CachedRegion *r = _region_cache[i];
+		if (r->users > 0) {
+			continue;
+		}
 		const uint64_t time = now - r->last_opened;
 		if (time >= oldest_time) {
 			oldest_index = i;
+			oldest_time = time;
 		}
 	}
 
+	if (oldest_index == -1) {
+		return false;
+	}
+
 	CachedRegion *region = _region_cache[oldest_index];
 	_region_cache.erase(_region_cache.begin() + oldest_index);
 
 	close_region(region);
 	memdelete(region);
+	return true;
 }
 
 static inline int convert_block_coordinate(int p_x, int old_size, int new_size) {
@@ -564,7 +611,7 @@ void VoxelStreamRegionFiles::_convert_files(Meta new_meta) {
 	Ref<VoxelStreamRegionFiles> old_stream;
 	old_stream.instance();
 	// Keep file cache to a minimum for the old stream, we'll query all blocks once anyways
-	old_stream->_max_open_regions = MAX(1, FOPEN_MAX);
+	old_stream->_max_open_regions = MAX(1, FOPEN_MAX / VoxelRegionFile::MAX_OPEN_FILES);
 
 	// Backup current folder by renaming it, leaving the current name vacant
 	{
@@ -656,7 +703,8 @@ void VoxelStreamRegionFiles::_convert_files(Meta new_meta) {
 	for (unsigned int i = 0; i < old_region_list.size(); ++i) {
 		PositionAndLod region_info = old_region_list[i];
 
-		const CachedRegion *old_region = old_stream->open_region(region_info.position, region_info.lod, false);
+		// Pinned, so loading blocks from the old stream doesn't close it
+		CachedRegion *old_region = old_stream->open_region(region_info.position, region_info.lod, false);
 		if (old_region == nullptr) {
 			continue;
 		}
@@ -733,6 +781,8 @@ void VoxelStreamRegionFiles::_convert_files(Meta new_meta) {
 				}
 			}
 		}
+
+		old_stream->unpin_region(old_region);
 	}
 
 	close_all_regions();
@@ -866,6 +916,30 @@ void VoxelStreamRegionFiles::convert_files(Dictionary d) {
 	emit_changed();
 }
 
+void VoxelStreamRegionFiles::set_preload_regions(bool enabled) {
+	MutexLock lock(_mutex);
+	_preload_regions = enabled;
+	for (unsigned int i = 0; i < _region_cache.size(); ++i) {
+		_region_cache[i]->region.set_preload_enabled(enabled);
+	}
+}
+
+bool VoxelStreamRegionFiles::get_preload_regions() const {
+	MutexLock lock(_mutex);
+	return _preload_regions;
+}
+
+void VoxelStreamRegionFiles::set_compression(int compression) {
+	ERR_FAIL_INDEX(compression, VoxelCompressedData::COMPRESSION_COUNT);
+	MutexLock lock(_mutex);
+	_compression = static_cast<VoxelCompressedData::Compression>(compression);
+}
+
+int VoxelStreamRegionFiles::get_compression() const {
+	MutexLock lock(_mutex);
+	return _compression;
+}
+
 void VoxelStreamRegionFiles::_bind_methods() {
 	ClassDB::bind_method(D_METHOD("set_directory", "directory"), &VoxelStreamRegionFiles::set_directory);
 	ClassDB::bind_method(D_METHOD("get_directory"), &VoxelStreamRegionFiles::get_directory);
@@ -883,7 +957,16 @@ void VoxelStreamRegionFiles::_bind_methods() {
 
 	ClassDB::bind_method(D_METHOD("convert_files", "new_settings"), &VoxelStreamRegionFiles::convert_files);
 
+	ClassDB::bind_method(D_METHOD("set_preload_regions", "enabled"), &VoxelStreamRegionFiles::set_preload_regions);
+	ClassDB::bind_method(D_METHOD("get_preload_regions"), &VoxelStreamRegionFiles::get_preload_regions);
+
+	ClassDB::bind_method(D_METHOD("set_compression", "compression"), &VoxelStreamRegionFiles::set_compression);
+	ClassDB::bind_method(D_METHOD("get_compression"), &VoxelStreamRegionFiles::get_compression);
+
 	ADD_PROPERTY(PropertyInfo(Variant::STRING, "directory", PROPERTY_HINT_DIR), "set_directory", "get_directory");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "preload_regions"), "set_preload_regions", "get_preload_regions");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "compression", PROPERTY_HINT_ENUM, "None,LZ4,Zstd"),
+			"set_compression", "get_compression");
 
 	ADD_GROUP("Dimensions", "");
 	ADD_PROPERTY(PropertyInfo(Variant::INT, "lod_count"), "set_lod_count", "get_lod_count");
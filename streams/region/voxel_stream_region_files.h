@@ -16,7 +16,8 @@ class FileAccess;
 // because it allows to keep using the same file handles and avoid switching.
 // Inspired by https://www.seedofandromeda.com/blogs/1-creating-a-region-file-system-for-a-voxel-game
 //
-// Region files are not thread-safe. Because of this, internal mutexing may often constrain the use by one thread only.
+// Several threads can load blocks at the same time, including from the same region file. The stream is only locked
+// while finding or opening regions, and region files only lock their header while reading bytes.
 //
 class VoxelStreamRegionFiles : public VoxelStream {
 	GDCLASS(VoxelStreamRegionFiles, VoxelStream)
@@ -49,6 +50,15 @@ public:
 
 	void convert_files(Dictionary d);
 
+	// When enabled, region files are read entirely in memory when first used, and blocks are decompressed from there.
+	// Good for worlds which are mostly read, costs as much memory as open region files take on disk.
+	void set_preload_regions(bool enabled);
+	bool get_preload_regions() const;
+
+	// Compression used for blocks saved from now on. Blocks already saved keep theirs, since it is stored with them.
+	void set_compression(int compression);
+	int get_compression() const;
+
 protected:
 	static void _bind_methods();
 
@@ -73,10 +83,11 @@ private:
 	void close_all_regions();
 	String get_region_file_path(const Vector3i &region_pos, unsigned int lod) const;
 	CachedRegion *open_region(const Vector3i region_pos, unsigned int lod, bool create_if_not_found);
+	void unpin_region(CachedRegion *cache);
 	void close_region(CachedRegion *cache);
 	CachedRegion *get_region_from_cache(const Vector3i pos, int lod) const;
 	int get_sectors_count(const RegionHeader &header) const;
-	void close_oldest_region();
+	bool close_oldest_region();
 
 	struct Meta {
 		uint8_t version = -1;
@@ -111,10 +122,6 @@ private:
 
 	static thread_local VoxelBlockSerializerInternal _block_serializer;
 
-	// TODO This is not thread-friendly.
-	// `VoxelRegionFile` is not thread-safe so we have to limit the usage to one thread at once, blocking the others.
-	// A refactoring should be done to allow better threading.
-
 	struct CachedRegion {
 		Vector3i position;
 		int lod = 0;
@@ -122,6 +129,8 @@ private:
 		VoxelRegionFile region;
 		uint64_t last_opened = 0;
 		//uint64_t last_accessed;
+		// How many threads are using the region outside of the stream mutex. It can't be closed until it gets to zero.
+		unsigned int users = 0;
 	};
 
 	String _directory_path;
@@ -130,7 +139,11 @@ private:
 	bool _meta_saved = false;
 	std::vector<CachedRegion *> _region_cache;
 	// TODO Add memory caches to increase capacity.
-	unsigned int _max_open_regions = MIN(8, FOPEN_MAX);
+	// Can be exceeded temporarily if all open regions are in use.
+	// Each region can have several files open, so they count in the limit.
+	unsigned int _max_open_regions = MAX(1, MIN(8, FOPEN_MAX / VoxelRegionFile::MAX_OPEN_FILES));
+	bool _preload_regions = false;
+	VoxelCompressedData::Compression _compression = VoxelCompressedData::COMPRESSION_LZ4;
 
 	Mutex _mutex;
 };
@@ -46,6 +46,10 @@ struct BlockLocation {
 class VoxelStreamSQLiteInternal {
 public:
 	static const int VERSION = 0;
+	// How many blocks a single query can load
+	static const unsigned int LOAD_BATCH_SIZE = 32;
+	// How long a connection waits for another one to finish writing, instead of failing right away
+	static const int BUSY_TIMEOUT_MS = 5000;
 
 	struct Meta {
 		int version = -1;
@@ -67,7 +71,7 @@ public:
 	VoxelStreamSQLiteInternal();
 	~VoxelStreamSQLiteInternal();
 
-	bool open(const char *fpath);
+	bool open(const char *fpath, int page_cache_size_kb, int mmap_size_mb);
 	void close();
 
 	bool is_open() const { return _db != nullptr; }
@@ -81,11 +85,26 @@ public:
 		return _opened_path.c_str();
 	}
 
+	// Read transactions don't block each other, or a write transaction
 	bool begin_transaction();
+	// Takes the write lock of the database right away, so concurrent writers wait instead of failing when they write
+	bool begin_write_transaction();
 	bool end_transaction();
+	// Cancels all changes made since the transaction began
+	bool rollback_transaction();
 
 	bool save_block(BlockLocation loc, const std::vector<uint8_t> &block_data, BlockType type);
-	VoxelStream::Result load_block(BlockLocation loc, std::vector<uint8_t> &out_block_data, BlockType type);
+	bool save_voxels_and_instances(BlockLocation loc,
+			const std::vector<uint8_t> &voxel_data, const std::vector<uint8_t> &instance_data);
+
+	// Loads blocks at the given locations, querying up to LOAD_BATCH_SIZE of them at once.
+	// `f(index, data)` is called for each block found, where `index` is the index of its location in `locs`.
+	// `data` is only valid during the call.
+	template <typename F>
+	bool load_blocks(ArraySlice<const uint64_t> locs, BlockType type, F f);
+
+	// Used to tell if the connection was opened with the current settings of the stream
+	uint32_t generation = 0;
 
 	Meta load_meta();
 	void save_meta(Meta meta);
@@ -93,9 +112,13 @@ public:
 private:
 	struct TransactionScope {
 		VoxelStreamSQLiteInternal &db;
-		TransactionScope(VoxelStreamSQLiteInternal &p_db) :
+		TransactionScope(VoxelStreamSQLiteInternal &p_db, bool write) :
 				db(p_db) {
-			db.begin_transaction();
+			if (write) {
+				db.begin_write_transaction();
+			} else {
+				db.begin_transaction();
+			}
 		}
 		~TransactionScope() {
 			db.end_transaction();
@@ -111,6 +134,17 @@ private:
 		return true;
 	}
 
+	static bool exec(sqlite3 *db, const char *sql) {
+		char *error_message = nullptr;
+		const int rc = sqlite3_exec(db, sql, nullptr, nullptr, &error_message);
+		if (rc != SQLITE_OK) {
+			ERR_PRINT(String("{0} failed: {1}").format(varray(sql, error_message)));
+			sqlite3_free(error_message);
+			return false;
+		}
+		return true;
+	}
+
 	static void finalize(sqlite3_stmt *&s) {
 		if (s != nullptr) {
 			sqlite3_finalize(s);
@@ -121,11 +155,14 @@ private:
 	std::string _opened_path;
 	sqlite3 *_db = nullptr;
 	sqlite3_stmt *_begin_statement = nullptr;
+	sqlite3_stmt *_begin_write_statement = nullptr;
 	sqlite3_stmt *_end_statement = nullptr;
+	sqlite3_stmt *_rollback_statement = nullptr;
 	sqlite3_stmt *_update_voxel_block_statement = nullptr;
-	sqlite3_stmt *_get_voxel_block_statement = nullptr;
 	sqlite3_stmt *_update_instance_block_statement = nullptr;
-	sqlite3_stmt *_get_instance_block_statement = nullptr;
+	sqlite3_stmt *_update_block_statement = nullptr;
+	sqlite3_stmt *_get_voxel_blocks_statement = nullptr;
+	sqlite3_stmt *_get_instance_blocks_statement = nullptr;
 	sqlite3_stmt *_load_meta_statement = nullptr;
 	sqlite3_stmt *_save_meta_statement = nullptr;
 	sqlite3_stmt *_load_channels_statement = nullptr;
@@ -139,7 +176,7 @@ VoxelStreamSQLiteInternal::~VoxelStreamSQLiteInternal() {
 	close();
 }
 
-bool VoxelStreamSQLiteInternal::open(const char *fpath) {
+bool VoxelStreamSQLiteInternal::open(const char *fpath, int page_cache_size_kb, int mmap_size_mb) {
 	VOXEL_PROFILE_SCOPE();
 	close();
 
@@ -153,6 +190,26 @@ bool VoxelStreamSQLiteInternal::open(const char *fpath) {
 	sqlite3 *db = _db;
 	char *error_message = nullptr;
 
+	sqlite3_busy_timeout(db, BUSY_TIMEOUT_MS);
+
+	// With a write-ahead log, reads don't wait for writes, so each thread can load blocks with its own connection
+	// while others save. The mode is persistent, older databases switch to it the first time they are opened.
+	// Committing no longer needs to sync the database file, only the log when it gets checkpointed.
+	// A power loss can lose the last transactions, but can't corrupt the database.
+	const std::string pragmas[4] = {
+		"PRAGMA journal_mode=WAL",
+		"PRAGMA synchronous=NORMAL",
+		// Negative values are in kibibytes instead of pages
+		"PRAGMA cache_size=" + std::to_string(-static_cast<int64_t>(page_cache_size_kb)),
+		"PRAGMA mmap_size=" + std::to_string(static_cast<int64_t>(mmap_size_mb) * 1024 * 1024)
+	};
+	for (size_t i = 0; i < 4; ++i) {
+		if (!exec(db, pragmas[i].c_str())) {
+			close();
+			return false;
+		}
+	}
+
 	// Create tables if they dont exist
 	const char *tables[3] = {
 		"CREATE TABLE IF NOT EXISTS meta (version INTEGER, block_size_po2 INTEGER)",
@@ -175,23 +232,43 @@ bool VoxelStreamSQLiteInternal::open(const char *fpath) {
 				"ON CONFLICT(loc) DO UPDATE SET vb=excluded.vb")) {
 		return false;
 	}
-	if (!prepare(db, &_get_voxel_block_statement, "SELECT vb FROM blocks WHERE loc=:loc")) {
-		return false;
-	}
 	if (!prepare(db, &_update_instance_block_statement,
 				"INSERT INTO blocks VALUES (:loc, null, :instances) "
 				"ON CONFLICT(loc) DO UPDATE SET instances=excluded.instances")) {
 		return false;
 	}
-	if (!prepare(db, &_get_instance_block_statement, "SELECT instances FROM blocks WHERE loc=:loc")) {
+	if (!prepare(db, &_update_block_statement,
+				"INSERT INTO blocks VALUES (:loc, :vb, :instances) "
+				"ON CONFLICT(loc) DO UPDATE SET vb=excluded.vb, instances=excluded.instances")) {
 		return false;
 	}
+	{
+		std::string locs_list;
+		for (unsigned int i = 0; i < LOAD_BATCH_SIZE; ++i) {
+			locs_list += i == 0 ? "?" : ",?";
+		}
+		const std::string get_voxel_blocks_sql = "SELECT loc, vb FROM blocks WHERE loc IN (" + locs_list + ")";
+		if (!prepare(db, &_get_voxel_blocks_statement, get_voxel_blocks_sql.c_str())) {
+			return false;
+		}
+		const std::string get_instance_blocks_sql =
+				"SELECT loc, instances FROM blocks WHERE loc IN (" + locs_list + ")";
+		if (!prepare(db, &_get_instance_blocks_statement, get_instance_blocks_sql.c_str())) {
+			return false;
+		}
+	}
 	if (!prepare(db, &_begin_statement, "BEGIN")) {
 		return false;
 	}
+	if (!prepare(db, &_begin_write_statement, "BEGIN IMMEDIATE")) {
+		return false;
+	}
 	if (!prepare(db, &_end_statement, "END")) {
 		return false;
 	}
+	if (!prepare(db, &_rollback_statement, "ROLLBACK")) {
+		return false;
+	}
 	if (!prepare(db, &_load_meta_statement, "SELECT * FROM meta")) {
 		return false;
 	}
@@ -231,11 +308,14 @@ void VoxelStreamSQLiteInternal::close() {
 		return;
 	}
 	finalize(_begin_statement);
+	finalize(_begin_write_statement);
 	finalize(_end_statement);
+	finalize(_rollback_statement);
 	finalize(_update_voxel_block_statement);
-	finalize(_get_voxel_block_statement);
 	finalize(_update_instance_block_statement);
-	finalize(_get_instance_block_statement);
+	finalize(_update_block_statement);
+	finalize(_get_voxel_blocks_statement);
+	finalize(_get_instance_blocks_statement);
 	finalize(_load_meta_statement);
 	finalize(_save_meta_statement);
 	finalize(_load_channels_statement);
@@ -266,6 +346,20 @@ bool VoxelStreamSQLiteInternal::begin_transaction() {
 	return true;
 }
 
+bool VoxelStreamSQLiteInternal::begin_write_transaction() {
+	int rc = sqlite3_reset(_begin_write_statement);
+	if (rc != SQLITE_OK) {
+		ERR_PRINT(sqlite3_errmsg(_db));
+		return false;
+	}
+	rc = sqlite3_step(_begin_write_statement);
+	if (rc != SQLITE_DONE) {
+		ERR_PRINT(sqlite3_errmsg(_db));
+		return false;
+	}
+	return true;
+}
+
 bool VoxelStreamSQLiteInternal::end_transaction() {
 	int rc = sqlite3_reset(_end_statement);
 	if (rc != SQLITE_OK) {
@@ -280,6 +374,31 @@ bool VoxelStreamSQLiteInternal::end_transaction() {
 	return true;
 }
 
+bool VoxelStreamSQLiteInternal::rollback_transaction() {
+	int rc = sqlite3_reset(_rollback_statement);
+	if (rc != SQLITE_OK) {
+		ERR_PRINT(sqlite3_errmsg(_db));
+		return false;
+	}
+	rc = sqlite3_step(_rollback_statement);
+	if (rc != SQLITE_DONE) {
+		ERR_PRINT(sqlite3_errmsg(_db));
+		return false;
+	}
+	return true;
+}
+
+static bool bind_blob_or_null(sqlite3_stmt *statement, int index, const std::vector<uint8_t> &data) {
+	int rc;
+	if (data.size() == 0) {
+		rc = sqlite3_bind_null(statement, index);
+	} else {
+		// We use SQLITE_TRANSIENT so SQLite will make its own copy of the data
+		rc = sqlite3_bind_blob(statement, index, data.data(), data.size(), SQLITE_TRANSIENT);
+	}
+	return rc == SQLITE_OK;
+}
+
 bool VoxelStreamSQLiteInternal::save_block(BlockLocation loc, const std::vector<uint8_t> &block_data, BlockType type) {
 	VOXEL_PROFILE_SCOPE();
 
@@ -311,16 +430,43 @@ bool VoxelStreamSQLiteInternal::save_block(BlockLocation loc, const std::vector<
 		return false;
 	}
 
-	if (block_data.size() == 0) {
-		rc = sqlite3_bind_null(update_block_statement, 2);
-	} else {
-		// We use SQLITE_TRANSIENT so SQLite will make its own copy of the data
-		rc = sqlite3_bind_blob(update_block_statement, 2, block_data.data(), block_data.size(), SQLITE_TRANSIENT);
+	if (!bind_blob_or_null(update_block_statement, 2, block_data)) {
+		ERR_PRINT(sqlite3_errmsg(db));
+		return false;
+	}
+
+	rc = sqlite3_step(update_block_statement);
+	if (rc != SQLITE_DONE) {
+		ERR_PRINT(sqlite3_errmsg(db));
+		return false;
+	}
+
+	return true;
+}
+
+bool VoxelStreamSQLiteInternal::save_voxels_and_instances(BlockLocation loc,
+		const std::vector<uint8_t> &voxel_data, const std::vector<uint8_t> &instance_data) {
+	VOXEL_PROFILE_SCOPE();
+
+	sqlite3 *db = _db;
+	sqlite3_stmt *update_block_statement = _update_block_statement;
+
+	int rc = sqlite3_reset(update_block_statement);
+	if (rc != SQLITE_OK) {
+		ERR_PRINT(sqlite3_errmsg(db));
+		return false;
 	}
+
+	rc = sqlite3_bind_int64(update_block_statement, 1, loc.encode());
 	if (rc != SQLITE_OK) {
 		ERR_PRINT(sqlite3_errmsg(db));
 		return false;
 	}
+	if (!bind_blob_or_null(update_block_statement, 2, voxel_data) ||
+			!bind_blob_or_null(update_block_statement, 3, instance_data)) {
+		ERR_PRINT(sqlite3_errmsg(db));
+		return false;
+	}
 
 	rc = sqlite3_step(update_block_statement);
 	if (rc != SQLITE_DONE) {
@@ -331,63 +477,70 @@ bool VoxelStreamSQLiteInternal::save_block(BlockLocation loc, const std::vector<
 	return true;
 }
 
-VoxelStream::Result VoxelStreamSQLiteInternal::load_block(
-		BlockLocation loc, std::vector<uint8_t> &out_block_data, BlockType type) {
+template <typename F>
+bool VoxelStreamSQLiteInternal::load_blocks(ArraySlice<const uint64_t> locs, BlockType type, F f) {
+	VOXEL_PROFILE_SCOPE();
 
 	sqlite3 *db = _db;
 
-	sqlite3_stmt *get_block_statement;
+	sqlite3_stmt *get_blocks_statement;
 	switch (type) {
 		case VOXELS:
-			get_block_statement = _get_voxel_block_statement;
+			get_blocks_statement = _get_voxel_blocks_statement;
 			break;
 		case INSTANCES:
-			get_block_statement = _get_instance_block_statement;
+			get_blocks_statement = _get_instance_blocks_statement;
 			break;
 		default:
 			CRASH_NOW();
 	}
 
-	int rc;
-
-	rc = sqlite3_reset(get_block_statement);
-	if (rc != SQLITE_OK) {
-		ERR_PRINT(sqlite3_errmsg(db));
-		return VoxelStream::RESULT_ERROR;
-	}
+	for (size_t batch_begin = 0; batch_begin < locs.size(); batch_begin += LOAD_BATCH_SIZE) {
+		const size_t batch_end = MIN(batch_begin + LOAD_BATCH_SIZE, locs.size());
 
-	const uint64_t eloc = loc.encode();
-
-	rc = sqlite3_bind_int64(get_block_statement, 1, eloc);
-	if (rc != SQLITE_OK) {
-		ERR_PRINT(sqlite3_errmsg(db));
-		return VoxelStream::RESULT_ERROR;
-	}
-
-	VoxelStream::Result result = VoxelStream::RESULT_BLOCK_NOT_FOUND;
+		int rc = sqlite3_reset(get_blocks_statement);
+		if (rc != SQLITE_OK) {
+			ERR_PRINT(sqlite3_errmsg(db));
+			return false;
+		}
 
-	while (true) {
-		rc = sqlite3_step(get_block_statement);
-		if (rc == SQLITE_ROW) {
-			const void *blob = sqlite3_column_blob(get_block_statement, 0);
-			//const uint8_t *b = reinterpret_cast<const uint8_t *>(blob);
-			const size_t blob_size = sqlite3_column_bytes(get_block_statement, 0);
-			if (blob_size != 0) {
-				result = VoxelStream::RESULT_BLOCK_FOUND;
-				out_block_data.resize(blob_size);
-				memcpy(out_block_data.data(), blob, blob_size);
+		// Parameters beyond the end of the batch repeat its last location, which doesn't change the result
+		for (unsigned int i = 0; i < LOAD_BATCH_SIZE; ++i) {
+			const size_t loc_index = MIN(batch_begin + i, batch_end - 1);
+			rc = sqlite3_bind_int64(get_blocks_statement, i + 1, locs[loc_index]);
+			if (rc != SQLITE_OK) {
+				ERR_PRINT(sqlite3_errmsg(db));
+				return false;
 			}
-			// The query is still ongoing, we'll need to step one more time to complete it
-			continue;
 		}
-		if (rc != SQLITE_DONE) {
-			ERR_PRINT(sqlite3_errmsg(db));
-			return VoxelStream::RESULT_ERROR;
+
+		while (true) {
+			rc = sqlite3_step(get_blocks_statement);
+			if (rc == SQLITE_ROW) {
+				const uint64_t loc = sqlite3_column_int64(get_blocks_statement, 0);
+				const void *blob = sqlite3_column_blob(get_blocks_statement, 1);
+				const size_t blob_size = sqlite3_column_bytes(get_blocks_statement, 1);
+				if (blob_size == 0) {
+					continue;
+				}
+				const ArraySlice<const uint8_t> data(reinterpret_cast<const uint8_t *>(blob), blob_size);
+				// Rows come in no particular order, and the same location could have been requested more than once
+				for (size_t i = batch_begin; i < batch_end; ++i) {
+					if (locs[i] == loc) {
+						f(i, data);
+					}
+				}
+				continue;
+			}
+			if (rc != SQLITE_DONE) {
+				ERR_PRINT(sqlite3_errmsg(db));
+				return false;
+			}
+			break;
 		}
-		break;
 	}
 
-	return result;
+	return true;
 }
 
 VoxelStreamSQLiteInternal::Meta VoxelStreamSQLiteInternal::load_meta() {
@@ -401,7 +554,7 @@ VoxelStreamSQLiteInternal::Meta VoxelStreamSQLiteInternal::load_meta() {
 		return Meta();
 	}
 
-	TransactionScope transaction(*this);
+	TransactionScope transaction(*this, false);
 
 	Meta meta;
 
@@ -466,7 +619,7 @@ void VoxelStreamSQLiteInternal::save_meta(Meta meta) {
 		return;
 	}
 
-	TransactionScope transaction(*this);
+	TransactionScope transaction(*this, true);
 
 	rc = sqlite3_bind_int(save_meta_statement, 1, meta.version);
 	if (rc != SQLITE_OK) {
@@ -522,8 +675,14 @@ void VoxelStreamSQLiteInternal::save_meta(Meta meta) {
 thread_local VoxelBlockSerializerInternal VoxelStreamSQLite::_voxel_block_serializer;
 thread_local std::vector<uint8_t> VoxelStreamSQLite::_temp_block_data;
 thread_local std::vector<uint8_t> VoxelStreamSQLite::_temp_compressed_block_data;
-
-VoxelStreamSQLite::VoxelStreamSQLite() {
+thread_local std::vector<uint64_t> VoxelStreamSQLite::_temp_block_locations;
+thread_local std::vector<VoxelStreamCache::FlushedBlock> VoxelStreamSQLite::_temp_flushed_blocks;
+
+VoxelStreamSQLite::VoxelStreamSQLite() :
+		_compression(VoxelCompressedData::COMPRESSION_LZ4) {
+	_cache_flush_policy.max_size_in_bytes = static_cast<uint64_t>(DEFAULT_CACHE_MAX_SIZE_MB) * 1024 * 1024;
+	_cache_flush_policy.max_age_usec = static_cast<uint64_t>(DEFAULT_CACHE_MAX_AGE_MSEC) * 1000;
+	_cache_flush_policy.max_idle_usec = static_cast<uint64_t>(DEFAULT_CACHE_MAX_IDLE_MSEC) * 1000;
 }
 
 VoxelStreamSQLite::~VoxelStreamSQLite() {
@@ -553,16 +712,13 @@ void VoxelStreamSQLite::set_database_path(String path) {
 		// Note, the path could be invalid,
 		// Since Godot helpfully sets the property for every character typed in the inspector.
 		// So there can be lots of errors in the editor if you type it.
-		if (con.open(cpath)) {
+		if (con.open(cpath, _page_cache_size_kb, _mmap_size_mb)) {
 			flush_cache(&con);
 		}
 	}
-	for (auto it = _connection_pool.begin(); it != _connection_pool.end(); ++it) {
-		delete *it;
-	}
-	_connection_pool.clear();
 	_connection_path = path;
 	// Don't actually open anything here. We'll do it only when necessary
+	clear_connection_pool();
 }
 
 String VoxelStreamSQLite::get_database_path() const {
@@ -570,6 +726,89 @@ String VoxelStreamSQLite::get_database_path() const {
 	return _connection_path;
 }
 
+void VoxelStreamSQLite::set_compression(int compression) {
+	ERR_FAIL_INDEX(compression, VoxelCompressedData::COMPRESSION_COUNT);
+	_compression = compression;
+}
+
+int VoxelStreamSQLite::get_compression() const {
+	return _compression;
+}
+
+void VoxelStreamSQLite::set_page_cache_size_kb(int size_kb) {
+	ERR_FAIL_COND(size_kb < 0);
+	MutexLock lock(_connection_mutex);
+	if (size_kb == _page_cache_size_kb) {
+		return;
+	}
+	_page_cache_size_kb = size_kb;
+	clear_connection_pool();
+}
+
+int VoxelStreamSQLite::get_page_cache_size_kb() const {
+	MutexLock lock(_connection_mutex);
+	return _page_cache_size_kb;
+}
+
+void VoxelStreamSQLite::set_mmap_size_mb(int size_mb) {
+	ERR_FAIL_COND(size_mb < 0);
+	MutexLock lock(_connection_mutex);
+	if (size_mb == _mmap_size_mb) {
+		return;
+	}
+	_mmap_size_mb = size_mb;
+	clear_connection_pool();
+}
+
+int VoxelStreamSQLite::get_mmap_size_mb() const {
+	MutexLock lock(_connection_mutex);
+	return _mmap_size_mb;
+}
+
+void VoxelStreamSQLite::set_cache_max_size_mb(int size_mb) {
+	ERR_FAIL_COND(size_mb < 0);
+	MutexLock lock(_connection_mutex);
+	_cache_flush_policy.max_size_in_bytes = static_cast<uint64_t>(size_mb) * 1024 * 1024;
+	_cache.request_flush_check();
+}
+
+int VoxelStreamSQLite::get_cache_max_size_mb() const {
+	MutexLock lock(_connection_mutex);
+	return _cache_flush_policy.max_size_in_bytes / (1024 * 1024);
+}
+
+void VoxelStreamSQLite::set_cache_max_age_msec(int msec) {
+	ERR_FAIL_COND(msec < 0);
+	MutexLock lock(_connection_mutex);
+	_cache_flush_policy.max_age_usec = static_cast<uint64_t>(msec) * 1000;
+	_cache.request_flush_check();
+}
+
+int VoxelStreamSQLite::get_cache_max_age_msec() const {
+	MutexLock lock(_connection_mutex);
+	return _cache_flush_policy.max_age_usec / 1000;
+}
+
+void VoxelStreamSQLite::set_cache_max_idle_msec(int msec) {
+	ERR_FAIL_COND(msec < 0);
+	MutexLock lock(_connection_mutex);
+	_cache_flush_policy.max_idle_usec = static_cast<uint64_t>(msec) * 1000;
+	_cache.request_flush_check();
+}
+
+int VoxelStreamSQLite::get_cache_max_idle_msec() const {
+	MutexLock lock(_connection_mutex);
+	return _cache_flush_policy.max_idle_usec / 1000;
+}
+
+VoxelStreamCache::Stats VoxelStreamSQLite::get_cache_stats() const {
+	return _cache.get_stats();
+}
+
+Dictionary VoxelStreamSQLite::_b_get_cache_stats() const {
+	return get_cache_stats().to_dict();
+}
+
 VoxelStream::Result VoxelStreamSQLite::emerge_block(Ref<VoxelBuffer> out_buffer, Vector3i origin_in_voxels, int lod) {
 	VoxelBlockRequest r;
 	r.lod = lod;
@@ -595,6 +834,9 @@ void VoxelStreamSQLite::immerge_block(Ref<VoxelBuffer> buffer, Vector3i origin_i
 void VoxelStreamSQLite::emerge_blocks(Vector<VoxelBlockRequest> &p_blocks, Vector<Result> &out_results) {
 	VOXEL_PROFILE_SCOPE();
 
+	// Streaming threads take care of the cache while they use the stream
+	flush_cache_due_blocks();
+
 	// TODO Get block size from database
 	const int bs_po2 = VoxelConstants::DEFAULT_BLOCK_SIZE_PO2;
 
@@ -620,12 +862,8 @@ void VoxelStreamSQLite::emerge_blocks(Vector<VoxelBlockRequest> &p_blocks, Vecto
 		return;
 	}
 
-	VoxelStreamSQLiteInternal *con = get_connection();
-	ERR_FAIL_COND(con == nullptr);
-
-	// TODO We should handle busy return codes
-	ERR_FAIL_COND(con->begin_transaction() == false);
-
+	std::vector<uint64_t> &locs = _temp_block_locations;
+	locs.clear();
 	for (int i = 0; i < blocks_to_load.size(); ++i) {
 		const int ri = blocks_to_load[i];
 		const VoxelBlockRequest &r = p_blocks[ri];
@@ -635,22 +873,37 @@ void VoxelStreamSQLite::emerge_blocks(Vector<VoxelBlockRequest> &p_blocks, Vecto
 		loc.y = r.origin_in_voxels.y >> bs_po2;
 		loc.z = r.origin_in_voxels.z >> bs_po2;
 		loc.lod = r.lod;
+		locs.push_back(loc.encode());
 
-		const Result res = con->load_block(loc, _temp_block_data, VoxelStreamSQLiteInternal::VOXELS);
-
-		if (res == RESULT_BLOCK_FOUND) {
-			VoxelBlockRequest &wr = p_blocks.write[ri];
-			// TODO Not sure if we should actually expect non-null. There can be legit not found blocks.
-			ERR_FAIL_COND(wr.voxel_buffer.is_null());
-			_voxel_block_serializer.decompress_and_deserialize(_temp_block_data, **wr.voxel_buffer);
-		}
-
-		out_results.write[i] = res;
+		out_results.write[ri] = RESULT_BLOCK_NOT_FOUND;
 	}
 
-	ERR_FAIL_COND(con->end_transaction() == false);
+	VoxelStreamSQLiteInternal *con = get_connection();
+	ERR_FAIL_COND(con == nullptr);
 
+	if (!con->begin_transaction()) {
+		recycle_connection(con);
+		ERR_FAIL_MSG("Could not begin transaction");
+	}
+
+	const bool success = con->load_blocks(to_slice_const(locs), VoxelStreamSQLiteInternal::VOXELS,
+			[&p_blocks, &out_results, &blocks_to_load](size_t i, ArraySlice<const uint8_t> data) {
+				const int ri = blocks_to_load[i];
+				VoxelBlockRequest &wr = p_blocks.write[ri];
+				// TODO Not sure if we should actually expect non-null. There can be legit not found blocks.
+				ERR_FAIL_COND(wr.voxel_buffer.is_null());
+				if (_voxel_block_serializer.decompress_and_deserialize(data, **wr.voxel_buffer)) {
+					out_results.write[ri] = RESULT_BLOCK_FOUND;
+				} else {
+					out_results.write[ri] = RESULT_ERROR;
+				}
+			});
+
+	const bool ended = con->end_transaction();
 	recycle_connection(con);
+
+	ERR_FAIL_COND(!success);
+	ERR_FAIL_COND(!ended);
 }
 
 void VoxelStreamSQLite::immerge_blocks(const Vector<VoxelBlockRequest> &p_blocks) {
@@ -670,10 +923,7 @@ void VoxelStreamSQLite::immerge_blocks(const Vector<VoxelBlockRequest> &p_blocks
 		_cache.save_voxel_block(pos, r.lod, r.voxel_buffer);
 	}
 
-	// TODO We should consider using a serialized cache, and measure the threshold in bytes
-	if (_cache.get_indicative_block_count() >= CACHE_SIZE) {
-		flush_cache();
-	}
+	flush_cache_due_blocks();
 }
 
 bool VoxelStreamSQLite::supports_instance_blocks() const {
@@ -706,45 +956,53 @@ void VoxelStreamSQLite::load_instance_blocks(
 		return;
 	}
 
-	VoxelStreamSQLiteInternal *con = get_connection();
-	ERR_FAIL_COND(con == nullptr);
-
-	// TODO We should handle busy return codes
-	// TODO recycle on error
-	ERR_FAIL_COND(con->begin_transaction() == false);
-
+	std::vector<uint64_t> &locs = _temp_block_locations;
+	locs.clear();
 	for (int i = 0; i < blocks_to_load.size(); ++i) {
 		const int ri = blocks_to_load[i];
-		VoxelStreamInstanceDataRequest &r = out_blocks[ri];
+		const VoxelStreamInstanceDataRequest &r = out_blocks[ri];
 
 		BlockLocation loc;
 		loc.x = r.position.x;
 		loc.y = r.position.y;
 		loc.z = r.position.z;
 		loc.lod = r.lod;
+		locs.push_back(loc.encode());
 
-		const Result res = con->load_block(loc, _temp_compressed_block_data, VoxelStreamSQLiteInternal::INSTANCES);
-
-		if (res == RESULT_BLOCK_FOUND) {
-			if (!VoxelCompressedData::decompress(to_slice_const(_temp_compressed_block_data), _temp_block_data)) {
-				ERR_PRINT("Failed to decompress instance block");
-				out_results[i] = RESULT_ERROR;
-				continue;
-			}
-			r.data = std::make_unique<VoxelInstanceBlockData>();
-			if (!deserialize_instance_block_data(*r.data, to_slice_const(_temp_block_data))) {
-				ERR_PRINT("Failed to deserialize instance block");
-				out_results[i] = RESULT_ERROR;
-				continue;
-			}
-		}
-
-		out_results[i] = res;
+		out_results[ri] = RESULT_BLOCK_NOT_FOUND;
 	}
 
-	ERR_FAIL_COND(con->end_transaction() == false);
+	VoxelStreamSQLiteInternal *con = get_connection();
+	ERR_FAIL_COND(con == nullptr);
 
+	if (!con->begin_transaction()) {
+		recycle_connection(con);
+		ERR_FAIL_MSG("Could not begin transaction");
+	}
+
+	const bool success = con->load_blocks(to_slice_const(locs), VoxelStreamSQLiteInternal::INSTANCES,
+			[&out_blocks, &out_results, &blocks_to_load](size_t i, ArraySlice<const uint8_t> data) {
+				const int ri = blocks_to_load[i];
+				VoxelStreamInstanceDataRequest &r = out_blocks[ri];
+				if (!VoxelCompressedData::decompress(data, _temp_block_data)) {
+					ERR_PRINT("Failed to decompress instance block");
+					out_results[ri] = RESULT_ERROR;
+					return;
+				}
+				r.data = std::make_unique<VoxelInstanceBlockData>();
+				if (!deserialize_instance_block_data(*r.data, to_slice_const(_temp_block_data))) {
+					ERR_PRINT("Failed to deserialize instance block");
+					out_results[ri] = RESULT_ERROR;
+					return;
+				}
+				out_results[ri] = RESULT_BLOCK_FOUND;
+			});
+
+	const bool ended = con->end_transaction();
 	recycle_connection(con);
+
+	ERR_FAIL_COND(!success);
+	ERR_FAIL_COND(!ended);
 }
 
 void VoxelStreamSQLite::save_instance_blocks(ArraySlice<VoxelStreamInstanceDataRequest> p_blocks) {
@@ -757,10 +1015,7 @@ void VoxelStreamSQLite::save_instance_blocks(ArraySlice<VoxelStreamInstanceDataR
 		_cache.save_instance_block(r.position, r.lod, std::move(r.data));
 	}
 
-	// TODO Optimization: we should consider using a serialized cache, and measure the threshold in bytes
-	if (_cache.get_indicative_block_count() >= CACHE_SIZE) {
-		flush_cache();
-	}
+	flush_cache_due_blocks();
 }
 
 void VoxelStreamSQLite::flush_cache() {
@@ -776,52 +1031,115 @@ void VoxelStreamSQLite::flush_cache(VoxelStreamSQLiteInternal *con) {
 	PRINT_VERBOSE(String("VoxelStreamSQLite: Flushing cache ({0} elements)")
 						  .format(varray(_cache.get_indicative_block_count())));
 
-	VoxelBlockSerializerInternal &serializer = _voxel_block_serializer;
+	ERR_FAIL_COND(con == nullptr);
+
+	std::vector<VoxelStreamCache::FlushedBlock> &blocks = _temp_flushed_blocks;
+	_cache.find_all_blocks(blocks);
+	save_cached_blocks(con, blocks);
+}
+
+void VoxelStreamSQLite::flush_cache_due_blocks() {
+	VoxelStreamCache::FlushPolicy policy;
+	{
+		MutexLock lock(_connection_mutex);
+		policy = _cache_flush_policy;
+	}
+
+	std::vector<VoxelStreamCache::FlushedBlock> &blocks = _temp_flushed_blocks;
+	_cache.find_blocks_to_flush(policy, CACHE_FLUSH_BATCH_SIZE, blocks);
+	if (blocks.size() == 0) {
+		return;
+	}
 
+	VoxelStreamSQLiteInternal *con = get_connection();
 	ERR_FAIL_COND(con == nullptr);
-	ERR_FAIL_COND(con->begin_transaction() == false);
+	save_cached_blocks(con, blocks);
+	recycle_connection(con);
+}
 
-	std::vector<uint8_t> &temp_data = _temp_block_data;
-	std::vector<uint8_t> &temp_compressed_data = _temp_compressed_block_data;
+// Saves blocks in a single transaction, then removes them from the cache.
+// If the database fails to write any of them, nothing is saved and all of them remain in the cache.
+void VoxelStreamSQLite::save_cached_blocks(
+		VoxelStreamSQLiteInternal *con, std::vector<VoxelStreamCache::FlushedBlock> &blocks) {
 
-	// TODO Needs better error rollback handling
-	_cache.flush([&serializer, con, &temp_data, &temp_compressed_data](VoxelStreamCache::Block &block) {
-		ERR_FAIL_COND(!BlockLocation::validate(block.position, block.lod));
+	VOXEL_PROFILE_SCOPE();
 
-		BlockLocation loc;
-		loc.x = block.position.x;
-		loc.y = block.position.y;
-		loc.z = block.position.z;
-		loc.lod = block.lod;
-
-		// Save voxels
-		if (block.has_voxels) {
-			if (block.voxels.is_valid()) {
-				VoxelBlockSerializerInternal::SerializeResult res = serializer.serialize_and_compress(**block.voxels);
-				ERR_FAIL_COND(!res.success);
-				con->save_block(loc, res.data, VoxelStreamSQLiteInternal::VOXELS);
-			} else {
-				const std::vector<uint8_t> empty;
-				con->save_block(loc, empty, VoxelStreamSQLiteInternal::VOXELS);
-			}
-		}
+	ERR_FAIL_COND(con->begin_write_transaction() == false);
 
-		// Save instances
-		temp_compressed_data.clear();
-		if (block.instances != nullptr) {
-			temp_data.clear();
+	const VoxelCompressedData::Compression compression =
+			static_cast<VoxelCompressedData::Compression>(_compression.load());
 
-			serialize_instance_block_data(*block.instances, temp_data);
+	bool write_failed = false;
 
-			ERR_FAIL_COND(!VoxelCompressedData::compress(
-					to_slice_const(temp_data), temp_compressed_data, VoxelCompressedData::COMPRESSION_NONE));
+	_cache.save_blocks(blocks, [this, con, compression, &write_failed](const VoxelStreamCache::Block &block) {
+		if (write_failed) {
+			// Will be rolled back anyways
+			return false;
 		}
-		con->save_block(loc, temp_compressed_data, VoxelStreamSQLiteInternal::INSTANCES);
-
-		// TODO Optimization: add a version of the query that can update both at once
+		const Error err = save_cached_block(con, block, compression);
+		if (err == ERR_DATABASE_CANT_WRITE) {
+			write_failed = true;
+			return false;
+		}
+		// Blocks which can't be serialized would fail again every time, so they are dropped
+		return true;
 	});
 
-	ERR_FAIL_COND(con->end_transaction() == false);
+	if (write_failed || !con->end_transaction()) {
+		con->rollback_transaction();
+		// Blocks stay in the cache, make sure the next check looks at them again
+		_cache.request_flush_check();
+		ERR_FAIL_MSG("Could not save cached blocks, they will be saved again later");
+	}
+
+	// Blocks can only leave the cache once other connections can read them from the database
+	_cache.remove_flushed_blocks(blocks);
+}
+
+// Returns ERR_DATABASE_CANT_WRITE if the database failed,
+// or ERR_INVALID_DATA if the block could not be serialized, in which case nothing was written.
+Error VoxelStreamSQLite::save_cached_block(VoxelStreamSQLiteInternal *con, const VoxelStreamCache::Block &block,
+		VoxelCompressedData::Compression compression) {
+
+	ERR_FAIL_COND_V(!BlockLocation::validate(block.position, block.lod), ERR_INVALID_DATA);
+
+	BlockLocation loc;
+	loc.x = block.position.x;
+	loc.y = block.position.y;
+	loc.z = block.position.z;
+	loc.lod = block.lod;
+
+	// Instances
+	std::vector<uint8_t> &temp_compressed_data = _temp_compressed_block_data;
+	temp_compressed_data.clear();
+	if (block.instances != nullptr) {
+		std::vector<uint8_t> &temp_data = _temp_block_data;
+		temp_data.clear();
+
+		serialize_instance_block_data(*block.instances, temp_data);
+
+		ERR_FAIL_COND_V(!VoxelCompressedData::compress(
+								to_slice_const(temp_data), temp_compressed_data, VoxelCompressedData::COMPRESSION_NONE),
+				ERR_INVALID_DATA);
+	}
+
+	bool saved;
+	if (block.has_voxels) {
+		// Voxels and instances are saved with a single query
+		if (block.voxels.is_valid()) {
+			VoxelBlockSerializerInternal::SerializeResult res =
+					_voxel_block_serializer.serialize_and_compress(**block.voxels, compression);
+			ERR_FAIL_COND_V(!res.success, ERR_INVALID_DATA);
+			saved = con->save_voxels_and_instances(loc, res.data, temp_compressed_data);
+		} else {
+			const std::vector<uint8_t> empty;
+			saved = con->save_voxels_and_instances(loc, empty, temp_compressed_data);
+		}
+	} else {
+		saved = con->save_block(loc, temp_compressed_data, VoxelStreamSQLiteInternal::INSTANCES);
+	}
+
+	return saved ? OK : ERR_DATABASE_CANT_WRITE;
 }
 
 VoxelStreamSQLiteInternal *VoxelStreamSQLite::get_connection() {
@@ -837,6 +1155,9 @@ VoxelStreamSQLiteInternal *VoxelStreamSQLite::get_connection() {
 		return s;
 	}
 	String fpath = _connection_path;
+	const int page_cache_size_kb = _page_cache_size_kb;
+	const int mmap_size_mb = _mmap_size_mb;
+	const uint32_t generation = _connection_generation;
 	_connection_mutex.unlock();
 
 	if (fpath.empty()) {
@@ -844,18 +1165,19 @@ VoxelStreamSQLiteInternal *VoxelStreamSQLite::get_connection() {
 	}
 	VoxelStreamSQLiteInternal *con = new VoxelStreamSQLiteInternal();
 	CharString fpath_utf8 = fpath.utf8();
-	if (!con->open(fpath_utf8)) {
+	if (!con->open(fpath_utf8, page_cache_size_kb, mmap_size_mb)) {
 		delete con;
 		con = nullptr;
+	} else {
+		con->generation = generation;
 	}
 	return con;
 }
 
 void VoxelStreamSQLite::recycle_connection(VoxelStreamSQLiteInternal *con) {
-	String con_path = con->get_opened_file_path();
 	_connection_mutex.lock();
-	// If path differs, delete this connection
-	if (_connection_path != con_path) {
+	// If the path or settings changed since the connection was opened, delete it
+	if (con->generation != _connection_generation) {
 		_connection_mutex.unlock();
 		delete con;
 	} else {
@@ -864,10 +1186,50 @@ void VoxelStreamSQLite::recycle_connection(VoxelStreamSQLiteInternal *con) {
 	}
 }
 
+// This function does not lock any mutex for internal use.
+void VoxelStreamSQLite::clear_connection_pool() {
+	for (auto it = _connection_pool.begin(); it != _connection_pool.end(); ++it) {
+		delete *it;
+	}
+	_connection_pool.clear();
+	// Connections in use will be deleted when recycled
+	++_connection_generation;
+}
+
 void VoxelStreamSQLite::_bind_methods() {
 	ClassDB::bind_method(D_METHOD("set_database_path", "path"), &VoxelStreamSQLite::set_database_path);
 	ClassDB::bind_method(D_METHOD("get_database_path"), &VoxelStreamSQLite::get_database_path);
 
+	ClassDB::bind_method(D_METHOD("set_compression", "compression"), &VoxelStreamSQLite::set_compression);
+	ClassDB::bind_method(D_METHOD("get_compression"), &VoxelStreamSQLite::get_compression);
+
+	ClassDB::bind_method(D_METHOD("set_page_cache_size_kb", "size_kb"), &VoxelStreamSQLite::set_page_cache_size_kb);
+	ClassDB::bind_method(D_METHOD("get_page_cache_size_kb"), &VoxelStreamSQLite::get_page_cache_size_kb);
+
+	ClassDB::bind_method(D_METHOD("set_mmap_size_mb", "size_mb"), &VoxelStreamSQLite::set_mmap_size_mb);
+	ClassDB::bind_method(D_METHOD("get_mmap_size_mb"), &VoxelStreamSQLite::get_mmap_size_mb);
+
+	ClassDB::bind_method(D_METHOD("set_cache_max_size_mb", "size_mb"), &VoxelStreamSQLite::set_cache_max_size_mb);
+	ClassDB::bind_method(D_METHOD("get_cache_max_size_mb"), &VoxelStreamSQLite::get_cache_max_size_mb);
+
+	ClassDB::bind_method(D_METHOD("set_cache_max_age_msec", "msec"), &VoxelStreamSQLite::set_cache_max_age_msec);
+	ClassDB::bind_method(D_METHOD("get_cache_max_age_msec"), &VoxelStreamSQLite::get_cache_max_age_msec);
+
+	ClassDB::bind_method(D_METHOD("set_cache_max_idle_msec", "msec"), &VoxelStreamSQLite::set_cache_max_idle_msec);
+	ClassDB::bind_method(D_METHOD("get_cache_max_idle_msec"), &VoxelStreamSQLite::get_cache_max_idle_msec);
+
+	ClassDB::bind_method(D_METHOD("get_cache_stats"), &VoxelStreamSQLite::_b_get_cache_stats);
+
 	ADD_PROPERTY(PropertyInfo(Variant::STRING, "database_path", PROPERTY_HINT_FILE),
 			"set_database_path", "get_database_path");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "compression", PROPERTY_HINT_ENUM, "None,LZ4,Zstd"),
+			"set_compression", "get_compression");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "page_cache_size_kb"), "set_page_cache_size_kb", "get_page_cache_size_kb");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "mmap_size_mb"), "set_mmap_size_mb", "get_mmap_size_mb");
+
+	ADD_GROUP("Cache", "");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "cache_max_size_mb"), "set_cache_max_size_mb", "get_cache_max_size_mb");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "cache_max_age_msec"), "set_cache_max_age_msec", "get_cache_max_age_msec");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "cache_max_idle_msec"), "set_cache_max_idle_msec",
+			"get_cache_max_idle_msec");
 }
@@ -5,6 +5,7 @@
 #include "../voxel_stream.h"
 #include "../voxel_stream_cache.h"
 #include <core/os/mutex.h>
+#include <atomic>
 #include <vector>
 
 class VoxelStreamSQLiteInternal;
@@ -13,7 +14,12 @@ class VoxelStreamSQLiteInternal;
 class VoxelStreamSQLite : public VoxelStream {
 	GDCLASS(VoxelStreamSQLite, VoxelStream)
 public:
-	static const unsigned int CACHE_SIZE = 64;
+	static const int DEFAULT_PAGE_CACHE_SIZE_KB = 8192;
+	static const int DEFAULT_CACHE_MAX_SIZE_MB = 32;
+	static const int DEFAULT_CACHE_MAX_AGE_MSEC = 30000;
+	static const int DEFAULT_CACHE_MAX_IDLE_MSEC = 5000;
+	// How many blocks can be flushed at once because of their age or idle time
+	static const unsigned int CACHE_FLUSH_BATCH_SIZE = 16;
 
 	VoxelStreamSQLite();
 	~VoxelStreamSQLite();
@@ -21,6 +27,20 @@ public:
 	void set_database_path(String path);
 	String get_database_path() const;
 
+	// Compression used for blocks saved from now on. Blocks already saved keep theirs, since it is stored with them.
+	void set_compression(int compression);
+	int get_compression() const;
+
+	// Memory SQLite can use to cache pages of the database, for each connection.
+	// Several connections can be open at once, one for each thread using the stream.
+	void set_page_cache_size_kb(int size_kb);
+	int get_page_cache_size_kb() const;
+
+	// When above zero, that much of the database file is memory-mapped and read directly, instead of being copied
+	// from the file. Connections share the mapping.
+	void set_mmap_size_mb(int size_mb);
+	int get_mmap_size_mb() const;
+
 	Result emerge_block(Ref<VoxelBuffer> out_buffer, Vector3i origin_in_voxels, int lod) override;
 	void immerge_block(Ref<VoxelBuffer> buffer, Vector3i origin_in_voxels, int lod) override;
 
@@ -32,6 +52,22 @@ public:
 			ArraySlice<VoxelStreamInstanceDataRequest> out_blocks, ArraySlice<Result> out_results) override;
 	void save_instance_blocks(ArraySlice<VoxelStreamInstanceDataRequest> p_blocks) override;
 
+	// Saved blocks are kept in memory, and written to the database a few at a time as they become due.
+	// They are written when the cache exceeds its maximum size, oldest first, when they have been cached for longer
+	// than the maximum age, or when they were not saved again for longer than the maximum idle time.
+	// Zero disables a trigger.
+	void set_cache_max_size_mb(int size_mb);
+	int get_cache_max_size_mb() const;
+
+	void set_cache_max_age_msec(int msec);
+	int get_cache_max_age_msec() const;
+
+	void set_cache_max_idle_msec(int msec);
+	int get_cache_max_idle_msec() const;
+
+	VoxelStreamCache::Stats get_cache_stats() const;
+
+	// Writes all cached blocks
 	void flush_cache();
 
 private:
@@ -48,22 +84,41 @@ private:
 	//
 	// Because of this, in our use case, it might be simpler to just leave SQLite in thread-safe mode,
 	// and synchronize ourselves.
+	//
+	// So each thread takes a connection from a pool, and has it for itself until it gives it back.
+	// The database uses a write-ahead log, so threads loading blocks don't wait for each other or for a thread saving.
 
 	VoxelStreamSQLiteInternal *get_connection();
 	void recycle_connection(VoxelStreamSQLiteInternal *con);
 	void flush_cache(VoxelStreamSQLiteInternal *con);
+	void flush_cache_due_blocks();
+	void save_cached_blocks(VoxelStreamSQLiteInternal *con, std::vector<VoxelStreamCache::FlushedBlock> &blocks);
+	Error save_cached_block(VoxelStreamSQLiteInternal *con, const VoxelStreamCache::Block &block,
+			VoxelCompressedData::Compression compression);
+
+	Dictionary _b_get_cache_stats() const;
+	void clear_connection_pool();
 
 	static void _bind_methods();
 
 	String _connection_path;
 	std::vector<VoxelStreamSQLiteInternal *> _connection_pool;
+	// Incremented when connections must be reopened, like when the path or settings change
+	uint32_t _connection_generation = 0;
+	int _page_cache_size_kb = DEFAULT_PAGE_CACHE_SIZE_KB;
+	int _mmap_size_mb = 0;
+	VoxelStreamCache::FlushPolicy _cache_flush_policy;
 	Mutex _connection_mutex;
 	VoxelStreamCache _cache;
+	// Atomic because the cache can be flushed while the connection mutex is held or not
+	std::atomic<int> _compression;
 
 	// TODO I should consider specialized memory allocators
 	static thread_local VoxelBlockSerializerInternal _voxel_block_serializer;
 	static thread_local std::vector<uint8_t> _temp_block_data;
 	static thread_local std::vector<uint8_t> _temp_compressed_block_data;
+	static thread_local std::vector<uint64_t> _temp_block_locations;
+	static thread_local std::vector<VoxelStreamCache::FlushedBlock> _temp_flushed_blocks;
 };
 
 #endif // VOXEL_STREAM_SQLITE_H
@@ -17,14 +17,24 @@ const uint8_t BLOCK_VERSION = 2;
 const unsigned int BLOCK_TRAILING_MAGIC = 0x900df00d;
 const unsigned int BLOCK_TRAILING_MAGIC_SIZE = 4;
 const unsigned int BLOCK_METADATA_HEADER_SIZE = sizeof(uint32_t);
+
+// Palette and RLE compression are only used in memory, such channels are saved uncompressed
+inline VoxelBuffer::Compression get_serialized_compression(const VoxelBuffer &buffer, unsigned int channel_index) {
+	const VoxelBuffer::Compression compression = buffer.get_channel_compression(channel_index);
+	if (compression == VoxelBuffer::COMPRESSION_PALETTE || compression == VoxelBuffer::COMPRESSION_RLE) {
+		return VoxelBuffer::COMPRESSION_NONE;
+	}
+	return compression;
+}
 } // namespace
 
 size_t get_metadata_size_in_bytes(const VoxelBuffer &buffer) {
 	size_t size = 0;
 
-	const Map<Vector3i, Variant>::Element *elem = buffer.get_voxel_metadata().front();
-	while (elem != nullptr) {
-		const Vector3i pos = elem->key();
+	const VoxelMetadataMap &voxel_metadata = buffer.get_voxel_metadata_map();
+	for (unsigned int i = 0; i < voxel_metadata.size(); ++i) {
+		const VoxelMetadataMap::Entry &entry = voxel_metadata.get_entry(i);
+		const Vector3i pos = buffer.get_position_from_index(entry.index);
 
 		ERR_FAIL_COND_V_MSG(pos.x < 0 || static_cast<uint32_t>(pos.x) >= VoxelBuffer::MAX_SIZE, 0,
 				"Invalid voxel metadata X position");
@@ -36,11 +46,9 @@ size_t get_metadata_size_in_bytes(const VoxelBuffer &buffer) {
 		size += 3 * sizeof(uint16_t); // Positions are stored as 3 unsigned shorts
 
 		int len;
-		const Error err = encode_variant(elem->value(), nullptr, len, false);
+		const Error err = encode_variant(entry.value, nullptr, len, false);
 		ERR_FAIL_COND_V_MSG(err != OK, 0, "Error when trying to encode voxel metadata.");
 		size += len;
-
-		elem = elem->next();
 	}
 
 	// If no metadata is found at all, nothing is serialized, not even null.
@@ -85,23 +93,23 @@ void serialize_metadata(uint8_t *p_dst, const VoxelBuffer &buffer, const size_t
 		CRASH_COND_MSG(static_cast<size_t>(dst - p_dst) > metadata_size, "Wrote block metadata out of expected bounds");
 	}
 
-	const Map<Vector3i, Variant>::Element *elem = buffer.get_voxel_metadata().front();
-	while (elem != nullptr) {
+	// Entries are sorted by voxel index, so they are read back in order and appended without moving others
+	const VoxelMetadataMap &voxel_metadata = buffer.get_voxel_metadata_map();
+	for (unsigned int i = 0; i < voxel_metadata.size(); ++i) {
 		// Serializing key as ushort because it's more than enough for a 3D dense array
 		static_assert(VoxelBuffer::MAX_SIZE <= 65535, "Maximum size exceeds serialization support");
-		const Vector3i pos = elem->key();
+		const VoxelMetadataMap::Entry &entry = voxel_metadata.get_entry(i);
+		const Vector3i pos = buffer.get_position_from_index(entry.index);
 		write<uint16_t>(dst, pos.x);
 		write<uint16_t>(dst, pos.y);
 		write<uint16_t>(dst, pos.z);
 
 		int written_length;
-		const Error err = encode_variant(elem->value(), dst, written_length, false);
+		const Error err = encode_variant(entry.value, dst, written_length, false);
 		CRASH_COND_MSG(err != OK, "Error when trying to encode voxel metadata.");
 		dst += written_length;
 
 		CRASH_COND_MSG(static_cast<size_t>(dst - p_dst) > metadata_size, "Wrote voxel metadata out of expected bounds");
-
-		elem = elem->next();
 	}
 
 	CRASH_COND_MSG(static_cast<size_t>(dst - p_dst) != metadata_size,
@@ -153,7 +161,7 @@ size_t get_size_in_bytes(const VoxelBuffer &buffer, size_t &metadata_size) {
 	const Vector3i size_in_voxels = buffer.get_size();
 
 	for (unsigned int channel_index = 0; channel_index < VoxelBuffer::MAX_CHANNELS; ++channel_index) {
-		const VoxelBuffer::Compression compression = buffer.get_channel_compression(channel_index);
+		const VoxelBuffer::Compression compression = get_serialized_compression(buffer, channel_index);
 		const VoxelBuffer::Depth depth = buffer.get_channel_depth(channel_index);
 
 		// For format value
@@ -206,7 +214,7 @@ VoxelBlockSerializerInternal::SerializeResult VoxelBlockSerializerInternal::seri
 	f->store_16(voxel_buffer.get_size().z);
 
 	for (unsigned int channel_index = 0; channel_index < VoxelBuffer::MAX_CHANNELS; ++channel_index) {
-		const VoxelBuffer::Compression compression = voxel_buffer.get_channel_compression(channel_index);
+		const VoxelBuffer::Compression compression = get_serialized_compression(voxel_buffer, channel_index);
 		const VoxelBuffer::Depth depth = voxel_buffer.get_channel_depth(channel_index);
 		// Low nibble: compression (up to 16 values allowed)
 		// High nibble: depth (up to 16 values allowed)
@@ -216,8 +224,16 @@ VoxelBlockSerializerInternal::SerializeResult VoxelBlockSerializerInternal::seri
 		switch (compression) {
 			case VoxelBuffer::COMPRESSION_NONE: {
 				ArraySlice<uint8_t> data;
-				ERR_FAIL_COND_V(!voxel_buffer.get_channel_raw(channel_index, data), SerializeResult(_data, false));
-				f->store_buffer(data.data(), data.size());
+				if (voxel_buffer.get_channel_raw(channel_index, data)) {
+					f->store_buffer(data.data(), data.size());
+				} else {
+					// Decode straight into the output
+					const size_t pos = f->get_position();
+					const size_t len = VoxelBuffer::get_size_in_bytes_for_volume(voxel_buffer.get_size(), depth);
+					ERR_FAIL_COND_V(pos + len > _data.size(), SerializeResult(_data, false));
+					voxel_buffer.decode_channel_raw(channel_index, ArraySlice<uint8_t>(_data.data(), pos, pos + len));
+					f->seek(pos + len);
+				}
 			} break;
 
 			case VoxelBuffer::COMPRESSION_UNIFORM: {
@@ -362,7 +378,7 @@ bool VoxelBlockSerializerInternal::deserialize(const std::vector<uint8_t> &p_dat
 }
 
 VoxelBlockSerializerInternal::SerializeResult VoxelBlockSerializerInternal::serialize_and_compress(
-		const VoxelBuffer &voxel_buffer) {
+		const VoxelBuffer &voxel_buffer, VoxelCompressedData::Compression compression) {
 
 	VOXEL_PROFILE_SCOPE();
 
@@ -371,8 +387,7 @@ VoxelBlockSerializerInternal::SerializeResult VoxelBlockSerializerInternal::seri
 	const std::vector<uint8_t> &data = res.data;
 
 	res.success = VoxelCompressedData::compress(
-			ArraySlice<const uint8_t>(data.data(), 0, data.size()), _compressed_data,
-			VoxelCompressedData::COMPRESSION_LZ4);
+			ArraySlice<const uint8_t>(data.data(), 0, data.size()), _compressed_data, compression);
 	ERR_FAIL_COND_V(!res.success, SerializeResult(_compressed_data, false));
 
 	return SerializeResult(_compressed_data, true);
@@ -380,10 +395,15 @@ VoxelBlockSerializerInternal::SerializeResult VoxelBlockSerializerInternal::seri
 
 bool VoxelBlockSerializerInternal::decompress_and_deserialize(
 		const std::vector<uint8_t> &p_data, VoxelBuffer &out_voxel_buffer) {
+	return decompress_and_deserialize(ArraySlice<const uint8_t>(p_data.data(), 0, p_data.size()), out_voxel_buffer);
+}
+
+bool VoxelBlockSerializerInternal::decompress_and_deserialize(
+		ArraySlice<const uint8_t> p_data, VoxelBuffer &out_voxel_buffer) {
 
 	VOXEL_PROFILE_SCOPE();
 
-	const bool res = VoxelCompressedData::decompress(ArraySlice<const uint8_t>(p_data.data(), 0, p_data.size()), _data);
+	const bool res = VoxelCompressedData::decompress(p_data, _data);
 	ERR_FAIL_COND_V(!res, false);
 
 	return deserialize(_data, out_voxel_buffer);
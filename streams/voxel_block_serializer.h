@@ -1,6 +1,9 @@
 #ifndef VOXEL_BLOCK_SERIALIZER_H
 #define VOXEL_BLOCK_SERIALIZER_H
 
+#include "../util/array_slice.h"
+#include "compressed_data.h"
+
 #include <core/io/file_access_memory.h>
 #include <core/reference.h>
 #include <vector>
@@ -22,8 +25,11 @@ public:
 	SerializeResult serialize(const VoxelBuffer &voxel_buffer);
 	bool deserialize(const std::vector<uint8_t> &p_data, VoxelBuffer &out_voxel_buffer);
 
-	SerializeResult serialize_and_compress(const VoxelBuffer &voxel_buffer);
+	// Decompression doesn't need to know the compression, it is written along with the data
+	SerializeResult serialize_and_compress(const VoxelBuffer &voxel_buffer,
+			VoxelCompressedData::Compression compression = VoxelCompressedData::COMPRESSION_LZ4);
 	bool decompress_and_deserialize(const std::vector<uint8_t> &p_data, VoxelBuffer &out_voxel_buffer);
+	bool decompress_and_deserialize(ArraySlice<const uint8_t> p_data, VoxelBuffer &out_voxel_buffer);
 	bool decompress_and_deserialize(FileAccess *f, unsigned int size_to_read, VoxelBuffer &out_voxel_buffer);
 
 	int serialize(Ref<StreamPeer> peer, Ref<VoxelBuffer> voxel_buffer, bool compress);
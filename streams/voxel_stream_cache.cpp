@@ -1,4 +1,47 @@
 #include "voxel_stream_cache.h"
+#include "../util/profiling.h"
+#include <core/os/os.h>
+#include <algorithm>
+#include <limits>
+
+namespace {
+
+uint32_t get_instances_size_in_bytes(const VoxelInstanceBlockData *instances) {
+	if (instances == nullptr) {
+		return 0;
+	}
+	uint32_t size = sizeof(VoxelInstanceBlockData);
+	for (auto it = instances->layers.begin(); it != instances->layers.end(); ++it) {
+		size += sizeof(VoxelInstanceBlockData::LayerData) +
+				it->instances.size() * sizeof(VoxelInstanceBlockData::InstanceData);
+	}
+	return size;
+}
+
+// Returns when the block becomes due because of its age or idle time
+uint64_t get_flush_time_usec(const VoxelStreamCache::Block &block, const VoxelStreamCache::FlushPolicy &policy) {
+	uint64_t t = std::numeric_limits<uint64_t>::max();
+	if (policy.max_age_usec != 0) {
+		t = block.first_save_time_usec + policy.max_age_usec;
+	}
+	if (policy.max_idle_usec != 0) {
+		t = MIN(t, block.last_save_time_usec + policy.max_idle_usec);
+	}
+	return t;
+}
+
+} // namespace
+
+VoxelStreamCache::VoxelStreamCache() :
+		_count(0),
+		_size_in_bytes(0),
+		_last_version(0),
+		_next_flush_time_usec(0),
+		_hits(0),
+		_misses(0),
+		_coalesced_saves(0),
+		_flushed_blocks(0) {
+}
 
 bool VoxelStreamCache::load_voxel_block(Vector3i position, uint8_t lod_index, Ref<VoxelBuffer> &out_voxels) {
 	ERR_FAIL_COND_V(out_voxels.is_null(), false);
@@ -10,6 +53,7 @@ bool VoxelStreamCache::load_voxel_block(Vector3i position, uint8_t lod_index, Re
 	if (it == lod.blocks.end()) {
 		// Not in cache, will have to query
 		lod.rw_lock.read_unlock();
+		++_misses;
 		return false;
 
 	} else {
@@ -24,13 +68,14 @@ bool VoxelStreamCache::load_voxel_block(Vector3i position, uint8_t lod_index, Re
 		out_voxels->copy_voxel_metadata(**vb);
 
 		lod.rw_lock.read_unlock();
+		++_hits;
 		return true;
 	}
 }
 
-void VoxelStreamCache::save_voxel_block(Vector3i position, uint8_t lod_index, Ref<VoxelBuffer> voxels) {
-	Lod &lod = _cache[lod_index];
-	RWLockWrite wlock(lod.rw_lock);
+// Must be called with the LOD locked for writing
+VoxelStreamCache::Block &VoxelStreamCache::get_or_create_block(Lod &lod, Vector3i position, uint8_t lod_index) {
+	const uint64_t now = OS::get_singleton()->get_ticks_usec();
 	auto it = lod.blocks.find(position);
 
 	if (it == lod.blocks.end()) {
@@ -38,16 +83,37 @@ void VoxelStreamCache::save_voxel_block(Vector3i position, uint8_t lod_index, Re
 		Block b;
 		b.position = position;
 		b.lod = lod_index;
-		b.voxels = voxels;
-		b.has_voxels = true;
-		lod.blocks.insert(std::make_pair(position, std::move(b)));
+		b.first_save_time_usec = now;
+		it = lod.blocks.insert(std::make_pair(position, std::move(b))).first;
 		++_count;
 
 	} else {
-		// Cached already, overwrite
-		it->second.voxels = voxels;
-		it->second.has_voxels = true;
+		// Cached already, it will be overwritten
+		++_coalesced_saves;
 	}
+
+	Block &block = it->second;
+	block.version = ++_last_version;
+	block.last_save_time_usec = now;
+	return block;
+}
+
+void VoxelStreamCache::update_block_size(Block &block) {
+	uint32_t size_in_bytes = get_instances_size_in_bytes(block.instances.get());
+	if (block.voxels.is_valid()) {
+		size_in_bytes += block.voxels->get_channels_size_in_bytes();
+	}
+	_size_in_bytes += static_cast<int64_t>(size_in_bytes) - block.size_in_bytes;
+	block.size_in_bytes = size_in_bytes;
+}
+
+void VoxelStreamCache::save_voxel_block(Vector3i position, uint8_t lod_index, Ref<VoxelBuffer> voxels) {
+	Lod &lod = _cache[lod_index];
+	RWLockWrite wlock(lod.rw_lock);
+	Block &block = get_or_create_block(lod, position, lod_index);
+	block.voxels = voxels;
+	block.has_voxels = true;
+	update_block_size(block);
 }
 
 bool VoxelStreamCache::load_instance_block(
@@ -60,6 +126,7 @@ bool VoxelStreamCache::load_instance_block(
 	if (it == lod.blocks.end()) {
 		// Not in cache, will have to query
 		lod.rw_lock.read_unlock();
+		++_misses;
 		return false;
 
 	} else {
@@ -75,6 +142,7 @@ bool VoxelStreamCache::load_instance_block(
 		}
 
 		lod.rw_lock.read_unlock();
+		++_hits;
 		return true;
 	}
 }
@@ -84,23 +152,168 @@ void VoxelStreamCache::save_instance_block(
 
 	Lod &lod = _cache[lod_index];
 	RWLockWrite wlock(lod.rw_lock);
-	auto it = lod.blocks.find(position);
+	Block &block = get_or_create_block(lod, position, lod_index);
+	block.instances = std::move(instances);
+	update_block_size(block);
+}
 
-	if (it == lod.blocks.end()) {
-		// Not cached yet, create an entry
-		Block b;
-		b.position = position;
-		b.lod = lod_index;
-		b.instances = std::move(instances);
-		lod.blocks.insert(std::make_pair(position, std::move(b)));
-		++_count;
+unsigned int VoxelStreamCache::get_indicative_block_count() const {
+	return _count;
+}
 
-	} else {
-		// Cached already, overwrite
-		it->second.instances = std::move(instances);
+int64_t VoxelStreamCache::get_size_in_bytes() const {
+	return _size_in_bytes;
+}
+
+VoxelStreamCache::Stats VoxelStreamCache::get_stats() const {
+	Stats stats;
+	stats.hits = _hits;
+	stats.misses = _misses;
+	stats.coalesced_saves = _coalesced_saves;
+	stats.flushed_blocks = _flushed_blocks;
+	stats.block_count = _count;
+	stats.size_in_bytes = _size_in_bytes;
+	return stats;
+}
+
+void VoxelStreamCache::find_blocks_to_flush(
+		const FlushPolicy &policy, unsigned int max_blocks, std::vector<FlushedBlock> &out_blocks) {
+
+	out_blocks.clear();
+
+	int64_t excess_bytes = 0;
+	if (policy.max_size_in_bytes > 0) {
+		excess_bytes = _size_in_bytes - static_cast<int64_t>(policy.max_size_in_bytes);
+	}
+
+	const uint64_t now = OS::get_singleton()->get_ticks_usec();
+
+	if (_count == 0 || (excess_bytes <= 0 && now < _next_flush_time_usec)) {
+		return;
+	}
+
+	VOXEL_PROFILE_SCOPE();
+
+	struct Candidate {
+		FlushedBlock block;
+		uint64_t first_save_time_usec;
+		uint32_t size_in_bytes;
+		bool due;
+	};
+
+	struct CandidateOlder {
+		inline bool operator()(const Candidate &a, const Candidate &b) const {
+			return a.first_save_time_usec < b.first_save_time_usec;
+		}
+	};
+
+	static thread_local std::vector<Candidate> tls_candidates;
+	std::vector<Candidate> &candidates = tls_candidates;
+	candidates.clear();
+
+	uint64_t next_flush_time = std::numeric_limits<uint64_t>::max();
+	unsigned int due_count = 0;
+
+	for (unsigned int lod_index = 0; lod_index < _cache.size(); ++lod_index) {
+		const Lod &lod = _cache[lod_index];
+		RWLockRead rlock(lod.rw_lock);
+		for (auto it = lod.blocks.begin(); it != lod.blocks.end(); ++it) {
+			const Block &block = it->second;
+			const uint64_t flush_time = get_flush_time_usec(block, policy);
+			const bool due = flush_time <= now;
+			if (due) {
+				++due_count;
+			} else if (flush_time < next_flush_time) {
+				next_flush_time = flush_time;
+			}
+			if (due || excess_bytes > 0) {
+				Candidate c;
+				c.block.position = block.position;
+				c.block.lod = lod_index;
+				c.block.version = block.version;
+				c.first_save_time_usec = block.first_save_time_usec;
+				c.size_in_bytes = block.size_in_bytes;
+				c.due = due;
+				candidates.push_back(c);
+			}
+		}
+	}
+
+	const size_t count = MIN(candidates.size(), static_cast<size_t>(max_blocks));
+	std::partial_sort(candidates.begin(), candidates.begin() + count, candidates.end(), CandidateOlder());
+
+	unsigned int picked_due_count = 0;
+	for (size_t i = 0; i < count; ++i) {
+		const Candidate &c = candidates[i];
+		if (excess_bytes > 0) {
+			excess_bytes -= c.size_in_bytes;
+			out_blocks.push_back(c.block);
+		} else if (c.due) {
+			out_blocks.push_back(c.block);
+		} else {
+			continue;
+		}
+		if (c.due) {
+			++picked_due_count;
+		}
+	}
+
+	if (picked_due_count < due_count) {
+		// Some are left for the next call
+		next_flush_time = now;
+	} else if (policy.max_age_usec != 0 || policy.max_idle_usec != 0) {
+		// Blocks cached after the scan started can't be due before this
+		uint64_t min_delay = std::numeric_limits<uint64_t>::max();
+		if (policy.max_age_usec != 0) {
+			min_delay = policy.max_age_usec;
+		}
+		if (policy.max_idle_usec != 0) {
+			min_delay = MIN(min_delay, policy.max_idle_usec);
+		}
+		next_flush_time = MIN(next_flush_time, now + min_delay);
 	}
+
+	_next_flush_time_usec = next_flush_time;
 }
 
-unsigned int VoxelStreamCache::get_indicative_block_count() const {
-	return _count;
+void VoxelStreamCache::request_flush_check() {
+	_next_flush_time_usec = 0;
+}
+
+void VoxelStreamCache::find_all_blocks(std::vector<FlushedBlock> &out_blocks) const {
+	out_blocks.clear();
+	for (unsigned int lod_index = 0; lod_index < _cache.size(); ++lod_index) {
+		const Lod &lod = _cache[lod_index];
+		RWLockRead rlock(lod.rw_lock);
+		for (auto it = lod.blocks.begin(); it != lod.blocks.end(); ++it) {
+			const Block &block = it->second;
+			out_blocks.push_back(FlushedBlock{ block.position, static_cast<uint8_t>(lod_index), block.version });
+		}
+	}
+}
+
+void VoxelStreamCache::remove_flushed_blocks(const std::vector<FlushedBlock> &blocks) {
+	for (auto it = blocks.begin(); it != blocks.end(); ++it) {
+		const FlushedBlock &fb = *it;
+		if (fb.version == 0) {
+			// Was not saved, it may still be due
+			_next_flush_time_usec = 0;
+			continue;
+		}
+		Lod &lod = _cache[fb.lod];
+		RWLockWrite wlock(lod.rw_lock);
+		auto bit = lod.blocks.find(fb.position);
+		if (bit == lod.blocks.end()) {
+			continue;
+		}
+		if (bit->second.version != fb.version) {
+			// Saved again since then, so it still has to be flushed
+			_next_flush_time_usec = 0;
+			continue;
+		}
+		_size_in_bytes -= bit->second.size_in_bytes;
+		lod.blocks.erase(bit);
+		--_count;
+		++_flushed_blocks;
+	}
 }
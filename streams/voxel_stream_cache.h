@@ -3,11 +3,16 @@
 
 #include "../storage/voxel_buffer.h"
 #include "instance_data.h"
+#include <atomic>
 #include <memory>
 #include <unordered_map>
+#include <vector>
 
 // In-memory database for voxel streams.
 // It allows to cache blocks so we can save to the filesystem less frequently, or quickly reload recent blocks.
+// Saving a block which is already cached replaces it, so it gets written only once.
+// Blocks can be flushed all at once, or a few at a time when a flush policy tells they are due,
+// so writing them doesn't stall the calling thread for long.
 class VoxelStreamCache {
 public:
 	struct Block {
@@ -21,8 +26,54 @@ public:
 
 		Ref<VoxelBuffer> voxels;
 		std::unique_ptr<VoxelInstanceBlockData> instances;
+
+		// Approximate memory used by the cached data
+		uint32_t size_in_bytes = 0;
+		// Changes every time the block is saved, so we can tell if it was saved again while being flushed
+		uint32_t version = 0;
+		uint64_t first_save_time_usec = 0;
+		uint64_t last_save_time_usec = 0;
+	};
+
+	struct FlushPolicy {
+		// Blocks are flushed, oldest first, while the cache uses more memory than this. 0 means no limit.
+		uint64_t max_size_in_bytes = 0;
+		// Blocks cached for longer than this are flushed, even if they keep being saved again. 0 disables it.
+		uint64_t max_age_usec = 0;
+		// Blocks which were not saved again for this long are flushed. 0 disables it.
+		uint64_t max_idle_usec = 0;
+	};
+
+	// A block picked for flushing, and which version of it got saved
+	struct FlushedBlock {
+		Vector3i position;
+		uint8_t lod;
+		uint32_t version;
+	};
+
+	struct Stats {
+		uint64_t hits = 0;
+		uint64_t misses = 0;
+		// Saves replacing a block which was not flushed yet
+		uint64_t coalesced_saves = 0;
+		uint64_t flushed_blocks = 0;
+		unsigned int block_count = 0;
+		int64_t size_in_bytes = 0;
+
+		Dictionary to_dict() {
+			Dictionary d;
+			d["hits"] = hits;
+			d["misses"] = misses;
+			d["coalesced_saves"] = coalesced_saves;
+			d["flushed_blocks"] = flushed_blocks;
+			d["block_count"] = block_count;
+			d["size_in_bytes"] = size_in_bytes;
+			return d;
+		}
 	};
 
+	VoxelStreamCache();
+
 	// Copies cached block into provided buffer
 	bool load_voxel_block(Vector3i position, uint8_t lod_index, Ref<VoxelBuffer> &out_voxels);
 
@@ -37,29 +88,65 @@ public:
 	void save_instance_block(Vector3i position, uint8_t lod_index, std::unique_ptr<VoxelInstanceBlockData> instances);
 
 	unsigned int get_indicative_block_count() const;
+	int64_t get_size_in_bytes() const;
+
+	Stats get_stats() const;
+
+	// Finds up to `max_blocks` blocks the policy wants flushed, oldest first: blocks needed to get under the size
+	// limit, and blocks due because of their age or idle time.
+	// Blocks are only looked at if the cache is over the size limit, or if one of them may be due.
+	// So it is cheap to call often.
+	void find_blocks_to_flush(const FlushPolicy &policy, unsigned int max_blocks, std::vector<FlushedBlock> &out_blocks);
+
+	// Makes the next call to `find_blocks_to_flush` look at blocks. Must be called when the flush policy changes.
+	void request_flush_check();
 
+	void find_all_blocks(std::vector<FlushedBlock> &out_blocks) const;
+
+	// Calls `save_func(block)` for each of the given blocks still in the cache, and remembers which version was saved.
+	// `save_func` returns false if the block could not be saved, in which case it will remain in the cache.
+	// Blocks remain in the cache, so they can still be loaded until `remove_flushed_blocks` gets called,
+	// once what was saved can be read back from the stream.
 	template <typename F>
-	void flush(F save_func) {
-		_count = 0;
-		for (unsigned int lod_index = 0; lod_index < _cache.size(); ++lod_index) {
-			Lod &lod = _cache[lod_index];
-			RWLockWrite wlock(lod.rw_lock);
-			for (auto it = lod.blocks.begin(); it != lod.blocks.end(); ++it) {
-				Block &block = it->second;
-				save_func(block);
+	void save_blocks(std::vector<FlushedBlock> &blocks, F save_func) const {
+		for (auto it = blocks.begin(); it != blocks.end(); ++it) {
+			FlushedBlock &fb = *it;
+			const Lod &lod = _cache[fb.lod];
+			RWLockRead rlock(lod.rw_lock);
+			auto bit = lod.blocks.find(fb.position);
+			if (bit == lod.blocks.end()) {
+				// Flushed by another thread meanwhile
+				fb.version = 0;
+				continue;
 			}
-			lod.blocks.clear();
+			const Block &block = bit->second;
+			fb.version = save_func(block) ? block.version : 0;
 		}
 	}
 
+	// Removes blocks saved with `save_blocks`, unless they were saved again in the cache since then
+	void remove_flushed_blocks(const std::vector<FlushedBlock> &blocks);
+
 private:
 	struct Lod {
 		std::unordered_map<Vector3i, Block> blocks;
 		RWLock rw_lock;
 	};
 
+	Block &get_or_create_block(Lod &lod, Vector3i position, uint8_t lod_index);
+	void update_block_size(Block &block);
+
 	FixedArray<Lod, VoxelConstants::MAX_LOD> _cache;
-	unsigned int _count = 0;
+	std::atomic<unsigned int> _count;
+	std::atomic<int64_t> _size_in_bytes;
+	std::atomic<uint32_t> _last_version;
+	// Before this time, no block is due for flushing. Blocks can be flushed later than that.
+	std::atomic<uint64_t> _next_flush_time_usec;
+
+	std::atomic<uint64_t> _hits;
+	std::atomic<uint64_t> _misses;
+	std::atomic<uint64_t> _coalesced_saves;
+	std::atomic<uint64_t> _flushed_blocks;
 };
 
 #endif // VOXEL_STREAM_CACHE_H
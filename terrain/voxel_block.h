@@ -31,6 +31,11 @@ public:
 	uint32_t last_collider_update_time = 0;
 	bool has_deferred_collider_update = false;
 	Vector<Array> deferred_collider_data;
+	// Voxels get decompressed when edited. This is used to compress them again once edits stop.
+	uint64_t last_edit_time_usec = 0;
+	bool pending_recompression = false;
+	// Used to pick which blocks to evict first when voxel memory goes over budget
+	uint64_t last_access_time_usec = 0;
 
 	static VoxelBlock *create(Vector3i bpos, Ref<VoxelBuffer> buffer, unsigned int size, unsigned int p_lod_index);
 
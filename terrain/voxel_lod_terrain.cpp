@@ -17,6 +17,8 @@
 #include <scene/3d/mesh_instance.h>
 #include <scene/resources/packed_scene.h>
 
+#include <algorithm>
+
 namespace {
 
 Ref<ArrayMesh> build_mesh(const Vector<Array> surfaces, Mesh::PrimitiveType primitive, int compression_flags,
@@ -117,6 +119,17 @@ static inline uint64_t get_ticks_msec() {
 	return OS::get_singleton()->get_ticks_msec();
 }
 
+static inline uint64_t get_ticks_usec() {
+	return OS::get_singleton()->get_ticks_usec();
+}
+
+// Distance in voxels, relative to the volume
+static inline float get_block_center_distance_sq(Vector3i block_pos, int lod, int block_size, Vector3 viewer_pos) {
+	const int lod_block_size = block_size << lod;
+	const Vector3 center = (block_pos * lod_block_size + Vector3i(lod_block_size / 2)).to_vec3();
+	return center.distance_squared_to(viewer_pos);
+}
+
 } // namespace
 
 VoxelLodTerrain::VoxelLodTerrain() {
@@ -320,6 +333,7 @@ void VoxelLodTerrain::post_edit_block_lod0(Vector3i block_pos_lod0) {
 	ERR_FAIL_COND(block == nullptr);
 
 	block->set_modified(true);
+	lod0.map.mark_block_edited(block);
 
 	if (!block->get_needs_lodding()) {
 		block->set_needs_lodding(true);
@@ -535,6 +549,7 @@ void VoxelLodTerrain::_notification(int p_what) {
 					block->set_world(world);
 				});
 			}
+			VoxelServer::get_singleton()->set_volume_world(_volume_id, world->get_instance_id());
 #ifdef TOOLS_ENABLED
 			if (is_showing_gizmos()) {
 				_debug_renderer.set_world(is_visible_in_tree() ? world : nullptr);
@@ -548,6 +563,7 @@ void VoxelLodTerrain::_notification(int p_what) {
 					block->set_world(nullptr);
 				});
 			}
+			VoxelServer::get_singleton()->set_volume_world(_volume_id, 0);
 #ifdef TOOLS_ENABLED
 			_debug_renderer.set_world(nullptr);
 #endif
@@ -595,9 +611,10 @@ Vector3 VoxelLodTerrain::get_local_viewer_pos() const {
 	Vector3 pos = (_lods[0].last_viewer_block_pos << _lods[0].map.get_block_size_pow2()).to_vec3();
 
 	// TODO Support for multiple viewers, this is a placeholder implementation
-	VoxelServer::get_singleton()->for_each_viewer([&pos](const VoxelServer::Viewer &viewer, uint32_t viewer_id) {
-		pos = viewer.world_position;
-	});
+	VoxelServer::get_singleton()->for_each_volume_viewer(_volume_id,
+			[&pos](const VoxelServer::Viewer &viewer, uint32_t viewer_id) {
+				pos = viewer.world_position;
+			});
 
 	const Transform world_to_local = get_global_transform().affine_inverse();
 	pos = world_to_local.xform(pos);
@@ -1086,14 +1103,21 @@ void VoxelLodTerrain::_process() {
 
 	_stats.time_request_blocks_to_load = profiling_clock.restart();
 
+	// Results of background tasks are applied within a time budget. What remains is deferred to next frames.
+	// Block data may only use half of it, so it can't starve meshes.
+	const unsigned int main_thread_time_budget_usec = VoxelServer::get_singleton()->get_main_thread_time_budget_usec();
+	const uint64_t main_thread_deadline_usec = get_ticks_usec() + main_thread_time_budget_usec;
+	const uint64_t data_deadline_usec = main_thread_deadline_usec - main_thread_time_budget_usec / 2;
+
 	// Get block loading responses
-	// Note: if block loading is too fast, this can cause stutters.
-	// It should only happen on first load, though.
 	{
 		VOXEL_PROFILE_SCOPE();
 
-		for (size_t reception_index = 0; reception_index < _reception_buffers.data_output.size(); ++reception_index) {
+		size_t reception_index = 0;
+		for (; reception_index < _reception_buffers.data_output.size() && get_ticks_usec() < data_deadline_usec;
+				++reception_index) {
 			VOXEL_PROFILE_SCOPE();
+			const VoxelServerApplyTimer apply_timer(VoxelServer::APPLY_BLOCK_DATA);
 			const VoxelServer::BlockDataOutput &ob = _reception_buffers.data_output[reception_index];
 
 			if (ob.type == VoxelServer::BlockDataOutput::TYPE_SAVE) {
@@ -1180,7 +1204,8 @@ void VoxelLodTerrain::_process() {
 			}
 		}
 
-		_reception_buffers.data_output.clear();
+		shift_up(_reception_buffers.data_output, reception_index);
+		_stats.remaining_main_thread_data_blocks = (int)_reception_buffers.data_output.size();
 	}
 
 	_stats.time_process_load_responses = profiling_clock.restart();
@@ -1228,8 +1253,6 @@ void VoxelLodTerrain::_process() {
 
 	_stats.time_request_blocks_to_update = profiling_clock.restart();
 
-	const uint32_t main_thread_task_timeout = get_ticks_msec() + VoxelConstants::MAIN_THREAD_MESHING_BUDGET_MS;
-
 	// Receive mesh updates:
 	// This contains work that should normally be threaded, but isn't because of Godot limitations.
 	// So after a timeout, it stops processing and will resume next frame.
@@ -1238,15 +1261,28 @@ void VoxelLodTerrain::_process() {
 
 		const Transform global_transform = get_global_transform();
 
+		// Apply the closest meshes first, since others may have to wait for the next frames
+		if (_reception_buffers.mesh_output.size() > 1) {
+			VOXEL_PROFILE_SCOPE_NAMED("Sort mesh updates");
+			const int block_size = get_block_size();
+			sort_by_key(_reception_buffers.mesh_output,
+					[viewer_pos, block_size](const VoxelServer::BlockMeshOutput &ob) {
+						return get_block_center_distance_sq(ob.position, ob.lod, block_size, viewer_pos);
+					});
+		}
+
 		// The following is done on the main thread because Godot doesn't really support multithreaded Mesh allocation.
 		// This also proved to be very slow compared to the meshing process itself...
 		// hopefully Vulkan will allow us to upload graphical resources without stalling rendering as they upload?
 
 		size_t queue_index = 0;
-		for (; queue_index < _reception_buffers.mesh_output.size() && get_ticks_msec() < main_thread_task_timeout;
+		// At least one mesh is applied, so meshes keep coming even if other work took the whole budget
+		for (; queue_index < _reception_buffers.mesh_output.size() &&
+				(queue_index == 0 || get_ticks_usec() < main_thread_deadline_usec);
 				++queue_index) {
 
 			VOXEL_PROFILE_SCOPE();
+			const VoxelServerApplyTimer apply_timer(VoxelServer::APPLY_BLOCK_MESH);
 			const VoxelServer::BlockMeshOutput &ob = _reception_buffers.mesh_output[queue_index];
 
 			if (ob.lod >= get_lod_count()) {
@@ -1344,7 +1380,16 @@ void VoxelLodTerrain::_process() {
 
 	_stats.time_process_update_responses = profiling_clock.restart();
 
-	process_deferred_collision_updates(main_thread_task_timeout);
+	process_deferred_collision_updates(main_thread_deadline_usec);
+
+	// Edits decompress voxels, compress them again when the player is done with them
+	const uint64_t now_usec = OS::get_singleton()->get_ticks_usec();
+	for (int lod_index = 0; lod_index < _lod_count; ++lod_index) {
+		_lods[lod_index].map.for_each_idle_edited_block(now_usec,
+				VoxelConstants::BLOCK_RECOMPRESSION_IDLE_DELAY_USEC, [this](VoxelBlock *block) {
+					VoxelServer::get_singleton()->request_block_compression(_volume_id, block->voxels);
+				});
+	}
 
 #ifdef TOOLS_ENABLED
 	if (is_showing_gizmos() && is_visible_in_tree()) {
@@ -1353,7 +1398,7 @@ void VoxelLodTerrain::_process() {
 #endif
 }
 
-void VoxelLodTerrain::process_deferred_collision_updates(uint32_t timeout_msec) {
+void VoxelLodTerrain::process_deferred_collision_updates(uint64_t deadline_usec) {
 	VOXEL_PROFILE_SCOPE();
 
 	for (int lod_index = 0; lod_index < _lod_count; ++lod_index) {
@@ -1384,7 +1429,7 @@ void VoxelLodTerrain::process_deferred_collision_updates(uint32_t timeout_msec)
 			}
 
 			// We always process at least one, then we to check the timeout
-			if (get_ticks_msec() >= timeout_msec) {
+			if (get_ticks_usec() >= deadline_usec) {
 				return;
 			}
 		}
@@ -1443,6 +1488,7 @@ void VoxelLodTerrain::flush_pending_lod_edits() {
 			schedule_mesh_update(dst_block, dst_lod.blocks_pending_update);
 
 			dst_block->set_modified(true);
+			dst_lod.map.mark_block_edited(dst_block);
 
 			if (dst_lod_index != _lod_count - 1 && !dst_block->get_needs_lodding()) {
 				dst_block->set_needs_lodding(true);
@@ -1455,7 +1501,8 @@ void VoxelLodTerrain::flush_pending_lod_edits() {
 			// This must always be done after an edit before it gets saved, otherwise LODs won't match and it will look ugly.
 			// TODO Try to narrow to edited region instead of taking whole block
 			{
-				RWLockWrite lock(src_block->voxels->get_lock());
+				RWLockRead src_lock(src_block->voxels->get_lock());
+				RWLockWrite dst_lock(dst_block->voxels->get_lock());
 				src_block->voxels->downscale_to(
 						**dst_block->voxels, Vector3i(), src_block->voxels->get_size(), rel * half_bs);
 			}
@@ -1683,6 +1730,7 @@ Dictionary VoxelLodTerrain::_b_get_statistics() const {
 	d["time_process_update_responses"] = _stats.time_process_update_responses;
 
 	d["remaining_main_thread_blocks"] = _stats.remaining_main_thread_blocks + deferred_collision_updates;
+	d["remaining_main_thread_data_blocks"] = _stats.remaining_main_thread_data_blocks;
 	d["dropped_block_loads"] = _stats.dropped_block_loads;
 	d["dropped_block_meshs"] = _stats.dropped_block_meshs;
 	d["updated_blocks"] = _stats.updated_blocks;
@@ -94,6 +94,7 @@ public:
 		int dropped_block_loads = 0;
 		int dropped_block_meshs = 0;
 		int remaining_main_thread_blocks = 0;
+		int remaining_main_thread_data_blocks = 0;
 		uint32_t time_detect_required_blocks = 0;
 		uint32_t time_request_blocks_to_load = 0;
 		uint32_t time_process_load_responses = 0;
@@ -164,7 +165,7 @@ private:
 	void flush_pending_lod_edits();
 	void save_all_modified_blocks(bool with_copy);
 	void send_block_data_requests();
-	void process_deferred_collision_updates(uint32_t timeout_msec);
+	void process_deferred_collision_updates(uint64_t deadline_usec);
 
 	void add_transition_update(VoxelBlock *block);
 	void add_transition_updates_around(Vector3i block_pos, int lod_index);
@@ -2,6 +2,7 @@
 #include "../constants/cube_tables.h"
 #include "../util/macros.h"
 #include "voxel_block.h"
+#include <core/os/os.h>
 #include <limits>
 
 VoxelMap::VoxelMap() :
@@ -317,6 +318,7 @@ void VoxelMap::clear() {
 	}
 	_blocks.clear();
 	_blocks_map.clear();
+	_blocks_pending_recompression.clear();
 	_last_accessed_block = nullptr;
 }
 
@@ -334,3 +336,12 @@ bool VoxelMap::is_area_fully_loaded(const Rect3i voxels_box) const {
 		return has_block(pos);
 	});
 }
+
+void VoxelMap::mark_block_edited(VoxelBlock *block) {
+	CRASH_COND(block == nullptr);
+	block->last_edit_time_usec = OS::get_singleton()->get_ticks_usec();
+	if (!block->pending_recompression) {
+		block->pending_recompression = true;
+		_blocks_pending_recompression.push_back(block->position);
+	}
+}
@@ -2,6 +2,7 @@
 #define VOXEL_MAP_H
 
 #include "../util/fixed_array.h"
+#include "../util/funcs.h"
 #include "voxel_block.h"
 
 #include <core/hash_map.h>
@@ -61,6 +62,25 @@ public:
 	void paste(Vector3i min_pos, VoxelBuffer &src_buffer, unsigned int channels_mask, uint64_t mask_value,
 			bool create_new_blocks);
 
+	// Executes a read-write action on all voxels of the box that are in loaded blocks,
+	// using `VoxelBuffer::read_write_action`. Positions given to `action_func` are in voxels of the map.
+	template <typename F>
+	void read_write_action(Rect3i voxel_box, unsigned int channel, F action_func) {
+		for_each_block_buffer_in_box(voxel_box, [&voxel_box, channel, &action_func](VoxelBuffer &voxels, Vector3i origin) {
+			voxels.read_write_action(Rect3i(voxel_box.pos - origin, voxel_box.size), channel,
+					BlockToVoxelAction<F>(action_func, origin));
+		});
+	}
+
+	// Same as `read_write_action`, with values seen as floats
+	template <typename F>
+	void read_write_action_f(Rect3i voxel_box, unsigned int channel, F action_func) {
+		for_each_block_buffer_in_box(voxel_box, [&voxel_box, channel, &action_func](VoxelBuffer &voxels, Vector3i origin) {
+			voxels.read_write_action_f(Rect3i(voxel_box.pos - origin, voxel_box.size), channel,
+					BlockToVoxelAction<F>(action_func, origin));
+		});
+	}
+
 	// Moves the given buffer into a block of the map. The buffer is referenced, no copy is made.
 	VoxelBlock *set_block_buffer(Vector3i bpos, Ref<VoxelBuffer> buffer);
 
@@ -115,7 +135,66 @@ public:
 
 	bool is_area_fully_loaded(const Rect3i voxels_box) const;
 
+	// Remembers that voxels of the block were edited, so they can be compressed again once edits stop.
+	void mark_block_edited(VoxelBlock *block);
+
+	// Calls `f(block)` for each edited block which has not been edited for at least `idle_usec`,
+	// and forgets about them.
+	template <typename F>
+	void for_each_idle_edited_block(uint64_t now_usec, uint64_t idle_usec, F f) {
+		for (unsigned int i = 0; i < _blocks_pending_recompression.size(); ++i) {
+			VoxelBlock *block = get_block(_blocks_pending_recompression[i]);
+			// The block may have been unloaded, or replaced by another one
+			if (block != nullptr && block->pending_recompression) {
+				if (now_usec - block->last_edit_time_usec < idle_usec) {
+					continue;
+				}
+				block->pending_recompression = false;
+				f(block);
+			}
+			unordered_remove(_blocks_pending_recompression, i);
+			// Note: can underflow, but it is incremented right after
+			--i;
+		}
+	}
+
 private:
+	// Calls `f(voxels, block_origin)` for each loaded block intersecting the box, with its voxels locked for writing
+	template <typename F>
+	void for_each_block_buffer_in_box(Rect3i voxel_box, F f) {
+		const Rect3i block_box = voxel_box.downscaled(get_block_size());
+		const Vector3i max_bpos = block_box.pos + block_box.size;
+		Vector3i bpos;
+		for (bpos.z = block_box.pos.z; bpos.z < max_bpos.z; ++bpos.z) {
+			for (bpos.x = block_box.pos.x; bpos.x < max_bpos.x; ++bpos.x) {
+				for (bpos.y = block_box.pos.y; bpos.y < max_bpos.y; ++bpos.y) {
+					VoxelBlock *block = get_block(bpos);
+					if (block == nullptr) {
+						continue;
+					}
+					VoxelBuffer &voxels = **block->voxels;
+					RWLockWrite lock(voxels.get_lock());
+					f(voxels, block_to_voxel(bpos));
+				}
+			}
+		}
+	}
+
+	// Converts positions local to a block into positions in the map
+	template <typename F>
+	struct BlockToVoxelAction {
+		F &f;
+		Vector3i origin;
+
+		BlockToVoxelAction(F &p_f, Vector3i p_origin) :
+				f(p_f), origin(p_origin) {}
+
+		template <typename V>
+		inline V operator()(Vector3i pos, V v) const {
+			return f(pos + origin, v);
+		}
+	};
+
 	void set_block(Vector3i bpos, VoxelBlock *block);
 	VoxelBlock *get_or_create_block_at_voxel_pos(Vector3i pos);
 	VoxelBlock *create_default_block(Vector3i bpos);
@@ -132,6 +211,9 @@ private:
 	HashMap<Vector3i, unsigned int, Vector3iHasher, HashMapComparatorDefault<Vector3i>, 3, 2> _blocks_map;
 	std::vector<VoxelBlock *> _blocks;
 
+	// Positions of blocks which were edited since they were last compressed
+	std::vector<Vector3i> _blocks_pending_recompression;
+
 	// Voxel access will most frequently be in contiguous areas, so the same blocks are accessed.
 	// To prevent too much hashing, this reference is checked before.
 	mutable VoxelBlock *_last_accessed_block;
@@ -15,6 +15,8 @@
 #include <core/engine.h>
 #include <scene/3d/mesh_instance.h>
 
+#include <algorithm>
+
 VoxelTerrain::VoxelTerrain() {
 	// Note: don't do anything heavy in the constructor.
 	// Godot may create and destroy dozens of instances of all node types on startup,
@@ -247,6 +249,8 @@ void VoxelTerrain::make_block_dirty(VoxelBlock *block) {
 	// TODO Immediate update viewer distance?
 	CRASH_COND(block == nullptr);
 	block->set_modified(true);
+	_map.mark_block_edited(block);
+	block->last_access_time_usec = block->last_edit_time_usec;
 	try_schedule_block_update(block);
 
 	//OS::get_singleton()->print("Dirty (%i, %i, %i)", bpos.x, bpos.y, bpos.z);
@@ -269,10 +273,26 @@ void VoxelTerrain::try_schedule_block_update(VoxelBlock *block) {
 	}
 }
 
+static inline bool needs_mesh(const VoxelViewerRefCount &viewers) {
+	return viewers.get(VoxelViewerRefCount::TYPE_MESH) != 0 || viewers.get(VoxelViewerRefCount::TYPE_COLLISION) != 0;
+}
+
 void VoxelTerrain::view_block(Vector3i bpos, bool data_flag, bool mesh_flag, bool collision_flag) {
 	VoxelBlock *block = _map.get_block(bpos);
 
 	if (block == nullptr) {
+		VoxelViewerRefCount *evicted_viewers = _evicted_blocks.getptr(bpos);
+		if (evicted_viewers != nullptr) {
+			evicted_viewers->add(data_flag, mesh_flag, collision_flag);
+			if (mesh_flag || collision_flag) {
+				// Meshes need voxels
+				VoxelServer::get_singleton()->set_volume_pipeline_block_mesh_wanted(_volume_id, bpos, true);
+				reload_evicted_block(bpos);
+				reload_evicted_neighbors(bpos);
+			}
+			return;
+		}
+
 		// The block isn't loaded
 		LoadingBlock *loading_block = _loading_blocks.getptr(bpos);
 
@@ -285,33 +305,45 @@ void VoxelTerrain::view_block(Vector3i bpos, bool data_flag, bool mesh_flag, boo
 			_loading_blocks.set(bpos, new_loading_block);
 			_blocks_pending_load.push_back(bpos);
 
+			if (needs_mesh(new_loading_block.viewers)) {
+				VoxelServer::get_singleton()->set_volume_pipeline_block_mesh_wanted(_volume_id, bpos, true);
+				reload_evicted_neighbors(bpos);
+			}
+
 		} else {
 			// More viewers
+			const bool needed_mesh = needs_mesh(loading_block->viewers);
 			loading_block->viewers.add(data_flag, mesh_flag, collision_flag);
+
+			if (!needed_mesh && needs_mesh(loading_block->viewers)) {
+				VoxelServer::get_singleton()->set_volume_pipeline_block_mesh_wanted(_volume_id, bpos, true);
+				reload_evicted_neighbors(bpos);
+			}
 		}
 
 	} else {
 		// The block is loaded
 		VoxelViewerRefCount &viewers = block->viewers;
+		const bool needed_mesh = needs_mesh(viewers);
 
-		if (data_flag) {
-			viewers.add(VoxelViewerRefCount::TYPE_DATA);
-		}
+		viewers.add(data_flag, mesh_flag, collision_flag);
 
-		if (mesh_flag) {
-			viewers.add(VoxelViewerRefCount::TYPE_MESH);
-			if (viewers.get(VoxelViewerRefCount::TYPE_MESH) == 1) {
-				// First to request a mesh (means it was not requested when the block was loaded earlier)
+		if (!needed_mesh && needs_mesh(viewers)) {
+			// First to request a mesh (means it was not requested when the block was loaded earlier)
+			reload_evicted_neighbors(bpos);
+			if (VoxelServer::get_singleton()->set_volume_pipeline_block_mesh_wanted(_volume_id, bpos, true)) {
+				// The server meshes it, either now or once its neighbors are loaded
+				if (block->get_mesh_state() != VoxelBlock::MESH_UPDATE_NOT_SENT) {
+					block->set_mesh_state(VoxelBlock::MESH_UPDATE_SENT);
+				}
+			} else {
 				// Trigger mesh update
 				try_schedule_block_update(block);
 			}
-		}
 
-		if (collision_flag) {
-			viewers.add(VoxelViewerRefCount::TYPE_COLLISION);
-			if (viewers.get(VoxelViewerRefCount::TYPE_COLLISION) == 1) {
-				try_schedule_block_update(block);
-			}
+		} else if (collision_flag && viewers.get(VoxelViewerRefCount::TYPE_COLLISION) == 1) {
+			// The mesh may have been built without collisions
+			try_schedule_block_update(block);
 		}
 
 		// TODO viewers with varying flags during the game is not supported at the moment.
@@ -323,6 +355,15 @@ void VoxelTerrain::unview_block(Vector3i bpos, bool data_flag, bool mesh_flag, b
 	VoxelBlock *block = _map.get_block(bpos);
 
 	if (block == nullptr) {
+		VoxelViewerRefCount *evicted_viewers = _evicted_blocks.getptr(bpos);
+		if (evicted_viewers != nullptr) {
+			evicted_viewers->remove(data_flag, mesh_flag, collision_flag);
+			if (evicted_viewers->get(VoxelViewerRefCount::TYPE_DATA) == 0) {
+				_evicted_blocks.erase(bpos);
+			}
+			return;
+		}
+
 		// The block isn't loaded
 		LoadingBlock *loading_block = _loading_blocks.getptr(bpos);
 		if (loading_block == nullptr) {
@@ -331,8 +372,13 @@ void VoxelTerrain::unview_block(Vector3i bpos, bool data_flag, bool mesh_flag, b
 			return;
 		}
 
+		const bool needed_mesh = needs_mesh(loading_block->viewers);
 		loading_block->viewers.remove(data_flag, mesh_flag, collision_flag);
 
+		if (needed_mesh && !needs_mesh(loading_block->viewers)) {
+			VoxelServer::get_singleton()->set_volume_pipeline_block_mesh_wanted(_volume_id, bpos, false);
+		}
+
 		if (loading_block->viewers.get(VoxelViewerRefCount::TYPE_DATA) == 0) {
 			// No longer want to load it
 			_loading_blocks.erase(bpos);
@@ -367,6 +413,10 @@ void VoxelTerrain::unview_block(Vector3i bpos, bool data_flag, bool mesh_flag, b
 			}
 		}
 
+		if ((mesh_flag || collision_flag) && !needs_mesh(viewers)) {
+			VoxelServer::get_singleton()->set_volume_pipeline_block_mesh_wanted(_volume_id, bpos, false);
+		}
+
 		if (data_flag) {
 			viewers.remove(VoxelViewerRefCount::TYPE_DATA);
 		}
@@ -410,6 +460,8 @@ void VoxelTerrain::immerge_block(Vector3i bpos) {
 
 	_loading_blocks.erase(bpos);
 
+	VoxelServer::get_singleton()->remove_volume_pipeline_block(_volume_id, bpos);
+
 	// Blocks in the update queue will be cancelled in _process,
 	// because it's too expensive to linear-search all blocks for each block
 
@@ -422,6 +474,130 @@ void VoxelTerrain::immerge_block(Vector3i bpos) {
 	// }
 }
 
+void VoxelTerrain::evict_blocks_over_budget() {
+	if (!VoxelServer::get_singleton()->is_voxel_memory_over_budget()) {
+		_eviction_candidates.clear();
+		return;
+	}
+	VOXEL_PROFILE_SCOPE();
+
+	struct CandidateComparator {
+		inline bool operator()(const EvictionCandidate &a, const EvictionCandidate &b) const {
+			return a.last_access_time_usec > b.last_access_time_usec;
+		}
+	};
+
+	const uint64_t now = OS::get_singleton()->get_ticks_usec();
+
+	if (_eviction_candidates.empty()) {
+		// The budget is shared by all volumes, so it is possible none of our blocks can be evicted.
+		// Don't look through all blocks every frame in that case.
+		if (now < _next_eviction_scan_time_usec) {
+			return;
+		}
+
+		_map.for_all_blocks([this](const VoxelBlock *block) {
+			if (can_evict_block(*block)) {
+				_eviction_candidates.push_back(EvictionCandidate{ block->position, block->last_access_time_usec });
+			}
+		});
+
+		if (_eviction_candidates.empty()) {
+			_next_eviction_scan_time_usec = now + VoxelConstants::BLOCK_EVICTION_SCAN_BACKOFF_USEC;
+			return;
+		}
+
+		// Least recently accessed last, so they can be popped
+		std::sort(_eviction_candidates.begin(), _eviction_candidates.end(), CandidateComparator());
+	}
+
+	unsigned int evicted_count = 0;
+	while (_eviction_candidates.size() > 0 && evicted_count < VoxelConstants::MAX_BLOCK_EVICTIONS_PER_FRAME) {
+		const EvictionCandidate candidate = _eviction_candidates.back();
+		_eviction_candidates.pop_back();
+
+		// Things may have changed since the scan
+		const VoxelBlock *block = _map.get_block(candidate.position);
+		if (block == nullptr || block->last_access_time_usec != candidate.last_access_time_usec ||
+				!can_evict_block(*block)) {
+			continue;
+		}
+
+		evict_block(candidate.position);
+		++evicted_count;
+	}
+}
+
+bool VoxelTerrain::can_evict_block(const VoxelBlock &block) const {
+	// Edited blocks are kept, because their changes may not have reached the stream yet
+	if (block.is_modified() || block.last_edit_time_usec != 0) {
+		return false;
+	}
+	// Meshes need voxels of their block and its neighbors
+	for (unsigned int i = 0; i < Cube::MOORE_AREA_3D_COUNT; ++i) {
+		const Vector3i npos = block.position + Cube::g_ordered_moore_area_3d[i];
+		const VoxelBlock *nblock = _map.get_block(npos);
+		if (nblock != nullptr) {
+			if (needs_mesh(nblock->viewers)) {
+				return false;
+			}
+		} else {
+			// The server only meshes a loading block once all its neighbors are loaded,
+			// so evicting one of them would leave it without a mesh
+			const LoadingBlock *loading_block = _loading_blocks.getptr(npos);
+			if (loading_block != nullptr && needs_mesh(loading_block->viewers)) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+void VoxelTerrain::evict_block(Vector3i bpos) {
+	VoxelViewerRefCount viewers;
+	_map.remove_block(bpos, [this, &viewers](VoxelBlock *block) {
+		viewers = block->viewers;
+		emit_block_unloaded(block);
+	});
+	_evicted_blocks.set(bpos, viewers);
+	VoxelServer::get_singleton()->remove_volume_pipeline_block(_volume_id, bpos);
+	++_stats.evicted_blocks;
+}
+
+void VoxelTerrain::reload_evicted_block(Vector3i bpos) {
+	const VoxelViewerRefCount *viewers = _evicted_blocks.getptr(bpos);
+	ERR_FAIL_COND(viewers == nullptr);
+	LoadingBlock loading_block;
+	loading_block.viewers = *viewers;
+	loading_block.was_evicted = true;
+	_evicted_blocks.erase(bpos);
+	_loading_blocks.set(bpos, loading_block);
+	_blocks_pending_load.push_back(bpos);
+	++_stats.reloaded_blocks;
+}
+
+void VoxelTerrain::reload_evicted_neighbors(Vector3i bpos) {
+	// Meshes need voxels of their block and its neighbors
+	for (unsigned int i = 0; i < Cube::MOORE_AREA_3D_COUNT; ++i) {
+		const Vector3i npos = bpos + Cube::g_ordered_moore_area_3d[i];
+		if (_evicted_blocks.has(npos)) {
+			reload_evicted_block(npos);
+		}
+	}
+}
+
+void VoxelTerrain::reload_evicted_blocks_in_area(Rect3i voxel_box) {
+	const uint64_t now = OS::get_singleton()->get_ticks_usec();
+	voxel_box.downscaled(_map.get_block_size()).for_each_cell([this, now](Vector3i bpos) {
+		VoxelBlock *block = _map.get_block(bpos);
+		if (block != nullptr) {
+			block->last_access_time_usec = now;
+		} else if (_evicted_blocks.has(bpos)) {
+			reload_evicted_block(bpos);
+		}
+	});
+}
+
 void VoxelTerrain::save_all_modified_blocks(bool with_copy) {
 	// That may cause a stutter, so should be used when the player won't notice
 	_map.for_all_blocks(ScheduleSaveAction{ _blocks_to_save, with_copy });
@@ -448,6 +624,28 @@ Dictionary VoxelTerrain::_b_get_statistics() const {
 	d["dropped_block_meshs"] = _stats.dropped_block_meshs;
 	d["updated_blocks"] = _stats.updated_blocks;
 	d["remaining_main_thread_blocks"] = _stats.remaining_main_thread_blocks;
+	d["remaining_main_thread_data_blocks"] = _stats.remaining_main_thread_data_blocks;
+	d["evicted_blocks"] = _stats.evicted_blocks;
+	d["reloaded_blocks"] = _stats.reloaded_blocks;
+
+	// Blocks needing a mesh can't get one if a neighbor is neither loaded nor loading.
+	// This looks at every block, so it is counted here rather than in _process.
+	int blocks_missing_neighbors = 0;
+	const Rect3i bounds_in_blocks = _bounds_in_voxels.downscaled(1 << get_block_size_pow2());
+	_map.for_all_blocks([this, &blocks_missing_neighbors, &bounds_in_blocks](const VoxelBlock *block) {
+		if (!needs_mesh(block->viewers)) {
+			return;
+		}
+		for (unsigned int i = 0; i < Cube::MOORE_AREA_3D_COUNT; ++i) {
+			const Vector3i npos = block->position + Cube::g_ordered_moore_area_3d[i];
+			if (bounds_in_blocks.contains(npos) && _map.get_block(npos) == nullptr &&
+					_loading_blocks.getptr(npos) == nullptr) {
+				++blocks_missing_neighbors;
+				return;
+			}
+		}
+	});
+	d["blocks_missing_neighbors"] = blocks_missing_neighbors;
 
 	return d;
 }
@@ -524,6 +722,8 @@ void VoxelTerrain::stop_streamer() {
 	VoxelServer::get_singleton()->set_volume_stream(_volume_id, Ref<VoxelStream>());
 	VoxelServer::get_singleton()->set_volume_generator(_volume_id, Ref<VoxelGenerator>());
 	_loading_blocks.clear();
+	_evicted_blocks.clear();
+	_eviction_candidates.clear();
 	_blocks_pending_load.clear();
 	_reception_buffers.data_output.clear();
 }
@@ -537,6 +737,8 @@ void VoxelTerrain::reset_map() {
 	_map.create(get_block_size_pow2(), 0);
 
 	_loading_blocks.clear();
+	_evicted_blocks.clear();
+	_eviction_candidates.clear();
 	_blocks_pending_load.clear();
 	_blocks_pending_update.clear();
 	_blocks_to_save.clear();
@@ -762,10 +964,12 @@ void VoxelTerrain::_notification(int p_what) {
 
 		case NOTIFICATION_ENTER_WORLD: {
 			_map.for_all_blocks(SetWorldAction(*get_world()));
+			VoxelServer::get_singleton()->set_volume_world(_volume_id, get_world()->get_instance_id());
 		} break;
 
 		case NOTIFICATION_EXIT_WORLD:
 			_map.for_all_blocks(SetWorldAction(nullptr));
+			VoxelServer::get_singleton()->set_volume_world(_volume_id, 0);
 			break;
 
 		case NOTIFICATION_VISIBILITY_CHANGED:
@@ -841,6 +1045,19 @@ bool VoxelTerrain::try_get_paired_viewer_index(uint32_t id, size_t &out_i) const
 	return false;
 }
 
+// Distance is in blocks
+int VoxelTerrain::get_closest_viewer_distance_sq(Vector3i block_pos) const {
+	CRASH_COND(_paired_viewers.size() == 0);
+	int closest_distance_sq = _paired_viewers[0].state.block_position.distance_sq(block_pos);
+	for (size_t i = 1; i < _paired_viewers.size(); ++i) {
+		const int d = _paired_viewers[i].state.block_position.distance_sq(block_pos);
+		if (d < closest_distance_sq) {
+			closest_distance_sq = d;
+		}
+	}
+	return closest_distance_sq;
+}
+
 void VoxelTerrain::_process() {
 	VOXEL_PROFILE_SCOPE();
 
@@ -865,6 +1082,11 @@ void VoxelTerrain::_process() {
 				PRINT_VERBOSE("Detected destroyed viewer in VoxelTerrain");
 				p.state.view_distance_blocks = 0;
 				unpaired_viewer_indexes.push_back(i);
+
+			} else if (!VoxelServer::get_singleton()->is_viewer_in_volume_world(p.id, _volume_id)) {
+				PRINT_VERBOSE("Detected viewer leaving the world of VoxelTerrain");
+				p.state.view_distance_blocks = 0;
+				unpaired_viewer_indexes.push_back(i);
 			}
 		}
 
@@ -876,30 +1098,31 @@ void VoxelTerrain::_process() {
 		const float view_distance_scale = world_to_local_transform.basis.xform(Vector3(1, 0, 0)).length();
 
 		// New viewers and updates
-		VoxelServer::get_singleton()->for_each_viewer([this, view_distance_scale, world_to_local_transform](
-															  const VoxelServer::Viewer &viewer, uint32_t viewer_id) {
-			size_t i;
-			if (!try_get_paired_viewer_index(viewer_id, i)) {
-				PairedViewer p;
-				p.id = viewer_id;
-				i = _paired_viewers.size();
-				_paired_viewers.push_back(p);
-			}
+		VoxelServer::get_singleton()->for_each_volume_viewer(_volume_id,
+				[this, view_distance_scale, world_to_local_transform](
+						const VoxelServer::Viewer &viewer, uint32_t viewer_id) {
+					size_t i;
+					if (!try_get_paired_viewer_index(viewer_id, i)) {
+						PairedViewer p;
+						p.id = viewer_id;
+						i = _paired_viewers.size();
+						_paired_viewers.push_back(p);
+					}
 
-			PairedViewer &p = _paired_viewers[i];
+					PairedViewer &p = _paired_viewers[i];
 
-			p.prev_state = p.state;
+					p.prev_state = p.state;
 
-			const unsigned int view_distance_voxels =
-					static_cast<unsigned int>(static_cast<float>(viewer.view_distance) * view_distance_scale);
-			const Vector3 local_position = world_to_local_transform.xform(viewer.world_position);
+					const unsigned int view_distance_voxels =
+							static_cast<unsigned int>(static_cast<float>(viewer.view_distance) * view_distance_scale);
+					const Vector3 local_position = world_to_local_transform.xform(viewer.world_position);
 
-			p.state.view_distance_blocks =
-					min(view_distance_voxels >> get_block_size_pow2(), _max_view_distance_blocks);
-			p.state.block_position = _map.voxel_to_block(Vector3i(local_position));
-			p.state.requires_collisions = VoxelServer::get_singleton()->is_viewer_requiring_collisions(viewer_id);
-			p.state.requires_meshes = VoxelServer::get_singleton()->is_viewer_requiring_visuals(viewer_id);
-		});
+					p.state.view_distance_blocks =
+							min(view_distance_voxels >> get_block_size_pow2(), _max_view_distance_blocks);
+					p.state.block_position = _map.voxel_to_block(Vector3i(local_position));
+					p.state.requires_collisions = VoxelServer::get_singleton()->is_viewer_requiring_collisions(viewer_id);
+					p.state.requires_meshes = VoxelServer::get_singleton()->is_viewer_requiring_visuals(viewer_id);
+				});
 	}
 
 	const bool stream_enabled = (_stream.is_valid() || _generator.is_valid()) &&
@@ -997,14 +1220,23 @@ void VoxelTerrain::_process() {
 
 	_stats.time_request_blocks_to_load = profiling_clock.restart();
 
+	// Results of background tasks are applied within a time budget. What remains is deferred to next frames.
+	// Block data may only use half of it, so it can't starve meshes.
+	OS &os = *OS::get_singleton();
+	const unsigned int main_thread_time_budget_usec = VoxelServer::get_singleton()->get_main_thread_time_budget_usec();
+	const uint64_t main_thread_deadline_usec = os.get_ticks_usec() + main_thread_time_budget_usec;
+	const uint64_t data_deadline_usec = main_thread_deadline_usec - main_thread_time_budget_usec / 2;
+
 	// Get block loading responses
-	// Note: if block loading is too fast, this can cause stutters. It should only happen on first load, though.
 	{
 		VOXEL_PROFILE_SCOPE();
 
 		//print_line(String("Receiving {0} blocks").format(varray(output.emerged_blocks.size())));
-		for (size_t i = 0; i < _reception_buffers.data_output.size(); ++i) {
-			const VoxelServer::BlockDataOutput &ob = _reception_buffers.data_output[i];
+		size_t queue_index = 0;
+		for (; queue_index < _reception_buffers.data_output.size() && os.get_ticks_usec() < data_deadline_usec;
+				++queue_index) {
+			const VoxelServerApplyTimer apply_timer(VoxelServer::APPLY_BLOCK_DATA);
+			const VoxelServer::BlockDataOutput &ob = _reception_buffers.data_output[queue_index];
 
 			if (ob.type == VoxelServer::BlockDataOutput::TYPE_SAVE) {
 				if (ob.dropped) {
@@ -1023,6 +1255,7 @@ void VoxelTerrain::_process() {
 
 				if (loading_block_ptr == nullptr) {
 					// That block was not requested or is no longer needed, drop it.
+					VoxelServer::get_singleton()->remove_volume_pipeline_block(_volume_id, block_pos);
 					++_stats.dropped_block_loads;
 					continue;
 				}
@@ -1053,6 +1286,7 @@ void VoxelTerrain::_process() {
 				ERR_PRINT(String("Block size obtained from stream is different from expected size. "
 								 "Expected {0}, got {1}")
 								  .format(varray(expected_block_size.to_vec3(), ob.voxels->get_size().to_vec3())));
+				VoxelServer::get_singleton()->remove_volume_pipeline_block(_volume_id, block_pos);
 				++_stats.dropped_block_loads;
 				continue;
 			}
@@ -1067,48 +1301,32 @@ void VoxelTerrain::_process() {
 				// Set viewers count that are currently expecting the block
 				block->viewers = loading_block.viewers;
 			}
+			block->last_access_time_usec = os.get_ticks_usec();
 
 			emit_block_loaded(block);
 
-			// TODO The following code appears to have order-dependency with block loading.
-			// i.e if block loading responses arrive in a different order they were requested in,
-			// some blocks will be stuck in LOAD. For now I made it so no re-ordering happens,
-			// but it needs to be made more robust
+			if (needs_mesh(block->viewers)) {
+				// The server schedules meshing by itself once the block and its neighbors are loaded,
+				// so we only have to wait for the mesh to come back.
+				block->set_mesh_state(VoxelBlock::MESH_UPDATE_SENT);
+			} else {
+				// The server doesn't mesh blocks nothing wants to see. If a viewer requires it later, it will be updated.
+				block->set_mesh_state(VoxelBlock::MESH_NEED_UPDATE);
+			}
 
-			// Trigger mesh updates
-			if (was_not_loaded) {
-				// All neighbors have to be checked. If they are now surrounded, they can be updated
-				Vector3i ndir;
-				for (ndir.z = -1; ndir.z < 2; ++ndir.z) {
-					for (ndir.x = -1; ndir.x < 2; ++ndir.x) {
-						for (ndir.y = -1; ndir.y < 2; ++ndir.y) {
-							const Vector3i npos = block_pos + ndir;
-
-							// TODO What if the map is really composed of empty blocks?
-							if (_map.is_block_surrounded(npos)) {
-								VoxelBlock *nblock = _map.get_block(npos);
-								if (nblock == nullptr || nblock->get_mesh_state() == VoxelBlock::MESH_UPDATE_NOT_SENT) {
-									// Assuming it is scheduled to be updated already.
-									// In case of BLOCK_UPDATE_SENT, we'll have to resend it.
-									continue;
-								}
-
-								nblock->set_mesh_state(VoxelBlock::MESH_UPDATE_NOT_SENT);
-								_blocks_pending_update.push_back(npos);
-							}
-						}
+			if (loading_block.was_evicted) {
+				// Neighbors which gained a mesh viewer meanwhile may have been meshed without that block
+				for (unsigned int i = 0; i < Cube::MOORE_AREA_3D_COUNT; ++i) {
+					VoxelBlock *nblock = _map.get_block(block_pos + Cube::g_ordered_moore_area_3d[i]);
+					if (nblock != nullptr && nblock != block) {
+						try_schedule_block_update(nblock);
 					}
 				}
-
-			} else {
-				// Only update the block, neighbors will probably follow if needed
-				block->set_mesh_state(VoxelBlock::MESH_UPDATE_NOT_SENT);
-				_blocks_pending_update.push_back(block_pos);
-				//OS::get_singleton()->print("Update (%i, %i, %i)\n", block_pos.x, block_pos.y, block_pos.z);
 			}
 		}
 
-		_reception_buffers.data_output.clear();
+		shift_up(_reception_buffers.data_output, queue_index);
+		_stats.remaining_main_thread_data_blocks = _reception_buffers.data_output.size();
 
 		if (stream_enabled) {
 			send_block_data_requests();
@@ -1121,31 +1339,18 @@ void VoxelTerrain::_process() {
 	{
 		VOXEL_PROFILE_SCOPE();
 
-		const int used_channels_mask = get_used_channels_mask();
-
 		for (size_t bi = 0; bi < _blocks_pending_update.size(); ++bi) {
 			const Vector3i block_pos = _blocks_pending_update[bi];
 
-			// Check if the block is worth meshing
-			// Smooth meshing works on more neighbors, so checking a single block isn't enough to ignore it,
-			// but that will slow down meshing a lot.
-			// TODO Query mesher instead?
-			if (!(used_channels_mask & (1 << VoxelBuffer::CHANNEL_SDF))) {
+			// Check if the block is worth meshing. The server's meshing pipeline uses the same check.
+			if (_mesher.is_valid()) {
 				VoxelBlock *block = _map.get_block(block_pos);
 				if (block == nullptr) {
 					continue;
 				} else {
 					CRASH_COND(block->voxels.is_null());
 
-					bool is_empty;
-					{
-						RWLockRead lock(block->voxels->get_lock());
-						is_empty = block->voxels->is_uniform(VoxelBuffer::CHANNEL_TYPE) &&
-								   block->voxels->is_uniform(VoxelBuffer::CHANNEL_SDF) &&
-								   block->voxels->get_voxel(0, 0, 0, VoxelBuffer::CHANNEL_TYPE) == Voxel::AIR_ID;
-					}
-
-					if (is_empty) {
+					if (_mesher->is_block_empty(**block->voxels)) {
 						// If we got here, it must have been because of scheduling an update
 						CRASH_COND(block->get_mesh_state() != VoxelBlock::MESH_UPDATE_NOT_SENT);
 
@@ -1199,27 +1404,51 @@ void VoxelTerrain::_process() {
 	{
 		VOXEL_PROFILE_SCOPE_NAMED("Receive mesh updates");
 
-		OS &os = *OS::get_singleton();
+		// Apply the closest meshes first, since others may have to wait for the next frames
+		if (_reception_buffers.mesh_output.size() > 1 && _paired_viewers.size() > 0) {
+			VOXEL_PROFILE_SCOPE_NAMED("Sort mesh updates");
+			sort_by_key(_reception_buffers.mesh_output, [this](const VoxelServer::BlockMeshOutput &ob) {
+				return get_closest_viewer_distance_sq(ob.position);
+			});
+		}
 
-		const uint32_t timeout = os.get_ticks_msec() + VoxelConstants::MAIN_THREAD_MESHING_BUDGET_MS;
 		size_t queue_index = 0;
 
 		const Transform local_to_world_transform = get_global_transform();
 
+		// Meshes can be built by the server before we received the data of their block, keep them for later
+		std::vector<VoxelServer::BlockMeshOutput> early_mesh_outputs;
+
 		// The following is done on the main thread because Godot doesn't really support multithreaded Mesh allocation.
 		// This also proved to be very slow compared to the meshing process itself...
 		// hopefully Vulkan will allow us to upload graphical resources without stalling rendering as they upload?
 
-		for (; queue_index < _reception_buffers.mesh_output.size() && os.get_ticks_msec() < timeout; ++queue_index) {
+		// At least one mesh is applied, so meshes keep coming even if other work took the whole budget
+		for (; queue_index < _reception_buffers.mesh_output.size() &&
+				(queue_index == 0 || os.get_ticks_usec() < main_thread_deadline_usec);
+				++queue_index) {
+			const VoxelServerApplyTimer apply_timer(VoxelServer::APPLY_BLOCK_MESH);
 			const VoxelServer::BlockMeshOutput &ob = _reception_buffers.mesh_output[queue_index];
 
 			VoxelBlock *block = _map.get_block(ob.position);
 			if (block == nullptr) {
+				if (ob.type != VoxelServer::BlockMeshOutput::TYPE_DROPPED && _loading_blocks.has(ob.position)) {
+					early_mesh_outputs.push_back(ob);
+					continue;
+				}
 				// That block is no longer loaded, drop the result
 				++_stats.dropped_block_meshs;
 				continue;
 			}
 
+			if (block->viewers.get(VoxelViewerRefCount::TYPE_MESH) == 0 &&
+					block->viewers.get(VoxelViewerRefCount::TYPE_COLLISION) == 0) {
+				// Nothing needs that mesh at the moment. If a viewer requires it later, it will be updated again.
+				block->set_mesh_state(VoxelBlock::MESH_NEED_UPDATE);
+				++_stats.dropped_block_meshs;
+				continue;
+			}
+
 			if (ob.type == VoxelServer::BlockMeshOutput::TYPE_DROPPED) {
 				// That block is loaded, but its meshing request was dropped.
 				// TODO Not sure what to do in this case, the code sending update queries has to be tweaked
@@ -1228,6 +1457,19 @@ void VoxelTerrain::_process() {
 				continue;
 			}
 
+			// If the block changed since, another update is on its way
+			const bool up_to_date = block->get_mesh_state() == VoxelBlock::MESH_UPDATE_SENT;
+
+			if (ob.type == VoxelServer::BlockMeshOutput::TYPE_EMPTY) {
+				// The server's meshing pipeline found the block has nothing to mesh
+				block->drop_mesh();
+				block->drop_collision();
+				if (up_to_date) {
+					block->set_mesh_state(VoxelBlock::MESH_UP_TO_DATE);
+				}
+				continue;
+			}
+
 			Ref<ArrayMesh> mesh;
 			mesh.instance();
 
@@ -1269,15 +1511,32 @@ void VoxelTerrain::_process() {
 			}
 			block->set_parent_visible(is_visible());
 			block->set_parent_transform(local_to_world_transform);
+			if (up_to_date) {
+				block->set_mesh_state(VoxelBlock::MESH_UP_TO_DATE);
+			}
 		}
 
 		shift_up(_reception_buffers.mesh_output, queue_index);
 
+		for (size_t i = 0; i < early_mesh_outputs.size(); ++i) {
+			_reception_buffers.mesh_output.push_back(early_mesh_outputs[i]);
+		}
+
 		_stats.remaining_main_thread_blocks = _reception_buffers.mesh_output.size();
 	}
 
 	_stats.time_process_update_responses = profiling_clock.restart();
 
+	// Edits decompress voxels, compress them again when the player is done with them
+	_map.for_each_idle_edited_block(os.get_ticks_usec(), VoxelConstants::BLOCK_RECOMPRESSION_IDLE_DELAY_USEC,
+			[this](VoxelBlock *block) {
+				VoxelServer::get_singleton()->request_block_compression(_volume_id, block->voxels);
+			});
+
+	if (stream_enabled) {
+		evict_blocks_over_budget();
+	}
+
 	//print_line(String("d:") + String::num(_dirty_blocks.size()) + String(", q:") + String::num(_block_update_queue.size()));
 }
 
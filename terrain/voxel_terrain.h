@@ -65,16 +65,24 @@ public:
 	// For convenience, this is actually stored in a particular type of mesher
 	Ref<VoxelLibrary> get_voxel_library() const;
 
+	// Blocks evicted to stay within the voxel memory budget are requested again if they are in the area.
+	// Loaded blocks in the area count as accessed, so they get evicted last.
+	void reload_evicted_blocks_in_area(Rect3i voxel_box);
+
 	struct Stats {
 		int updated_blocks = 0;
 		int dropped_block_loads = 0;
 		int dropped_block_meshs = 0;
 		int remaining_main_thread_blocks = 0;
+		int remaining_main_thread_data_blocks = 0;
 		uint32_t time_detect_required_blocks = 0;
 		uint32_t time_request_blocks_to_load = 0;
 		uint32_t time_process_load_responses = 0;
 		uint32_t time_request_blocks_to_update = 0;
 		uint32_t time_process_update_responses = 0;
+		// Since the terrain started
+		uint64_t evicted_blocks = 0;
+		uint64_t reloaded_blocks = 0;
 	};
 
 	const Stats &get_stats() const;
@@ -106,6 +114,11 @@ private:
 	void view_block(Vector3i bpos, bool data_flag, bool mesh_flag, bool collision_flag);
 	void unview_block(Vector3i bpos, bool data_flag, bool mesh_flag, bool collision_flag);
 	void immerge_block(Vector3i bpos);
+	void evict_blocks_over_budget();
+	bool can_evict_block(const VoxelBlock &block) const;
+	void evict_block(Vector3i bpos);
+	void reload_evicted_block(Vector3i bpos);
+	void reload_evicted_neighbors(Vector3i bpos);
 	void make_block_dirty(Vector3i bpos);
 	void make_block_dirty(VoxelBlock *block);
 	void try_schedule_block_update(VoxelBlock *block);
@@ -118,6 +131,7 @@ private:
 	void emit_block_unloaded(const VoxelBlock *block);
 
 	bool try_get_paired_viewer_index(uint32_t id, size_t &out_i) const;
+	int get_closest_viewer_distance_sq(Vector3i block_pos) const;
 
 	static void _bind_methods();
 
@@ -165,9 +179,24 @@ private:
 
 	struct LoadingBlock {
 		VoxelViewerRefCount viewers;
+		// Reloaded after being evicted to save memory
+		bool was_evicted = false;
 	};
 
 	HashMap<Vector3i, LoadingBlock, Vector3iHasher> _loading_blocks;
+	// Blocks removed to save memory while viewers still need them, with their viewers
+	HashMap<Vector3i, VoxelViewerRefCount, Vector3iHasher> _evicted_blocks;
+
+	struct EvictionCandidate {
+		Vector3i position;
+		uint64_t last_access_time_usec;
+	};
+
+	// Blocks found evictable by the last scan, least recently accessed last.
+	// They are evicted over the next frames, as long as they were not accessed meanwhile.
+	std::vector<EvictionCandidate> _eviction_candidates;
+	uint64_t _next_eviction_scan_time_usec = 0;
+
 	std::vector<Vector3i> _blocks_pending_load;
 	std::vector<Vector3i> _blocks_pending_update;
 	std::vector<BlockToSave> _blocks_to_save;
@@ -1,6 +1,7 @@
 #include "voxel_viewer.h"
 #include "../server/voxel_server.h"
 #include <core/engine.h>
+#include <scene/resources/world.h>
 
 VoxelViewer::VoxelViewer() {
 	set_notify_transform(!Engine::get_singleton()->is_editor_hint());
@@ -44,11 +45,17 @@ void VoxelViewer::_notification(int p_what) {
 		case NOTIFICATION_ENTER_TREE: {
 			if (!Engine::get_singleton()->is_editor_hint()) {
 				_viewer_id = VoxelServer::get_singleton()->add_viewer();
+				// Only volumes in the same world will see this viewer
+				Ref<World> world = get_world();
+				if (world.is_valid()) {
+					VoxelServer::get_singleton()->set_viewer_world(_viewer_id, world->get_instance_id());
+				}
 				VoxelServer::get_singleton()->set_viewer_distance(_viewer_id, _view_distance);
 				VoxelServer::get_singleton()->set_viewer_requires_visuals(_viewer_id, _requires_visuals);
 				VoxelServer::get_singleton()->set_viewer_requires_collisions(_viewer_id, _requires_collisions);
-				const Vector3 pos = get_global_transform().origin;
-				VoxelServer::get_singleton()->set_viewer_position(_viewer_id, pos);
+				const Transform gt = get_global_transform();
+				VoxelServer::get_singleton()->set_viewer_position(_viewer_id, gt.origin);
+				VoxelServer::get_singleton()->set_viewer_direction(_viewer_id, -gt.basis.get_axis(Vector3::AXIS_Z));
 			}
 		} break;
 
@@ -60,8 +67,9 @@ void VoxelViewer::_notification(int p_what) {
 
 		case NOTIFICATION_TRANSFORM_CHANGED:
 			if (is_active()) {
-				const Vector3 pos = get_global_transform().origin;
-				VoxelServer::get_singleton()->set_viewer_position(_viewer_id, pos);
+				const Transform gt = get_global_transform();
+				VoxelServer::get_singleton()->set_viewer_position(_viewer_id, gt.origin);
+				VoxelServer::get_singleton()->set_viewer_direction(_viewer_id, -gt.basis.get_axis(Vector3::AXIS_Z));
 			}
 			break;
 
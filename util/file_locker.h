@@ -49,9 +49,6 @@ private:
 			} else {
 				fp = *fpp;
 			}
-			else {
-				fp = *fpp;
-			}
 		}
 
 		if (read_only) {
@@ -3,6 +3,8 @@
 
 #include <core/pool_vector.h>
 #include <core/vector.h>
+#include <algorithm>
+#include <utility>
 #include <vector>
 
 #ifdef DEBUG_ENABLED
@@ -25,7 +27,7 @@ template <typename T>
 void shift_up(std::vector<T> &v, unsigned int pos) {
 	unsigned int j = 0;
 	for (unsigned int i = pos; i < v.size(); ++i, ++j) {
-		v[j] = v[i];
+		v[j] = std::move(v[i]);
 	}
 	int remaining = v.size() - pos;
 	v.resize(remaining);
@@ -77,6 +79,41 @@ inline void append_array(std::vector<T> &dst, const std::vector<T> &src) {
 	dst.insert(dst.end(), src.begin(), src.end());
 }
 
+// Sorts items in ascending order of the key returned by `get_key(item)`.
+// Keys are computed once per item instead of once per comparison, which matters when they are expensive to get.
+// The sort is stable and must remain so: items with equal keys keep their order. Terrains rely on it so that
+// several results for the same block are still applied in the order they were received.
+template <typename T, typename F>
+void sort_by_key(std::vector<T> &items, F get_key) {
+	typedef decltype(get_key(items[0])) Key;
+
+	struct Entry {
+		Key key;
+		size_t index;
+	};
+
+	std::vector<Entry> entries;
+	entries.reserve(items.size());
+	for (size_t i = 0; i < items.size(); ++i) {
+		entries.push_back(Entry{ get_key(items[i]), i });
+	}
+
+	// Ties are broken on the original index, which makes the sort stable
+	std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
+		if (a.key != b.key) {
+			return a.key < b.key;
+		}
+		return a.index < b.index;
+	});
+
+	std::vector<T> sorted_items;
+	sorted_items.reserve(items.size());
+	for (size_t i = 0; i < entries.size(); ++i) {
+		sorted_items.push_back(std::move(items[entries[i].index]));
+	}
+	items.swap(sorted_items);
+}
+
 // Removes all items satisfying the given predicate.
 // This can reduce the size of the container. Items are moved to preserve order.
 //template <typename T, typename F>
@@ -0,0 +1,96 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <atomic>
+#include <cstdint>
+
+// Distribution of durations in microseconds, counted in buckets of exponentially growing size.
+// Samples are not stored individually, so recording has a small fixed cost and memory usage doesn't grow.
+// Recording is lock-free and can be done from multiple threads.
+class LatencyHistogram {
+public:
+	// Bucket `i` counts durations in [2^i, 2^(i+1)[, the last one also counts everything above.
+	static const unsigned int BUCKET_COUNT = 24;
+
+	struct Summary {
+		uint64_t count = 0;
+		uint64_t mean_usec = 0;
+		// Percentiles are approximated to the upper bound of the bucket they fall in
+		uint64_t p50_usec = 0;
+		uint64_t p90_usec = 0;
+		uint64_t p95_usec = 0;
+		uint64_t p99_usec = 0;
+		uint64_t max_usec = 0;
+	};
+
+	LatencyHistogram() {
+		clear();
+	}
+
+	void record(uint64_t usec) {
+		_buckets[get_bucket_index(usec)].fetch_add(1, std::memory_order_relaxed);
+		_total_usec.fetch_add(usec, std::memory_order_relaxed);
+		uint64_t prev_max = _max_usec.load(std::memory_order_relaxed);
+		while (usec > prev_max &&
+				!_max_usec.compare_exchange_weak(prev_max, usec, std::memory_order_relaxed)) {
+		}
+	}
+
+	// Samples recorded while this runs may or may not be accounted for
+	Summary get_summary() const {
+		uint64_t counts[BUCKET_COUNT];
+		Summary s;
+		for (unsigned int i = 0; i < BUCKET_COUNT; ++i) {
+			counts[i] = _buckets[i].load(std::memory_order_relaxed);
+			s.count += counts[i];
+		}
+		if (s.count == 0) {
+			return s;
+		}
+		s.max_usec = _max_usec.load(std::memory_order_relaxed);
+		s.mean_usec = _total_usec.load(std::memory_order_relaxed) / s.count;
+		s.p50_usec = get_percentile(counts, s.count, 50, s.max_usec);
+		s.p90_usec = get_percentile(counts, s.count, 90, s.max_usec);
+		s.p95_usec = get_percentile(counts, s.count, 95, s.max_usec);
+		s.p99_usec = get_percentile(counts, s.count, 99, s.max_usec);
+		return s;
+	}
+
+	void clear() {
+		for (unsigned int i = 0; i < BUCKET_COUNT; ++i) {
+			_buckets[i] = 0;
+		}
+		_total_usec = 0;
+		_max_usec = 0;
+	}
+
+private:
+	static inline unsigned int get_bucket_index(uint64_t usec) {
+		unsigned int i = 0;
+		while (usec > 1 && i + 1 < BUCKET_COUNT) {
+			usec >>= 1;
+			++i;
+		}
+		return i;
+	}
+
+	static uint64_t get_percentile(const uint64_t *counts, uint64_t total, unsigned int percent, uint64_t max_usec) {
+		// Rank of the sample we are looking for, rounded up
+		const uint64_t rank = (total * percent + 99) / 100;
+		uint64_t accumulated = 0;
+		for (unsigned int i = 0; i < BUCKET_COUNT; ++i) {
+			accumulated += counts[i];
+			if (accumulated >= rank) {
+				const uint64_t upper_bound = (uint64_t(1) << (i + 1)) - 1;
+				return upper_bound < max_usec ? upper_bound : max_usec;
+			}
+		}
+		return max_usec;
+	}
+
+	std::atomic<uint64_t> _buckets[BUCKET_COUNT];
+	std::atomic<uint64_t> _total_usec;
+	std::atomic<uint64_t> _max_usec;
+};
+
+#endif // LATENCY_HISTOGRAM_H
@@ -115,6 +115,21 @@ public:
 		}
 	}
 
+	// Same as `for_each_cell`, but in the ZXY order voxels are stored in VoxelBuffer,
+	// so accesses to a buffer go through contiguous memory.
+	template <typename A>
+	inline void for_each_cell_zxy(A a) const {
+		Vector3i max = pos + size;
+		Vector3i p;
+		for (p.z = pos.z; p.z < max.z; ++p.z) {
+			for (p.x = pos.x; p.x < max.x; ++p.x) {
+				for (p.y = pos.y; p.y < max.y; ++p.y) {
+					a(p);
+				}
+			}
+		}
+	}
+
 	template <typename A>
 	inline bool all_cells_match(A a) const {
 		Vector3i max = pos + size;
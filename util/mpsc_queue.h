@@ -0,0 +1,56 @@
+#ifndef MPSC_QUEUE_H
+#define MPSC_QUEUE_H
+
+#include <atomic>
+
+// Lock-free queue which can be pushed to from multiple threads, and consumed by a single thread.
+// Items are consumed all at once, in the order they were pushed.
+// The queue is intrusive: items are linked with their own `T *mpsc_next` member, so pushing doesn't allocate.
+// An item can only be in one such queue at a time, and the queue doesn't own it.
+template <typename T>
+class MPSCQueue {
+public:
+	MPSCQueue() :
+			_head(nullptr) {}
+
+	void push(T *item) {
+		T *head = _head.load(std::memory_order_relaxed);
+		do {
+			item->mpsc_next = head;
+		} while (!_head.compare_exchange_weak(head, item, std::memory_order_release, std::memory_order_relaxed));
+	}
+
+	// Must only be called from the consumer thread.
+	// Items pushed while this function runs will be left for the next call.
+	template <typename F>
+	void pop_all(F f) {
+		T *item = _head.exchange(nullptr, std::memory_order_acquire);
+
+		// Items are stacked up, so they have to be reversed to get them in push order
+		T *prev = nullptr;
+		while (item != nullptr) {
+			T *next = item->mpsc_next;
+			item->mpsc_next = prev;
+			prev = item;
+			item = next;
+		}
+
+		item = prev;
+		while (item != nullptr) {
+			// Read before calling, since the callback may delete the item
+			T *next = item->mpsc_next;
+			item->mpsc_next = nullptr;
+			f(item);
+			item = next;
+		}
+	}
+
+	bool is_empty() const {
+		return _head.load(std::memory_order_relaxed) == nullptr;
+	}
+
+private:
+	std::atomic<T *> _head;
+};
+
+#endif // MPSC_QUEUE_H
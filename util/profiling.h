@@ -12,15 +12,25 @@
 #define VOXEL_PROFILE_SCOPE_NAMED(name) ZoneScopedN(name)
 #define VOXEL_PROFILE_MARK_FRAME() FrameMark
 #define VOXEL_PROFILE_SET_THREAD_NAME(name) tracy::SetThreadName(name)
+#define VOXEL_PROFILE_THREAD_EXIT()
 
 #else
 
-#define VOXEL_PROFILE_SCOPE()
+// Without an external profiler, scopes go to the built-in recorder, which does nothing unless turned on at runtime.
+
+#include "trace_recorder.h"
+
+#define VOXEL_PROFILE_CONCAT_IMPL(a, b) a##b
+#define VOXEL_PROFILE_CONCAT(a, b) VOXEL_PROFILE_CONCAT_IMPL(a, b)
+
+#define VOXEL_PROFILE_SCOPE() TraceRecorder::Scope VOXEL_PROFILE_CONCAT(voxel_profile_scope_, __LINE__)(__FUNCTION__)
 // Name must be static const char* (usually string litteral)
-#define VOXEL_PROFILE_SCOPE_NAMED(name)
-#define VOXEL_PROFILE_MARK_FRAME()
+#define VOXEL_PROFILE_SCOPE_NAMED(name) TraceRecorder::Scope VOXEL_PROFILE_CONCAT(voxel_profile_scope_, __LINE__)(name)
+#define VOXEL_PROFILE_MARK_FRAME() TraceRecorder::mark_frame()
 // Name must be const char*. An internal copy will be made so it can be temporary.
-#define VOXEL_PROFILE_SET_THREAD_NAME(name)
+#define VOXEL_PROFILE_SET_THREAD_NAME(name) TraceRecorder::set_thread_name(name)
+// Must be the last profiling call of a thread, outside of any scope
+#define VOXEL_PROFILE_THREAD_EXIT() TraceRecorder::release_thread_buffer()
 
 #endif
 
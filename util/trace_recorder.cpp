@@ -0,0 +1,212 @@
+#include "trace_recorder.h"
+
+#include <core/os/file_access.h>
+#include <core/os/memory.h>
+#include <core/os/mutex.h>
+#include <core/os/os.h>
+
+#include <vector>
+
+namespace {
+
+const char *FRAME_MARK_NAME = "Frame";
+
+struct Event {
+	const char *name;
+	uint64_t begin_usec;
+	uint64_t end_usec;
+};
+
+// Only written by the thread owning it, so recording doesn't need locking
+struct ThreadBuffer {
+	Event events[TraceRecorder::THREAD_BUFFER_CAPACITY];
+	// Total amount of events written. Published after each event is written.
+	std::atomic<uint64_t> write_index{ 0 };
+	// Events before this index were cleared
+	std::atomic<uint64_t> begin_index{ 0 };
+	uint32_t thread_id = 0;
+	// Protected by the registry mutex
+	String name;
+};
+
+// Registry of all buffers. Only locked when a thread records its first event, or when saving.
+Mutex g_mutex;
+std::vector<ThreadBuffer *> g_buffers;
+// Buffers of threads which exited. Threads created later reuse them, so buffers don't pile up when threads are
+// recreated.
+std::vector<ThreadBuffer *> g_free_buffers;
+// Incremented when buffers are freed, so threads know their cached buffer is no longer valid
+std::atomic<uint32_t> g_generation{ 0 };
+
+thread_local ThreadBuffer *tl_buffer = nullptr;
+thread_local uint32_t tl_generation = 0;
+thread_local String tl_thread_name;
+
+ThreadBuffer &get_thread_buffer() {
+	const uint32_t generation = g_generation.load(std::memory_order_acquire);
+	if (tl_buffer == nullptr || tl_generation != generation) {
+		MutexLock lock(g_mutex);
+		ThreadBuffer *buffer;
+		if (g_free_buffers.size() > 0) {
+			buffer = g_free_buffers.back();
+			g_free_buffers.pop_back();
+			// Events of the previous thread would otherwise be shown as if they came from this one
+			buffer->begin_index = buffer->write_index.load();
+		} else {
+			buffer = memnew(ThreadBuffer);
+			buffer->thread_id = g_buffers.size();
+			g_buffers.push_back(buffer);
+		}
+		buffer->name = tl_thread_name;
+		tl_buffer = buffer;
+		tl_generation = generation;
+	}
+	return *tl_buffer;
+}
+
+void write_json_string(FileAccess &f, const char *s) {
+	f.store_8('"');
+	for (; *s != '\0'; ++s) {
+		if (*s == '"' || *s == '\\') {
+			f.store_8('\\');
+		}
+		f.store_8(*s);
+	}
+	f.store_8('"');
+}
+
+} // namespace
+
+std::atomic<bool> TraceRecorder::_enabled{ false };
+
+uint64_t TraceRecorder::get_time_usec() {
+	return OS::get_singleton()->get_ticks_usec();
+}
+
+void TraceRecorder::set_enabled(bool enabled) {
+	if (enabled && !is_enabled()) {
+		MutexLock lock(g_mutex);
+		for (size_t i = 0; i < g_buffers.size(); ++i) {
+			ThreadBuffer &b = *g_buffers[i];
+			b.begin_index = b.write_index.load();
+		}
+	}
+	_enabled = enabled;
+}
+
+void TraceRecorder::record(const char *name, uint64_t begin_usec, uint64_t end_usec) {
+	ThreadBuffer &b = get_thread_buffer();
+	const uint64_t i = b.write_index.load(std::memory_order_relaxed);
+	Event &e = b.events[i % THREAD_BUFFER_CAPACITY];
+	e.name = name;
+	e.begin_usec = begin_usec;
+	e.end_usec = end_usec;
+	b.write_index.store(i + 1, std::memory_order_release);
+}
+
+void TraceRecorder::mark_frame() {
+	if (is_enabled()) {
+		const uint64_t now = get_time_usec();
+		record(FRAME_MARK_NAME, now, now);
+	}
+}
+
+void TraceRecorder::set_thread_name(const char *name) {
+	// Buffers are only created when something gets recorded, so the name is kept until then
+	tl_thread_name = String::utf8(name);
+	if (tl_buffer != nullptr && tl_generation == g_generation.load(std::memory_order_acquire)) {
+		MutexLock lock(g_mutex);
+		tl_buffer->name = tl_thread_name;
+	}
+}
+
+void TraceRecorder::release_thread_buffer() {
+	if (tl_buffer == nullptr) {
+		return;
+	}
+	MutexLock lock(g_mutex);
+	// The buffer was already freed if resources were freed since
+	if (tl_generation == g_generation.load(std::memory_order_acquire)) {
+		g_free_buffers.push_back(tl_buffer);
+	}
+	tl_buffer = nullptr;
+}
+
+Error TraceRecorder::save_chrome_trace(String fpath) {
+	Error err;
+	FileAccess *f = FileAccess::open(fpath, FileAccess::WRITE, &err);
+	if (f == nullptr) {
+		ERR_PRINT(String("Could not save trace to {0}").format(varray(fpath)));
+		return err;
+	}
+
+	std::vector<Event> events;
+	bool first = true;
+
+	f->store_string("{\"traceEvents\":[\n");
+
+	MutexLock lock(g_mutex);
+
+	for (size_t buffer_index = 0; buffer_index < g_buffers.size(); ++buffer_index) {
+		const ThreadBuffer &b = *g_buffers[buffer_index];
+
+		const uint64_t end_index = b.write_index.load(std::memory_order_acquire);
+		uint64_t begin_index = b.begin_index;
+		if (end_index > THREAD_BUFFER_CAPACITY && end_index - THREAD_BUFFER_CAPACITY > begin_index) {
+			begin_index = end_index - THREAD_BUFFER_CAPACITY;
+		}
+
+		events.clear();
+		for (uint64_t i = begin_index; i < end_index; ++i) {
+			events.push_back(b.events[i % THREAD_BUFFER_CAPACITY]);
+		}
+
+		// The thread may have kept recording while we were copying.
+		// Discard events which could have been overwritten in the meantime.
+		const uint64_t end_index_after = b.write_index.load(std::memory_order_acquire);
+		size_t skip = 0;
+		if (end_index_after >= THREAD_BUFFER_CAPACITY && end_index_after - THREAD_BUFFER_CAPACITY + 1 > begin_index) {
+			skip = MIN(end_index_after - THREAD_BUFFER_CAPACITY + 1 - begin_index, events.size());
+		}
+
+		const String tid = String::num_uint64(b.thread_id);
+
+		if (!first) {
+			f->store_string(",\n");
+		}
+		first = false;
+		const String thread_name = b.name.empty() ? String("Thread {0}").format(varray(b.thread_id)) : b.name;
+		f->store_string("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" + tid + ",\"args\":{\"name\":");
+		write_json_string(*f, thread_name.utf8().get_data());
+		f->store_string("}}");
+
+		for (size_t i = skip; i < events.size(); ++i) {
+			const Event &e = events[i];
+			f->store_string(",\n{\"name\":");
+			write_json_string(*f, e.name);
+			if (e.name == FRAME_MARK_NAME) {
+				f->store_string(",\"ph\":\"i\",\"s\":\"g\"");
+			} else {
+				f->store_string(",\"ph\":\"X\",\"dur\":" + String::num_uint64(e.end_usec - e.begin_usec));
+			}
+			f->store_string(",\"ts\":" + String::num_uint64(e.begin_usec) + ",\"pid\":0,\"tid\":" + tid + "}");
+		}
+	}
+
+	f->store_string("\n]}\n");
+
+	f->close();
+	memdelete(f);
+	return OK;
+}
+
+void TraceRecorder::free_resources() {
+	_enabled = false;
+	MutexLock lock(g_mutex);
+	for (size_t i = 0; i < g_buffers.size(); ++i) {
+		memdelete(g_buffers[i]);
+	}
+	g_buffers.clear();
+	g_free_buffers.clear();
+	++g_generation;
+}
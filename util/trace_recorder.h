@@ -0,0 +1,69 @@
+#ifndef TRACE_RECORDER_H
+#define TRACE_RECORDER_H
+
+#include <core/error_list.h>
+#include <core/ustring.h>
+
+#include <atomic>
+#include <cstdint>
+
+// Records profiling scopes into per-thread ring buffers, so they can be saved as Chrome trace events
+// (viewable in chrome://tracing or https://ui.perfetto.dev).
+// It is used by profiling macros when no external profiler is compiled in.
+// Recording can be turned on and off at runtime. When off, a scope costs an atomic load.
+class TraceRecorder {
+public:
+	// Events kept per thread. Older events get overwritten.
+	static const unsigned int THREAD_BUFFER_CAPACITY = 1 << 14;
+
+	class Scope {
+	public:
+		// Name must be static const char* (usually string litteral)
+		inline Scope(const char *name) :
+				_name(name),
+				_begin_usec(0) {
+			if (is_enabled()) {
+				_begin_usec = get_time_usec();
+			}
+		}
+
+		inline ~Scope() {
+			if (_begin_usec != 0) {
+				record(_name, _begin_usec, get_time_usec());
+			}
+		}
+
+	private:
+		const char *_name;
+		uint64_t _begin_usec;
+	};
+
+	static inline bool is_enabled() {
+		return _enabled.load(std::memory_order_relaxed);
+	}
+
+	// Enabling discards events recorded previously
+	static void set_enabled(bool enabled);
+
+	static void record(const char *name, uint64_t begin_usec, uint64_t end_usec);
+	static void mark_frame();
+	// An internal copy of the name is made so it can be temporary
+	static void set_thread_name(const char *name);
+	// Must be called by threads before they exit, so their buffer can be reused by threads created later.
+	// Its events can still be saved until then.
+	static void release_thread_buffer();
+
+	// Saves recorded events in Chrome trace event JSON format.
+	// It's best to do it while recording is off, events recorded in the meantime may be missing.
+	static Error save_chrome_trace(String fpath);
+
+	// Must be called when no other thread uses the recorder anymore
+	static void free_resources();
+
+private:
+	static uint64_t get_time_usec();
+
+	static std::atomic<bool> _enabled;
+};
+
+#endif // TRACE_RECORDER_H